@@ -0,0 +1,149 @@
+#ifndef ACQUISITION_METRICS_HPP
+#define ACQUISITION_METRICS_HPP
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "CommandLatency.hpp"
+
+/// the counters and gauges of the acquisition over the whole process,
+/// updated where the work is done and published by the MetricsServer.
+/// every update is one atomic add or one aligned store, so the receive
+/// paths never wait for a reader and a reader never waits for them
+struct AcquisitionMetrics
+{
+    AcquisitionMetrics()
+        : histogramsPolled(0), controlBytes(0), postMortemBytes(0), postMortemCaptures(0),
+        histogramBytesPerS(0), postMortemBytesPerS(0),
+        controlQueue(0), pipelineBlocks(0), transfersWaiting(0), droppedRequests(0)
+    {}
+
+    volatile uint64_t histogramsPolled; // 'getHistogram' responses received
+    volatile uint64_t controlBytes; // received on CONTROL_SOCKET
+    volatile uint64_t postMortemBytes; // received on POST_MORTEM_SOCKET
+    volatile uint64_t postMortemCaptures; // received completely
+
+    volatile uint64_t histogramBytesPerS; // [bytes/s] of the transfer of the last histogram
+    volatile uint64_t postMortemBytesPerS; // [bytes/s] of the last post mortem capture, its transfer time only
+
+    volatile int controlQueue; // requests waiting in the multiplexers
+    volatile int pipelineBlocks; // post mortem blocks between the receive and the persist stage
+    volatile int transfersWaiting; // for a slot of a TransferBudget
+
+    volatile uint64_t droppedRequests; // control requests failed without a response
+};
+
+/// the metrics of the process; never destroyed, as commandLatencies()
+inline AcquisitionMetrics & acquisitionMetrics()
+{
+    static AcquisitionMetrics * metrics = new AcquisitionMetrics();
+    return *metrics;
+}
+
+inline void countMetric(volatile uint64_t & counter, uint64_t n = 1)
+{
+    __sync_fetch_and_add(&counter, n);
+}
+
+inline void gaugeMetric(volatile int & gauge, int change)
+{
+    __sync_fetch_and_add(&gauge, change);
+}
+
+/// [bytes/s] of 'bytes' in 'ns'; kept when the time is too short to tell
+inline void rateMetric(volatile uint64_t & gauge, uint64_t bytes, uint64_t ns)
+{
+    if(ns > 0)
+        gauge = (uint64_t)(bytes * 1E9 / ns);
+}
+
+namespace detail
+{
+
+/// a label value of the text format: backslash, double quote and new line escaped
+inline std::string metricLabel(const std::string & value)
+{
+    std::string escaped;
+
+    for(std::size_t i = 0; i < value.size(); i++)
+    {
+        if(value[i] == '\\' || value[i] == '"')
+            escaped += '\\';
+
+        if(value[i] == '\n')
+            escaped += "\\n";
+        else
+            escaped += value[i];
+    }
+
+    return escaped;
+}
+
+inline void metricFamily(std::ostream & out, const char * name, const char * type, const char * help)
+{
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+inline void commandSummary(std::ostream & out, const CommandLatency & c, const char * phase, const LatencyHistogram & h)
+{
+    static const double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    std::string labels = "command=\"" + metricLabel(c.command) + "\",phase=\"" + phase + "\"";
+
+    for(std::size_t i = 0; i < sizeof(QUANTILES) / sizeof(QUANTILES[0]); i++)
+        out << "rosy_command_latency_seconds{" << labels << ",quantile=\"" << QUANTILES[i] << "\"} "
+            << h.percentile(QUANTILES[i]) / 1E9 << "\n";
+
+    out << "rosy_command_latency_seconds_sum{" << labels << "} " << h.sum() / 1E9 << "\n";
+    out << "rosy_command_latency_seconds_count{" << labels << "} " << h.count() << "\n";
+}
+
+} // namespace detail
+
+/// the metrics of the process in the Prometheus text exposition format
+inline std::string renderMetrics()
+{
+    const AcquisitionMetrics & m = acquisitionMetrics();
+    std::stringstream out;
+
+    detail::metricFamily(out, "rosy_histograms_polled_total", "counter", "time loss histograms received");
+    out << "rosy_histograms_polled_total " << m.histogramsPolled << "\n";
+
+    detail::metricFamily(out, "rosy_received_bytes_total", "counter", "bytes received from the ROSY per socket");
+    out << "rosy_received_bytes_total{socket=\"control\"} " << m.controlBytes << "\n";
+    out << "rosy_received_bytes_total{socket=\"post_mortem\"} " << m.postMortemBytes << "\n";
+
+    detail::metricFamily(out, "rosy_post_mortem_captures_total", "counter", "post mortem captures received completely");
+    out << "rosy_post_mortem_captures_total " << m.postMortemCaptures << "\n";
+
+    detail::metricFamily(out, "rosy_transfer_mb_per_second", "gauge", "MB/s of the last transfer of each kind");
+    out << "rosy_transfer_mb_per_second{transfer=\"histogram\"} " << m.histogramBytesPerS / 1E6 << "\n";
+    out << "rosy_transfer_mb_per_second{transfer=\"post_mortem\"} " << m.postMortemBytesPerS / 1E6 << "\n";
+
+    detail::metricFamily(out, "rosy_queue_depth", "gauge", "items waiting in the queues of the client");
+    out << "rosy_queue_depth{queue=\"control_requests\"} " << m.controlQueue << "\n";
+    out << "rosy_queue_depth{queue=\"post_mortem_blocks\"} " << m.pipelineBlocks << "\n";
+    out << "rosy_queue_depth{queue=\"transfer_slots\"} " << m.transfersWaiting << "\n";
+
+    detail::metricFamily(out, "rosy_dropped_total", "counter", "items lost on the way");
+    out << "rosy_dropped_total{item=\"control_request\"} " << m.droppedRequests << "\n";
+
+    std::vector<const CommandLatency *> commands = commandLatencies().commands();
+
+    detail::metricFamily(out, "rosy_command_latency_seconds", "summary",
+                         "latency of the control commands per phase, see CommandLatency.hpp");
+    for(std::size_t i = 0; i < commands.size(); i++)
+    {
+        detail::commandSummary(out, *commands[i], "queued", commands[i]->queued);
+        detail::commandSummary(out, *commands[i], "first_byte", commands[i]->firstByte);
+        detail::commandSummary(out, *commands[i], "transfer", commands[i]->transfer);
+        detail::commandSummary(out, *commands[i], "round_trip", commands[i]->roundTrip);
+    }
+
+    return out.str();
+}
+
+#endif // ACQUISITION_METRICS_HPP
@@ -0,0 +1,370 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <boost/chrono.hpp>
+#include <boost/foreach.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <dirent.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// the results of a run of the benchmark suite, one JSON document:
+///
+///     { "suite": "rosy-client", "format": 1, "date": "2013-06-01T12:00:00Z",
+///       "build": { "compiler": "4.8.1", "compiled": "Jun  1 2013 11:58:02", "host": "pcte" },
+///       "settings": { "histogramPolls": 200, ... },
+///       "results": [
+///         { "name": "histogram_poll/bins=1000",
+///           "metrics": { "latency_p50_us": 85.250, "histograms_per_s": 10512.400, ... } },
+///         ... ] }
+///
+/// the metrics are numbers. the rates ("_per_s") and the medians of the
+/// latencies ("_p50_us", "_p50_ms") of two builds are compared case by case
+/// with compareBenchmarks(); the other metrics, e.g. the tails of the
+/// latencies over a few repetitions, are too noisy for that and only reported.
+
+typedef boost::chrono::steady_clock BenchmarkClock;
+
+/// [us] from 'from' to 'to'
+inline double elapsedUs(BenchmarkClock::time_point from, BenchmarkClock::time_point to)
+{
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(to - from).count() / 1000.0;
+}
+
+/// the latencies of a case, [us]
+class LatencySamples
+{
+public:
+
+    void add(double us)
+    {
+        samples_.push_back(us);
+    }
+
+    std::size_t count() const
+    {
+        return samples_.size();
+    }
+
+    double mean() const
+    {
+        double sum = 0;
+        for(std::size_t i = 0; i < samples_.size(); i++)
+            sum += samples_[i];
+        return samples_.empty() ? 0 : sum / samples_.size();
+    }
+
+    /// nearest rank, 'p' from 0 (the minimum) to 1 (the maximum)
+    double percentile(double p) const
+    {
+        if(samples_.empty())
+            return 0;
+
+        std::vector<double> sorted(samples_);
+        std::sort(sorted.begin(), sorted.end());
+
+        std::size_t rank = (std::size_t)(p * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(rank, sorted.size() - 1)];
+    }
+
+private:
+    std::vector<double> samples_;
+};
+
+/// the metrics of one case of the suite
+struct BenchmarkResult
+{
+    std::string name; // e.g. "post_mortem/channels=2/blocks=4"
+    std::vector<std::pair<std::string, double> > metrics;
+
+    explicit BenchmarkResult(const std::string & name = "")
+        : name(name)
+    {}
+
+    BenchmarkResult & metric(const std::string & metricName, double value)
+    {
+        /// NOT A NUMBER OR INFINITE, E.G. A RATE OVER NO TIME: JSON HAS NO WORD FOR IT
+        if(!(value >= -1E300 && value <= 1E300))
+            value = 0;
+
+        metrics.push_back(std::make_pair(metricName, value));
+        return *this;
+    }
+
+    /// <prefix>_min_<unit>, _mean_, _p50_, _p90_, _p99_ and _max_ of 'samples'; 'unit' is "us" or "ms"
+    BenchmarkResult & latency(const std::string & prefix, const LatencySamples & samples, const std::string & unit = "us")
+    {
+        double scale = (unit == "ms") ? 1E-3 : 1;
+
+        metric(prefix + "_min_" + unit, samples.percentile(0) * scale);
+        metric(prefix + "_mean_" + unit, samples.mean() * scale);
+        metric(prefix + "_p50_" + unit, samples.percentile(0.50) * scale);
+        metric(prefix + "_p90_" + unit, samples.percentile(0.90) * scale);
+        metric(prefix + "_p99_" + unit, samples.percentile(0.99) * scale);
+        return metric(prefix + "_max_" + unit, samples.percentile(1) * scale);
+    }
+
+    /// 0 if there is no such metric
+    double value(const std::string & metricName) const
+    {
+        for(std::size_t i = 0; i < metrics.size(); i++)
+            if(metrics[i].first == metricName)
+                return metrics[i].second;
+        return 0;
+    }
+};
+
+/// one run of the suite
+struct BenchmarkRun
+{
+    std::string date; // UTC, ISO 8601
+    std::vector<std::pair<std::string, std::string> > build;
+    std::vector<std::pair<std::string, double> > settings;
+    std::vector<BenchmarkResult> results;
+};
+
+namespace detail
+{
+
+inline std::string jsonString(const std::string & s)
+{
+    std::string quoted = "\"";
+
+    for(std::size_t i = 0; i < s.size(); i++)
+    {
+        char c = s[i];
+
+        if(c == '"' || c == '\\')
+            quoted += std::string("\\") + c;
+        else if((unsigned char)c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)c);
+            quoted += escaped;
+        }
+        else
+            quoted += c;
+    }
+
+    return quoted + "\"";
+}
+
+inline void writeJsonNumbers(std::ostream & out, const std::vector<std::pair<std::string, double> > & values, const char * indent)
+{
+    for(std::size_t i = 0; i < values.size(); i++)
+        out << indent << jsonString(values[i].first) << ": " << values[i].second
+            << (i + 1 < values.size() ? ",\n" : "\n");
+}
+
+} // namespace detail
+
+/// the date of now for BenchmarkRun::date
+inline std::string benchmarkDate()
+{
+    struct tm timestamp;
+    time_t t = time(NULL);
+    gmtime_r(&t, &timestamp);
+
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &timestamp);
+    return buffer;
+}
+
+/// the compiler, the compilation date and the machine of this build, for BenchmarkRun::build
+inline std::vector<std::pair<std::string, std::string> > benchmarkBuild()
+{
+    std::vector<std::pair<std::string, std::string> > build;
+
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+
+#ifdef __VERSION__
+    build.push_back(std::make_pair(std::string("compiler"), std::string(__VERSION__)));
+#endif
+    build.push_back(std::make_pair(std::string("compiled"), std::string(__DATE__ " " __TIME__)));
+    build.push_back(std::make_pair(std::string("host"), std::string(host)));
+
+    return build;
+}
+
+inline void writeBenchmarkRun(const std::string & path, const BenchmarkRun & run)
+{
+    std::ofstream out(path.c_str());
+    if(!out)
+        throw std::runtime_error("Benchmark: cannot create " + path);
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"suite\": \"rosy-client\",\n";
+    out << "  \"format\": 1,\n";
+    out << "  \"date\": " << detail::jsonString(run.date) << ",\n";
+
+    out << "  \"build\": {\n";
+    for(std::size_t i = 0; i < run.build.size(); i++)
+        out << "    " << detail::jsonString(run.build[i].first) << ": " << detail::jsonString(run.build[i].second)
+            << (i + 1 < run.build.size() ? ",\n" : "\n");
+    out << "  },\n";
+
+    out << "  \"settings\": {\n";
+    detail::writeJsonNumbers(out, run.settings, "    ");
+    out << "  },\n";
+
+    out << "  \"results\": [\n";
+    for(std::size_t i = 0; i < run.results.size(); i++)
+    {
+        out << "    { \"name\": " << detail::jsonString(run.results[i].name) << ",\n";
+        out << "      \"metrics\": {\n";
+        detail::writeJsonNumbers(out, run.results[i].metrics, "        ");
+        out << "      } }" << (i + 1 < run.results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n";
+    out << "}\n";
+
+    if(!out)
+        throw std::runtime_error("Benchmark: cannot write " + path);
+}
+
+/// the results of a run written by writeBenchmarkRun()
+inline BenchmarkRun readBenchmarkRun(const std::string & path)
+{
+    using boost::property_tree::ptree;
+
+    ptree document;
+
+    try
+    {
+        boost::property_tree::read_json(path, document);
+    }
+    catch(boost::property_tree::json_parser_error & e)
+    {
+        throw std::runtime_error("Benchmark: " + std::string(e.what()));
+    }
+
+    if(document.get<std::string>("suite", "") != "rosy-client")
+        throw std::runtime_error("Benchmark: not the results of the benchmark suite: " + path);
+
+    BenchmarkRun run;
+    run.date = document.get<std::string>("date", "");
+
+    BOOST_FOREACH(const ptree::value_type & b, document.get_child("build", ptree()))
+        run.build.push_back(std::make_pair(b.first, b.second.data()));
+
+    BOOST_FOREACH(const ptree::value_type & s, document.get_child("settings", ptree()))
+        run.settings.push_back(std::make_pair(s.first, s.second.get_value<double>(0)));
+
+    BOOST_FOREACH(const ptree::value_type & r, document.get_child("results", ptree()))
+    {
+        BenchmarkResult result(r.second.get<std::string>("name", ""));
+
+        BOOST_FOREACH(const ptree::value_type & m, r.second.get_child("metrics", ptree()))
+            result.metric(m.first, m.second.get_value<double>(0));
+
+        run.results.push_back(result);
+    }
+
+    return run;
+}
+
+/// +1 if a larger value of 'metricName' is better, -1 if a smaller one, 0 if it is only reported
+inline int benchmarkDirection(const std::string & metricName)
+{
+    std::size_t n = metricName.size();
+
+    if(n > 6 && metricName.compare(n - 6, 6, "_per_s") == 0)
+        return 1;
+    if(metricName.find("_p50_") != std::string::npos
+       && (metricName.compare(n - 3, 3, "_us") == 0 || metricName.compare(n - 3, 3, "_ms") == 0))
+        return -1;
+    return 0;
+}
+
+/// prints the metrics of 'current' which changed by more than 'tolerance'
+/// (relative) from 'baseline', in the cases and metrics both runs have;
+/// returns the number of regressions
+inline int compareBenchmarks(const BenchmarkRun & current, const BenchmarkRun & baseline, double tolerance)
+{
+    int regressions = 0;
+    int improvements = 0;
+    int compared = 0;
+
+    std::cout << "benchmark: compared with the run of " << baseline.date << ", tolerance "
+              << tolerance * 100 << " %" << std::endl;
+
+    for(std::size_t i = 0; i < current.results.size(); i++)
+    {
+        const BenchmarkResult & now = current.results[i];
+        const BenchmarkResult * before = 0;
+
+        for(std::size_t j = 0; j < baseline.results.size() && !before; j++)
+            if(baseline.results[j].name == now.name)
+                before = &baseline.results[j];
+
+        if(!before)
+            continue;
+
+        for(std::size_t m = 0; m < now.metrics.size(); m++)
+        {
+            const std::string & metricName = now.metrics[m].first;
+            int direction = benchmarkDirection(metricName);
+            double then = before->value(metricName);
+
+            if(direction == 0 || then <= 0)
+                continue;
+
+            compared++;
+
+            double change = (now.metrics[m].second - then) / then;
+
+            if(change * direction < -tolerance)
+            {
+                regressions++;
+                std::cout << "benchmark: REGRESSION ";
+            }
+            else if(change * direction > tolerance)
+            {
+                improvements++;
+                std::cout << "benchmark: improvement ";
+            }
+            else
+                continue;
+
+            std::cout << now.name << " " << metricName << ": " << then << " -> " << now.metrics[m].second
+                      << " (" << std::showpos << change * 100 << std::noshowpos << " %)" << std::endl;
+        }
+    }
+
+    std::cout << "benchmark: " << compared << " metrics compared, " << regressions << " regressions, "
+              << improvements << " improvements" << std::endl;
+
+    return regressions;
+}
+
+/// removes the files of 'directory', e.g. the captures saved by a case
+inline void removeBenchmarkFiles(const std::string & directory)
+{
+    DIR * dir = opendir(directory.c_str());
+    if(!dir)
+        return;
+
+    for(struct dirent * entry = readdir(dir); entry; entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+
+        if(name != "." && name != "..")
+            unlink((directory + "/" + name).c_str());
+    }
+
+    closedir(dir);
+}
+
+#endif // BENCHMARK_HPP
@@ -0,0 +1,406 @@
+#ifndef CAPTURE_FORMAT_HPP
+#define CAPTURE_FORMAT_HPP
+
+#include <boost/static_assert.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "RosySettings.hpp"
+#include "Checksum.hpp"
+
+/// binary post mortem capture file:
+///
+///   [header, CAPTURE_HEADER_SIZE bytes][channel 0][channel 1]...[checksums]
+///
+/// only the enabled channels are stored, in the order A, B, C, D;
+/// every channel is 'bytesPerChannel' of little endian int16_t
+/// samples, i.e. raw ADC counts as received from the device.
+/// the header carries everything needed to interpret the samples,
+/// so the whole file can be used through a single mmap.
+/// from version 2 the channels are followed by the CRC32C of every
+/// transferred block as received, channel by channel (uint32_t each).
+
+const char CAPTURE_MAGIC[8] = { 'R', 'O', 'S', 'Y', 'P', 'M', 0, 0 };
+const uint32_t CAPTURE_FORMAT_VERSION = 2;
+
+/// one page, so that the channel data start page aligned
+const uint32_t CAPTURE_HEADER_SIZE = 4096;
+
+struct CaptureFileHeader
+{
+    char magic[8]; // CAPTURE_MAGIC
+    uint32_t version; // CAPTURE_FORMAT_VERSION
+    uint32_t headerSize; // [bytes], offset of the first channel
+    uint64_t timestampNs; // time of the capture, ns since the epoch (UTC)
+    uint64_t bytesPerChannel;
+    uint32_t numberOfChannels; // stored channels
+    uint32_t numberOfBlocks; // per channel, as transferred
+    uint32_t blockBytes; // size of one transferred block
+    uint32_t blocksCompleted; // blocks already written, all channels together
+
+    /// channel map: device channel (0 = A .. 3 = D) and
+    /// vertical range of every stored channel, in file order
+    int32_t channel[4];
+    int32_t channelRange[4];
+
+    /// PostMortemSettings of the capture
+    double delay; // [number of samples]
+    double samplingPeriod; // [s], as requested, -1 means minimum
+    double effectiveSamplingPeriod; // [s], period of the stored samples
+    int32_t numberOfSamples; // as requested, -1 means maximum
+    int32_t range[4]; // range_A .. range_D, -1 means disabled
+    int16_t triggerThreshold; // [mV]
+    char triggerChannel[8]; // A | B | C | D | EXT
+    char triggerDirection[16]; // RISING | FALLING | RISE_FALL
+};
+
+BOOST_STATIC_ASSERT(sizeof(CaptureFileHeader) <= CAPTURE_HEADER_SIZE);
+
+/// "checksum mismatch in block 2 of channel A" of the capture block 'block' (channel * numberOfBlocks + block)
+inline std::string corruptBlockMessage(const CaptureFileHeader & h, uint64_t block)
+{
+    std::ostringstream os;
+    os << "checksum mismatch in block " << block % h.numberOfBlocks
+       << " of channel " << (char)('A' + h.channel[block / h.numberOfBlocks]) << " of";
+    return os.str();
+}
+
+inline uint64_t captureTimestampNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/// fills the header of a capture of the enabled channels of 'ps'
+inline void fillCaptureHeader(CaptureFileHeader & h, const PostMortemSettings * ps,
+                              int numberOfBlocks, uint32_t blockBytes, uint64_t timestampNs)
+{
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+    h.version = CAPTURE_FORMAT_VERSION;
+    h.headerSize = CAPTURE_HEADER_SIZE;
+    h.timestampNs = timestampNs;
+
+    for(int c = 0; c < 4; c++)
+    {
+        h.range[c] = channelRange(ps, c);
+
+        if(h.range[c] > 0)
+        {
+            h.channel[h.numberOfChannels] = c;
+            h.channelRange[h.numberOfChannels] = h.range[c];
+            h.numberOfChannels++;
+        }
+    }
+
+    for(int c = h.numberOfChannels; c < 4; c++)
+    {
+        h.channel[c] = -1;
+        h.channelRange[c] = DISABLE_CHANNEL;
+    }
+
+    h.numberOfBlocks = numberOfBlocks;
+    h.blockBytes = blockBytes;
+    h.bytesPerChannel = (uint64_t)blockBytes * numberOfBlocks;
+
+    h.delay = ps->delay;
+    h.samplingPeriod = ps->samplingPeriod;
+    h.effectiveSamplingPeriod = effectiveSamplingPeriod(ps, h.numberOfChannels);
+    h.numberOfSamples = ps->numberOfSamples;
+    h.triggerThreshold = ps->triggerThreshold;
+    std::strncpy(h.triggerChannel, ps->triggerChannel.c_str(), sizeof(h.triggerChannel) - 1);
+    std::strncpy(h.triggerDirection, ps->triggerDirection.c_str(), sizeof(h.triggerDirection) - 1);
+}
+
+/// offset of the block checksums, i.e. the end of the channels
+inline uint64_t captureChecksumOffset(const CaptureFileHeader & h)
+{
+    return h.headerSize + h.bytesPerChannel * h.numberOfChannels;
+}
+
+/// number of block checksums, 0 for version 1 captures
+inline uint64_t captureChecksums(const CaptureFileHeader & h)
+{
+    return h.version >= 2 ? (uint64_t)h.numberOfBlocks * h.numberOfChannels : 0;
+}
+
+inline uint64_t captureFileSize(const CaptureFileHeader & h)
+{
+    return captureChecksumOffset(h) + captureChecksums(h) * sizeof(uint32_t);
+}
+
+/// true for the capture versions the readers understand
+inline bool captureVersionSupported(uint32_t version)
+{
+    return version >= 1 && version <= CAPTURE_FORMAT_VERSION;
+}
+
+/// accumulates the CRC32C of the transferred blocks from the CRC32C of
+/// their slices, which arrive in order; the checksum of a block is
+/// complete with its last slice
+class BlockChecksums
+{
+public:
+
+    explicit BlockChecksums(int numberOfChannels)
+        : pending_(numberOfChannels, 0)
+    {}
+
+    /// adds the slice of 'bytes' bytes with the CRC32C 'crc' to the block
+    /// of 'channel'; returns the CRC32C of the whole block when 'completesBlock'
+    uint32_t add(int channel, uint32_t crc, uint64_t bytes, bool completesBlock)
+    {
+        uint32_t block = crc32cCombine(pending_[channel], crc, bytes);
+        pending_[channel] = completesBlock ? 0 : block;
+        return block;
+    }
+
+private:
+    std::vector<uint32_t> pending_;
+};
+
+/// writes a capture file block by block with pwrite, from the persist stage
+/// of the post mortem pipeline; the file is sized up front, so blocks can
+/// be written in any order
+class CaptureFileWriter
+{
+public:
+
+    CaptureFileWriter(const std::string & path, const CaptureFileHeader & h)
+        : path_(path), header_(h), checksums_(h.numberOfChannels)
+    {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd_ < 0)
+            fail("cannot open");
+
+        if(::ftruncate(fd_, captureFileSize(h)) != 0)
+            fail("cannot resize");
+
+        writeHeader();
+    }
+
+    ~CaptureFileWriter()
+    {
+        ::close(fd_);
+    }
+
+    /// 'crc' is the CRC32C of the 'bytes' bytes as received; 'completesBlock'
+    /// is false for all but the last slice of a transferred block
+    void writeBlock(int channel, uint64_t offset, const void * data, uint64_t bytes,
+                    uint32_t crc, bool completesBlock = true)
+    {
+        uint32_t blockCrc = checksums_.add(channel, crc, bytes, completesBlock);
+
+        writeAt(data, bytes, header_.headerSize + channel * header_.bytesPerChannel + offset);
+
+        if(completesBlock)
+        {
+            uint64_t block = channel * header_.numberOfBlocks + offset / header_.blockBytes;
+            writeAt(&blockCrc, sizeof(blockCrc), captureChecksumOffset(header_) + block * sizeof(uint32_t));
+
+            header_.blocksCompleted++;
+            writeHeader();
+        }
+    }
+
+    const std::string & path() const
+    {
+        return path_;
+    }
+
+private:
+
+    void writeAt(const void * data, uint64_t bytes, uint64_t position)
+    {
+        const char * p = static_cast<const char *>(data);
+
+        while(bytes > 0)
+        {
+            ssize_t written = ::pwrite(fd_, p, bytes, position);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                fail("cannot write");
+
+            p += written;
+            position += written;
+            bytes -= written;
+        }
+    }
+
+    void writeHeader()
+    {
+        if(::pwrite(fd_, &header_, sizeof(header_), 0) != (ssize_t)sizeof(header_))
+            fail("cannot write the header of");
+    }
+
+    void fail(const char * what)
+    {
+        std::string msg = std::string("CaptureFileWriter: ") + what + " " + path_ + ": " + std::strerror(errno);
+
+        if(fd_ >= 0)
+            ::close(fd_);
+        fd_ = -1;
+
+        throw std::runtime_error(msg);
+    }
+
+private:
+    std::string path_;
+    int fd_;
+    CaptureFileHeader header_;
+    BlockChecksums checksums_;
+};
+
+/// read-only view of a capture file through a single mmap
+class CaptureReader
+{
+public:
+
+    /// 'verify' checks the blocks written so far against their checksums
+    /// and throws on the first mismatch
+    explicit CaptureReader(const std::string & path, bool verify = true)
+        : path_(path), fd_(-1), base_(0), length_(0)
+    {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if(fd_ < 0)
+            fail("cannot open");
+
+        struct stat st;
+        if(::fstat(fd_, &st) != 0)
+            fail("cannot stat");
+
+        length_ = st.st_size;
+        if(length_ < CAPTURE_HEADER_SIZE)
+            fail("too short to be a capture:", false);
+
+        void * p = ::mmap(0, length_, PROT_READ, MAP_SHARED, fd_, 0);
+        if(p == MAP_FAILED)
+            fail("cannot map");
+
+        base_ = static_cast<const char *>(p);
+
+        const CaptureFileHeader & h = header();
+
+        if(std::memcmp(h.magic, CAPTURE_MAGIC, sizeof(h.magic)) != 0)
+            fail("not a capture:", false);
+        if(!captureVersionSupported(h.version))
+            fail("unsupported capture version:", false);
+        if(h.numberOfChannels > 4 || captureFileSize(h) > length_)
+            fail("truncated or corrupted capture:", false);
+
+        if(verify)
+        {
+            int64_t block = corruptBlock();
+            if(block >= 0)
+                fail(corruptBlockMessage(h, block).c_str(), false);
+        }
+    }
+
+    ~CaptureReader()
+    {
+        if(base_)
+            ::munmap(const_cast<char *>(base_), length_);
+        if(fd_ >= 0)
+            ::close(fd_);
+    }
+
+    const CaptureFileHeader & header() const
+    {
+        return *reinterpret_cast<const CaptureFileHeader *>(base_);
+    }
+
+    int numberOfChannels() const
+    {
+        return header().numberOfChannels;
+    }
+
+    uint64_t samplesPerChannel() const
+    {
+        return header().bytesPerChannel / sizeof(int16_t);
+    }
+
+    /// samples of the stored channel 'i' (0 .. numberOfChannels-1)
+    const int16_t * channel(int i) const
+    {
+        return reinterpret_cast<const int16_t *>(base_ + header().headerSize + i * header().bytesPerChannel);
+    }
+
+    /// device channel name ('A' .. 'D') of the stored channel 'i'
+    char channelName(int i) const
+    {
+        return 'A' + header().channel[i];
+    }
+
+    VERTICAL_RANGE channelRange(int i) const
+    {
+        return (VERTICAL_RANGE)header().channelRange[i];
+    }
+
+    /// true when all blocks have been written
+    bool complete() const
+    {
+        return header().blocksCompleted == header().numberOfBlocks * header().numberOfChannels;
+    }
+
+    bool hasChecksums() const
+    {
+        return captureChecksums(header()) > 0;
+    }
+
+    /// first of the blocks written so far (channel * numberOfBlocks + block)
+    /// which does not match its checksum, -1 if none
+    int64_t corruptBlock() const
+    {
+        const CaptureFileHeader & h = header();
+        const uint32_t * checksums = reinterpret_cast<const uint32_t *>(base_ + captureChecksumOffset(h));
+
+        /// THE BLOCKS ARE COMPLETED IN THE ORDER OF THE TRANSFER
+        uint64_t blocks = std::min<uint64_t>(h.blocksCompleted, captureChecksums(h));
+
+        for(uint64_t b = 0; b < blocks; b++)
+        {
+            const char * data = base_ + h.headerSize + b * h.blockBytes;
+            if(crc32c(data, h.blockBytes) != checksums[b])
+                return b;
+        }
+
+        return -1;
+    }
+
+private:
+
+    void fail(const char * what, bool systemError = true)
+    {
+        std::string msg = std::string("CaptureReader: ") + what + " " + path_;
+        if(systemError)
+            msg += std::string(": ") + std::strerror(errno);
+
+        if(base_)
+            ::munmap(const_cast<char *>(base_), length_);
+        if(fd_ >= 0)
+            ::close(fd_);
+
+        throw std::runtime_error(msg);
+    }
+
+private:
+    std::string path_;
+    int fd_;
+    const char * base_;
+    uint64_t length_;
+};
+
+#endif // CAPTURE_FORMAT_HPP
@@ -0,0 +1,370 @@
+#ifndef CAPTURE_STORE_HPP
+#define CAPTURE_STORE_HPP
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "CaptureFormat.hpp"
+#include "ChunkedCapture.hpp"
+#include "ChannelLayout.hpp"
+#include "Placement.hpp"
+
+/// memory budget of a post mortem capture when none is configured, [bytes]
+const uint64_t DEFAULT_MEMORY_BUDGET = 1ULL << 30;
+
+/// smallest slice of a block moved through the pipeline, [samples]
+const uint64_t PIPELINE_MIN_SLICE = 1 << 16;
+
+/// samples per slice moved through the post mortem pipeline: whole blocks
+/// when the 'depth' slots fit in half of the budget, smaller slices otherwise
+inline uint64_t pipelineSliceSamples(uint64_t blockSamples, uint64_t budget, int depth, bool millivolts)
+{
+    uint64_t sampleBytes = sizeof(int16_t) + (millivolts ? sizeof(float) : 0);
+    uint64_t slice = std::max(budget / 2 / (depth * sampleBytes), PIPELINE_MIN_SLICE) & ~7ULL;
+
+    return std::min(blockSamples, slice);
+}
+
+/// samples per chunk of a chunked capture written within 'budget' [bytes]:
+/// 'chunkSamples' when the chunks being filled and one chunk in flight fit,
+/// smaller chunks otherwise, down to PIPELINE_MIN_SLICE; 0 if even these do not fit
+inline uint32_t budgetChunkSamples(uint32_t chunkSamples, uint32_t channels, uint64_t budget)
+{
+    uint64_t fit = (budget / chunkWriterBytes(channels, 1, 1)) & ~7ULL;
+
+    if(fit >= chunkSamples)
+        return chunkSamples;
+
+    return fit >= PIPELINE_MIN_SLICE ? (uint32_t)fit : 0;
+}
+
+enum CAPTURE_STORE_KIND
+{
+    STORE_MEMORY, // the whole capture in RAM
+    STORE_SPILL, // an unlinked spill file, for captures over the budget
+    STORE_FILE, // an existing .bin capture
+    STORE_CHUNKED // an existing chunked .pmc capture
+};
+
+/// the samples of a post mortem capture for the analyses of the whole
+/// capture (edges, spectrum), within a memory budget. a capture which
+/// fits is held in RAM; otherwise it lives in a file and is read through
+/// windows of at most windowSamples() samples, so that the memory used
+/// never depends on the size of the capture. window() gives one channel,
+/// for the kernels working channel by channel; tiles() gives all the
+/// channels interleaved, for the analyses across channels.
+class CaptureStore
+{
+public:
+
+    /// store of a capture being received, filled with write(); in memory
+    /// if it fits in 'budget', otherwise in the spill file 'spillPath',
+    /// which is unlinked at once and disappears with the store
+    CaptureStore(const CaptureFileHeader & h, uint64_t budget, const std::string & spillPath)
+        : path_(spillPath), header_(h), budget_(budget), fd_(-1)
+    {
+        uint64_t bytes = h.bytesPerChannel * h.numberOfChannels;
+
+        if(bytes <= budget)
+        {
+            kind_ = STORE_MEMORY;
+            samples_.resize(bytes / sizeof(int16_t));
+            return;
+        }
+
+        kind_ = STORE_SPILL;
+
+        fd_ = ::open(spillPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if(fd_ < 0)
+            fail("cannot open the spill file");
+
+        ::unlink(spillPath.c_str());
+
+        if(::ftruncate(fd_, bytes) != 0)
+            fail("cannot resize the spill file");
+
+        header_.headerSize = 0;
+    }
+
+    /// read-only store of an existing .bin or .pmc capture, checked against its checksums
+    CaptureStore(const std::string & path, uint64_t budget)
+        : path_(path), budget_(budget), fd_(-1)
+    {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if(fd_ < 0)
+            fail("cannot open");
+
+        char magic[sizeof(CAPTURE_MAGIC)];
+        if(::pread(fd_, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic))
+            fail("too short to be a capture:", false);
+
+        if(std::memcmp(magic, CHUNKED_CAPTURE_MAGIC, sizeof(magic)) == 0)
+        {
+            ::close(fd_);
+            fd_ = -1;
+
+            kind_ = STORE_CHUNKED;
+            chunked_.reset(new ChunkedCaptureReader(path));
+            header_ = chunked_->header();
+            return;
+        }
+
+        kind_ = STORE_FILE;
+
+        struct stat st;
+        if(::fstat(fd_, &st) != 0)
+            fail("cannot stat");
+
+        readAt(&header_, sizeof(header_), 0);
+
+        if(std::memcmp(header_.magic, CAPTURE_MAGIC, sizeof(header_.magic)) != 0)
+            fail("not a capture:", false);
+        if(!captureVersionSupported(header_.version))
+            fail("unsupported capture version:", false);
+        if(header_.numberOfChannels > 4 || captureFileSize(header_) > (uint64_t)st.st_size)
+            fail("truncated or corrupted capture:", false);
+
+        verify();
+    }
+
+    ~CaptureStore()
+    {
+        if(fd_ >= 0)
+            ::close(fd_);
+    }
+
+    /// stores samples 'first' .. 'first + n - 1' of the stored channel 'channel'
+    void write(int channel, uint64_t first, const int16_t * data, uint64_t n)
+    {
+        if(kind_ == STORE_MEMORY)
+        {
+            std::memcpy(&samples_[channel * samplesPerChannel() + first], data, n * sizeof(int16_t));
+            return;
+        }
+
+        if(kind_ != STORE_SPILL)
+            throw std::runtime_error("CaptureStore: " + path_ + " is read-only");
+
+        const char * p = reinterpret_cast<const char *>(data);
+        uint64_t bytes = n * sizeof(int16_t);
+        uint64_t position = channel * header_.bytesPerChannel + first * sizeof(int16_t);
+
+        while(bytes > 0)
+        {
+            ssize_t written = ::pwrite(fd_, p, bytes, position);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                fail("cannot write the spill file");
+
+            p += written;
+            position += written;
+            bytes -= written;
+        }
+    }
+
+    const CaptureFileHeader & header() const
+    {
+        return header_;
+    }
+
+    int numberOfChannels() const
+    {
+        return header_.numberOfChannels;
+    }
+
+    uint64_t samplesPerChannel() const
+    {
+        return header_.bytesPerChannel / sizeof(int16_t);
+    }
+
+    char channelName(int i) const
+    {
+        return 'A' + header_.channel[i];
+    }
+
+    VERTICAL_RANGE channelRange(int i) const
+    {
+        return (VERTICAL_RANGE)header_.channelRange[i];
+    }
+
+    CAPTURE_STORE_KIND kind() const
+    {
+        return kind_;
+    }
+
+    /// moves a STORE_MEMORY capture to the NUMA node 'node', see Placement.hpp;
+    /// the file backed stores are left to the page cache
+    bool bindMemory(int node)
+    {
+        return kind_ == STORE_MEMORY && !samples_.empty()
+               && bindMemoryToNode(&samples_[0], samples_.size() * sizeof(int16_t), node);
+    }
+
+    /// longest window, [samples]: the whole channel in memory,
+    /// otherwise what fits in half of the budget
+    uint64_t windowSamples() const
+    {
+        if(kind_ == STORE_MEMORY)
+            return std::max<uint64_t>(samplesPerChannel(), 1);
+
+        return std::max<uint64_t>(budget_ / 2 / sizeof(int16_t), PIPELINE_MIN_SLICE);
+    }
+
+    /// samples 'first' .. 'first + n - 1' of the stored channel 'channel',
+    /// n <= windowSamples(); valid until the next call
+    const int16_t * window(int channel, uint64_t first, uint64_t n)
+    {
+        if(first + n > samplesPerChannel() || n > windowSamples())
+            throw std::runtime_error("CaptureStore: window beyond the capture or the budget, " + path_);
+
+        if(kind_ == STORE_MEMORY)
+            return &samples_[channel * samplesPerChannel() + first];
+
+        samples_.resize(std::max<uint64_t>(n, 1));
+        readChannel(channel, first, n, &samples_[0]);
+
+        return &samples_[0];
+    }
+
+    /// longest window of all the channels in the interleaved layout, [samples per channel]:
+    /// what fits in half of the budget together with the planar samples it is made of
+    uint64_t tileSamples() const
+    {
+        uint64_t samples = budget_ / 2 / sizeof(int16_t) / (2 * std::max(numberOfChannels(), 1));
+        return std::max<uint64_t>(samples / LAYOUT_TILE * LAYOUT_TILE, LAYOUT_TILE);
+    }
+
+    /// samples 'first' .. 'first + n - 1' of all the channels in the interleaved
+    /// layout (see ChannelLayout.hpp), for the analyses across channels;
+    /// n <= tileSamples(), valid until the next call
+    const int16_t * tiles(uint64_t first, uint64_t n)
+    {
+        if(first + n > samplesPerChannel() || n > tileSamples())
+            throw std::runtime_error("CaptureStore: window beyond the capture or the budget, " + path_);
+
+        int channels = numberOfChannels();
+        std::vector<const int16_t *> planes(channels);
+
+        if(kind_ != STORE_MEMORY)
+            planar_.resize(std::max<uint64_t>(n * channels, 1));
+
+        for(int c = 0; c < channels; c++)
+        {
+            if(kind_ == STORE_MEMORY)
+            {
+                planes[c] = &samples_[c * samplesPerChannel() + first];
+            }
+            else
+            {
+                readChannel(c, first, n, &planar_[c * n]);
+                planes[c] = &planar_[c * n];
+            }
+        }
+
+        tiles_.resize(std::max<std::size_t>(interleavedSize(channels, n), 1));
+        interleaveChannels(&planes[0], channels, n, &tiles_[0]);
+
+        return &tiles_[0];
+    }
+
+    /// the reader of a chunked capture, 0 for the other stores
+    const ChunkedCaptureReader * chunked() const
+    {
+        return chunked_.get();
+    }
+
+private:
+
+    void readChannel(int channel, uint64_t first, uint64_t n, int16_t * out)
+    {
+        if(kind_ == STORE_CHUNKED)
+            chunked_->read(channel, first, n, out);
+        else
+            readAt(out, n * sizeof(int16_t),
+                   header_.headerSize + channel * header_.bytesPerChannel + first * sizeof(int16_t));
+    }
+
+    /// checks the blocks written so far against their checksums, in one pass
+    /// through the window buffer; chunked captures check every chunk as it is decoded
+    void verify()
+    {
+        uint64_t blocks = std::min<uint64_t>(header_.blocksCompleted, captureChecksums(header_));
+        if(blocks == 0)
+            return;
+
+        std::vector<uint32_t> checksums(blocks);
+        readAt(&checksums[0], blocks * sizeof(uint32_t), captureChecksumOffset(header_));
+
+        uint64_t piece = std::min<uint64_t>(windowSamples(), header_.blockBytes / sizeof(int16_t));
+        samples_.resize(std::max<uint64_t>(piece, 1));
+
+        for(uint64_t b = 0; b < blocks; b++)
+        {
+            uint32_t crc = 0;
+
+            for(uint64_t done = 0; done < header_.blockBytes; done += piece * sizeof(int16_t))
+            {
+                uint64_t bytes = std::min<uint64_t>(piece * sizeof(int16_t), header_.blockBytes - done);
+                readAt(&samples_[0], bytes, header_.headerSize + b * header_.blockBytes + done);
+                crc = crc32c(&samples_[0], bytes, crc);
+            }
+
+            if(crc != checksums[b])
+                fail(corruptBlockMessage(header_, b).c_str(), false);
+        }
+    }
+
+    void readAt(void * data, uint64_t bytes, uint64_t position)
+    {
+        char * p = static_cast<char *>(data);
+
+        while(bytes > 0)
+        {
+            ssize_t got = ::pread(fd_, p, bytes, position);
+            if(got < 0 && errno == EINTR)
+                continue;
+            if(got <= 0)
+                fail("cannot read");
+
+            p += got;
+            position += got;
+            bytes -= got;
+        }
+    }
+
+    void fail(const char * what, bool systemError = true)
+    {
+        std::string msg = std::string("CaptureStore: ") + what + " " + path_;
+        if(systemError)
+            msg += std::string(": ") + std::strerror(errno);
+
+        if(fd_ >= 0)
+            ::close(fd_);
+        fd_ = -1;
+
+        throw std::runtime_error(msg);
+    }
+
+private:
+    std::string path_;
+    CAPTURE_STORE_KIND kind_;
+    CaptureFileHeader header_;
+    uint64_t budget_;
+    int fd_;
+    std::vector<int16_t> samples_; // STORE_MEMORY: the channels one after the other, otherwise the window
+    std::vector<int16_t> planar_; // channels read for tiles(), file backed stores only
+    std::vector<int16_t> tiles_;
+    std::auto_ptr<ChunkedCaptureReader> chunked_;
+};
+
+#endif // CAPTURE_STORE_HPP
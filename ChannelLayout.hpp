@@ -0,0 +1,111 @@
+#ifndef CHANNEL_LAYOUT_HPP
+#define CHANNEL_LAYOUT_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define ROSY_HAVE_SSE2_TILES
+#endif
+
+/// memory layouts of the samples of several channels:
+///
+///   planar       [A0 A1 A2 ...][B0 B1 B2 ...]...     one array per channel,
+///                for the kernels which work on one channel at a time
+///                (envelope, edges, spectrum)
+///
+///   interleaved  [A0..A15][B0..B15]...[A16..A31][B16..B31]...
+///                time-major tiles of LAYOUT_TILE samples of every channel,
+///                for the analyses across channels: the samples of one
+///                instant sit in the same lane of neighbouring registers
+///                and a window of all the channels is one contiguous range
+///
+/// the captures are stored planar; interleaveChannels() and
+/// deinterleaveChannels() transpose between the two.
+
+enum CHANNEL_LAYOUT
+{
+    LAYOUT_PLANAR,
+    LAYOUT_INTERLEAVED
+};
+
+/// samples of one channel in a tile of the interleaved layout, one AVX2 register
+const std::size_t LAYOUT_TILE = 16;
+
+/// [samples] of an interleaved buffer of 'samples' samples of 'channels'
+/// channels, the last tile padded
+inline std::size_t interleavedSize(int channels, std::size_t samples)
+{
+    return (samples + LAYOUT_TILE - 1) / LAYOUT_TILE * LAYOUT_TILE * channels;
+}
+
+/// position of sample 'i' of channel 'channel' in an interleaved buffer
+inline std::size_t interleavedIndex(int channels, int channel, std::size_t i)
+{
+    return (i / LAYOUT_TILE * channels + channel) * LAYOUT_TILE + i % LAYOUT_TILE;
+}
+
+namespace detail
+{
+
+/// copies one tile of LAYOUT_TILE samples
+inline void copyTile(int16_t * dst, const int16_t * src)
+{
+#ifdef ROSY_HAVE_SSE2_TILES
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8), hi);
+#else
+    std::memcpy(dst, src, LAYOUT_TILE * sizeof(int16_t));
+#endif
+}
+
+} // namespace detail
+
+/// transposes 'samples' samples of the 'channels' arrays 'planes' to the
+/// interleaved buffer 'out' of interleavedSize() samples; the padding of
+/// the last tile is zero
+inline void interleaveChannels(const int16_t * const * planes, int channels, std::size_t samples, int16_t * out)
+{
+    std::size_t whole = samples / LAYOUT_TILE * LAYOUT_TILE;
+
+    /// THE OUTPUT IS WRITTEN IN ORDER, THE CHANNELS ARE READ AS PARALLEL STREAMS
+    for(std::size_t i = 0; i < whole; i += LAYOUT_TILE)
+    {
+        for(int c = 0; c < channels; c++, out += LAYOUT_TILE)
+            detail::copyTile(out, planes[c] + i);
+    }
+
+    if(whole < samples)
+    {
+        for(int c = 0; c < channels; c++, out += LAYOUT_TILE)
+        {
+            std::memset(out, 0, LAYOUT_TILE * sizeof(int16_t));
+            std::memcpy(out, planes[c] + whole, (samples - whole) * sizeof(int16_t));
+        }
+    }
+}
+
+/// the inverse of interleaveChannels(): 'samples' samples of every channel
+/// of the interleaved buffer 'in' to the 'channels' arrays 'planes'
+inline void deinterleaveChannels(const int16_t * in, int channels, std::size_t samples, int16_t * const * planes)
+{
+    std::size_t whole = samples / LAYOUT_TILE * LAYOUT_TILE;
+
+    for(std::size_t i = 0; i < whole; i += LAYOUT_TILE)
+    {
+        for(int c = 0; c < channels; c++, in += LAYOUT_TILE)
+            detail::copyTile(planes[c] + i, in);
+    }
+
+    if(whole < samples)
+    {
+        for(int c = 0; c < channels; c++, in += LAYOUT_TILE)
+            std::memcpy(planes[c] + whole, in, (samples - whole) * sizeof(int16_t));
+    }
+}
+
+#endif // CHANNEL_LAYOUT_HPP
@@ -0,0 +1,188 @@
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define ROSY_HAVE_SSE42_CRC
+#endif
+
+/// CRC32C (Castagnoli, reflected polynomial 0x82F63B78) of the transferred
+/// histograms and post mortem blocks: the crc32 instruction of SSE4.2 where
+/// the CPU has it, slicing-by-8 tables otherwise. crc32c("123456789") is 0xE3069283.
+
+const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;
+
+namespace detail
+{
+
+/// the 8 tables of slicing-by-8, built once
+inline const uint32_t (*crc32cTables())[256]
+{
+    static uint32_t tables[8][256];
+    static bool built = false;
+
+    if(!built)
+    {
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for(int k = 0; k < 8; k++)
+                crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0 - (crc & 1)));
+            tables[0][i] = crc;
+        }
+
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            for(int t = 1; t < 8; t++)
+                tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xff];
+        }
+
+        built = true;
+    }
+
+    return tables;
+}
+
+/// 'crc' and the result without the final inversion
+inline uint32_t crc32cSlicing8(uint32_t crc, const uint8_t * p, std::size_t n)
+{
+    const uint32_t (*t)[256] = crc32cTables();
+
+    for(; n > 0 && (reinterpret_cast<uintptr_t>(p) & 7); n--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+
+    for(; n >= 8; n -= 8, p += 8)
+    {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+              ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+
+    for(; n > 0; n--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+
+    return crc;
+}
+
+#ifdef ROSY_HAVE_SSE42_CRC
+__attribute__((target("sse4.2")))
+inline uint32_t crc32cSSE42(uint32_t crc, const uint8_t * p, std::size_t n)
+{
+    for(; n > 0 && (reinterpret_cast<uintptr_t>(p) & 7); n--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    for(; n >= 8; n -= 8, p += 8)
+        crc64 = _mm_crc32_u64(crc64, *reinterpret_cast<const uint64_t *>(p));
+    crc = (uint32_t)crc64;
+#else
+    for(; n >= 4; n -= 4, p += 4)
+        crc = _mm_crc32_u32(crc, *reinterpret_cast<const uint32_t *>(p));
+#endif
+
+    for(; n > 0; n--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+#endif
+
+typedef uint32_t (*Crc32cKernel)(uint32_t, const uint8_t *, std::size_t);
+
+inline Crc32cKernel selectCrc32cKernel()
+{
+#ifdef ROSY_HAVE_SSE42_CRC
+    if(__builtin_cpu_supports("sse4.2"))
+        return crc32cSSE42;
+#endif
+    crc32cTables();
+    return crc32cSlicing8;
+}
+
+/// product of the 32x32 GF(2) matrix 'm' and the vector 'v'
+inline uint32_t gf2Times(const uint32_t * m, uint32_t v)
+{
+    uint32_t sum = 0;
+    for(; v; v >>= 1, m++)
+    {
+        if(v & 1)
+            sum ^= *m;
+    }
+    return sum;
+}
+
+inline void gf2Square(uint32_t * square, const uint32_t * m)
+{
+    for(int n = 0; n < 32; n++)
+        square[n] = gf2Times(m, m[n]);
+}
+
+} // namespace detail
+
+/// CRC32C of 'n' bytes at 'data'; 'crc' is the CRC32C of the bytes
+/// before them, so a stream can be checksummed piece by piece
+inline uint32_t crc32c(const void * data, std::size_t n, uint32_t crc = 0)
+{
+    static const detail::Crc32cKernel kernel = detail::selectCrc32cKernel();
+    return ~kernel(~crc, static_cast<const uint8_t *>(data), n);
+}
+
+/// name of the kernel crc32c() runs, for the logs
+inline const char * crc32cKernelName()
+{
+#ifdef ROSY_HAVE_SSE42_CRC
+    if(__builtin_cpu_supports("sse4.2"))
+        return "SSE4.2";
+#endif
+    return "slicing-by-8";
+}
+
+/// CRC32C of A followed by B from 'crcA', 'crcB' and the length of B,
+/// without the data (as zlib's crc32_combine)
+inline uint32_t crc32cCombine(uint32_t crcA, uint32_t crcB, uint64_t bytesB)
+{
+    if(bytesB == 0)
+        return crcA;
+
+    uint32_t even[32]; // operator for an even number of zero bits
+    uint32_t odd[32]; // and for an odd one
+
+    /// ONE ZERO BIT
+    odd[0] = CRC32C_POLYNOMIAL;
+    for(int n = 1; n < 32; n++)
+        odd[n] = 1u << (n - 1);
+
+    detail::gf2Square(even, odd); // 2 zero bits
+    detail::gf2Square(odd, even); // 4 zero bits
+
+    /// APPLY bytesB ZERO BYTES TO crcA, SQUARING THE OPERATOR FOR EVERY BIT OF THE LENGTH
+    do
+    {
+        detail::gf2Square(even, odd);
+        if(bytesB & 1)
+            crcA = detail::gf2Times(even, crcA);
+        bytesB >>= 1;
+
+        if(bytesB == 0)
+            break;
+
+        detail::gf2Square(odd, even);
+        if(bytesB & 1)
+            crcA = detail::gf2Times(odd, crcA);
+        bytesB >>= 1;
+    }
+    while(bytesB != 0);
+
+    return crcA ^ crcB;
+}
+
+#endif // CHECKSUM_HPP
@@ -0,0 +1,632 @@
+#ifndef CHUNKED_CAPTURE_HPP
+#define CHUNKED_CAPTURE_HPP
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread.hpp>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "CaptureFormat.hpp"
+#include "TaskPool.hpp"
+#include "WaveformCodec.hpp"
+
+/// chunked post mortem capture file:
+///
+///   [header, CAPTURE_HEADER_SIZE bytes][chunks ...][chunk index][chunk checksums]
+///
+/// every channel is cut into chunks of 'chunkSamples' samples (the last
+/// one of a channel may be shorter), every chunk is compressed on its own,
+/// so any window of samples is read by decoding only the chunks it overlaps.
+/// the chunks are stored in the order they were compressed; the index at
+/// the end holds one entry per chunk, channel by channel, so the entry of
+/// a sample is found without any search. from version 2 the index is
+/// followed by the CRC32C of the samples of every chunk, in the same order,
+/// which the reader checks on every decoded chunk.
+
+const char CHUNKED_CAPTURE_MAGIC[8] = { 'R', 'O', 'S', 'Y', 'P', 'M', 'C', 0 };
+const uint32_t CHUNKED_CAPTURE_VERSION = 2;
+
+/// default size of a chunk, 1 MB of samples
+const uint32_t CHUNK_SAMPLES = 1 << 19;
+
+/// chunks queued for compression per worker of the pool, beyond it the persist stage waits
+const int CHUNK_QUEUE_PER_WORKER = 2;
+
+/// [bytes] held by a writer of 'channels' channels with chunks of 'chunkSamples'
+/// samples: the chunk being filled of every channel, plus the samples and the
+/// encoded copy of each of the 'inFlight' chunks being compressed
+inline uint64_t chunkWriterBytes(uint32_t channels, uint64_t chunkSamples, int inFlight)
+{
+    return (channels + 2 * (uint64_t)inFlight) * chunkSamples * sizeof(int16_t);
+}
+
+struct ChunkedCaptureHeader
+{
+    CaptureFileHeader capture; // magic is CHUNKED_CAPTURE_MAGIC, the rest as in a .bin capture
+    uint32_t chunkSamples;
+    uint32_t codec; // CHUNK_CODEC requested; every chunk records the codec it is stored with
+    uint64_t chunksPerChannel;
+    uint64_t indexOffset; // [bytes], 0 until the capture is closed
+    uint64_t storedBytes; // [bytes] of all the chunks
+};
+
+BOOST_STATIC_ASSERT(sizeof(ChunkedCaptureHeader) <= CAPTURE_HEADER_SIZE);
+
+struct ChunkIndexEntry
+{
+    uint64_t offset; // [bytes] from the start of the file
+    uint32_t bytes;
+    uint32_t codec;
+};
+
+/// encodes 'n' samples, appending the result to 'out'
+typedef void (*ChunkEncoder)(const int16_t * samples, std::size_t n, std::vector<uint8_t> & out);
+
+/// decodes exactly 'n' samples from 'bytes' bytes; false if the data are corrupted
+typedef bool (*ChunkDecoder)(const uint8_t * data, std::size_t bytes, int16_t * samples, std::size_t n);
+
+struct ChunkCodec
+{
+    const char * name;
+    ChunkEncoder encode;
+    ChunkDecoder decode;
+};
+
+namespace detail
+{
+
+inline void encodeNone(const int16_t * samples, std::size_t n, std::vector<uint8_t> & out)
+{
+    const uint8_t * p = reinterpret_cast<const uint8_t *>(samples);
+    out.insert(out.end(), p, p + n * sizeof(int16_t));
+}
+
+inline bool decodeNone(const uint8_t * data, std::size_t bytes, int16_t * samples, std::size_t n)
+{
+    if(bytes != n * sizeof(int16_t))
+        return false;
+
+    std::memcpy(samples, data, bytes);
+    return true;
+}
+
+/// difference to the previous sample, zigzag mapped and stored as a
+/// LEB128 varint: 1 byte for steps within +-63 counts, at most 3 bytes
+inline void encodeDelta(const int16_t * samples, std::size_t n, std::vector<uint8_t> & out)
+{
+    int32_t previous = 0;
+
+    for(std::size_t i = 0; i < n; i++)
+    {
+        int32_t d = samples[i] - previous;
+        uint32_t z = (uint32_t)((d << 1) ^ (d >> 31));
+        previous = samples[i];
+
+        while(z >= 0x80)
+        {
+            out.push_back((uint8_t)(z | 0x80));
+            z >>= 7;
+        }
+        out.push_back((uint8_t)z);
+    }
+}
+
+inline bool decodeDelta(const uint8_t * data, std::size_t bytes, int16_t * samples, std::size_t n)
+{
+    const uint8_t * end = data + bytes;
+    int32_t previous = 0;
+
+    for(std::size_t i = 0; i < n; i++)
+    {
+        uint32_t z = 0;
+        int shift = 0;
+
+        for(;;)
+        {
+            if(data == end || shift > 14)
+                return false;
+
+            uint8_t b = *data++;
+            z |= (uint32_t)(b & 0x7f) << shift;
+            shift += 7;
+
+            if(!(b & 0x80))
+                break;
+        }
+
+        previous += (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+        samples[i] = (int16_t)previous;
+    }
+
+    return data == end;
+}
+
+} // namespace detail
+
+/// the codec 'codec', 0 if unknown
+inline const ChunkCodec * chunkCodec(int codec)
+{
+    static const ChunkCodec codecs[] =
+    {
+        { "NONE", detail::encodeNone, detail::decodeNone },
+        { "DELTA", detail::encodeDelta, detail::decodeDelta },
+        { "RICE", encodeWaveform, decodeWaveform }
+    };
+
+    if(codec < 0 || codec >= (int)(sizeof(codecs) / sizeof(codecs[0])))
+        return 0;
+
+    return &codecs[codec];
+}
+
+/// parses the codec name as printed by chunkCodec(): NONE | DELTA | RICE
+inline CHUNK_CODEC parseChunkCodec(const std::string & name)
+{
+    for(int c = 0; chunkCodec(c); c++)
+    {
+        if(name == chunkCodec(c)->name)
+            return (CHUNK_CODEC)c;
+    }
+
+    throw std::runtime_error("parseChunkCodec: unknown codec " + name);
+}
+
+/// writes a chunked capture from the persist stage of the post mortem
+/// pipeline: append() cuts the samples of every channel into chunks,
+/// which the analysis pool compresses and writes in parallel. with a
+/// 'budget' [bytes], fewer chunks are queued when chunkWriterBytes()
+/// of the full queue would not fit; 0 leaves the queue at its default
+class ChunkedCaptureWriter
+{
+public:
+
+    ChunkedCaptureWriter(const std::string & path, const CaptureFileHeader & h, CHUNK_CODEC codec,
+                         uint32_t chunkSamples = CHUNK_SAMPLES, uint64_t budget = 0, TaskPool & pool = analysisPool())
+        : path_(path), fd_(-1), codec_(chunkCodec(codec)), pending_(h.numberOfChannels),
+        pendingCrc_(h.numberOfChannels, 0), nextChunk_(h.numberOfChannels, 0), end_(CAPTURE_HEADER_SIZE),
+        tasks_(pool), inFlight_(0), maxInFlight_(pool.workers() * CHUNK_QUEUE_PER_WORKER)
+    {
+        if(!codec_)
+            throw std::runtime_error("ChunkedCaptureWriter: unknown codec");
+        if(chunkSamples == 0)
+            throw std::runtime_error("ChunkedCaptureWriter: empty chunks");
+
+        if(budget > 0)
+        {
+            while(maxInFlight_ > 0 && chunkWriterBytes(h.numberOfChannels, chunkSamples, maxInFlight_) > budget)
+                maxInFlight_--;
+
+            if(maxInFlight_ == 0)
+                throw std::runtime_error("ChunkedCaptureWriter: chunks of " + boost::lexical_cast<std::string>(chunkSamples)
+                                         + " samples do not fit in the memory budget, " + path);
+        }
+
+        std::memset(&header_, 0, sizeof(header_));
+        header_.capture = h;
+        std::memcpy(header_.capture.magic, CHUNKED_CAPTURE_MAGIC, sizeof(header_.capture.magic));
+        header_.capture.version = CHUNKED_CAPTURE_VERSION;
+        header_.capture.headerSize = CAPTURE_HEADER_SIZE;
+        header_.capture.blocksCompleted = 0;
+        header_.chunkSamples = chunkSamples;
+        header_.codec = codec;
+
+        uint64_t samples = h.bytesPerChannel / sizeof(int16_t);
+        header_.chunksPerChannel = (samples + chunkSamples - 1) / chunkSamples;
+        index_.resize(header_.chunksPerChannel * h.numberOfChannels);
+        checksums_.resize(index_.size());
+
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd_ < 0)
+            fail("cannot open");
+
+        writeAt(&header_, sizeof(header_), 0);
+    }
+
+    ~ChunkedCaptureWriter()
+    {
+        stop();
+
+        if(fd_ >= 0)
+            ::close(fd_);
+    }
+
+    /// appends the next 'n' samples of the stored channel 'channel'
+    void append(int channel, const int16_t * samples, std::size_t n)
+    {
+        std::vector<int16_t> & pending = pending_[channel];
+
+        while(n > 0)
+        {
+            std::size_t take = std::min<std::size_t>(n, header_.chunkSamples - pending.size());
+            pending.insert(pending.end(), samples, samples + take);
+            pendingCrc_[channel] = crc32c(samples, take * sizeof(int16_t), pendingCrc_[channel]);
+            samples += take;
+            n -= take;
+
+            if(pending.size() == header_.chunkSamples)
+                submit(channel);
+        }
+    }
+
+    /// compresses the last partial chunks, waits for the pool
+    /// and writes the index; the file is complete afterwards
+    void close()
+    {
+        for(std::size_t c = 0; c < pending_.size(); c++)
+        {
+            if(!pending_[c].empty())
+                submit(c);
+        }
+
+        stop();
+        checkError();
+
+        header_.indexOffset = end_;
+        header_.capture.blocksCompleted = header_.capture.numberOfBlocks * header_.capture.numberOfChannels;
+
+        if(!index_.empty())
+        {
+            writeAt(&index_[0], index_.size() * sizeof(ChunkIndexEntry), end_);
+            writeAt(&checksums_[0], checksums_.size() * sizeof(uint32_t), end_ + index_.size() * sizeof(ChunkIndexEntry));
+        }
+        writeAt(&header_, sizeof(header_), 0);
+    }
+
+    const std::string & path() const
+    {
+        return path_;
+    }
+
+    /// [bytes] of all the compressed chunks so far
+    uint64_t storedBytes() const
+    {
+        return header_.storedBytes;
+    }
+
+private:
+
+    struct Chunk
+    {
+        int channel;
+        uint64_t number;
+        uint32_t crc; // CRC32C of the samples
+        std::vector<int16_t> samples;
+    };
+
+    void submit(int channel)
+    {
+        checkError();
+
+        Chunk * chunk = new Chunk;
+        chunk->channel = channel;
+        chunk->number = nextChunk_[channel]++;
+        chunk->crc = pendingCrc_[channel];
+        pendingCrc_[channel] = 0;
+        chunk->samples.swap(pending_[channel]);
+        pending_[channel].reserve(header_.chunkSamples);
+
+        if(chunk->number >= header_.chunksPerChannel)
+        {
+            delete chunk;
+            throw std::runtime_error("ChunkedCaptureWriter: more samples than in the header, " + path_);
+        }
+
+        /// BOUNDED: THE PERSIST STAGE WAITS WHILE THE POOL IS BEHIND
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while(inFlight_ >= maxInFlight_)
+                compressed_.wait(lock);
+            inFlight_++;
+        }
+
+        tasks_.run(boost::bind(&ChunkedCaptureWriter::compress, this, chunk));
+    }
+
+    void compress(Chunk * chunk)
+    {
+        std::vector<uint8_t> encoded;
+
+        /// NOTHING IS WRITTEN AFTER A FAILURE
+        bool failed;
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            failed = !error_.empty();
+        }
+
+        if(!failed)
+        {
+            try
+            {
+                std::size_t n = chunk->samples.size();
+                uint32_t codec = header_.codec;
+
+                codec_->encode(&chunk->samples[0], n, encoded);
+
+                /// A CHUNK WHICH DOES NOT COMPRESS IS STORED AS IT IS
+                if(encoded.size() >= n * sizeof(int16_t))
+                {
+                    encoded.clear();
+                    detail::encodeNone(&chunk->samples[0], n, encoded);
+                    codec = CODEC_NONE;
+                }
+
+                ChunkIndexEntry entry;
+                entry.bytes = encoded.size();
+                entry.codec = codec;
+
+                {
+                    boost::lock_guard<boost::mutex> lock(mutex_);
+                    entry.offset = end_;
+                    end_ += entry.bytes;
+                    header_.storedBytes += entry.bytes;
+                }
+
+                writeAt(&encoded[0], encoded.size(), entry.offset);
+
+                boost::lock_guard<boost::mutex> lock(mutex_);
+                index_[chunk->channel * header_.chunksPerChannel + chunk->number] = entry;
+                checksums_[chunk->channel * header_.chunksPerChannel + chunk->number] = chunk->crc;
+            }
+            catch(std::exception & e)
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+                if(error_.empty())
+                    error_ = e.what();
+            }
+        }
+
+        delete chunk;
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        inFlight_--;
+        compressed_.notify_one();
+    }
+
+    void stop()
+    {
+        tasks_.wait();
+    }
+
+    void checkError()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if(!error_.empty())
+            throw std::runtime_error(error_);
+    }
+
+    void writeAt(const void * data, uint64_t bytes, uint64_t position)
+    {
+        const char * p = static_cast<const char *>(data);
+
+        while(bytes > 0)
+        {
+            ssize_t written = ::pwrite(fd_, p, bytes, position);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                fail("cannot write");
+
+            p += written;
+            position += written;
+            bytes -= written;
+        }
+    }
+
+    void fail(const char * what)
+    {
+        throw std::runtime_error(std::string("ChunkedCaptureWriter: ") + what + " " + path_ + ": " + std::strerror(errno));
+    }
+
+private:
+    std::string path_;
+    int fd_;
+    const ChunkCodec * codec_;
+    ChunkedCaptureHeader header_;
+    std::vector<std::vector<int16_t> > pending_; // samples of the chunk being filled, per channel
+    std::vector<uint32_t> pendingCrc_; // and their CRC32C, computed as they are copied in
+    std::vector<uint64_t> nextChunk_;
+    std::vector<ChunkIndexEntry> index_;
+    std::vector<uint32_t> checksums_; // per chunk, in the order of the index
+    uint64_t end_; // [bytes], where the next chunk goes
+    TaskGroup tasks_; // the chunks being compressed
+    int inFlight_;
+    int maxInFlight_;
+    boost::mutex mutex_;
+    boost::condition_variable compressed_;
+    std::string error_;
+};
+
+/// random access to a chunked capture: read() decodes only the chunks
+/// overlapping the requested window
+class ChunkedCaptureReader
+{
+public:
+
+    explicit ChunkedCaptureReader(const std::string & path)
+        : path_(path), fd_(-1)
+    {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if(fd_ < 0)
+            fail("cannot open");
+
+        struct stat st;
+        if(::fstat(fd_, &st) != 0)
+            fail("cannot stat");
+
+        readAt(&header_, sizeof(header_), 0);
+
+        const CaptureFileHeader & h = header_.capture;
+
+        if(std::memcmp(h.magic, CHUNKED_CAPTURE_MAGIC, sizeof(h.magic)) != 0)
+            fail("not a chunked capture:", false);
+        if(h.version < 1 || h.version > CHUNKED_CAPTURE_VERSION)
+            fail("unsupported chunked capture version:", false);
+        if(header_.indexOffset == 0)
+            fail("incomplete chunked capture:", false);
+
+        uint64_t entries = header_.chunksPerChannel * h.numberOfChannels;
+        uint64_t checksums = h.version >= 2 ? entries : 0;
+
+        if(h.numberOfChannels > 4 || header_.chunkSamples == 0
+           || header_.indexOffset + entries * sizeof(ChunkIndexEntry) + checksums * sizeof(uint32_t) > (uint64_t)st.st_size)
+            fail("truncated or corrupted chunked capture:", false);
+
+        index_.resize(entries);
+        if(entries > 0)
+            readAt(&index_[0], entries * sizeof(ChunkIndexEntry), header_.indexOffset);
+
+        checksums_.resize(checksums);
+        if(checksums > 0)
+            readAt(&checksums_[0], checksums * sizeof(uint32_t), header_.indexOffset + entries * sizeof(ChunkIndexEntry));
+    }
+
+    ~ChunkedCaptureReader()
+    {
+        if(fd_ >= 0)
+            ::close(fd_);
+    }
+
+    const CaptureFileHeader & header() const
+    {
+        return header_.capture;
+    }
+
+    int numberOfChannels() const
+    {
+        return header_.capture.numberOfChannels;
+    }
+
+    uint64_t samplesPerChannel() const
+    {
+        return header_.capture.bytesPerChannel / sizeof(int16_t);
+    }
+
+    uint32_t chunkSamples() const
+    {
+        return header_.chunkSamples;
+    }
+
+    const char * codecName() const
+    {
+        const ChunkCodec * codec = chunkCodec(header_.codec);
+        return codec ? codec->name : "unknown";
+    }
+
+    uint64_t storedBytes() const
+    {
+        return header_.storedBytes;
+    }
+
+    char channelName(int i) const
+    {
+        return 'A' + header_.capture.channel[i];
+    }
+
+    VERTICAL_RANGE channelRange(int i) const
+    {
+        return (VERTICAL_RANGE)header_.capture.channelRange[i];
+    }
+
+    /// copies samples 'first' .. 'first + n - 1' of the stored channel 'channel' to 'out'
+    void read(int channel, uint64_t first, uint64_t n, int16_t * out) const
+    {
+        if(first + n > samplesPerChannel())
+            throw std::runtime_error("ChunkedCaptureReader: window beyond the end of " + path_);
+
+        std::vector<uint8_t> stored;
+        std::vector<int16_t> chunk;
+
+        while(n > 0)
+        {
+            uint64_t number = first / header_.chunkSamples;
+            uint64_t start = number * header_.chunkSamples;
+            std::size_t count = std::min<uint64_t>(header_.chunkSamples, samplesPerChannel() - start);
+
+            decodeChunk(channel, number, count, stored, chunk);
+
+            std::size_t skip = first - start;
+            std::size_t take = std::min<uint64_t>(n, count - skip);
+            std::memcpy(out, &chunk[skip], take * sizeof(int16_t));
+
+            out += take;
+            first += take;
+            n -= take;
+        }
+    }
+
+private:
+
+    void decodeChunk(int channel, uint64_t number, std::size_t count,
+                     std::vector<uint8_t> & stored, std::vector<int16_t> & chunk) const
+    {
+        const ChunkIndexEntry & entry = index_[channel * header_.chunksPerChannel + number];
+        const ChunkCodec * codec = chunkCodec(entry.codec);
+
+        if(!codec)
+            throw std::runtime_error("ChunkedCaptureReader: unknown codec in " + path_);
+
+        stored.resize(entry.bytes);
+        chunk.resize(count);
+
+        if(entry.bytes > 0)
+            readAt(&stored[0], entry.bytes, entry.offset);
+
+        if(!codec->decode(stored.empty() ? 0 : &stored[0], entry.bytes, &chunk[0], count))
+            throw std::runtime_error("ChunkedCaptureReader: corrupted chunk in " + path_);
+
+        if(!checksums_.empty()
+           && crc32c(&chunk[0], count * sizeof(int16_t)) != checksums_[channel * header_.chunksPerChannel + number])
+            throw std::runtime_error("ChunkedCaptureReader: checksum mismatch in chunk "
+                                     + boost::lexical_cast<std::string>(number) + " of channel " + channelName(channel) + " of " + path_);
+    }
+
+    void readAt(void * data, uint64_t bytes, uint64_t position) const
+    {
+        char * p = static_cast<char *>(data);
+
+        while(bytes > 0)
+        {
+            ssize_t got = ::pread(fd_, p, bytes, position);
+            if(got < 0 && errno == EINTR)
+                continue;
+            if(got <= 0)
+                throw std::runtime_error("ChunkedCaptureReader: cannot read " + path_);
+
+            p += got;
+            position += got;
+            bytes -= got;
+        }
+    }
+
+    void fail(const char * what, bool systemError = true)
+    {
+        std::string msg = std::string("ChunkedCaptureReader: ") + what + " " + path_;
+        if(systemError)
+            msg += std::string(": ") + std::strerror(errno);
+
+        if(fd_ >= 0)
+            ::close(fd_);
+
+        throw std::runtime_error(msg);
+    }
+
+private:
+    std::string path_;
+    int fd_;
+    ChunkedCaptureHeader header_;
+    std::vector<ChunkIndexEntry> index_;
+    std::vector<uint32_t> checksums_; // empty for version 1 captures
+};
+
+#endif // CHUNKED_CAPTURE_HPP
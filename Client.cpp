@@ -1,6 +1,9 @@
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/asio/read_until.hpp>
 #include <boost/asio/read.hpp>
 #include <boost/asio/streambuf.hpp>
@@ -23,14 +26,36 @@
 #include <fstream>
 #include <iomanip>
 #include <time.h>
+#include <sys/stat.h>
 #include <string>
 #include <cstdlib>
-
-/// flags used in the 'parallelOperationTest'
-/// example function
-bool PM_THREAD_IS_RUNNING;
-bool TL_THREAD_IS_RUNNING;
-bool POST_MORTEM_STARTED;
+#include <algorithm>
+#include <memory>
+
+#include "RosySettings.hpp"
+#include "ScopePipeline.hpp"
+#include "CaptureFormat.hpp"
+#include "MappedCapture.hpp"
+#include "VoltageConversion.hpp"
+#include "WaveformEnvelope.hpp"
+#include "EdgeFinder.hpp"
+#include "Spectrum.hpp"
+#include "ChunkedCapture.hpp"
+#include "CaptureStore.hpp"
+#include "Checksum.hpp"
+#include "ControlMultiplexer.hpp"
+#include "ControlSequence.hpp"
+#include "Placement.hpp"
+#include "DaemonSocket.hpp"
+#include "TransferBudget.hpp"
+#include "SequenceScript.hpp"
+#include "RosySimulator.hpp"
+#include "Benchmark.hpp"
+#include "CommandLatency.hpp"
+#include "AcquisitionMetrics.hpp"
+#include "MetricsServer.hpp"
+#include "SocketJournal.hpp"
+#include "JournalPlayer.hpp"
 
 /// arguments for the TCP connection function;
 /// CONTROL_SOCKET uses port 3893
@@ -42,122 +67,173 @@ const int POST_MORTEM_SOCKET = 1;
 /// which indicates the successful completion
 const std::string RESPONSE_OK = "0";
 
+/// period of the time loss histograms in 'parallelOperationTest' and, by default, of the daemon
+const long HISTOGRAM_PERIOD_MS = 1000;
+
 using boost::asio::deadline_timer;
 using boost::asio::ip::tcp;
 using boost::lambda::bind;
 using boost::lambda::var;
 
-/// vertical (i.e. voltage) range on the input channels of the device;
-/// values from 3 to 10 (+-100 mV ... +- 20 V, respectively);
-/// value -1 means that the channel is disabled in POST MORTEM
-enum VERTICAL_RANGE
-{
-    RANGE_100_MV = 3, RANGE_200_MV, RANGE_500_MV,
-    RANGE_1_V, RANGE_2_V, RANGE_5_V, RANGE_10_V, RANGE_20_V,
-    DISABLE_CHANNEL = -1
-};
-
-/// Time Loss device ID == 0;
-/// Post Mortem device ID == 1;
-/// these ID values are used in 'postMortemViaTimeLossDeviceTest'
-/// example function, which demonstrates how to swap
-/// the functionality of the two devices, in order to
-/// be able to read out (using a regular POST MORTEM operation)
-/// the raw data from the input channels on the Time Loss device.
-enum DEVICE_ID
-{
-    TIME_LOSS_DEVICE, POST_MORTEM_DEVICE
-};
-
-struct TimeLossSettings
-{
-    int numberOfIterations;
-    double threshold;
-    bool saveToFile;
-    bool printSomeData;
-};
-
-struct PostMortemSettings
-{
-    double delay; // [number of samples]
-    // positive delay => acquisition starts after the specified number of samples AFTER trigger
-    // negative delay => the specified number of samples are acquired BEFORE trigger
-
-    VERTICAL_RANGE range_A; // 3..10 ; -1 means "disable channel"
-    VERTICAL_RANGE range_B; // 3..10 ; -1 means "disable channel"
-    VERTICAL_RANGE range_C; // 3..10 ; -1 means "disable channel"
-    VERTICAL_RANGE range_D; // 3..10 ; -1 means "disable channel"
-    std::string triggerChannel; // A | B | C | D | EXT
-    std::string triggerDirection; // RISING | FALLING | RISE_FALL
-    int numberOfSamples; // -1 means maximum possible number of samples
-
-    double samplingPeriod; // [s]
-    // -1 means the minimum possible sampling period
-    //
-    // for 1 channel, minimum possible period is 200 ps
-    // for 2 channels (only A+C or B+D), minimum possible period is 400 ps
-    // for 3 or 4 channels, minimum possible period is 800 ps
-
-    short triggerThreshold; // [mV], from 1 to 1000
-    bool saveToFile;
-    bool printSomeData;
-};
-
 class TCPClient
 {
 public:
 
-    TCPClient(boost::asio::io_service& io_service)
-        : stopped_(false),
-        socket_(io_service), socket_2(io_service), deadline_(io_service)
+    /// with an 'executor' the multiplexer of CONTROL_SOCKET runs on it instead
+    /// of a thread of its own, see DeviceManager
+    TCPClient(boost::asio::io_service& io_service, ControlExecutor executor = ControlExecutor())
+        : stopped_(false), throwOnErrors_(false), outputDirectory_("./"), io_service_(io_service),
+        socket_(io_service), socket_2(io_service), deadline_(io_service), scopeFileStart_(0), scopeFileCrc_(0), executor_(executor), journal_(0), placement_(0),
+        histogramTimer_(io_service)
     {}
 
     ~TCPClient()
     {
         stop();
+
+        if(postMortemThread_.get())
+            postMortemThread_->join();
     }
 
     void start(tcp::resolver::iterator endpoint_iter, int SOCKET_NUMBER)
     {
         start_connect(endpoint_iter, SOCKET_NUMBER);
+
+        /// FROM NOW ON EVERY COMMAND GOES THROUGH THE MULTIPLEXER
+        if(SOCKET_NUMBER == CONTROL_SOCKET && socket_.is_open())
+            control_.reset(new ControlMultiplexer(socket_, input_buffer_, executor_,
+                                                  JournalTap(journal_, JOURNAL_CONTROL_SOCKET)));
+    }
+
+    /// records the traffic of both sockets into 'journal', see SocketJournal.hpp;
+    /// called before start()
+    void record(SocketJournal * journal)
+    {
+        journal_ = journal;
+        postMortemTap_ = JournalTap(journal, JOURNAL_POST_MORTEM_SOCKET);
+    }
+
+    /// errors of the session throw instead of ending the process, for a
+    /// client among others in one process
+    void throwOnErrors()
+    {
+        throwOnErrors_ = true;
+    }
+
+    /// where the histogram and post mortem files go, "./" by default
+    void setOutputDirectory(const std::string & directory)
+    {
+        outputDirectory_ = directory;
+        if(outputDirectory_.empty() || outputDirectory_[outputDirectory_.size() - 1] != '/')
+            outputDirectory_ += "/";
     }
 
     void stop()
     {
         stopped_ = true;
+        control_.reset();
         socket_.close();
         socket_2.close();
     }
 
-    void send(std::string msg)
+    /// pins the receive threads near the NIC of the sockets and the analysis
+    /// workers on the other NUMA nodes, and reports the topology; called once
+    /// both sockets are connected, see Placement.hpp
+    void place(PlacementSettings * pl)
+    {
+        placement_ = pl;
+
+        if(!pl->pinThreads && !pl->bindMemory)
+            return;
+
+        plan_ = planPlacement(socket_2.local_endpoint().address().to_string(), pl->interface, pl->receiveNode);
+        printPlacement(plan_);
+
+        if(pl->pinThreads)
+        {
+            /// THE RECEIVE STAGE RUNS IN THIS THREAD: THE PIPELINE STAGES STARTED FROM IT
+            /// INHERIT ITS CPUS AND ITS BUFFERS ARE FIRST TOUCHED ON ITS NODE
+            bool pinned = setThreadAffinity(pthread_self(), plan_.receiveCpus);
+
+            if(control_.get())
+                pinned = control_->setAffinity(plan_.receiveCpus) && pinned;
+
+            pinned = analysisPool().setAffinity(plan_.analysisCpus) && pinned;
+
+            if(!pinned)
+                std::cout << "placement: some threads could not be pinned" << std::endl;
+        }
+    }
+
+    ControlMultiplexer & control()
+    {
+        return *control_;
+    }
+
+    boost::asio::io_service & io_service()
+    {
+        return io_service_;
+    }
+
+    /// reads the status, size and blocks lines which announce the post mortem
+    /// data on POST_MORTEM_SOCKET without blocking, for a ControlSequence;
+    /// 'done' is called from the event loop
+    void async_read_post_mortem_header(boost::function<void (const std::string &)> done)
+    {
+        boost::asio::async_read_until(socket_2, input_buffer_2, '\n',
+            boost::bind(&TCPClient::handle_header_line, this, boost::asio::placeholders::error, 0, done));
+    }
+
+    /// receives the post mortem data announced by async_read_post_mortem_header()
+    /// on a thread of its own, so that the event loop goes on meanwhile, for a
+    /// ControlSequence; 'done' is called from that thread, with the error if any
+    void async_receive_post_mortem(PostMortemSettings * ps, int numberOfChannels, boost::function<void (const std::string &)> done)
+    {
+        /// THE PREVIOUS TRANSFER HAS CALLED ITS 'done', ITS THREAD IS ENDING
+        if(postMortemThread_.get())
+            postMortemThread_->join();
+
+        postMortemThread_.reset(new boost::thread(
+            boost::bind(&TCPClient::receive_post_mortem, this, ps, numberOfChannels, done)));
+    }
+
+    /// queues 'request' on CONTROL_SOCKET; safe from any thread, see ControlMultiplexer
+    ControlFuture submit(const ControlRequest & request, ControlHandler handler = ControlHandler())
+    {
+        return control_->submit(request, handler);
+    }
+
+    /// sends 'request' and waits for its response
+    ControlResponse call(const ControlRequest & request)
     {
-        std::cout << "\n\n ..  SENDING : " << msg << "\n" << std::endl;
-        boost::asio::write(socket_, boost::asio::buffer(msg));
+        return control_->submit(request).get();
     }
 
-    void blocking_read(std::string token)
+    /// sends 'request' and exits unless its response contains 'token'
+    void expect(const ControlRequest & request, std::string token)
     {
-        boost::asio::read_until(socket_, input_buffer_, '\n');
+        ControlResponse response = call(request);
 
-        if(!(isToken(token)))
+        if(response.line.find(token) == std::string::npos)
         {
             std::cout << "\t ---> ERROR --- the client has not received the expected response: "
                       << token << std::endl;
-            exit(1);
+            fail("expected " + token + ", received " + response.line);
         }
     }
 
-    std::string blocking_read(int number)
+    /// checks the status of a 'getHistogram' response and parses its histogram
+    void process_histogram(const ControlResponse & response, TimeLossSettings * tlc)
     {
-        std::string result;
+        if(response.line.find(RESPONSE_OK) == std::string::npos)
+            throw std::runtime_error("process_histogram: getHistogram failed: " + response.line);
 
-        for(int i = 0; i < number; i++)
-        {
-            boost::asio::read_until(socket_, input_buffer_, '\n');
-            result = parseInputBuffer();
-        }
+        std::cout << "process_histogram: CRC32C " << std::hex << std::setw(8) << std::setfill('0')
+                  << response.crc << std::dec << std::setfill(' ') << std::endl;
 
-        return result;
+        parseTimelossData(&response.histogram, response.histogram.size(), tlc->printSomeData, tlc->saveToFile, response.crc);
+        std::cout << "\n\n\t * * * Histogram length is " << response.histogram.size() << " bins, time interval "
+                  << 1.6*response.histogram.size() << " ns" << std::endl;
     }
 
     std::string blocking_read_scope(int number)
@@ -173,17 +249,6 @@ public:
         return result;
     }
 
-    int blocking_read_size()
-    {
-        std::cout << "blocking_read_size(): started" << std::endl;
-
-        int result = 0;
-        int readBytes = boost::asio::read_until(socket_, input_buffer_, '\n');
-        std::cout << "blocking_read_size(): read " << readBytes << " bytes" << std::endl;
-        result = parseSize();
-        return result;
-    }
-
     int blocking_read_scope_size()
     {
         std::cout << "blocking_read_scope_size(): started" << std::endl;
@@ -195,95 +260,485 @@ public:
         return result;
     }
 
-    void blocking_read_timeloss_data(int size, bool print, bool save)
+    void blocking_read_scope_data(int size, int num_of_blocks, int numberOfChannels, PostMortemSettings * ps)
     {
-        std::cout << "blocking_read_timeloss_data: allocating memory for the buffer... size " << size << " bytes." << std::endl;
-        timeLossData = new std::vector<int32_t>(size/4);
+        timeval start_time;
+        timeval end_time;
+        timeval pipeline_start_time;
+        timeval pipeline_end_time;
+
+        std::cout << "blocking_read_scope_data: num_of_blocks == " << num_of_blocks
+                  << ", channels == " << numberOfChannels << std::endl;
+
+        /// THE BINARY FORMATS DESCRIBE THE CAPTURE IN THE FILE HEADER;
+        /// IN THE MAPPED MODE THE BLOCKS ARE RECEIVED STRAIGHT INTO THE OUTPUT FILE,
+        /// OTHERWISE INTO THE BUFFERS OF THE PIPELINE
+        bool binary = ps->saveToFile && (ps->saveFormat == SAVE_BINARY || ps->saveFormat == SAVE_MAPPED);
+        bool mapped = ps->saveToFile && ps->saveFormat == SAVE_MAPPED;
+        bool chunked = ps->saveToFile && ps->saveFormat == SAVE_CHUNKED;
+        std::auto_ptr<MappedCaptureFile> capture;
+        std::auto_ptr<CaptureFileWriter> writer;
+        std::auto_ptr<ChunkedCaptureWriter> chunkWriter;
+
+        CaptureFileHeader header;
+        fillCaptureHeader(header, ps, num_of_blocks, size, captureTimestampNs());
+
+        if(header.numberOfChannels != (uint32_t)numberOfChannels)
+            throw std::runtime_error("blocking_read_scope_data: channel count does not match the settings");
+
+        /// THE BLOCKS GO THROUGH THE PIPELINE IN SLICES SMALL ENOUGH FOR THE MEMORY BUDGET,
+        /// WHATEVER THE SIZE OF THE BLOCKS THE DEVICE SENDS
+        uint64_t blockSamples = size/2;
+        uint64_t sliceSamples = pipelineSliceSamples(blockSamples, ps->memoryBudget, SCOPE_PIPELINE_DEPTH, ps->convertToMillivolts);
+        uint64_t pipelineBytes = SCOPE_PIPELINE_DEPTH * sliceSamples
+                                 * (sizeof(int16_t) + (ps->convertToMillivolts ? sizeof(float) : 0));
+
+        /// THE ENVELOPE IS PAID FROM THE BUDGET TOO; THE CHUNK WRITER AND THE STORE GET WHAT IS LEFT
+        uint64_t envelopeSize = ps->computeEnvelope
+                                ? numberOfChannels * envelopeBytes(header.bytesPerChannel / sizeof(int16_t)) : 0;
+
+        if(pipelineBytes + envelopeSize > ps->memoryBudget)
+        {
+            std::ostringstream os;
+            os << "blocking_read_scope_data: memory budget of " << ps->memoryBudget << " bytes, below the "
+               << pipelineBytes << " bytes of the pipeline buffers and the " << envelopeSize << " bytes of the envelope";
+            throw std::runtime_error(os.str());
+        }
 
-        std::cout << "blocking_read_timeloss_data: transferring the data..." << std::endl;
-        boost::asio::read(socket_, boost::asio::buffer(*timeLossData, size));
+        uint64_t restBudget = ps->memoryBudget - pipelineBytes - envelopeSize;
 
-        parseTimelossData(timeLossData, size/4, print, save);
+        std::string baseName = outputDirectory_ + get_current_time() + "_PM";
 
-        std::cout << "blocking_read_timeloss_data: deleting the buffer...\n\n" << std::endl;
-        delete timeLossData;
-    }
+        if(binary)
+        {
+            std::string name = baseName + ".bin";
 
-    void blocking_read_scope_data(int size, int num_of_blocks, bool printSomeData, bool save)
-    {
-        timeval start_time;
-        timeval end_time;
+            if(mapped)
+            {
+                std::cout << "blocking_read_scope_data: mapping the output file " << name << "... size "
+                          << captureFileSize(header) << " bytes." << std::endl;
+                capture.reset(new MappedCaptureFile(name, header));
+            }
+            else
+            {
+                std::cout << "blocking_read_scope_data: creating the output file " << name << "... size "
+                          << captureFileSize(header) << " bytes." << std::endl;
+                writer.reset(new CaptureFileWriter(name, header));
+            }
+        }
+        else if(chunked)
+        {
+            std::string name = baseName + ".pmc";
+            uint32_t chunkSamples = budgetChunkSamples(ps->chunkSamples, numberOfChannels, restBudget);
+
+            if(chunkSamples == 0)
+                throw std::runtime_error("blocking_read_scope_data: the chunks do not fit in the memory budget");
+
+            std::cout << "blocking_read_scope_data: creating the chunked output file " << name << ", "
+                      << chunkCodec(ps->chunkCodec)->name << " codec, " << chunkSamples << " samples per chunk" << std::endl;
+            chunkWriter.reset(new ChunkedCaptureWriter(name, header, ps->chunkCodec, chunkSamples, restBudget));
+        }
+
+
+        if(!mapped)
+        {
+            std::cout << "blocking_read_scope_data: allocating memory for " << SCOPE_PIPELINE_DEPTH
+                      << " buffers... size " << sliceSamples * sizeof(int16_t) << " bytes each." << std::endl;
+        }
+
+        if(sliceSamples < blockSamples)
+        {
+            std::cout << "blocking_read_scope_data: blocks of " << size << " bytes received in slices of "
+                      << sliceSamples * sizeof(int16_t) << " bytes, memory budget " << ps->memoryBudget << " bytes" << std::endl;
+        }
+
+        std::cout << "blocking_read_scope_data: CRC32C of every block with the " << crc32cKernelName() << " kernel" << std::endl;
+
+        /// THE ANALYSES OF THE WHOLE CAPTURE READ THE SAVED CAPTURE; WITHOUT ONE THE SAMPLES
+        /// ARE KEPT IN MEMORY IF THEY FIT IN THE BUDGET, OTHERWISE IN A SPILL FILE
+        bool analyse = ps->findEdges || ps->computeSpectrum;
+        std::auto_ptr<CaptureStore> store;
+
+        if(analyse && !binary && !chunked)
+        {
+            store.reset(new CaptureStore(header, restBudget, baseName + ".spill"));
+
+            std::cout << "blocking_read_scope_data: capture kept "
+                      << (store->kind() == STORE_MEMORY ? "in memory" : "in a spill file") << " for the analyses" << std::endl;
+        }
+
+        /// RECEIVE STAGE RUNS IN THIS THREAD, PROCESS AND PERSIST STAGES IN THEIR OWN THREADS;
+        /// THE TRANSFER OF THE NEXT BLOCK OVERLAPS THE PROCESSING OF THE CURRENT ONE
+        ScopePipeline::Stage persist;
 
-        std::cout << "blocking_read_scope_data: num_of_blocks == " << num_of_blocks << std::endl;
+        if(mapped)
+            persist = boost::bind(&TCPClient::flushMappedBlock, this, _1, capture.get());
+        else if(binary)
+            persist = boost::bind(&TCPClient::writeCaptureBlock, this, _1, writer.get());
+        else if(chunked)
+            persist = boost::bind(&TCPClient::appendChunkedBlock, this, _1, chunkWriter.get());
+        else
+            persist = boost::bind(&TCPClient::persistScopeBlock, this, _1, ps->saveToFile);
+
+        if(store.get())
+            persist = boost::bind(&TCPClient::storeScopeBlock, this, _1, store.get(), persist);
+
+        /// THE MIN/MAX ENVELOPE IS BUILT BY THE PROCESS STAGE WHILE THE BLOCKS ARRIVE
+        std::vector<EnvelopeBuilder> envelopes(ps->computeEnvelope ? numberOfChannels : 0);
+
+        for(std::size_t i = 0; i < envelopes.size(); i++)
+            envelopes[i].reserve(header.bytesPerChannel / sizeof(int16_t));
+
+        int buffers = mapped ? 0 : RECEIVE_BUFFERS;
+
+        if(ps->convertToMillivolts)
+        {
+            buffers |= MILLIVOLT_BUFFERS;
+            std::cout << "blocking_read_scope_data: converting to mV, " << convertKernelName() << " kernel" << std::endl;
+        }
 
-        long totalTimePerChannel = 0;
+        ScopePipeline pipeline(sliceSamples, buffers,
+                               boost::bind(&TCPClient::processScopeBlock, this, _1, ps, &envelopes),
+                               persist);
 
-        for(int i = 0; i < num_of_blocks; i++)
+        if(placement_ && placement_->bindMemory)
         {
-            std::cout << "blocking_read_scope_data: reading block # " << i << std::endl;
+            bool bound = pipeline.bindBuffers(plan_.receiveNode);
+
+            if(store.get() && store->kind() == STORE_MEMORY)
+                bound = store->bindMemory(plan_.receiveNode) && bound;
+
+            std::cout << "blocking_read_scope_data: buffers " << (bound ? "bound" : "could not be bound")
+                      << " to NUMA node " << plan_.receiveNode << std::endl;
+        }
+
+        long totalTime = 0;
+        uint64_t transferTimeUs = 0; // totalTime WITHOUT THE ROUNDING TO ms, FOR THE RATE METRIC
+
+        gettimeofday(&pipeline_start_time, 0);
+
+        for(int k = 0; k < numberOfChannels; k++)
+        {
+            long totalTimePerChannel = 0;
+
+            bool stopped = false;
+
+            for(int i = 0; i < num_of_blocks && !stopped; i++)
+            {
+                std::cout << "blocking_read_scope_data: reading block # " << i << " of channel # " << k << std::endl;
+
+                /// ONLY THE READS OFF THE SOCKET ARE TIMED, NOT THE WAITS FOR A FREE BUFFER
+                uint64_t blockTimeUs = 0;
+
+                for(uint64_t o = 0; o < blockSamples; o += sliceSamples)
+                {
+                    uint64_t n = std::min(sliceSamples, blockSamples - o);
+                    uint64_t offset = (uint64_t)i * blockSamples + o;
+
+                    ScopeBlock block;
+                    bool acquired;
+
+                    if(mapped)
+                    {
+                        char * region = capture->region(k, offset * sizeof(int16_t), n * sizeof(int16_t));
+                        acquired = pipeline.acquire(k, i, reinterpret_cast<int16_t *>(region), n, block);
+                    }
+                    else
+                    {
+                        acquired = pipeline.acquire(k, i, block);
+                    }
+
+                    if(!acquired)
+                    {
+                        stopped = true;
+                        break;
+                    }
 
-            std::cout << "blocking_read_scope_data: allocating memory for the buffer... size " << size << " bytes." << std::endl;
-            scopeData = new std::vector<int16_t>(size/2);
+                    block.count = n;
+                    block.offset = offset;
+                    block.last = (o + n == blockSamples);
 
-            gettimeofday(&start_time, 0);
-            long start_time_ms = start_time.tv_sec * 1000 + start_time.tv_usec / 1000;
+                    gettimeofday(&start_time, 0);
+                    block.crc = read_scope_block(block.samples, n * sizeof(int16_t));
+                    gettimeofday(&end_time, 0);
 
-            std::cout << "blocking_read_scope_data: transferring the data..." << std::endl;
-            boost::asio::read(socket_2, boost::asio::buffer(*scopeData));
-            //socket_.read_some(boost::asio::buffer(*scopeData));
+                    blockTimeUs += (uint64_t)(end_time.tv_sec - start_time.tv_sec) * 1000000
+                                   + (end_time.tv_usec - start_time.tv_usec);
 
-            gettimeofday(&end_time, 0);
-            long end_time_ms = end_time.tv_sec * 1000 + end_time.tv_usec / 1000;
+                    if(!pipeline.submit(block))
+                    {
+                        stopped = true;
+                        break;
+                    }
+                }
+
+                totalTimePerChannel += blockTimeUs / 1000;
+                transferTimeUs += blockTimeUs;
+                std::cout << "blocking_read_scope_data: \t scope data transfer time: " << blockTimeUs / 1000 << " ms" << std::endl;
+            }
+
+            std::cout << "blocking_read_scope_data: total time per channel data transfer == " << totalTimePerChannel << " ms" << std::endl;
+            totalTime += totalTimePerChannel;
+        }
 
-            totalTimePerChannel += (end_time_ms - start_time_ms);
-            std::cout << "blocking_read_scope_data: \t scope data transfer time: " << (end_time_ms - start_time_ms) << " ms" << std::endl;
+        pipeline.finish();
 
-            parseScopeData(scopeData, size/2, printSomeData, save);
+        /// A CAPTURE STOPPED WITHIN A BLOCK LEAVES ITS FILE WITHOUT THE CHECKSUM LINE
+        if(scopeFile_.is_open())
+            scopeFile_.close();
 
-            std::cout << "blocking_read_scope_data: deleting the buffer... \n\n" << std::endl;
+        if(chunked)
+            chunkWriter->close();
 
-            scopeData->clear();
+        gettimeofday(&pipeline_end_time, 0);
+        long wallTime = (pipeline_end_time.tv_sec - pipeline_start_time.tv_sec) * 1000
+                        + (pipeline_end_time.tv_usec - pipeline_start_time.tv_usec) / 1000;
+
+        std::cout << "blocking_read_scope_data: total data transfer == " << totalTime << " ms, "
+                  << "wall time including processing == " << wallTime << " ms" << std::endl;
+
+        countMetric(acquisitionMetrics().postMortemCaptures);
+        rateMetric(acquisitionMetrics().postMortemBytesPerS, header.bytesPerChannel * header.numberOfChannels,
+                   transferTimeUs * 1000);
+
+        if(mapped)
+            std::cout << "blocking_read_scope_data: capture saved to " << capture->path() << std::endl;
+        else if(binary)
+            std::cout << "blocking_read_scope_data: capture saved to " << writer->path() << std::endl;
+        else if(chunked)
+            std::cout << "blocking_read_scope_data: capture saved to " << chunkWriter->path() << ", "
+                      << chunkWriter->storedBytes() << " of " << header.bytesPerChannel * header.numberOfChannels
+                      << " bytes" << std::endl;
+
+        if(ps->computeEnvelope)
+        {
+            saveEnvelope(baseName + ".env", header, envelopes);
+            std::cout << "blocking_read_scope_data: envelope saved to " << baseName << ".env" << std::endl;
+
+            /// ITS SHARE OF THE BUDGET GOES BACK TO THE ANALYSES
+            std::vector<EnvelopeBuilder>().swap(envelopes);
         }
 
-        std::cout << "blocking_read_scope_data: total time per channel data transfer == " << totalTimePerChannel << " ms" << std::endl;
+        /// ANALYSES OF THE WHOLE CAPTURE WORK ON THE SAVED CAPTURE, OR ON THE STORE FILLED DURING THE TRANSFER
+        if(analyse)
+        {
+            /// THE PIPELINE STILL HOLDS ITS BUFFERS
+            if(binary)
+                store.reset(new CaptureStore(baseName + ".bin", ps->memoryBudget - pipelineBytes));
+            else if(chunked)
+                store.reset(new CaptureStore(baseName + ".pmc", ps->memoryBudget - pipelineBytes));
+
+            if(ps->findEdges)
+            {
+                saveCaptureEdges(*store, ps->edgeDirection, ps->edgeThreshold, ps->edgeHysteresis, baseName + "_edges.txt");
+                std::cout << "blocking_read_scope_data: edges saved to " << baseName << "_edges.txt" << std::endl;
+            }
 
-        delete scopeData;
+            if(ps->computeSpectrum)
+            {
+                saveCaptureSpectrum(*store, ps->spectrumSegment, baseName + "_psd.txt");
+                std::cout << "blocking_read_scope_data: spectrum saved to " << baseName << "_psd.txt" << std::endl;
+            }
+        }
     }
 
+    /// drives the time loss histograms on CONTROL_SOCKET and the armed post
+    /// mortem on POST_MORTEM_SOCKET from the io_service of the client, in the
+    /// calling thread; 'getPostMortemData' must have been sent. the histograms
+    /// stop as soon as the post mortem size arrives, i.e. on the trigger, and
+    /// the post mortem data are received once no histogram is in flight.
+    /// returns when both are done
+    void run_parallel_operation(TimeLossSettings * tlc, PostMortemSettings * ps, int numberOfChannels)
+    {
+        tlc_ = tlc;
+        ps_ = ps;
+        numberOfChannels_ = numberOfChannels;
+        histogramsLeft_ = tlc->numberOfIterations;
+        histogramInFlight_ = false;
+        postMortemStarted_ = false;
+        postMortemPending_ = false;
+
+        /// THE HISTOGRAMS ARE READ BY THE MULTIPLEXER, NOT BY THE io_service:
+        /// KEEP run() GOING UNTIL THE POST MORTEM DATA ARE IN
+        work_.reset(new boost::asio::io_service::work(io_service_));
+
+        if(histogramsLeft_ > 0)
+            schedule_histogram();
+
+        boost::asio::async_read_until(socket_2, input_buffer_2, '\n',
+            boost::bind(&TCPClient::handle_post_mortem_status, this, boost::asio::placeholders::error));
+
+        /// THE io_service MAY HAVE RUN OUT OF WORK BEFORE
+        io_service_.reset();
+        io_service_.run();
+    }
 
 private:
 
-    std::string parseInputBuffer()
+    /// TIME LOSS SIDE OF run_parallel_operation():
+    /// timer -> request through the multiplexer -> response posted back -> timer ...
+
+    void schedule_histogram()
     {
-        std::string line;
-        std::istream is(&input_buffer_);
-        std::getline(is, line);
+        histogramTimer_.expires_from_now(boost::posix_time::milliseconds(HISTOGRAM_PERIOD_MS));
+        histogramTimer_.async_wait(boost::bind(&TCPClient::handle_histogram_timer, this, boost::asio::placeholders::error));
+    }
 
-        std::cout << "Received: " << line << "\n";
+    void handle_histogram_timer(const boost::system::error_code & ec)
+    {
+        /// CANCELLED BY THE TRIGGER
+        if(ec == boost::asio::error::operation_aborted || postMortemStarted_)
+            return;
+        check(ec);
+
+        histogramInFlight_ = true;
+        submit(ControlRequest("function getHistogram", CONTROL_HISTOGRAM).arg(0),
+               boost::bind(&TCPClient::post_histogram, this, _1, _2));
+    }
 
-        return line;
+    /// called by the thread of the multiplexer: the response is handled in the event loop
+    void post_histogram(const ControlResponse & response, const std::string & error)
+    {
+        io_service_.post(boost::bind(&TCPClient::handle_histogram, this, response, error));
     }
 
-    std::string parseInputBufferScope()
+    void handle_histogram(const ControlResponse & response, const std::string & error)
     {
-        std::string line;
-        std::istream is(&input_buffer_2);
-        std::getline(is, line);
+        if(!error.empty())
+            throw std::runtime_error("run_parallel_operation: " + error);
+
+        process_histogram(response, tlc_);
+        histogramInFlight_ = false;
+
+        if(postMortemPending_)
+            receive_post_mortem_data();
+        else if(!postMortemStarted_ && --histogramsLeft_ > 0)
+            schedule_histogram();
+        else if(!postMortemStarted_)
+            std::cout << "run_parallel_operation: time loss histograms done" << std::endl;
+    }
 
-        std::cout << "Received scope message: " << line << "\n";
+    /// POST MORTEM SIDE OF run_parallel_operation():
+    /// status line -> size line (the trigger) -> blocks line -> data
 
-        return line;
+    void handle_post_mortem_status(const boost::system::error_code & ec)
+    {
+        check(ec);
+
+        parseInputBufferScope(); // status response of 'getPostMortemData', expecting RESPONSE_OK
+
+        boost::asio::async_read_until(socket_2, input_buffer_2, '\n',
+            boost::bind(&TCPClient::handle_post_mortem_size, this, boost::asio::placeholders::error));
+    }
+
+    void handle_post_mortem_size(const boost::system::error_code & ec)
+    {
+        check(ec);
+
+        scopeSize_ = parseScopeSize(); // SIZE OF DATA BUFFER OF A CHANNEL
+
+        /// THE TRIGGER: NO NEW HISTOGRAM IS REQUESTED FROM NOW ON
+        postMortemStarted_ = true;
+        histogramTimer_.cancel();
+        std::cout << "run_parallel_operation: post mortem triggered, time loss histograms stopped" << std::endl;
+
+        boost::asio::async_read_until(socket_2, input_buffer_2, '\n',
+            boost::bind(&TCPClient::handle_post_mortem_blocks, this, boost::asio::placeholders::error));
+    }
+
+    void handle_post_mortem_blocks(const boost::system::error_code & ec)
+    {
+        check(ec);
+
+        scopeBlocks_ = parseScopeSize(); // NUMBER OF BLOCKS IN THE DATA BUFFER
+
+        /// A HISTOGRAM STILL IN FLIGHT IS COMPLETED FIRST, SEE handle_histogram()
+        if(histogramInFlight_)
+        {
+            std::cout << "run_parallel_operation: post mortem data wait for the histogram in flight" << std::endl;
+            postMortemPending_ = true;
+        }
+        else
+            receive_post_mortem_data();
+    }
+
+    /// the thread of async_receive_post_mortem()
+    void receive_post_mortem(PostMortemSettings * ps, int numberOfChannels, boost::function<void (const std::string &)> done)
+    {
+        /// THE RECEIVE STAGE RUNS IN THIS THREAD, SEE place()
+        if(placement_ && placement_->pinThreads)
+            setThreadAffinity(pthread_self(), plan_.receiveCpus);
+
+        std::string error;
+
+        try
+        {
+            blocking_read_scope_data(scopeSize_ / scopeBlocks_, scopeBlocks_, numberOfChannels, ps); // CHANNEL DATA
+        }
+        catch(std::exception & e)
+        {
+            error = e.what();
+        }
+
+        done(error);
+    }
+
+    /// the bulk transfer is synchronous: nothing else is left for the reactor to do
+    void receive_post_mortem_data()
+    {
+        postMortemPending_ = false;
+        blocking_read_scope_data(scopeSize_ / scopeBlocks_, scopeBlocks_, numberOfChannels_, ps_); // CHANNEL DATA
+        work_.reset();
+    }
+
+    void handle_header_line(const boost::system::error_code & ec, int line, boost::function<void (const std::string &)> done)
+    {
+        if(ec)
+        {
+            done(ec.message());
+            return;
+        }
+
+        if(line == 0)
+            parseInputBufferScope(); // status response of 'getPostMortemData', expecting RESPONSE_OK
+        else if(line == 1)
+            scopeSize_ = parseScopeSize(); // SIZE OF DATA BUFFER OF A CHANNEL
+        else
+            scopeBlocks_ = parseScopeSize(); // NUMBER OF BLOCKS IN THE DATA BUFFER
+
+        if(line < 2)
+            boost::asio::async_read_until(socket_2, input_buffer_2, '\n',
+                boost::bind(&TCPClient::handle_header_line, this, boost::asio::placeholders::error, line + 1, done));
+        else
+            done("");
+    }
+
+    /// exit(1), or an exception after throwOnErrors()
+    void fail(const std::string & message)
+    {
+        if(throwOnErrors_)
+            throw std::runtime_error("TCPClient: " + message);
+
+        exit(1);
+    }
+
+    void check(const boost::system::error_code & ec)
+    {
+        if(ec)
+            throw boost::system::system_error(ec);
     }
 
-    int parseSize()
+    std::string parseInputBufferScope()
     {
         std::string line;
-        std::istream is(&input_buffer_);
+        std::istream is(&input_buffer_2);
         std::getline(is, line);
 
-        std::cout << "Received size: " << line << "\n";
+        std::cout << "Received scope message: " << line << "\n";
+        postMortemTap_.receivedLine(line);
+        countMetric(acquisitionMetrics().postMortemBytes, line.size() + 1);
 
-        return boost::lexical_cast<int>(line);
+        return line;
     }
 
     int parseScopeSize()
@@ -293,18 +748,20 @@ private:
         std::getline(is, line);
 
         std::cout << "Received scope size: " << line << "\n";
+        postMortemTap_.receivedLine(line);
+        countMetric(acquisitionMetrics().postMortemBytes, line.size() + 1);
 
         return boost::lexical_cast<int>(line);
     }
 
-    void parseTimelossData(std::vector<int32_t> * data, int sz, bool print, bool save)
+    void parseTimelossData(const std::vector<int32_t> * data, int sz, bool print, bool save, uint32_t crc)
     {
         std::cout << "Parsing time loss data, histogram size: " << sz << " bins, "
                   << "i.e. " << (sz*1.6) << " ns."
                   << "save: " << save << std::endl;
 
         if(save)
-            saveHistogramToFile(data);
+            saveHistogramToFile(data, crc);
 
         if(print)
         {
@@ -319,12 +776,52 @@ private:
         }
     }
 
-    void parseScopeData(std::vector<int16_t> * data, int sz, bool print, bool save)
+    void processScopeBlock(ScopeBlock & block, PostMortemSettings * ps, std::vector<EnvelopeBuilder> * envelopes)
     {
-        std::cout << "Parsing scope data, size: " << sz << " samples. \n";
+        if(!envelopes->empty())
+            (*envelopes)[block.channel].append(block.samples, block.count);
+
+        if(block.millivolts)
+        {
+            int channel = deviceChannel(ps, block.channel);
+            convertToMillivolts(block.samples, block.millivolts, block.count,
+                                channelRange(ps, channel), ps->offsetCorrection[channel]);
+        }
+
+        parseScopeData(block.samples, block.millivolts, block.count, ps->printSomeData);
+    }
 
+    void persistScopeBlock(ScopeBlock & block, bool save)
+    {
         if(save)
-            saveRawDataToFile(data);
+            saveRawDataToFile(block);
+    }
+
+    void flushMappedBlock(ScopeBlock & block, MappedCaptureFile * capture)
+    {
+        capture->flush(reinterpret_cast<const char *>(block.samples), block.count * sizeof(int16_t), block.crc, block.last);
+    }
+
+    void writeCaptureBlock(ScopeBlock & block, CaptureFileWriter * writer)
+    {
+        writer->writeBlock(block.channel, block.offset * sizeof(int16_t),
+                           block.samples, block.count * sizeof(int16_t), block.crc, block.last);
+    }
+
+    void storeScopeBlock(ScopeBlock & block, CaptureStore * store, ScopePipeline::Stage persist)
+    {
+        store->write(block.channel, block.offset, block.samples, block.count);
+        persist(block);
+    }
+
+    void appendChunkedBlock(ScopeBlock & block, ChunkedCaptureWriter * writer)
+    {
+        writer->append(block.channel, block.samples, block.count);
+    }
+
+    void parseScopeData(const int16_t * data, const float * millivolts, int sz, bool print)
+    {
+        std::cout << "Parsing scope data, size: " << sz << " samples. \n";
 
         if(print)
         {
@@ -334,33 +831,33 @@ private:
             int printTo = 5;
 
             for(int j = 0; j < printTo; j++)
-                std::cout << j << " , " << data->at(j) << std::endl;
+                printSample(j, data, millivolts);
 
             std::cout << "..." << std::endl;
 
             for(int j = (sz - 5); j < sz; j++)
-                std::cout << j << " , " << data->at(j) << std::endl;
+                printSample(j, data, millivolts);
         }
         std::cout << std::endl;
 
     }
 
-    bool isToken(std::string token)
+    void printSample(int j, const int16_t * data, const float * millivolts)
     {
-        bool result = false;
-
-        std::string line;
-        std::istream is(&input_buffer_);
-        std::getline(is, line);
-
-        std::cout << "Received: " << line << "\n";
-
-        if (line.find(token) != std::string::npos)
-        {
-            result = true;
-        }
+        std::cout << j << " , " << data[j];
+        if(millivolts)
+            std::cout << " , " << millivolts[j] << " mV";
+        std::cout << std::endl;
+    }
 
-        return result;
+    /// reads 'bytes' bytes of the post mortem data into 'data' and returns
+    /// their CRC32C; bytes which 'read_until' has already pulled into
+    /// 'input_buffer_2' together with the size lines are consumed first
+    uint32_t read_scope_block(int16_t * data, std::size_t bytes)
+    {
+        uint32_t crc = receiveChecksummed(socket_2, input_buffer_2, reinterpret_cast<char *>(data), bytes, postMortemTap_);
+        countMetric(acquisitionMetrics().postMortemBytes, bytes);
+        return crc;
     }
 
     void start_connect(tcp::resolver::iterator endpoint_iter, int SOCKET_NUMBER)
@@ -394,10 +891,15 @@ private:
 
                 }
 
+                /// 'getPostMortemData' HAS NO RESPONSE, SO ITS ACK MAY BE DELAYED:
+                /// THE NEXT REQUEST MUST NOT WAIT FOR IT
+                if(success)
+                    socket_.set_option(tcp::no_delay(true));
+
                 if(!success)
                 {
                     stop();
-                    exit(1);
+                    fail("cannot connect CONTROL_SOCKET");
                 }
             }
             else
@@ -436,7 +938,7 @@ private:
                 if(!success)
                 {
                     stop();
-                    exit(1);
+                    fail("cannot connect POST_MORTEM_SOCKET");
                 }
             }
             else
@@ -463,7 +965,7 @@ private:
     return std::string(buffer);
 }
 
-    void saveHistogramToFile(std::vector<int32_t> * data)
+    void saveHistogramToFile(const std::vector<int32_t> * data, uint32_t crc)
     {
         std::fstream myfile;
         using namespace boost::posix_time;
@@ -472,7 +974,7 @@ private:
         std::stringstream ss;
 
         
-        ss <<get_current_time()<<"_TL.txt";
+        ss << outputDirectory_ << get_current_time() << "_TL.txt";
         // std::string name = "./TL-";
         // name += boost::lexical_cast<std::string>(histogramCounter++);
         // name += ".txt";
@@ -484,487 +986,1955 @@ private:
             myfile << i << " , " << data->at(i) << "\n";
         }
 
+        writeChecksumLine(myfile, crc);
         myfile.close();
     }
 
-    void saveRawDataToFile(std::vector<int16_t> * data)
+    /// one PM-N.txt per channel block: the slices of a block, see
+    /// pipelineSliceSamples(), are appended to the file opened by its first
+    /// slice, numbered from the start of the block, and the checksum line
+    /// of its last slice covers the whole block
+    void saveRawDataToFile(const ScopeBlock & block)
     {
-        std::fstream myfile;
-
         static int scopeCounter = 0;
 
-        std::string name = "./PM-";
-        name += boost::lexical_cast<std::string>(scopeCounter++);
-        name += ".txt";
-
-        myfile.open(name.c_str(), std::fstream::out);
+        if(!scopeFile_.is_open())
+        {
+            std::string name = outputDirectory_ + "PM-";
+            name += boost::lexical_cast<std::string>(scopeCounter++);
+            name += ".txt";
+
+            scopeFile_.clear();
+            scopeFile_.open(name.c_str(), std::fstream::out);
+            scopeFileStart_ = block.offset;
+            scopeFileCrc_ = 0;
+        }
+
+        uint64_t first = block.offset - scopeFileStart_;
+
+        for (int i = 0; i < block.count; ++i)
+        {
+            scopeFile_ << first + i << " , " << block.samples[i];
+            if(block.millivolts)
+                scopeFile_ << " , " << block.millivolts[i];
+            scopeFile_ << "\n";
+        }
+
+        scopeFileCrc_ = crc32cCombine(scopeFileCrc_, block.crc, block.count * sizeof(int16_t));
+
+        if(block.last)
+        {
+            writeChecksumLine(scopeFile_, scopeFileCrc_);
+            scopeFile_.close();
+        }
+    }
+
+    /// last line of the text files: CRC32C of the data as received
+    void writeChecksumLine(std::fstream & file, uint32_t crc)
+    {
+        file << "# crc32c " << std::hex << std::setw(8) << std::setfill('0') << crc << std::dec << "\n";
+    }
+
+private:
+    bool stopped_;
+    bool throwOnErrors_;
+    std::string outputDirectory_; // ENDS WITH '/'
+    boost::asio::io_service & io_service_;
+    tcp::socket socket_; // CONTROL_SOCKET
+    tcp::socket socket_2; // POST_MORTEM_SOCKET
+    deadline_timer deadline_;
+    boost::asio::streambuf input_buffer_; // BUFFER FOR CONTROL_SOCKET
+    boost::asio::streambuf input_buffer_2; // BUFFER FOR POST_MORTEM_SOCKET
+    std::fstream scopeFile_; // PM-N.txt OF THE BLOCK BEING SAVED, ONLY TOUCHED BY THE PERSIST STAGE
+    uint64_t scopeFileStart_; // [samples], OFFSET OF ITS FIRST SAMPLE IN THE CHANNEL
+    uint32_t scopeFileCrc_; // CRC32C OF ITS SLICES SO FAR
+    ControlExecutor executor_; // EMPTY: THE MULTIPLEXER HAS ITS OWN THREAD
+    std::auto_ptr<ControlMultiplexer> control_; // OWNS CONTROL_SOCKET ONCE CONNECTED
+    SocketJournal * journal_; // 0 WITHOUT A JOURNAL
+    JournalTap postMortemTap_; // POST_MORTEM_SOCKET INTO 'journal_'
+    PlacementSettings * placement_; // 0 UNTIL place()
+    PlacementPlan plan_;
+    std::auto_ptr<boost::thread> postMortemThread_; // OF async_receive_post_mortem()
+
+    /// STATE OF run_parallel_operation(), ONLY TOUCHED BY THE HANDLERS
+    TimeLossSettings * tlc_;
+    PostMortemSettings * ps_;
+    int numberOfChannels_;
+    deadline_timer histogramTimer_;
+    std::auto_ptr<boost::asio::io_service::work> work_;
+    int histogramsLeft_;
+    bool histogramInFlight_;
+    bool postMortemStarted_; // the post mortem size has arrived, i.e. the trigger
+    bool postMortemPending_; // the post mortem data wait for the histogram in flight
+    int scopeSize_;
+    int scopeBlocks_;
+};
+
+void establishConnection(TCPClient * c)
+{
+    std::cout << "establishConnection started" << std::endl;
+
+    c->expect(ControlRequest("hello"), "hello"); //expecting "hello"
+    c->expect(ControlRequest("version 1.0"), "welcome"); //expecting "welcome"
+
+    std::cout << "establishConnection ended" << std::endl;
+}
+
+void connectDevice(TCPClient * c)
+{
+    std::cout << "connectDevice started" << std::endl;
+
+    c->expect(ControlRequest("function acquireDevice").arg(0), RESPONSE_OK); // expecting RESPONSE_OK
+
+    std::cout << "connectDevice ended" << std::endl;
+}
+
+void stopAcquisition(TCPClient * c)
+{
+    std::cout << "stopAcquisition started" << std::endl;
+
+    /// AHEAD OF ANY QUEUED REQUEST, E.G. THE HISTOGRAM POLLS
+    c->expect(ControlRequest("procedure stopAcquisition", CONTROL_LINE, CONTROL_URGENT).arg(0), RESPONSE_OK); // expecting RESPONSE_OK
+
+    std::cout << "stopAcquisition ended" << std::endl;
+}
+
+void disconnectDevice(TCPClient * c)
+{
+    std::cout << "disconnectDevice started" << std::endl;
+
+    c->expect(ControlRequest("procedure releaseDevice").arg(0), RESPONSE_OK); // expecting RESPONSE_OK
+
+    c->call(ControlRequest("bye", CONTROL_NO_RESPONSE));
+
+    std::cout << "disconnectDevice ended" << std::endl;
+}
+
+/// 'procedure setupPostMortem' with the arguments of 'ps'
+ControlRequest setupPostMortemRequest(PostMortemSettings * ps)
+{
+    ControlRequest request("procedure setupPostMortem");
+
+    request.arg(0) // device
+           .arg(ps->delay)
+           .arg(ps->range_A)
+           .arg(ps->range_B)
+           .arg(ps->range_C)
+           .arg(ps->range_D)
+           .arg(ps->triggerChannel) // trigger channel: A | B | C | D | EXT
+           .arg(ps->triggerThreshold) // trigger threshold: mV // EXT trigger range 0..1000 mV
+           .arg(ps->triggerDirection) // trigger direction: RISING | FALLING | RISE_FALL
+           .arg(ps->numberOfSamples)
+           .arg(ps->samplingPeriod);
+
+    return request;
+}
+
+/// 'timeLossTest' as a ControlSequence
+class TimeLossSequence : public ControlSequence
+{
+public:
+
+    TimeLossSequence(TCPClient * c, TimeLossSettings * tlc)
+        : ControlSequence("timeLossTest", c->control(), c->io_service()), c_(c), tlc_(tlc), iteration_(0)
+    {}
+
+private:
+
+    void step()
+    {
+        SEQUENCE_REENTER
+        {
+            SEQUENCE_AWAIT(setupHistogram(tlc_->threshold));
+            expect(RESPONSE_OK);
+
+            for(iteration_ = 0; iteration_ < tlc_->numberOfIterations; iteration_++)
+            {
+                // TIME LOSS HISTOGRAM, int32_t VALUES, AND RESPONSE_OK
+                SEQUENCE_AWAIT(getHistogram());
+                c_->process_histogram(response(), tlc_);
+            }
+        }
+    }
+
+private:
+    TCPClient * c_;
+    TimeLossSettings * tlc_;
+    int iteration_;
+};
+
+/// 'postMortemTest' as a ControlSequence; with 'viaTimeLossDevice' the post
+/// mortem is read from the input channels of the Time Loss device, see
+/// 'postMortemViaTimeLossDeviceTest'
+class PostMortemSequence : public ControlSequence
+{
+public:
+
+    PostMortemSequence(TCPClient * c, PostMortemSettings * ps, bool viaTimeLossDevice)
+        : ControlSequence(viaTimeLossDevice ? "postMortemViaTimeLossDeviceTest" : "postMortemTest", c->control(), c->io_service()),
+        c_(c), ps_(ps), viaTimeLossDevice_(viaTimeLossDevice), numberOfChannels_(0)
+    {
+        if(ps->range_A > 0) numberOfChannels_++;
+        if(ps->range_B > 0) numberOfChannels_++;
+        if(ps->range_C > 0) numberOfChannels_++;
+        if(ps->range_D > 0) numberOfChannels_++;
+    }
+
+private:
+
+    void step()
+    {
+        SEQUENCE_REENTER
+        {
+            if(viaTimeLossDevice_)
+            {
+                SEQUENCE_AWAIT(stopAcquisition());
+                expect(RESPONSE_OK);
+                SEQUENCE_AWAIT(request(ControlRequest("procedure setTimelossDevice").arg(0).arg(1)));
+                expect(RESPONSE_OK);
+            }
+
+            ///  POSTMORTEM SETUP
+
+            SEQUENCE_AWAIT(request(setupPostMortemRequest(ps_)));
+            expect(RESPONSE_OK);
+
+            /// NB: THE RESPONSE OF THE 'function getPostMortemData' WILL BE SENT OVER SOCKET 3894
+
+            SEQUENCE_AWAIT(armPostMortem());
+            SEQUENCE_AWAIT(waitForTrigger());
+            SEQUENCE_AWAIT(c_->async_receive_post_mortem(ps_, numberOfChannels_, resumer())); // CHANNEL DATA
+
+            if(viaTimeLossDevice_)
+            {
+                SEQUENCE_AWAIT(stopAcquisition());
+                expect(RESPONSE_OK);
+                SEQUENCE_AWAIT(request(ControlRequest("procedure setTimelossDevice").arg(0).arg(0)));
+                expect(RESPONSE_OK);
+            }
+        }
+    }
+
+    /// awaitable: sends 'getPostMortemData', no response on CONTROL_SOCKET
+    void armPostMortem()
+    {
+        request(ControlRequest("function getPostMortemData", CONTROL_NO_RESPONSE).arg(0));
+    }
+
+    /// awaitable: the status, size and blocks lines on POST_MORTEM_SOCKET, i.e. the trigger
+    void waitForTrigger()
+    {
+        c_->async_read_post_mortem_header(resumer());
+    }
+
+private:
+    TCPClient * c_;
+    PostMortemSettings * ps_;
+    bool viaTimeLossDevice_;
+    int numberOfChannels_;
+};
+
+/// runs 'sequence' on the event loop of the client until it ends
+void runSequence(TCPClient * c, ControlSequence * sequence)
+{
+    std::vector<boost::shared_ptr<ControlSequence> > sequences(1, boost::shared_ptr<ControlSequence>(sequence));
+    runSequences(c->io_service(), sequences);
+}
+
+void timeLossTest(TCPClient * c, TimeLossSettings * tlc)
+{
+    std::cout << "timeLossTest started" << std::endl;
+
+    runSequence(c, new TimeLossSequence(c, tlc));
+
+    std::cout << "timeLossTest ended" << std::endl;
+}
+
+void readTimeLossData(TCPClient * c, TimeLossSettings * tlc)
+{
+    std::cout << "readTimeLossData started" << std::endl;
+
+    sleep(1);
+
+    // TIME LOSS HISTOGRAM, int32_t VALUES, AND RESPONSE_OK
+    c->process_histogram(c->call(ControlRequest("function getHistogram", CONTROL_HISTOGRAM).arg(0)), tlc);
+
+    std::cout << "readTimeLossData ended" << std::endl;
+}
+
+void postMortemViaTimeLossDeviceTest(TCPClient * c, PostMortemSettings * ps)
+{
+    std::cout << "postMortemViaTimeLossDeviceTest started" << std::endl;
+
+    runSequence(c, new PostMortemSequence(c, ps, true));
+
+    std::cout << "postMortemViaTimeLossDeviceTest ended" << std::endl;
+}
+
+void postMortemTest(TCPClient * c, PostMortemSettings * ps)
+{
+    std::cout << "postMortemTest started" << std::endl;
+
+    runSequence(c, new PostMortemSequence(c, ps, false));
+
+    std::cout << "postMortemTest ended" << std::endl;
+}
+
+/// the steps of a sequence file, see SequenceScript.hpp; the settings start
+/// as those of main() and are changed by the 'set' steps
+class ScriptSequence : public ControlSequence
+{
+public:
+
+    ScriptSequence(TCPClient * c, const SequenceScript & script, TimeLossSettings * tlc, PostMortemSettings * ps)
+        : ControlSequence("sequence " + script.path, c->control(), c->io_service()),
+        c_(c), script_(script), tlc_(*tlc), ps_(*ps), index_(0), iteration_(0)
+    {}
+
+private:
+
+    const ScriptStep & current() const
+    {
+        return script_.steps[index_];
+    }
+
+    void step()
+    {
+        SEQUENCE_REENTER
+        {
+            for(index_ = 0; index_ < script_.steps.size(); index_++)
+            {
+                std::cout << "sequence: " << script_.path << ":" << current().line << ": " << current().text << std::endl;
+
+                if(current().operation == SCRIPT_SET)
+                    applyScriptSetting(current().name, current().value, &tlc_, &ps_); // checked by loadSequenceScript()
+                else if(current().operation == SCRIPT_SETUP_HISTOGRAM)
+                {
+                    SEQUENCE_AWAIT(setupHistogram(tlc_.threshold));
+                    expect(RESPONSE_OK);
+                }
+                else if(current().operation == SCRIPT_POLL)
+                {
+                    for(iteration_ = 0; iteration_ < current().count; iteration_++)
+                    {
+                        if(iteration_ > 0)
+                            SEQUENCE_AWAIT(sleep(current().ms));
+
+                        // TIME LOSS HISTOGRAM, int32_t VALUES, AND RESPONSE_OK
+                        SEQUENCE_AWAIT(getHistogram());
+                        c_->process_histogram(response(), &tlc_);
+                    }
+                }
+                else if(current().operation == SCRIPT_READ)
+                {
+                    SEQUENCE_AWAIT(getHistogram());
+                    c_->process_histogram(response(), &tlc_);
+                }
+                else if(current().operation == SCRIPT_SETUP_POST_MORTEM)
+                {
+                    SEQUENCE_AWAIT(request(setupPostMortemRequest(&ps_)));
+                    expect(RESPONSE_OK);
+                }
+                else if(current().operation == SCRIPT_ARM)
+                {
+                    /// NB: THE RESPONSE OF THE 'function getPostMortemData' WILL BE SENT OVER SOCKET 3894
+                    SEQUENCE_AWAIT(request(ControlRequest("function getPostMortemData", CONTROL_NO_RESPONSE).arg(0)));
+                }
+                else if(current().operation == SCRIPT_WAIT)
+                {
+                    /// THE STATUS, SIZE AND BLOCKS LINES ON POST_MORTEM_SOCKET, I.E. THE TRIGGER
+                    SEQUENCE_AWAIT(c_->async_read_post_mortem_header(resumer()));
+                    SEQUENCE_AWAIT(c_->async_receive_post_mortem(&ps_, numberOfChannels(), resumer())); // CHANNEL DATA
+                }
+                else if(current().operation == SCRIPT_STOP)
+                {
+                    SEQUENCE_AWAIT(stopAcquisition());
+                    expect(RESPONSE_OK);
+                }
+                else if(current().operation == SCRIPT_SLEEP)
+                    SEQUENCE_AWAIT(sleep(current().ms));
+                else if(current().operation == SCRIPT_SET_TIMELOSS_DEVICE)
+                {
+                    SEQUENCE_AWAIT(request(ControlRequest("procedure setTimelossDevice").arg(0).arg(current().count)));
+                    expect(RESPONSE_OK);
+                }
+            }
+        }
+    }
+
+    int numberOfChannels() const
+    {
+        int n = 0;
+        for(int channel = 0; channel < 4; channel++)
+            if(channelRange(&ps_, channel) > 0)
+                n++;
+        return n;
+    }
+
+private:
+    TCPClient * c_;
+    SequenceScript script_;
+    TimeLossSettings tlc_;
+    PostMortemSettings ps_;
+    std::size_t index_;
+    int iteration_;
+};
+
+void sequenceTest(TCPClient * c, const SequenceScript & script, TimeLossSettings * tlc, PostMortemSettings * ps)
+{
+    std::cout << "sequenceTest started" << std::endl;
+
+    runSequence(c, new ScriptSequence(c, script, tlc, ps));
+
+    std::cout << "sequenceTest ended" << std::endl;
+}
+
+void parallelOperationTest(TCPClient * c, TimeLossSettings * tlc, PostMortemSettings * ps)
+{
+    std::cout << "parallelOperationTest started" << std::endl;
+
+    /// TIME LOSS SETUP
+
+    c->expect(ControlRequest("procedure setupHistogram").arg(0).arg(tlc->threshold), RESPONSE_OK); // expecting RESPONSE_OK
+
+    /// POST MORTEM SETUP
+
+    int numberOfChannels = 0;
+
+    if(ps->range_A > 0) numberOfChannels++;
+    if(ps->range_B > 0) numberOfChannels++;
+    if(ps->range_C > 0) numberOfChannels++;
+    if(ps->range_D > 0) numberOfChannels++;
+
+    c->expect(setupPostMortemRequest(ps), RESPONSE_OK); // expecting RESPONSE_OK
+
+    /// STARTING THE OPERATION
+
+    /// SENDING 'getPostMortemData', i.e. arming the Post Mortem device.
+    /// when a trigger occurs, it will return the data over the 'POST_MORTEM_SOCKET' socket, port 3894.
+
+    c->call(ControlRequest("function getPostMortemData", CONTROL_NO_RESPONSE).arg(0));
+
+    /// running getHistogram via 'CONTROL_SOCKET', port 3893, every HISTOGRAM_PERIOD_MS
+    /// and waiting for the response from 'getPostMortemData' via 'POST_MORTEM_SOCKET', port 3894,
+    /// both from the same event loop
+    c->run_parallel_operation(tlc, ps, numberOfChannels);
+
+    std::cout << "parallelOperationTest ended" << std::endl;
+}
+
+/// the resident daemon mode: the session and the devices stay open, the time
+/// loss histograms are read every 'histogramPeriodMs' and processed as in
+/// 'timeLossTest', and local programs control the acquisition with the
+/// commands of the socket of DaemonSocket.hpp:
+///
+///   status              acquisition, period, histograms read, the last one
+///   start [threshold]   'setupHistogram' and the schedule of histograms
+///   stop                'stopAcquisition', the schedule pauses
+///   read                one histogram right now, in the reply
+///   last                the last histogram read, without a round trip
+///   period <ms>         the period of the schedule
+///   latency             the latency percentiles of every command so far, see CommandLatency.hpp
+///   quit                stops the acquisition and releases the devices
+///
+/// a sample thus costs one 'getHistogram' round trip instead of the start of
+/// a client, the connections, the handshake and 'acquireDevice' of a loop
+/// of the timelossstart / timelossread / timelossstop programs.
+class AcquisitionDaemon
+{
+public:
+
+    AcquisitionDaemon(TCPClient * c, TimeLossSettings * tlc, DaemonSettings * ds)
+        : c_(c), tlc_(tlc), ds_(ds), timer_(c->io_service()),
+        socket_(c->io_service(), ds->socketPath, boost::bind(&AcquisitionDaemon::handle_command, this, _1, _2)),
+        acquiring_(false), inFlight_(false), scheduled_(false), quitting_(false), histograms_(0)
+    {}
+
+    /// returns after 'quit'
+    void run()
+    {
+        work_.reset(new boost::asio::io_service::work(c_->io_service()));
+
+        std::cout << "daemon: listening on " << socket_.path() << std::endl;
+
+        if(ds_->startAcquisition)
+            start(tlc_->threshold, DaemonReply());
+
+        /// THE io_service MAY HAVE RUN OUT OF WORK BEFORE
+        c_->io_service().reset();
+        c_->io_service().run();
+    }
+
+    bool acquiring() const
+    {
+        return acquiring_;
+    }
+
+private:
+
+    void handle_command(const std::string & command, const DaemonReply & reply)
+    {
+        std::stringstream ss(command);
+        std::string name;
+        ss >> name;
+
+        std::cout << "daemon: command " << command << std::endl;
+
+        if(name == "status")
+            reply(status());
+        else if(name == "start")
+        {
+            double threshold = tlc_->threshold;
+            if(!(ss >> threshold))
+                threshold = tlc_->threshold;
+
+            start(threshold, reply);
+        }
+        else if(name == "stop")
+        {
+            acquiring_ = false;
+            timer_.cancel();
+
+            /// AHEAD OF A QUEUED HISTOGRAM
+            c_->submit(ControlRequest("procedure stopAcquisition", CONTROL_LINE, CONTROL_URGENT).arg(0),
+                       boost::bind(&AcquisitionDaemon::post_line, this, _1, _2, reply));
+        }
+        else if(name == "read")
+        {
+            readers_.push_back(reply);
+            request_histogram();
+        }
+        else if(name == "last")
+            reply(histograms_ > 0 ? formatHistogram(last_) : std::string("error: no histogram yet"));
+        else if(name == "period")
+        {
+            long ms = 0;
+            if(!(ss >> ms) || ms <= 0)
+            {
+                reply("error: period <ms>, ms > 0");
+                return;
+            }
+
+            ds_->histogramPeriodMs = ms;
+
+            /// THE NEXT HISTOGRAM WITH THE NEW PERIOD, UNLESS ONE IS IN FLIGHT
+            if(acquiring_ && !scheduled_)
+                schedule();
+
+            reply(RESPONSE_OK);
+        }
+        else if(name == "latency")
+            reply(commandLatencies().report(""));
+        else if(name == "quit")
+        {
+            reply(RESPONSE_OK);
+            quit();
+        }
+        else
+            reply("error: unknown command " + name);
+    }
+
+    std::string status() const
+    {
+        std::stringstream ss;
+
+        ss << (acquiring_ ? "acquiring" : "stopped") << ", period " << ds_->histogramPeriodMs << " ms, "
+           << histograms_ << " histograms";
+
+        if(histograms_ > 0)
+            ss << ", the last " << (boost::posix_time::microsec_clock::universal_time() - lastAt_).total_milliseconds()
+               << " ms ago, CRC32C " << std::hex << std::setw(8) << std::setfill('0') << last_.crc;
+
+        return ss.str();
+    }
+
+    /// "<status> <bins> <CRC32C>" and the bins on one line
+    static std::string formatHistogram(const ControlResponse & response)
+    {
+        std::stringstream ss;
+
+        ss << response.line << " " << response.histogram.size() << " "
+           << std::hex << std::setw(8) << std::setfill('0') << response.crc << std::dec << "\n";
+
+        for(std::size_t j = 0; j < response.histogram.size(); j++)
+            ss << (j > 0 ? " " : "") << response.histogram[j];
+
+        return ss.str();
+    }
+
+    void start(double threshold, const DaemonReply & reply)
+    {
+        c_->submit(ControlRequest("procedure setupHistogram").arg(0).arg(threshold),
+                   boost::bind(&AcquisitionDaemon::post_started, this, _1, _2, reply));
+    }
+
+    void quit()
+    {
+        quitting_ = true;
+        timer_.cancel();
+        socket_.close();
+
+        /// A HISTOGRAM IN FLIGHT IS COMPLETED FIRST, SEE handle_histogram()
+        if(!inFlight_)
+            work_.reset();
+    }
+
+    /// THE SCHEDULE: timer -> request through the multiplexer -> response posted back -> timer ...
+
+    void schedule()
+    {
+        timer_.expires_from_now(boost::posix_time::milliseconds(ds_->histogramPeriodMs));
+        timer_.async_wait(boost::bind(&AcquisitionDaemon::handle_timer, this, boost::asio::placeholders::error));
+    }
+
+    void handle_timer(const boost::system::error_code & ec)
+    {
+        /// CANCELLED BY 'stop', 'period' OR 'quit'
+        if(ec == boost::asio::error::operation_aborted || !acquiring_ || quitting_)
+            return;
+
+        scheduled_ = true;
+        request_histogram();
+    }
+
+    /// one 'getHistogram' serves the schedule and every 'read' waiting for it
+    void request_histogram()
+    {
+        if(inFlight_)
+            return;
+
+        inFlight_ = true;
+        c_->submit(ControlRequest("function getHistogram", CONTROL_HISTOGRAM).arg(0),
+                   boost::bind(&AcquisitionDaemon::post_histogram, this, _1, _2));
+    }
+
+    /// called by the thread of the multiplexer: the responses are handled in the event loop
+
+    void post_histogram(const ControlResponse & response, const std::string & error)
+    {
+        c_->io_service().post(boost::bind(&AcquisitionDaemon::handle_histogram, this, response, error));
+    }
+
+    void post_started(const ControlResponse & response, const std::string & error, DaemonReply reply)
+    {
+        c_->io_service().post(boost::bind(&AcquisitionDaemon::handle_started, this, response, error, reply));
+    }
+
+    void post_line(const ControlResponse & response, const std::string & error, DaemonReply reply)
+    {
+        c_->io_service().post(boost::bind(&AcquisitionDaemon::handle_line, this, response, error, reply));
+    }
+
+    void handle_histogram(const ControlResponse & response, const std::string & error)
+    {
+        /// THE CONTROL SOCKET IS LOST, SEE ControlMultiplexer
+        if(!error.empty())
+            throw std::runtime_error("daemon: " + error);
+
+        inFlight_ = false;
+
+        std::string reply;
+
+        /// E.G. NO HISTOGRAM SET UP: REPORTED, THE DAEMON GOES ON
+        if(response.line.find(RESPONSE_OK) == std::string::npos)
+        {
+            std::cout << "daemon: getHistogram failed: " << response.line << std::endl;
+            reply = "error: getHistogram failed: " + response.line;
+        }
+        else
+        {
+            c_->process_histogram(response, tlc_);
+
+            last_ = response;
+            lastAt_ = boost::posix_time::microsec_clock::universal_time();
+            histograms_++;
+            reply = formatHistogram(response);
+        }
 
-        for (int i = 0; i < data->size(); ++i)
+        for(std::size_t i = 0; i < readers_.size(); i++)
+            readers_[i](reply);
+        readers_.clear();
+
+        if(scheduled_)
         {
-            myfile << i << " , " << data->at(i) << "\n";
+            scheduled_ = false;
+            if(acquiring_ && !quitting_)
+                schedule();
+        }
+
+        if(quitting_)
+            work_.reset();
+    }
+
+    void handle_started(const ControlResponse & response, const std::string & error, DaemonReply reply)
+    {
+        if(!error.empty())
+            throw std::runtime_error("daemon: " + error);
+
+        if(response.line.find(RESPONSE_OK) != std::string::npos && !quitting_)
+        {
+            acquiring_ = true;
+
+            if(!scheduled_)
+                schedule();
+        }
+
+        std::cout << "daemon: setupHistogram: " << response.line << std::endl;
+
+        if(reply)
+            reply(response.line);
+    }
+
+    void handle_line(const ControlResponse & response, const std::string & error, DaemonReply reply)
+    {
+        if(!error.empty())
+            throw std::runtime_error("daemon: " + error);
+
+        reply(response.line);
+    }
+
+private:
+    TCPClient * c_;
+    TimeLossSettings * tlc_;
+    DaemonSettings * ds_;
+    deadline_timer timer_;
+    DaemonSocket socket_;
+    std::auto_ptr<boost::asio::io_service::work> work_;
+    std::vector<DaemonReply> readers_; // 'read' commands waiting for the histogram in flight
+    bool acquiring_;
+    bool inFlight_;
+    bool scheduled_; // the histogram in flight is one of the schedule
+    bool quitting_;
+    uint64_t histograms_;
+    ControlResponse last_;
+    boost::posix_time::ptime lastAt_;
+};
+
+void daemonMode(TCPClient * c, TimeLossSettings * tlc, DaemonSettings * ds)
+{
+    std::cout << "daemonMode started" << std::endl;
+
+    AcquisitionDaemon daemon(c, tlc, ds);
+    daemon.run();
+
+    if(daemon.acquiring())
+        stopAcquisition(c);
+
+    std::cout << "daemonMode ended" << std::endl;
+}
+
+/// runs 'f' on the threads of 'io_service'; the ControlExecutor of the
+/// clients of a DeviceManager
+void postToService(boost::asio::io_service * io_service, const boost::function<void ()> & f)
+{
+    io_service->post(f);
+}
+
+/// what a DeviceManager reports for every device
+struct DeviceStats
+{
+    std::string state; // connecting | acquiring | closing | closed | failed
+    std::string error; // why it failed
+    uint64_t histograms;
+    uint64_t failures; // histograms with an error status
+    uint64_t bytes; // histogram data received
+    uint64_t deferred; // histograms which had to wait for a slot of the TransferBudget
+    double lastRoundTripMs;
+    double maxRoundTripMs;
+    double totalRoundTripMs;
+};
+
+/// one ROSY unit of a DeviceManager: its own TCPClient, schedule of time
+/// loss histograms and output directory. the handlers of a device run on
+/// its strand of the shared io_service, i.e. one at a time; what blocks
+/// (connecting, releasing the devices) and every request run in a slot of
+/// the TransferBudget.
+class DeviceSession
+{
+public:
+
+    DeviceSession(const std::string & host, boost::asio::io_service & io_service, TransferBudget & budget,
+                  TimeLossSettings * tlc, DeviceManagerSettings * ms, boost::function<void ()> done)
+        : host_(host), io_service_(io_service), budget_(budget), tlc_(tlc), ms_(ms), done_(done),
+        strand_(io_service), timer_(io_service), client_(io_service, boost::bind(&postToService, &io_service, _1)),
+        stopping_(false), busy_(false)
+    {
+        stats_.state = "connecting";
+        stats_.histograms = stats_.failures = stats_.bytes = stats_.deferred = 0;
+        stats_.lastRoundTripMs = stats_.maxRoundTripMs = stats_.totalRoundTripMs = 0;
+
+        client_.throwOnErrors();
+
+        if(ms->directoryPerDevice)
+        {
+            ::mkdir(host.c_str(), 0755);
+            client_.setOutputDirectory(host);
+        }
+    }
+
+    const std::string & host() const
+    {
+        return host_;
+    }
+
+    DeviceStats stats()
+    {
+        boost::lock_guard<boost::mutex> lock(statsMutex_);
+        return stats_;
+    }
+
+    /// connects when a slot is free, then follows the schedule
+    void begin()
+    {
+        busy_ = true;
+        budget_.acquire(strand_.wrap(boost::bind(&DeviceSession::open, this)));
+    }
+
+    /// ends the schedule and releases the device, from any thread
+    void stop()
+    {
+        strand_.post(boost::bind(&DeviceSession::handle_stop, this));
+    }
+
+private:
+
+    void open()
+    {
+        try
+        {
+            tcp::resolver r(io_service_);
+
+            client_.start(r.resolve(tcp::resolver::query(host_, "3893")), CONTROL_SOCKET);
+            establishConnection(&client_);
+            client_.start(r.resolve(tcp::resolver::query(host_, "3894")), POST_MORTEM_SOCKET);
+            connectDevice(&client_);
+            client_.expect(ControlRequest("procedure setupHistogram").arg(0).arg(tlc_->threshold), RESPONSE_OK);
+        }
+        catch(std::exception & e)
+        {
+            budget_.release();
+            failed(e.what());
+            return;
+        }
+
+        budget_.release();
+        busy_ = false;
+        setState("acquiring");
+
+        if(stopping_)
+            finish();
+        else
+            schedule();
+    }
+
+    void schedule()
+    {
+        timer_.expires_from_now(boost::posix_time::milliseconds(ms_->histogramPeriodMs));
+        timer_.async_wait(strand_.wrap(boost::bind(&DeviceSession::handle_timer, this, boost::asio::placeholders::error)));
+    }
+
+    void handle_timer(const boost::system::error_code & ec)
+    {
+        /// CANCELLED BY stop()
+        if(ec == boost::asio::error::operation_aborted || stopping_)
+            return;
+
+        busy_ = true;
+
+        if(budget_.acquire(strand_.wrap(boost::bind(&DeviceSession::poll, this))))
+        {
+            boost::lock_guard<boost::mutex> lock(statsMutex_);
+            stats_.deferred++;
+        }
+    }
+
+    void poll()
+    {
+        if(stopping_)
+        {
+            budget_.release();
+            finish();
+            return;
+        }
+
+        sentAt_ = boost::posix_time::microsec_clock::universal_time();
+        client_.submit(ControlRequest("function getHistogram", CONTROL_HISTOGRAM).arg(0),
+                       boost::bind(&DeviceSession::post_histogram, this, _1, _2));
+    }
+
+    /// called by the drain of the multiplexer: the response is handled on the strand
+    void post_histogram(const ControlResponse & response, const std::string & error)
+    {
+        strand_.post(boost::bind(&DeviceSession::handle_histogram, this, response, error));
+    }
+
+    void handle_histogram(const ControlResponse & response, const std::string & error)
+    {
+        budget_.release();
+        busy_ = false;
+
+        if(!error.empty())
+        {
+            failed(error);
+            return;
+        }
+
+        double ms = (boost::posix_time::microsec_clock::universal_time() - sentAt_).total_microseconds() / 1000.0;
+        bool ok = response.line.find(RESPONSE_OK) != std::string::npos;
+
+        if(ok)
+            client_.process_histogram(response, tlc_);
+
+        {
+            boost::lock_guard<boost::mutex> lock(statsMutex_);
+
+            if(ok)
+            {
+                stats_.histograms++;
+                stats_.bytes += response.histogram.size() * sizeof(int32_t);
+            }
+            else
+                stats_.failures++;
+
+            stats_.lastRoundTripMs = ms;
+            stats_.maxRoundTripMs = std::max(stats_.maxRoundTripMs, ms);
+            stats_.totalRoundTripMs += ms;
+        }
+
+        if(stopping_ || (ms_->histogramsPerDevice > 0 && stats().histograms >= (uint64_t)ms_->histogramsPerDevice))
+            finish();
+        else
+            schedule();
+    }
+
+    void handle_stop()
+    {
+        if(stopping_)
+            return;
+
+        stopping_ = true;
+        timer_.cancel();
+
+        /// ELSE open() OR handle_histogram() FINISHES, poll() IF IT WAITS FOR A SLOT
+        if(!busy_ && stats().state == "acquiring")
+            finish();
+    }
+
+    void finish()
+    {
+        stopping_ = true;
+        busy_ = true;
+        setState("closing");
+        budget_.acquire(strand_.wrap(boost::bind(&DeviceSession::close, this)));
+    }
+
+    void close()
+    {
+        try
+        {
+            stopAcquisition(&client_);
+            disconnectDevice(&client_);
+        }
+        catch(std::exception & e)
+        {
+            budget_.release();
+            failed(e.what());
+            return;
+        }
+
+        client_.stop();
+        budget_.release();
+        setState("closed");
+        done_();
+    }
+
+    void failed(const std::string & error)
+    {
+        std::cout << "DeviceManager: " << host_ << " failed: " << error << std::endl;
+
+        client_.stop();
+
+        {
+            boost::lock_guard<boost::mutex> lock(statsMutex_);
+            stats_.state = "failed";
+            stats_.error = error;
+        }
+
+        done_();
+    }
+
+    void setState(const std::string & state)
+    {
+        boost::lock_guard<boost::mutex> lock(statsMutex_);
+        stats_.state = state;
+    }
+
+private:
+    std::string host_;
+    boost::asio::io_service & io_service_;
+    TransferBudget & budget_;
+    TimeLossSettings * tlc_;
+    DeviceManagerSettings * ms_;
+    boost::function<void ()> done_;
+    boost::asio::io_service::strand strand_;
+    deadline_timer timer_;
+    TCPClient client_;
+    bool stopping_;
+    bool busy_; // connecting, waiting for a slot, a histogram in flight or closing
+    boost::posix_time::ptime sentAt_;
+    boost::mutex statsMutex_; // stats_ is read by the reports from any thread
+    DeviceStats stats_;
+};
+
+/// many ROSY units from one process: a DeviceSession per host on one
+/// io_service, run by a few threads. the threads do not grow with the
+/// devices: an idle device is a timer, its multiplexer has no thread of its
+/// own, and the TransferBudget bounds the transfers in flight. SIGINT or
+/// SIGTERM release every device before the end.
+class DeviceManager
+{
+public:
+
+    DeviceManager(TimeLossSettings * tlc, DeviceManagerSettings * ms)
+        : tlc_(tlc), ms_(ms), work_(new boost::asio::io_service::work(io_service_)),
+        budget_(io_service_, ms->maxTransfers), signals_(io_service_, SIGINT, SIGTERM), statsTimer_(io_service_),
+        running_(0)
+    {}
+
+    ~DeviceManager()
+    {
+        for(std::size_t i = 0; i < sessions_.size(); i++)
+            delete sessions_[i];
+    }
+
+    /// returns when every device is closed or has failed
+    void run()
+    {
+        for(std::size_t i = 0; i < ms_->hosts.size(); i++)
+            sessions_.push_back(new DeviceSession(ms_->hosts[i], io_service_, budget_, tlc_, ms_,
+                                                  boost::bind(&DeviceManager::session_done, this)));
+
+        running_ = (int)sessions_.size();
+
+        signals_.async_wait(boost::bind(&DeviceManager::handle_signal, this, boost::asio::placeholders::error));
+        if(ms_->statsPeriodMs > 0)
+            schedule_stats();
+
+        /// THE BLOCKING PARTS OF THE SESSIONS HOLD A THREAD EACH, ONE MORE KEEPS THE REST GOING
+        int threads = (ms_->threads > 0) ? ms_->threads : budget_.slots() + 1;
+        std::cout << "DeviceManager: " << sessions_.size() << " devices, " << threads << " threads, "
+                  << budget_.slots() << " transfers in flight at most" << std::endl;
+
+        for(int t = 0; t < threads; t++)
+            threads_.create_thread(boost::bind(&DeviceManager::worker, this));
+
+        for(std::size_t i = 0; i < sessions_.size(); i++)
+            sessions_[i]->begin();
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while(running_ > 0)
+                finished_.wait(lock);
+        }
+
+        boost::system::error_code ec;
+        signals_.cancel(ec);
+        statsTimer_.cancel();
+        work_.reset();
+        threads_.join_all();
+
+        printStats();
+    }
+
+private:
+
+    void worker()
+    {
+        for(;;)
+        {
+            try
+            {
+                io_service_.run();
+                return;
+            }
+            catch(std::exception & e)
+            {
+                std::cerr << "DeviceManager: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    void session_done()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if(--running_ == 0)
+            finished_.notify_all();
+    }
+
+    void handle_signal(const boost::system::error_code & ec)
+    {
+        if(ec)
+            return;
+
+        std::cout << "DeviceManager: stopping every device" << std::endl;
+
+        for(std::size_t i = 0; i < sessions_.size(); i++)
+            sessions_[i]->stop();
+    }
+
+    void schedule_stats()
+    {
+        statsTimer_.expires_from_now(boost::posix_time::milliseconds(ms_->statsPeriodMs));
+        statsTimer_.async_wait(boost::bind(&DeviceManager::handle_stats_timer, this, boost::asio::placeholders::error));
+    }
+
+    void handle_stats_timer(const boost::system::error_code & ec)
+    {
+        if(ec)
+            return;
+
+        printStats();
+        schedule_stats();
+    }
+
+    /// one line per device and the totals
+    void printStats()
+    {
+        DeviceStats total = DeviceStats();
+        int acquiring = 0;
+
+        std::cout << "DeviceManager: device          state       histograms  failures  deferred"
+                  << "  RTT last / mean / max [ms]" << std::endl;
+
+        for(std::size_t i = 0; i < sessions_.size(); i++)
+        {
+            DeviceStats s = sessions_[i]->stats();
+
+            std::cout << "DeviceManager: " << std::left << std::setw(16) << sessions_[i]->host() << std::setw(12) << s.state
+                      << std::right << std::setw(10) << s.histograms << std::setw(10) << s.failures
+                      << std::setw(10) << s.deferred << std::fixed << std::setprecision(2)
+                      << "  " << s.lastRoundTripMs << " / "
+                      << (s.histograms + s.failures > 0 ? s.totalRoundTripMs / (s.histograms + s.failures) : 0.0)
+                      << " / " << s.maxRoundTripMs << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+
+            if(!s.error.empty())
+                std::cout << "DeviceManager: \t " << s.error << std::endl;
+
+            total.histograms += s.histograms;
+            total.failures += s.failures;
+            total.bytes += s.bytes;
+            total.deferred += s.deferred;
+            acquiring += (s.state == "acquiring");
+        }
+
+        std::cout << "DeviceManager: total: " << acquiring << " of " << sessions_.size() << " devices acquiring, "
+                  << total.histograms << " histograms (" << total.bytes << " bytes), " << total.failures << " failures, "
+                  << total.deferred << " deferred, " << budget_.inFlight() << " transfers in flight, "
+                  << budget_.waiting() << " waiting" << std::endl;
+
+        commandLatencies().report(std::cout, "DeviceManager: ");
+    }
+
+private:
+    TimeLossSettings * tlc_;
+    DeviceManagerSettings * ms_;
+    boost::asio::io_service io_service_;
+    std::auto_ptr<boost::asio::io_service::work> work_;
+    TransferBudget budget_;
+    boost::asio::signal_set signals_;
+    deadline_timer statsTimer_;
+    boost::thread_group threads_;
+    std::vector<DeviceSession *> sessions_;
+    boost::mutex mutex_;
+    boost::condition_variable finished_;
+    int running_; // sessions neither closed nor failed
+};
+
+void multiDeviceTest(TimeLossSettings * tlc, DeviceManagerSettings * ms)
+{
+    std::cout << "multiDeviceTest started" << std::endl;
+
+    DeviceManager manager(tlc, ms);
+    manager.run();
+
+    std::cout << "multiDeviceTest ended" << std::endl;
+}
+
+/// the benchmark suite of the acquisition paths; every case runs against
+/// a RosySimulator of its own on the loopback interface, so the numbers
+/// are those of the client and can be compared from build to build:
+///
+///   histogram_poll/bins=<n>              'getHistogram' round trips, histograms and MB per second
+///   post_mortem/channels=<c>/blocks=<b>  trigger to data received, nothing saved nor analysed
+///   setup_to_armed                       'setupPostMortem' sent to 'getPostMortemData' sent,
+///                                        over every post mortem of the suite
+///   save/format=<format>                 trigger to capture saved, in every SAVE_FORMAT
+///
+/// the trigger is the arrival of the status line on POST_MORTEM_SOCKET; the
+/// saved captures are in the page cache, as in the other modes. the results
+/// are written as JSON, see Benchmark.hpp.
+class AcquisitionBenchmark
+{
+public:
+
+    AcquisitionBenchmark(TimeLossSettings * tlc, PostMortemSettings * ps, BenchmarkSettings * bs)
+        : tlc_(*tlc), ps_(*ps), bs_(bs)
+    {
+        tlc_.saveToFile = false;
+        tlc_.printSomeData = false;
+
+        ps_.printSomeData = false;
+        ps_.convertToMillivolts = false;
+        ps_.computeEnvelope = false;
+        ps_.findEdges = false;
+        ps_.computeSpectrum = false;
+        ps_.numberOfSamples = bs->samplesPerChannel;
+    }
+
+    /// runs every case and writes the results; returns the number of
+    /// regressions against the baseline, 0 without one
+    int run()
+    {
+        ::mkdir(bs_->outputDirectory.c_str(), 0755);
+
+        run_.date = benchmarkDate();
+        run_.build = benchmarkBuild();
+        run_.settings.push_back(std::make_pair(std::string("histogramPolls"), (double)bs_->histogramPolls));
+        run_.settings.push_back(std::make_pair(std::string("samplesPerChannel"), (double)bs_->samplesPerChannel));
+        run_.settings.push_back(std::make_pair(std::string("repetitions"), (double)bs_->repetitions));
+        run_.settings.push_back(std::make_pair(std::string("triggerDelayMs"), (double)bs_->triggerDelayMs));
+
+        for(std::size_t i = 0; i < bs_->histogramBins.size(); i++)
+            add(histogramPoll(bs_->histogramBins[i]));
+
+        for(int channels = 1; channels <= bs_->maxChannels && channels <= 4; channels++)
+        {
+            for(std::size_t i = 0; i < bs_->blockCounts.size(); i++)
+            {
+                std::stringstream name;
+                name << "post_mortem/channels=" << channels << "/blocks=" << bs_->blockCounts[i];
+
+                PostMortemSettings ps = withChannels(channels);
+                ps.saveToFile = false;
+                add(postMortem(ps, bs_->blockCounts[i], name.str(), "trigger_to_received"));
+            }
+        }
+
+        static const char * formats[] = { "TEXT", "BINARY", "MAPPED", "CHUNKED" };
+        static const char * codecs[] = { "NONE", "DELTA", "RICE" };
+
+        for(int format = SAVE_TEXT; format <= SAVE_CHUNKED; format++)
+        {
+            for(int codec = CODEC_NONE; codec <= (format == SAVE_CHUNKED ? CODEC_RICE : CODEC_NONE); codec++)
+            {
+                std::string name = std::string("save/format=") + formats[format];
+                if(format == SAVE_CHUNKED)
+                    name += std::string("/codec=") + codecs[codec];
+
+                PostMortemSettings ps = withChannels(bs_->saveChannels);
+                ps.saveToFile = true;
+                ps.saveFormat = (SAVE_FORMAT)format;
+                ps.chunkCodec = (CHUNK_CODEC)codec;
+                add(postMortem(ps, standIn().postMortemBlocks, name, "trigger_to_disk"));
+
+                removeBenchmarkFiles(bs_->outputDirectory);
+            }
+        }
+
+        add(BenchmarkResult("setup_to_armed").latency("latency", armed_));
+
+        writeBenchmarkRun(bs_->resultsPath, run_);
+        std::cout << "benchmark: " << run_.results.size() << " cases, results saved to " << bs_->resultsPath << std::endl;
+
+        if(bs_->baselinePath.empty())
+            return 0;
+
+        return compareBenchmarks(run_, readBenchmarkRun(bs_->baselinePath), bs_->tolerance);
+    }
+
+private:
+
+    /// the simulated ROSY of a case
+    SimulatorSettings standIn() const
+    {
+        SimulatorSettings s = defaultSimulatorSettings();
+
+        s.address = "127.0.0.1";
+        s.controlPort = bs_->port;
+        s.postMortemPort = bs_->port + 1;
+        s.triggerDelayMs = bs_->triggerDelayMs;
+        return s;
+    }
+
+    /// the sockets, the handshake and 'acquireDevice', as in main()
+    void open(TCPClient * c, tcp::resolver & r)
+    {
+        c->throwOnErrors();
+        c->setOutputDirectory(bs_->outputDirectory);
+
+        c->start(r.resolve(tcp::resolver::query("127.0.0.1", boost::lexical_cast<std::string>(bs_->port))), CONTROL_SOCKET);
+        establishConnection(c);
+        c->start(r.resolve(tcp::resolver::query("127.0.0.1", boost::lexical_cast<std::string>(bs_->port + 1))), POST_MORTEM_SOCKET);
+        connectDevice(c);
+    }
+
+    PostMortemSettings withChannels(int channels) const
+    {
+        PostMortemSettings ps = ps_;
+
+        ps.range_A = (channels > 0) ? RANGE_1_V : DISABLE_CHANNEL;
+        ps.range_B = (channels > 1) ? RANGE_1_V : DISABLE_CHANNEL;
+        ps.range_C = (channels > 2) ? RANGE_1_V : DISABLE_CHANNEL;
+        ps.range_D = (channels > 3) ? RANGE_1_V : DISABLE_CHANNEL;
+        return ps;
+    }
+
+    BenchmarkResult histogramPoll(int bins)
+    {
+        std::stringstream name;
+        name << "histogram_poll/bins=" << bins;
+
+        SimulatorSettings s = standIn();
+        s.histogramBins = bins;
+
+        RosySimulator device(s);
+        device.start();
+
+        boost::asio::io_service io_service;
+        tcp::resolver r(io_service);
+        TCPClient c(io_service);
+        open(&c, r);
+
+        c.expect(ControlRequest("procedure setupHistogram").arg(0).arg(tlc_.threshold), RESPONSE_OK);
+
+        LatencySamples latency;
+        uint64_t bytes = 0;
+        BenchmarkClock::time_point start = BenchmarkClock::now();
+
+        for(int i = 0; i < bs_->histogramPolls; i++)
+        {
+            BenchmarkClock::time_point sent = BenchmarkClock::now();
+            ControlResponse response = c.call(ControlRequest("function getHistogram", CONTROL_HISTOGRAM).arg(0));
+            latency.add(elapsedUs(sent, BenchmarkClock::now()));
+
+            c.process_histogram(response, &tlc_);
+            bytes += response.histogram.size() * sizeof(int32_t);
         }
 
-        myfile.close();
-    }
+        double seconds = elapsedUs(start, BenchmarkClock::now()) * 1E-6;
 
+        stopAcquisition(&c);
+        disconnectDevice(&c);
 
-private:
-    bool stopped_;
-    tcp::socket socket_; // CONTROL_SOCKET
-    tcp::socket socket_2; // POST_MORTEM_SOCKET
-    deadline_timer deadline_;
-    boost::asio::streambuf input_buffer_; // BUFFER FOR CONTROL_SOCKET
-    boost::asio::streambuf input_buffer_2; // BUFFER FOR POST_MORTEM_SOCKET
-    std::vector<int32_t> * timeLossData;
-    std::vector<int16_t> * scopeData;
-};
+        return BenchmarkResult(name.str())
+               .latency("latency", latency)
+               .metric("histograms_per_s", latency.count() / seconds)
+               .metric("mb_per_s", bytes / seconds / 1E6);
+    }
 
-void establishConnection(TCPClient * c)
-{
-    std::cout << "establishConnection started" << std::endl;
+    /// 'repetitions' post mortems of 'ps', announced in 'blocks' blocks per channel
+    BenchmarkResult postMortem(PostMortemSettings ps, int blocks, const std::string & name, const std::string & latencyName)
+    {
+        SimulatorSettings s = standIn();
+        s.postMortemBlocks = blocks;
 
-    c->send("hello\n");
-    c->blocking_read("hello"); //expecting "hello"
+        RosySimulator device(s);
+        device.start();
 
-    c->send("version 1.0\n");
-    c->blocking_read("welcome"); //expecting "welcome"
+        boost::asio::io_service io_service;
+        tcp::resolver r(io_service);
+        TCPClient c(io_service);
+        open(&c, r);
 
-    std::cout << "establishConnection ended" << std::endl;
-}
+        int numberOfChannels = 0;
+        for(int channel = 0; channel < 4; channel++)
+            if(channelRange(&ps, channel) > 0)
+                numberOfChannels++;
 
-void connectDevice(TCPClient * c)
-{
-    std::cout << "connectDevice started" << std::endl;
+        LatencySamples latency;
+        uint64_t bytes = 0;
+        double seconds = 0;
 
-    c->send("function acquireDevice\n");
-    c->send("0\n");
-    c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
+        for(int i = 0; i < bs_->repetitions; i++)
+        {
+            BenchmarkClock::time_point setup = BenchmarkClock::now();
+            c.expect(setupPostMortemRequest(&ps), RESPONSE_OK);
+            c.call(ControlRequest("function getPostMortemData", CONTROL_NO_RESPONSE).arg(0));
+            armed_.add(elapsedUs(setup, BenchmarkClock::now()));
+
+            /// THE STATUS LINE ARRIVES WITH THE TRIGGER, THE SIZE AND BLOCKS LINES RIGHT AFTER IT
+            c.blocking_read_scope(1);
+            BenchmarkClock::time_point trigger = BenchmarkClock::now();
+
+            int size = c.blocking_read_scope_size();
+            int numberOfBlocks = c.blocking_read_scope_size();
+            c.blocking_read_scope_data(size / numberOfBlocks, numberOfBlocks, numberOfChannels, &ps);
+
+            double us = elapsedUs(trigger, BenchmarkClock::now());
+            latency.add(us);
+            seconds += us * 1E-6;
+            bytes += (uint64_t)size * numberOfChannels;
+        }
 
-    std::cout << "connectDevice ended" << std::endl;
-}
+        stopAcquisition(&c);
+        disconnectDevice(&c);
 
-void stopAcquisition(TCPClient * c)
-{
-    std::cout << "stopAcquisition started" << std::endl;
+        return BenchmarkResult(name)
+               .latency(latencyName, latency, "ms")
+               .metric("mb_per_s", bytes / seconds / 1E6);
+    }
 
-    c->send("procedure stopAcquisition\n");
-    c->send("0\n");
-    c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
+    void add(const BenchmarkResult & result)
+    {
+        run_.results.push_back(result);
 
-    std::cout << "stopAcquisition ended" << std::endl;
-}
+        std::cout << "benchmark: " << result.name;
+        for(std::size_t i = 0; i < result.metrics.size(); i++)
+            if(result.metrics[i].first.find("_p50_") != std::string::npos || result.metrics[i].first.find("_per_s") != std::string::npos)
+                std::cout << ", " << result.metrics[i].first << " " << result.metrics[i].second;
+        std::cout << std::endl;
+    }
 
-void disconnectDevice(TCPClient * c)
-{
-    std::cout << "disconnectDevice started" << std::endl;
+private:
+    TimeLossSettings tlc_;
+    PostMortemSettings ps_;
+    BenchmarkSettings * bs_;
+    BenchmarkRun run_;
+    LatencySamples armed_; // of every post mortem of the suite
+};
 
-    c->send("procedure releaseDevice\n");
-    c->send("0\n");
-    c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
+/// the benchmark suite; returns the number of regressions against the baseline
+int benchmarkTest(TimeLossSettings * tlc, PostMortemSettings * ps, BenchmarkSettings * bs)
+{
+    std::cout << "benchmarkTest started" << std::endl;
 
-    c->send("bye\n");
+    AcquisitionBenchmark benchmark(tlc, ps, bs);
+    int regressions = benchmark.run();
 
-    std::cout << "disconnectDevice ended" << std::endl;
+    std::cout << "benchmarkTest ended" << std::endl;
+    return regressions;
 }
 
-void timeLossTest(TCPClient * c, TimeLossSettings * tlc)
+void printCaptureInfo(const std::string & path)
 {
-    std::cout << "timeLossTest started" << std::endl;
+    CaptureReader capture(path, false);
+    const CaptureFileHeader & h = capture.header();
 
-    std::string thresholdStr;
-
-    try
+    time_t seconds = h.timestampNs / 1000000000ULL;
+    struct tm timestamp;
+    gmtime_r(&seconds, &timestamp);
+
+    char timeStr[32];
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &timestamp);
+
+    std::cout << "capture file      : " << path << std::endl;
+    std::cout << "format version    : " << h.version << std::endl;
+    std::cout << "timestamp (UTC)   : " << timeStr << "." << std::setw(9) << std::setfill('0')
+              << (h.timestampNs % 1000000000ULL) << std::setfill(' ') << std::endl;
+    std::cout << "complete          : " << (capture.complete() ? "yes" : "no") << " ("
+              << h.blocksCompleted << " of " << h.numberOfBlocks * h.numberOfChannels << " blocks)" << std::endl;
+    if(capture.hasChecksums())
     {
-        thresholdStr = boost::lexical_cast<std::string>(tlc->threshold);
-        thresholdStr += "\n";
+        int64_t corrupt = capture.corruptBlock();
+        std::cout << "checksums         : " << (corrupt < 0 ? "ok" : corruptBlockMessage(h, corrupt) + " the capture")
+                  << " (CRC32C, " << crc32cKernelName() << ")" << std::endl;
     }
-    catch( boost::bad_lexical_cast const& )
+    else
     {
-        std::cout << "timeLossTest: error -- input threshold was not valid" << std::endl;
-        exit(1);
+        std::cout << "checksums         : none" << std::endl;
     }
+    std::cout << "samples / channel : " << capture.samplesPerChannel()
+              << " in " << h.numberOfBlocks << " blocks of " << h.blockBytes << " bytes" << std::endl;
+    std::cout << "sampling period   : " << h.effectiveSamplingPeriod << " s (requested " << h.samplingPeriod << ")" << std::endl;
+    std::cout << "delay             : " << h.delay << " samples" << std::endl;
+    std::cout << "trigger           : " << h.triggerChannel << " " << h.triggerDirection
+              << " " << h.triggerThreshold << " mV" << std::endl;
+
+    for(int i = 0; i < capture.numberOfChannels(); i++)
+        std::cout << "channel " << i << "         : " << capture.channelName(i)
+                  << ", range " << capture.channelRange(i) << std::endl;
+}
+
+void convertCaptureToMillivolts(const std::string & path)
+{
+    CaptureReader capture(path);
+
+    const uint64_t chunk = 1 << 20; // [samples]
+    std::vector<float> millivolts(chunk);
 
-    c->send("procedure setupHistogram\n");
-    c->send("0\n");
-    c->send(thresholdStr);
-    c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
+    std::cout << "converting " << path << " to mV, " << convertKernelName() << " kernel" << std::endl;
 
-    for(int i = 0; i < tlc->numberOfIterations; i++)
+    for(int i = 0; i < capture.numberOfChannels(); i++)
     {
-        sleep(0);
+        std::string name = path + "_" + capture.channelName(i) + ".f32";
+        std::fstream out(name.c_str(), std::fstream::out | std::fstream::binary);
 
-        c->send("function getHistogram\n");
-        c->send("0\n");
+        const int16_t * samples = capture.channel(i);
+        uint64_t total = capture.samplesPerChannel();
 
-        int size = c->blocking_read_size(); // SIZE OF HISTOGRAM
-        c->blocking_read_timeloss_data(size, tlc->printSomeData, tlc->saveToFile); // TIME LOSS HISTOGRAM, int32_t VALUES
-        c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
-        std::cout << "\n\n\t * * * Histogram length is " << (int)(size/4.0) << " bins, time interval " << 1.6*(size/4.0) << " ns" << std::endl;
-    }
+        for(uint64_t done = 0; done < total; done += chunk)
+        {
+            uint64_t n = std::min(chunk, total - done);
+            convertToMillivolts(samples + done, &millivolts[0], n, capture.channelRange(i));
+            out.write(reinterpret_cast<const char *>(&millivolts[0]), n * sizeof(float));
+        }
 
-    std::cout << "timeLossTest ended" << std::endl;
+        out.close();
+        std::cout << "channel " << capture.channelName(i) << " : " << total << " samples saved to " << name << std::endl;
+    }
 }
 
-void readTimeLossData(TCPClient * c, TimeLossSettings * tlc)
+void buildCaptureEnvelope(const std::string & path)
 {
-    std::cout << "readTimeLossData started" << std::endl;
-
-    sleep(1);
+    CaptureReader capture(path);
+    std::vector<EnvelopeBuilder> envelopes(capture.numberOfChannels());
 
-    c->send("function getHistogram\n");
-    c->send("0\n");
+    for(int i = 0; i < capture.numberOfChannels(); i++)
+        envelopes[i].append(capture.channel(i), capture.samplesPerChannel());
 
-    int size = c->blocking_read_size(); // SIZE OF HISTOGRAM
-    c->blocking_read_timeloss_data(size, tlc->printSomeData, tlc->saveToFile); // TIME LOSS HISTOGRAM, int32_t VALUES
-    c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
+    std::string name = path.substr(0, path.rfind(".bin")) + ".env";
+    saveEnvelope(name, capture.header(), envelopes);
 
-    std::cout << "\n\n\t * * * Histogram length is " << (int)(size/4.0) << " bins, time interval " << 1.6*(size/4.0) << " ns" << std::endl;
-    std::cout << "readTimeLossData ended" << std::endl;
+    std::cout << "envelope of " << path << " saved to " << name << std::endl;
 }
 
-void postMortemViaTimeLossDeviceTest(TCPClient * c, PostMortemSettings * ps)
+void printEnvelopePreview(const std::string & path)
 {
-    stopAcquisition(c);
+    EnvelopeReader envelope(path);
+    const EnvelopeFileHeader & h = envelope.header();
 
-    std::cout << "postMortemViaTimeLossDeviceTest started" << std::endl;
+    /// THE COARSEST LEVEL WHICH STILL GIVES A USEFUL NUMBER OF POINTS
+    int level = 0;
+    while(level + 1 < ENVELOPE_LEVELS && envelopeBuckets(level + 1, h.samplesPerChannel) >= 100)
+        level++;
 
-    c->send("procedure setTimelossDevice\n");
-    c->send("0\n");
-    c->send("1\n");
-    c->blocking_read(RESPONSE_OK);
+    uint64_t factor = envelopeFactor(level);
 
-    /// PREPARATION OF THE INPUT ARGUMENTS FOR 'procedure setupPostMortem' ...
-    /// ********************************************************************
+    std::cout << "envelope of " << h.samplesPerChannel << " samples per channel, level 1:" << factor << std::endl;
 
-    std::string THRESHOLD_str = boost::lexical_cast<std::string>(ps->triggerThreshold);
-    THRESHOLD_str += "\n";
+    for(uint32_t c = 0; c < h.numberOfChannels; c++)
+    {
+        std::vector<EnvelopeBucket> buckets = envelope.level(c, level);
+        float scale = millivoltsPerCount((VERTICAL_RANGE)h.channelRange[c]);
 
-    std::string SAMPLING_PERIOD_str = boost::lexical_cast<std::string>(ps->samplingPeriod);
-    SAMPLING_PERIOD_str += "\n";
+        std::cout << std::endl;
+        std::cout << "CHANNEL " << (char)('A' + h.channel[c]) << " : time [s] , min [mV] , max [mV]" << std::endl;
 
-    std::string NUM_OF_SAMPLES_str = boost::lexical_cast<std::string>(ps->numberOfSamples);
-    NUM_OF_SAMPLES_str += "\n";
+        for(std::size_t b = 0; b < buckets.size(); b++)
+            std::cout << b * factor * h.samplingPeriod << " , "
+                      << buckets[b].min * scale << " , " << buckets[b].max * scale << std::endl;
+    }
+}
 
-    std::string DELAY_str = boost::lexical_cast<std::string>(ps->delay);
-    DELAY_str += "\n";
+void findCaptureEdges(const std::string & path, int argc, char* argv[])
+{
+    CaptureStore capture(path, DEFAULT_MEMORY_BUDGET);
+    const CaptureFileHeader & h = capture.header();
 
-    std::string RANGE_A_str = boost::lexical_cast<std::string>(ps->range_A);
-    RANGE_A_str += "\n";
-    std::string RANGE_B_str = boost::lexical_cast<std::string>(ps->range_B);
-    RANGE_B_str += "\n";
-    std::string RANGE_C_str = boost::lexical_cast<std::string>(ps->range_C);
-    RANGE_C_str += "\n";
-    std::string RANGE_D_str = boost::lexical_cast<std::string>(ps->range_D);
-    RANGE_D_str += "\n";
+    /// BY DEFAULT THE HARDWARE TRIGGER SETTINGS STORED IN THE CAPTURE
+    double threshold = (argc > 3) ? boost::lexical_cast<double>(argv[3]) : h.triggerThreshold;
+    double hysteresis = (argc > 4) ? boost::lexical_cast<double>(argv[4]) : 10;
+    std::string direction = (argc > 5) ? argv[5] : h.triggerDirection;
 
-    std::string TRIGGER_CHANNEL_str = ps->triggerChannel + "\n";
-    std::string TRIGGER_DIRECTION_str = ps->triggerDirection + "\n";
+    std::string name = path.substr(0, path.rfind('.')) + "_edges.txt";
+    saveCaptureEdges(capture, direction, threshold, hysteresis, name);
 
-    int numberOfChannels = 0;
+    std::cout << "edges of " << path << " saved to " << name << std::endl;
+}
 
-    if(ps->range_A > 0) numberOfChannels++;
-    if(ps->range_B > 0) numberOfChannels++;
-    if(ps->range_C > 0) numberOfChannels++;
-    if(ps->range_D > 0) numberOfChannels++;
-    /// ********************************************************************
+void computeCaptureSpectrum(const std::string & path, int argc, char* argv[])
+{
+    CaptureStore capture(path, DEFAULT_MEMORY_BUDGET);
 
-    ///  POSTMORTEM SETUP
+    int segment = (argc > 3) ? boost::lexical_cast<int>(argv[3]) : 65536;
 
-    c->send("procedure setupPostMortem\n");
-    c->send("0\n"); //device
-    c->send(DELAY_str); // delay
-    c->send(RANGE_A_str);// range A
-    c->send(RANGE_B_str);// range B
-    c->send(RANGE_C_str);// range C
-    c->send(RANGE_D_str);// range D
-    c->send(TRIGGER_CHANNEL_str);// trigger channel: A | B | C | D | EXT
-    c->send(THRESHOLD_str); // trigger threshold: mV // EXT trigger range 0..1000 mV
-    c->send(TRIGGER_DIRECTION_str); // trigger direction: RISING | FALLING | RISE_FALL
-    c->send(NUM_OF_SAMPLES_str);
-    c->send(SAMPLING_PERIOD_str);
+    std::string name = path.substr(0, path.rfind('.')) + "_psd.txt";
+    saveCaptureSpectrum(capture, segment, name);
 
-    c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
+    std::cout << "spectrum of " << path << " saved to " << name << std::endl;
+}
 
-    /// RECEIVING THE DATA (WORKFLOW IS BLOCKED UNTIL WE RECEIVE THE DATA)
-    /// NB: THE RESPONSE OF THE 'function getPostMortemData' WILL BE SENT OVER SOCKET 3894
+void packCapture(const std::string & path, int argc, char* argv[])
+{
+    CaptureReader capture(path);
+    CHUNK_CODEC codec = (argc > 3) ? parseChunkCodec(argv[3]) : CODEC_RICE;
 
-    c->send("function getPostMortemData\n");
-    c->send("0\n");
+    std::string name = path.substr(0, path.rfind(".bin")) + ".pmc";
+    ChunkedCaptureWriter writer(name, capture.header(), codec);
 
-    c->blocking_read_scope(1); // response of 'getPostMortemData', expecting "0"
+    for(int c = 0; c < capture.numberOfChannels(); c++)
+        writer.append(c, capture.channel(c), capture.samplesPerChannel());
 
-    int size = 1;
-    int num_of_blocks = 1;
+    writer.close();
 
-    size = c->blocking_read_scope_size(); // SIZE OF DATA BUFFER OF A CHANNEL
-    num_of_blocks = c->blocking_read_scope_size(); // NUMBER OF BLOCKS IN THE DATA BUFFER
+    std::cout << path << " packed to " << name << " with the " << chunkCodec(codec)->name << " codec, "
+              << writer.storedBytes() << " of " << capture.header().bytesPerChannel * capture.numberOfChannels()
+              << " bytes" << std::endl;
+}
 
-    size /= num_of_blocks;
+void unpackCapture(const std::string & path)
+{
+    ChunkedCaptureReader chunked(path);
 
-    for(int k = 0; k < numberOfChannels; k++)
-        c->blocking_read_scope_data(size, num_of_blocks, ps->printSomeData, ps->saveToFile); // CHANNEL DATA
+    CaptureFileHeader h = chunked.header();
+    std::memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+    h.version = CAPTURE_FORMAT_VERSION;
+    h.blocksCompleted = 0;
 
-    stopAcquisition(c);
+    std::string name = path.substr(0, path.rfind(".pmc")) + ".bin";
+    CaptureFileWriter writer(name, h);
+    std::vector<int16_t> block(h.blockBytes / sizeof(int16_t));
 
-    c->send("procedure setTimelossDevice\n");
-    c->send("0\n");
-    c->send("0\n");
-    c->blocking_read(RESPONSE_OK);
+    for(int c = 0; c < chunked.numberOfChannels(); c++)
+    {
+        for(uint32_t b = 0; b < h.numberOfBlocks; b++)
+        {
+            chunked.read(c, (uint64_t)b * block.size(), block.size(), &block[0]);
+            writer.writeBlock(c, (uint64_t)b * h.blockBytes, &block[0], h.blockBytes, crc32c(&block[0], h.blockBytes));
+        }
+    }
 
-    std::cout << "postMortemViaTimeLossDeviceTest ended" << std::endl;
+    std::cout << path << " unpacked to " << name << std::endl;
 }
 
-void postMortemTest(TCPClient * c, PostMortemSettings * ps)
+void printCaptureWindow(const std::string & path, int argc, char* argv[])
 {
-    std::cout << "postMortemTest started" << std::endl;
-
-    /// PREPARATION OF THE INPUT ARGUMENTS FOR 'procedure setupPostMortem' ...
-    /// ********************************************************************
+    CaptureStore capture(path, DEFAULT_MEMORY_BUDGET);
+    const CaptureFileHeader & h = capture.header();
 
-    std::string THRESHOLD_str = boost::lexical_cast<std::string>(ps->triggerThreshold);
-    THRESHOLD_str += "\n";
+    uint64_t first = (argc > 3) ? boost::lexical_cast<uint64_t>(argv[3]) : 0;
+    uint64_t count = (argc > 4) ? boost::lexical_cast<uint64_t>(argv[4]) : 20;
 
-    std::string SAMPLING_PERIOD_str = boost::lexical_cast<std::string>(ps->samplingPeriod);
-    SAMPLING_PERIOD_str += "\n";
+    first = std::min(first, capture.samplesPerChannel());
+    count = std::min(count, capture.samplesPerChannel() - first);
 
-    std::string NUM_OF_SAMPLES_str = boost::lexical_cast<std::string>(ps->numberOfSamples);
-    NUM_OF_SAMPLES_str += "\n";
+    if(capture.chunked())
+        std::cout << capture.chunked()->codecName() << " codec, " << capture.chunked()->chunkSamples() << " samples per chunk, "
+                  << capture.chunked()->storedBytes() << " of " << h.bytesPerChannel * h.numberOfChannels << " bytes" << std::endl;
 
-    std::string DELAY_str = boost::lexical_cast<std::string>(ps->delay);
-    DELAY_str += "\n";
+    int channels = capture.numberOfChannels();
+    std::vector<float> scale(channels);
 
-    std::string RANGE_A_str = boost::lexical_cast<std::string>(ps->range_A);
-    RANGE_A_str += "\n";
-    std::string RANGE_B_str = boost::lexical_cast<std::string>(ps->range_B);
-    RANGE_B_str += "\n";
-    std::string RANGE_C_str = boost::lexical_cast<std::string>(ps->range_C);
-    RANGE_C_str += "\n";
-    std::string RANGE_D_str = boost::lexical_cast<std::string>(ps->range_D);
-    RANGE_D_str += "\n";
-
-    std::string TRIGGER_CHANNEL_str = ps->triggerChannel + "\n";
-    std::string TRIGGER_DIRECTION_str = ps->triggerDirection + "\n";
+    std::cout << "time [s]";
+    for(int c = 0; c < channels; c++)
+    {
+        scale[c] = millivoltsPerCount(capture.channelRange(c));
+        std::cout << " , " << capture.channelName(c) << " [mV]";
+    }
+    std::cout << std::endl;
 
-    int numberOfChannels = 0;
+    /// THE ROWS ARE PRINTED FROM INTERLEAVED WINDOWS, ALL THE CHANNELS OF A ROW ARE NEIGHBOURS;
+    /// FROM A CHUNKED CAPTURE ONLY THE CHUNKS AROUND THE WINDOW ARE READ AND DECODED
+    for(uint64_t done = 0; done < count; )
+    {
+        uint64_t n = std::min(capture.tileSamples(), count - done);
+        const int16_t * tiles = capture.tiles(first + done, n);
 
-    if(ps->range_A > 0) numberOfChannels++;
-    if(ps->range_B > 0) numberOfChannels++;
-    if(ps->range_C > 0) numberOfChannels++;
-    if(ps->range_D > 0) numberOfChannels++;
-    /// ********************************************************************
+        for(uint64_t i = 0; i < n; i++)
+        {
+            std::cout << (first + done + i) * h.effectiveSamplingPeriod;
+            for(int c = 0; c < channels; c++)
+                std::cout << " , " << tiles[interleavedIndex(channels, c, i)] * scale[c];
+            std::cout << std::endl;
+        }
 
-    ///  POSTMORTEM SETUP
+        done += n;
+    }
+}
 
-    c->send("procedure setupPostMortem\n");
-    c->send("0\n"); //device
-    c->send(DELAY_str); // delay
-    c->send(RANGE_A_str);// range A
-    c->send(RANGE_B_str);// range B
-    c->send(RANGE_C_str);// range C
-    c->send(RANGE_D_str);// range D
-    c->send(TRIGGER_CHANNEL_str);// trigger channel: A | B | C | D | EXT
-    c->send(THRESHOLD_str); // trigger threshold: mV // EXT trigger range 0..1000 mV
-    c->send(TRIGGER_DIRECTION_str); // trigger direction: RISING | FALLING | RISE_FALL
-    c->send(NUM_OF_SAMPLES_str);
-    c->send(SAMPLING_PERIOD_str);
+int main(int argc, char* argv[])
+{
+    try
+    {
+        std::string mode = (argc > 2) ? argv[2] : "";
+        bool options = (mode == "EDGES" || mode == "PSD" || mode == "PACK" || mode == "WINDOW"
+                        || mode == "DAEMON" || mode == "SEND" || mode == "MULTI" || mode == "RUN" || mode == "BENCH"
+                        || mode == "TL" || mode == "PM" || mode == "BOTH" || mode == "REPLAY");
 
-    c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
+        if (argc < 3 || (argc > 3 && !options))
+        {
+            std::cout << "\n Usage: Client <host> < TL | PM | BOTH > [journal]\n" << std::endl;
+            std::cout << "\t <host> is the IP address of the ROSY device" << std::endl;
+            std::cout << "\t TL is the Time Loss Histogram mode test" << std::endl;
+            std::cout << "\t PM is the Post Mortem mode test" << std::endl;
+            std::cout << "\t BOTH is the test of the parallel execution of both modes" << std::endl;
+            std::cout << "\t with a journal, the traffic of the session is also recorded to it, see SocketJournal.hpp" << std::endl;
+            std::cout << "\n Usage: Client <host> RUN <sequence file> [journal]\n" << std::endl;
+            std::cout << "\t runs the steps of the sequence file in one session, see SequenceScript.hpp" << std::endl;
+            std::cout << "\n Usage: Client <journal> REPLAY [ FAST ]\n" << std::endl;
+            std::cout << "\t runs the recorded session again on the traffic of the journal, at the original timing" << std::endl;
+            std::cout << "\t or as fast as possible" << std::endl;
+            std::cout << "\n Usage: Client <sequence file> CHECK\n" << std::endl;
+            std::cout << "\t checks a sequence file and lists its steps" << std::endl;
+            std::cout << "\n Usage: Client <host> DAEMON [socket]\n" << std::endl;
+            std::cout << "\t keeps the session with the ROSY open, reads the time loss histograms periodically" << std::endl;
+            std::cout << "\t and takes commands on the UNIX socket, ./rosy.sock by default" << std::endl;
+            std::cout << "\n Usage: Client <socket> SEND < status | start [threshold] | stop | read | last | period <ms> | latency | quit >\n" << std::endl;
+            std::cout << "\t sends a command to a running daemon and prints its reply" << std::endl;
+            std::cout << "\n Usage: Client <host>,<host>,... MULTI [histograms per device]\n" << std::endl;
+            std::cout << "\t reads the time loss histograms of many ROSY units from one process, until SIGINT by default" << std::endl;
+            std::cout << "\n Usage: Client <results> BENCH [baseline]\n" << std::endl;
+            std::cout << "\t runs the benchmark suite against simulated ROSY units and saves the results as JSON," << std::endl;
+            std::cout << "\t compared with the results of an earlier build if given" << std::endl;
+            std::cout << "\n Usage: Client <capture> < INFO | MV | ENVELOPE >\n" << std::endl;
+            std::cout << "\t <capture> is a binary Post Mortem capture file" << std::endl;
+            std::cout << "\t INFO prints the settings stored in the capture" << std::endl;
+            std::cout << "\t MV converts the channels to float32 mV files, <capture>_<channel>.f32" << std::endl;
+            std::cout << "\t ENVELOPE saves the min/max envelope of the capture next to it" << std::endl;
+            std::cout << "\n Usage: Client <capture> EDGES [threshold mV] [hysteresis mV] [ RISING | FALLING | RISE_FALL ]\n" << std::endl;
+            std::cout << "\t saves every threshold crossing of the channels of a binary or chunked capture, by default with the trigger settings of the capture" << std::endl;
+            std::cout << "\n Usage: Client <capture> PSD [samples per segment]\n" << std::endl;
+            std::cout << "\t saves the Welch power spectral density of the channels, <capture>_psd.txt" << std::endl;
+            std::cout << "\n Usage: Client <capture> PACK [ NONE | DELTA | RICE ]\n" << std::endl;
+            std::cout << "\t compresses the capture to a chunked capture, <capture>.pmc" << std::endl;
+            std::cout << "\n Usage: Client <chunked capture> UNPACK\n" << std::endl;
+            std::cout << "\t restores the binary capture, <capture>.bin" << std::endl;
+            std::cout << "\n Usage: Client <capture> WINDOW [first sample] [samples]\n" << std::endl;
+            std::cout << "\t prints a window of samples of all the channels of a binary or chunked capture in mV" << std::endl;
+            std::cout << "\n Usage: Client <envelope> PREVIEW\n" << std::endl;
+            std::cout << "\t prints the overview of a capture from its envelope file" << std::endl;
+            return 1;
+        }
 
-    /// RECEIVING THE DATA (WORKFLOW IS BLOCKED UNTIL WE RECEIVE THE DATA)
-    /// NB: THE RESPONSE OF THE 'function getPostMortemData' WILL BE SENT OVER SOCKET 3894
+        /// OFFLINE MODES, THE FIRST ARGUMENT IS A CAPTURE FILE
+        if(mode.compare("INFO") == 0)
+        {
+            printCaptureInfo(argv[1]);
+            return 0;
+        }
+        else if(mode.compare("MV") == 0)
+        {
+            convertCaptureToMillivolts(argv[1]);
+            return 0;
+        }
+        else if(mode.compare("ENVELOPE") == 0)
+        {
+            buildCaptureEnvelope(argv[1]);
+            return 0;
+        }
+        else if(mode.compare("EDGES") == 0)
+        {
+            findCaptureEdges(argv[1], argc, argv);
+            return 0;
+        }
+        else if(mode.compare("PSD") == 0)
+        {
+            computeCaptureSpectrum(argv[1], argc, argv);
+            return 0;
+        }
+        else if(mode.compare("PACK") == 0)
+        {
+            packCapture(argv[1], argc, argv);
+            return 0;
+        }
+        else if(mode.compare("UNPACK") == 0)
+        {
+            unpackCapture(argv[1]);
+            return 0;
+        }
+        else if(mode.compare("WINDOW") == 0)
+        {
+            printCaptureWindow(argv[1], argc, argv);
+            return 0;
+        }
+        else if(mode.compare("PREVIEW") == 0)
+        {
+            printEnvelopePreview(argv[1]);
+            return 0;
+        }
+        else if(mode.compare("CHECK") == 0) /// THE FIRST ARGUMENT IS A SEQUENCE FILE
+        {
+            SequenceScript script = loadSequenceScript(argv[1]);
 
-    c->send("function getPostMortemData\n");
-    c->send("0\n");
+            for(std::size_t i = 0; i < script.steps.size(); i++)
+                std::cout << script.path << ":" << script.steps[i].line << ": " << script.steps[i].text << std::endl;
+            std::cout << script.steps.size() << " steps, OK" << std::endl;
+            return 0;
+        }
+        else if(mode.compare("SEND") == 0) /// THE FIRST ARGUMENT IS THE SOCKET OF A DAEMON
+        {
+            std::string command;
+            for(int i = 3; i < argc; i++)
+                command += (i > 3 ? " " : "") + std::string(argv[i]);
 
-    c->blocking_read_scope(1); // response of getPostMortemData, expecting "0"
+            std::cout << sendDaemonCommand(argv[1], command.empty() ? "status" : command);
+            return 0;
+        }
 
-    int size = 1;
-    int num_of_blocks = 1;
+        /// ***** TIME LOSS HISTOGRAM SETTINGS *****
 
-    size = c->blocking_read_scope_size(); // SIZE OF DATA BUFFER OF A CHANNEL
-    num_of_blocks = c->blocking_read_scope_size(); // NUMBER OF BLOCKS IN THE DATA BUFFER
+        TimeLossSettings * tlc = new TimeLossSettings();
 
-    size /= num_of_blocks;
+        tlc->numberOfIterations = 0;
 
-    for(int k = 0; k < numberOfChannels; k++)
-        c->blocking_read_scope_data(size, num_of_blocks, ps->printSomeData, ps->saveToFile); // CHANNEL DATA
+        tlc->threshold = 15; // [mV] // signal threshold
 
-    std::cout << "postMortemTest ended" << std::endl;
-}
+        tlc->saveToFile = true;
+        tlc->printSomeData = false;
 
-void getHistogramFunction(TCPClient * c, TimeLossSettings * tlc)
-{
-    for(int i = 0; i < tlc->numberOfIterations; i++)
-    {
-        /// INTERRUPTION POINT FOR THE THREAD:
-        /// EVERY ITERATION CHECKS IF THE POST MORTEM THREAD
-        /// STARTED THE DATA ACQUISITION. IF YES, THE TIME LOSS THREAD IS CLOSED.
-        if(POST_MORTEM_STARTED)
-            break;
+        /// ************************************
 
-        sleep(1);
+        /// THE LATENCIES OF THE COMMANDS ARE PRINTED AT EXIT, ALSO WHEN THE SESSION ENDS WITH exit()
+        atexit(printCommandLatencies);
 
-        c->send("function getHistogram\n");
-        c->send("0\n");
+        /// ***** METRICS SETTINGS *****
 
-        int size = c->blocking_read_size(); // size of time loss histogram
-        c->blocking_read_timeloss_data(size, tlc->printSomeData, tlc->saveToFile); // time loss histogram
+        MetricsSettings * mt = new MetricsSettings();
 
-        std::cout << "\n\n\t * * * Histogram length is " << size/4 << ", time interval " << 1.6*(size/4) << " ns" << std::endl;
+        mt->address = "127.0.0.1"; // "0.0.0.0" lets the monitoring of other machines scrape it
+        mt->port = 9464; // 0 means no metrics endpoint
 
-        c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
-    }
+        std::auto_ptr<MetricsServer> metrics(startMetricsServer(mt)); // GET /metrics, until the end of the session
 
-    std::cout << "getHistogramFunction : THREAD ENDED" << std::endl;
+        /// ************************************
 
-    TL_THREAD_IS_RUNNING = false;
-}
+        /// MANY ROSY UNITS, THE FIRST ARGUMENT IS A LIST OF HOSTS
+        if(mode.compare("MULTI") == 0)
+        {
+            /// ***** DEVICE MANAGER SETTINGS *****
 
-void getPostMortemDataFunction(TCPClient * c, int numberOfChannels, PostMortemSettings * ps)
-{
-    c->blocking_read_scope(1); // status response of 'getPostMortemData', expecting RESPONSE_OK
+            DeviceManagerSettings * ms = new DeviceManagerSettings();
 
-    int size = 1;
-    int num_of_blocks = 1;
+            std::stringstream hosts(argv[1]);
+            for(std::string host; std::getline(hosts, host, ','); )
+                if(!host.empty())
+                    ms->hosts.push_back(host);
 
-    size = c->blocking_read_scope_size(); // SIZE OF DATA BUFFER OF A CHANNEL
+            ms->histogramPeriodMs = HISTOGRAM_PERIOD_MS; // [ms]
+            ms->histogramsPerDevice = (argc > 3) ? boost::lexical_cast<int>(argv[3]) : 0; // 0 means until SIGINT / SIGTERM
+            ms->maxTransfers = 4; // in flight over all the devices
+            ms->threads = 0; // 0 means maxTransfers + 1
+            ms->statsPeriodMs = 10000; // [ms], 0 means only at the end
+            ms->directoryPerDevice = true; // ./<host>/
 
-    POST_MORTEM_STARTED = true; // DISABLING THE TIME LOSS HISTOGRAM
+            /// ************************************
 
-    num_of_blocks = c->blocking_read_scope_size(); // NUMBER OF BLOCKS IN THE DATA BUFFER
+            multiDeviceTest(tlc, ms); // Time Loss histograms of every device on its own schedule
+            return 0;
+        }
 
-    size /= num_of_blocks;
+        /// ***** POST MORTEM SETTINGS *****
 
-    for(int k = 0; k < numberOfChannels; k++)
-        c->blocking_read_scope_data(size, num_of_blocks, ps->printSomeData, ps->saveToFile); // CHANNEL DATA
+        PostMortemSettings * ps = new PostMortemSettings();
 
-    std::cout << "getPostMortemDataFunction : THREAD ENDED" << std::endl;
+        ps->delay = 0; // [number of samples]
+        // positive delay => acquisition starts after the specified number of samples AFTER trigger
+        // negative delay => the specified number of samples are acquired BEFORE trigger
 
-    PM_THREAD_IS_RUNNING = false;
-}
+        ps->range_A = RANGE_1_V;
+        ps->range_B = DISABLE_CHANNEL;
+        ps->range_C = DISABLE_CHANNEL;
+        ps->range_D = DISABLE_CHANNEL;
 
-void parallelOperationTest(TCPClient * c, TimeLossSettings * tlc, PostMortemSettings * ps)
-{
-    std::cout << "parallelOperationTest started" << std::endl;
+        ps->triggerChannel = "EXT"; // A | B | C | D | EXT
+        ps->triggerDirection = "RISING"; // RISING | FALLING | RISE_FALL
+        ps->triggerThreshold = 250; // [mV], from +1 to +1000 mV
 
-    /// TIME LOSS SETUP
+        ps->numberOfSamples = 1E6; // minimum 100 samples, max (1E9/selected channels)
+        // -1 means maximum possible number of samples
 
-    std::string thresholdStr;
+        ps->samplingPeriod = -1; // [s]
+        // -1 means the minimum possible sampling period
+        //
+        // for 1 channel, minimum possible period is 200 ps
+        // for 2 channels (only A+C or B+D), minimum possible period is 400 ps
+        // for 3 or 4 channels, minimum possible period is 800 ps
 
-    try
-    {
-        thresholdStr = boost::lexical_cast<std::string>(tlc->threshold);
-        thresholdStr += "\n";
-    }
-    catch( boost::bad_lexical_cast const& )
-    {
-        std::cout << "timeLossTest: error -- input threshold was not valid" << std::endl;
-        exit(1);
-    }
+        ps->saveToFile = true;
+        ps->saveFormat = SAVE_TEXT; // SAVE_TEXT | SAVE_BINARY | SAVE_MAPPED | SAVE_CHUNKED
+        ps->chunkCodec = CODEC_RICE; // CODEC_NONE | CODEC_DELTA | CODEC_RICE
+        ps->chunkSamples = CHUNK_SAMPLES;
+        ps->printSomeData = true;
+        ps->convertToMillivolts = false;
+        ps->computeEnvelope = true;
 
-    c->send("procedure setupHistogram\n");
-    c->send("0\n");
-    c->send(thresholdStr);
-    c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
+        ps->findEdges = false;
+        ps->edgeDirection = ps->triggerDirection; // RISING | FALLING | RISE_FALL
+        ps->edgeThreshold = ps->triggerThreshold; // [mV]
+        ps->edgeHysteresis = 10; // [mV]
 
-    /// POST MORTEM SETUP
+        ps->computeSpectrum = false;
+        ps->spectrumSegment = 65536; // [samples], any length, powers of 2 are the fastest
+        ps->memoryBudget = DEFAULT_MEMORY_BUDGET; // [bytes]
 
-    /// PREPARATION OF THE INPUT ARGUMENTS FOR 'procedure setupPostMortem' ...
-    /// ********************************************************************
+        /// ************************************
 
-    std::string THRESHOLD_str = boost::lexical_cast<std::string>(ps->triggerThreshold);
-    THRESHOLD_str += "\n";
+        /// BENCHMARK SUITE AGAINST SIMULATED ROSY UNITS, THE FIRST ARGUMENT IS THE RESULTS FILE
+        if(mode.compare("BENCH") == 0)
+        {
+            /// ***** BENCHMARK SETTINGS *****
 
-    std::string SAMPLING_PERIOD_str = boost::lexical_cast<std::string>(ps->samplingPeriod);
-    SAMPLING_PERIOD_str += "\n";
+            BenchmarkSettings * bs = new BenchmarkSettings();
 
-    std::string NUM_OF_SAMPLES_str = boost::lexical_cast<std::string>(ps->numberOfSamples);
-    NUM_OF_SAMPLES_str += "\n";
+            bs->resultsPath = argv[1];
+            bs->baselinePath = (argc > 3) ? argv[3] : ""; // "" means no comparison
+            bs->tolerance = 0.10; // relative change reported as a regression
+            bs->port = 13893; // of the simulated ROSY, 13894 for the post mortem data
+            bs->triggerDelayMs = 20; // [ms]
 
-    std::string DELAY_str = boost::lexical_cast<std::string>(ps->delay);
-    DELAY_str += "\n";
+            bs->histogramBins.push_back(1000);
+            bs->histogramBins.push_back(16384);
+            bs->histogramBins.push_back(262144);
+            bs->histogramPolls = 200; // per bin count
 
-    std::string RANGE_A_str = boost::lexical_cast<std::string>(ps->range_A);
-    RANGE_A_str += "\n";
-    std::string RANGE_B_str = boost::lexical_cast<std::string>(ps->range_B);
-    RANGE_B_str += "\n";
-    std::string RANGE_C_str = boost::lexical_cast<std::string>(ps->range_C);
-    RANGE_C_str += "\n";
-    std::string RANGE_D_str = boost::lexical_cast<std::string>(ps->range_D);
-    RANGE_D_str += "\n";
+            bs->maxChannels = 4;
+            bs->blockCounts.push_back(1);
+            bs->blockCounts.push_back(4);
+            bs->blockCounts.push_back(16);
+            bs->samplesPerChannel = 1E6;
+            bs->repetitions = 5;
+            bs->saveChannels = 2;
+            bs->outputDirectory = "benchmark-captures";
 
-    std::string TRIGGER_CHANNEL_str = ps->triggerChannel + "\n";
-    std::string TRIGGER_DIRECTION_str = ps->triggerDirection + "\n";
+            /// ************************************
 
-    int numberOfChannels = 0;
+            return benchmarkTest(tlc, ps, bs) > 0 ? 1 : 0; // 1 if the results regressed from the baseline
+        }
 
-    if(ps->range_A > 0) numberOfChannels++;
-    if(ps->range_B > 0) numberOfChannels++;
-    if(ps->range_C > 0) numberOfChannels++;
-    if(ps->range_D > 0) numberOfChannels++;
-    /// ********************************************************************
-
-    ///  POSTMORTEM SETUP
-
-    c->send("procedure setupPostMortem\n");
-    c->send("0\n"); //device
-    c->send(DELAY_str); // delay
-    c->send(RANGE_A_str);// range A
-    c->send(RANGE_B_str);// range B
-    c->send(RANGE_C_str);// range C
-    c->send(RANGE_D_str);// range D
-    c->send(TRIGGER_CHANNEL_str);// trigger channel: A | B | C | D | EXT
-    c->send(THRESHOLD_str); // trigger threshold: mV // EXT trigger range 0..1000 mV
-    c->send(TRIGGER_DIRECTION_str); // trigger direction: RISING | FALLING | RISE_FALL
-    c->send(NUM_OF_SAMPLES_str);
-    c->send(SAMPLING_PERIOD_str);
-
-    c->blocking_read(RESPONSE_OK); // expecting RESPONSE_OK
-
-    /// ****************
-    /// ****************
-    /// ****************
-    /// ****************
+        /// ***** JOURNAL SETTINGS *****
 
-    /// STARTING THE OPERATION
+        JournalSettings * jr = new JournalSettings();
 
-    PM_THREAD_IS_RUNNING = true;
-    TL_THREAD_IS_RUNNING = true;
-    POST_MORTEM_STARTED = false;
+        int journalArgument = (mode == "RUN") ? 4 : 3; // after the sequence file of RUN
+        bool recordable = (mode == "TL" || mode == "PM" || mode == "BOTH" || mode == "RUN");
 
-    /// SENDING 'getPostMortemData', i.e. arming the Post Mortem device.
-    /// when a trigger occurs, it will return the data over the 'POST_MORTEM_SOCKET' socket, port 3894.
+        jr->recordPath = (recordable && argc > journalArgument) ? argv[journalArgument] : ""; // "" means no journal
+        jr->replayTimed = !(argc > 3 && std::string(argv[3]) == "FAST"); // REPLAY FAST as fast as possible
 
-    c->send("function getPostMortemData\n");
-    c->send("0\n");
+        /// ************************************
 
-    /// running getHistogram via 'CONTROL_SOCKET', port 3893
-    boost::thread(getHistogramFunction, c, tlc);
+        std::string host = argv[1];
+        std::string controlPort = "3893";
+        std::string postMortemPort = "3894";
+        std::string argument = (argc > 3) ? argv[3] : ""; // of the mode, e.g. the sequence file of RUN
 
-    /// waiting for the response from 'getPostMortemData' via 'POST_MORTEM_SOCKET', port 3894
-    boost::thread(getPostMortemDataFunction, c, numberOfChannels, ps);
+        /// A REPLAYED JOURNAL IS THE ROSY OF THE SESSION, WHICH RUNS THE RECORDED MODE AGAIN
+        std::auto_ptr<JournalPlayer> player;
 
-    while(TL_THREAD_IS_RUNNING || PM_THREAD_IS_RUNNING)
-        sleep(1);
+        if(mode.compare("REPLAY") == 0)
+        {
+            player.reset(new JournalPlayer(argv[1], jr->replayTimed));
 
-    std::cout << "parallelOperationTest ended" << std::endl;
-}
+            host = "127.0.0.1";
+            controlPort = boost::lexical_cast<std::string>(player->controlPort());
+            postMortemPort = boost::lexical_cast<std::string>(player->postMortemPort());
+            mode = player->header().mode;
+            argument = player->header().argument;
 
-int main(int argc, char* argv[])
-{
-    try
-    {
-        if (argc != 3)
-        {
-            std::cout << "\n Usage: Client <host> < TL | PM | BOTH >\n" << std::endl;
-            std::cout << "\t <host> is the IP address of the ROSY device" << std::endl;
-            std::cout << "\t TL is the Time Loss Histogram mode test" << std::endl;
-            std::cout << "\t PM is the Post Mortem mode test" << std::endl;
-            std::cout << "\t BOTH is the test of the parallel execution of both modes" << std::endl;
-            return 1;
+            if(mode != "TL" && mode != "PM" && mode != "BOTH" && mode != "RUN")
+                throw std::runtime_error("REPLAY: a journal of the mode '" + mode + "' cannot be replayed");
         }
 
-        std::string mode = argv[2];
+        /// THE SEQUENCE FILE IS CHECKED BEFORE ANYTHING IS SENT TO THE ROSY
+        SequenceScript script;
+        if(mode.compare("RUN") == 0)
+            script = loadSequenceScript(argument);
+
+        /// THE JOURNAL OUTLIVES THE CLIENT, WHOSE THREADS RECORD INTO IT
+        std::auto_ptr<SocketJournal> journal;
+        if(!jr->recordPath.empty())
+            journal.reset(new SocketJournal(jr->recordPath, mode, mode == "RUN" ? argument : ""));
 
         /// PREPARING THE TCP CONNECTION
         boost::asio::io_service io_service;
@@ -972,12 +2942,15 @@ int main(int argc, char* argv[])
         TCPClient c(io_service);
         io_service.run();
 
+        if(journal.get())
+            c.record(journal.get());
+
 
         /// CONNECTING THE 'CONTROL_SOCKET', USING PORT 3893;
         /// ALL FUNCTIONS/PROCEDURES ARE SENT TO THE SERVER
         /// USING THIS SOCKET; THE TIME LOSS HISTOGRAM DATA
         /// ARE READ OUT THROUGH THIS SOCKET AS WELL
-        c.start(r.resolve(tcp::resolver::query(argv[1], "3893")), CONTROL_SOCKET);
+        c.start(r.resolve(tcp::resolver::query(host, controlPort)), CONTROL_SOCKET);
 
         /// EXCHANGING THE VERIFICATION MESSAGES WITH THE ROSY DEVICE
         establishConnection(&c);
@@ -985,7 +2958,7 @@ int main(int argc, char* argv[])
         /// AFTER THE VERIFICATION HAS ENDED SUCCESSFULLY,
         /// CONNECTING THE 'POST_MORTEM_SOCKET', USING PORT 3894
         /// THIS SOCKET IS USED ONLY FOR THE POST MORTEM DATA TRANSFER
-        c.start(r.resolve(tcp::resolver::query(argv[1], "3894")), POST_MORTEM_SOCKET);
+        c.start(r.resolve(tcp::resolver::query(host, postMortemPort)), POST_MORTEM_SOCKET);
 
         /// Thus, two sockets are created in the application: the first one
         /// that connects to port 3893 of the ROSY, and the second one
@@ -997,48 +2970,26 @@ int main(int argc, char* argv[])
 
 
 
-        /// ***** TIME LOSS HISTOGRAM SETTINGS *****
-
-        TimeLossSettings * tlc = new TimeLossSettings();
+        /// ***** PLACEMENT SETTINGS *****
 
-        tlc->numberOfIterations = 0;
+        PlacementSettings * pl = new PlacementSettings();
 
-        tlc->threshold = 15; // [mV] // signal threshold
+        pl->pinThreads = true; // receive threads near the NIC, analysis workers on the other NUMA nodes
+        pl->interface = ""; // "" means the NIC of the sockets
+        pl->receiveNode = -1; // -1 means the NUMA node of the NIC
+        pl->bindMemory = false; // the first touch of the pinned receive thread is usually enough
 
-        tlc->saveToFile = true;
-        tlc->printSomeData = false;
+        c.place(pl);
 
         /// ************************************
 
-        /// ***** POST MORTEM SETTINGS *****
-
-        PostMortemSettings * ps = new PostMortemSettings();
-
-        ps->delay = 0; // [number of samples]
-        // positive delay => acquisition starts after the specified number of samples AFTER trigger
-        // negative delay => the specified number of samples are acquired BEFORE trigger
-
-        ps->range_A = RANGE_1_V;
-        ps->range_B = DISABLE_CHANNEL;
-        ps->range_C = DISABLE_CHANNEL;
-        ps->range_D = DISABLE_CHANNEL;
-
-        ps->triggerChannel = "EXT"; // A | B | C | D | EXT
-        ps->triggerDirection = "RISING"; // RISING | FALLING | RISE_FALL
-        ps->triggerThreshold = 250; // [mV], from +1 to +1000 mV
+        /// ***** DAEMON SETTINGS *****
 
-        ps->numberOfSamples = 1E6; // minimum 100 samples, max (1E9/selected channels)
-        // -1 means maximum possible number of samples
-
-        ps->samplingPeriod = -1; // [s]
-        // -1 means the minimum possible sampling period
-        //
-        // for 1 channel, minimum possible period is 200 ps
-        // for 2 channels (only A+C or B+D), minimum possible period is 400 ps
-        // for 3 or 4 channels, minimum possible period is 800 ps
+        DaemonSettings * ds = new DaemonSettings();
 
-        ps->saveToFile = true;
-        ps->printSomeData = true;
+        ds->socketPath = (argc > 3) ? argv[3] : "rosy.sock";
+        ds->histogramPeriodMs = HISTOGRAM_PERIOD_MS; // [ms]
+        ds->startAcquisition = true; // false waits for the 'start' command
 
         /// ************************************
 
@@ -1060,6 +3011,14 @@ int main(int argc, char* argv[])
             stopAcquisition(&c);
             readTimeLossData(&c, tlc); // Get the histogram data after the data acquisition is stopped
         }
+        else if(mode.compare("RUN") == 0) /// THE STEPS OF A SEQUENCE FILE
+        {
+            sequenceTest(&c, script, tlc, ps); // Every step in this session, with the settings above changed by its 'set' steps
+        }
+        else if(mode.compare("DAEMON") == 0) /// RESIDENT DAEMON, UNTIL THE 'quit' COMMAND
+        {
+            daemonMode(&c, tlc, ds); // Time Loss histograms every period, commands on the UNIX socket
+        }
 
         /// *** TESTING THE POST MORTEM DATA READING FROM THE TIME LOSS DEVICE
         //postMortemViaTimeLossDeviceTest(&c, ps); // Get Post Mortem data from the Time Loss device
@@ -1069,6 +3028,9 @@ int main(int argc, char* argv[])
 
         /// RELEASE THE DEVICES IN ROSY
         disconnectDevice(&c);
+
+        if(journal.get())
+            std::cout << "journal: " << journal->bytes() << " bytes recorded to " << journal->path() << std::endl;
     }
     catch (std::exception& e)
     {
@@ -0,0 +1,335 @@
+#ifndef COMMAND_LATENCY_HPP
+#define COMMAND_LATENCY_HPP
+
+#include <boost/chrono.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/// the latencies of the commands of the control protocol, one set of
+/// histograms per command (the first line of the request, e.g.
+/// "function getHistogram"), over every ControlMultiplexer of the process:
+///
+///   queued      submitted to written, i.e. the wait behind the other requests
+///   first byte  written to the first byte of the response, the device and the network
+///   transfer    first byte to the final token, the payload
+///   round trip  written to the final token; for a command without a
+///               response, e.g. 'getPostMortemData', the write only
+///
+/// the histograms are recorded lock-free from any thread and read at any
+/// time, see commandLatencies(); a report read while commands are recorded
+/// may be a few samples behind.
+
+typedef boost::chrono::steady_clock LatencyClock;
+
+/// [ns] from 'from' to 'to'
+inline uint64_t elapsedNs(LatencyClock::time_point from, LatencyClock::time_point to)
+{
+    boost::chrono::nanoseconds ns = boost::chrono::duration_cast<boost::chrono::nanoseconds>(to - from);
+    return ns.count() > 0 ? (uint64_t)ns.count() : 0;
+}
+
+/// [bits] of the sub-buckets of a power of two: 32 sub-buckets, so a value
+/// is known within 1/32 (3 %) from 1 ns to over an hour
+const int LATENCY_SUB_BITS = 5;
+const int LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BITS;
+const int LATENCY_MAX_EXPONENT = 42; // 2^43 ns = 2.4 hours, larger values are counted there
+const int LATENCY_BUCKETS = 2 * LATENCY_SUB_BUCKETS + (LATENCY_MAX_EXPONENT - LATENCY_SUB_BITS) * LATENCY_SUB_BUCKETS;
+
+/// a high dynamic range histogram of latencies in [ns]: the values below
+/// 2 * LATENCY_SUB_BUCKETS have a bucket each, every higher power of two
+/// is split into LATENCY_SUB_BUCKETS buckets of equal width. record() only
+/// adds atomically, so any number of threads record without a lock
+class LatencyHistogram
+{
+public:
+
+    LatencyHistogram()
+        : count_(0), sum_(0), min_(~(uint64_t)0), max_(0)
+    {
+        for(int i = 0; i < LATENCY_BUCKETS; i++)
+            counts_[i] = 0;
+    }
+
+    void record(uint64_t ns)
+    {
+        __sync_fetch_and_add(&counts_[bucket(ns)], 1);
+        __sync_fetch_and_add(&count_, 1);
+        __sync_fetch_and_add(&sum_, ns);
+
+        for(uint64_t m = min_; ns < m && !__sync_bool_compare_and_swap(&min_, m, ns); m = min_)
+            ;
+        for(uint64_t m = max_; ns > m && !__sync_bool_compare_and_swap(&max_, m, ns); m = max_)
+            ;
+    }
+
+    uint64_t count() const
+    {
+        return count_;
+    }
+
+    /// [ns]
+    double mean() const
+    {
+        uint64_t n = count_;
+        return n > 0 ? (double)sum_ / n : 0;
+    }
+
+    /// [ns]
+    uint64_t sum() const
+    {
+        return sum_;
+    }
+
+    /// [ns], exact
+    uint64_t min() const
+    {
+        return count_ > 0 ? min_ : 0;
+    }
+
+    /// [ns], exact
+    uint64_t max() const
+    {
+        return max_;
+    }
+
+    /// [ns], 'p' from 0 to 1: the highest value of the bucket of the
+    /// sample of that rank, so a timeout set from it covers the sample
+    uint64_t percentile(double p) const
+    {
+        uint64_t n = 0;
+        uint64_t counts[LATENCY_BUCKETS];
+
+        /// ONE SNAPSHOT, THE BUCKETS MAY GROW WHILE THEY ARE READ
+        for(int i = 0; i < LATENCY_BUCKETS; i++)
+            n += counts[i] = counts_[i];
+
+        if(n == 0)
+            return 0;
+
+        uint64_t rank = (uint64_t)(p * n + 0.5);
+        rank = (rank < 1) ? 1 : (rank > n ? n : rank);
+
+        uint64_t seen = 0;
+        for(int i = 0; i < LATENCY_BUCKETS; i++)
+        {
+            seen += counts[i];
+            if(seen >= rank)
+                return std::min(highest(i), max());
+        }
+
+        return max();
+    }
+
+    /// the bucket of 'ns'
+    static int bucket(uint64_t ns)
+    {
+        if(ns < 2 * (uint64_t)LATENCY_SUB_BUCKETS)
+            return (int)ns;
+
+        int exponent = 63 - __builtin_clzll(ns);
+        if(exponent > LATENCY_MAX_EXPONENT)
+            return LATENCY_BUCKETS - 1;
+
+        int shift = exponent - LATENCY_SUB_BITS;
+        return 2 * LATENCY_SUB_BUCKETS + (shift - 1) * LATENCY_SUB_BUCKETS
+               + (int)(ns >> shift) - LATENCY_SUB_BUCKETS;
+    }
+
+    /// [ns], the highest value counted in 'bucket'
+    static uint64_t highest(int bucket)
+    {
+        if(bucket < 2 * LATENCY_SUB_BUCKETS)
+            return bucket;
+
+        int shift = (bucket - 2 * LATENCY_SUB_BUCKETS) / LATENCY_SUB_BUCKETS + 1;
+        uint64_t sub = (bucket - 2 * LATENCY_SUB_BUCKETS) % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+        return ((sub + 1) << shift) - 1;
+    }
+
+private:
+    LatencyHistogram(const LatencyHistogram &);
+    LatencyHistogram & operator=(const LatencyHistogram &);
+
+    volatile uint64_t counts_[LATENCY_BUCKETS];
+    volatile uint64_t count_;
+    volatile uint64_t sum_; // [ns]
+    volatile uint64_t min_; // [ns]
+    volatile uint64_t max_; // [ns]
+};
+
+/// the phases of one command, see the top of this file
+struct CommandLatency
+{
+    explicit CommandLatency(const std::string & command)
+        : command(command), bytes(0)
+    {}
+
+    const std::string command;
+    LatencyHistogram queued;
+    LatencyHistogram firstByte;
+    LatencyHistogram transfer;
+    LatencyHistogram roundTrip;
+    volatile uint64_t bytes; // of the responses, lines included
+
+    void addBytes(uint64_t n)
+    {
+        __sync_fetch_and_add(&bytes, n);
+    }
+};
+
+/// the CommandLatency of every command seen so far. a command is added
+/// once under a lock; after that forCommand() only reads the published
+/// entries, so the recording threads never wait for each other
+class CommandLatencies
+{
+public:
+
+    /// more commands than the protocol has; the others share the last entry
+    static const int MAX_COMMANDS = 63;
+
+    CommandLatencies()
+        : size_(0)
+    {
+        for(int i = 0; i <= MAX_COMMANDS; i++)
+            commands_[i] = 0;
+    }
+
+    /// the entry of the request 'text', i.e. of its first line
+    CommandLatency & forCommand(const std::string & text)
+    {
+        std::string command = text.substr(0, text.find('\n'));
+
+        int n = size_;
+        __sync_synchronize();
+
+        for(int i = 0; i < n; i++)
+            if(commands_[i]->command == command)
+                return *commands_[i];
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+
+        for(int i = n; i < size_; i++)
+            if(commands_[i]->command == command)
+                return *commands_[i];
+
+        if(size_ == MAX_COMMANDS)
+        {
+            if(!commands_[MAX_COMMANDS])
+                commands_[MAX_COMMANDS] = new CommandLatency("(other)");
+            return *commands_[MAX_COMMANDS];
+        }
+
+        commands_[size_] = new CommandLatency(command);
+
+        /// THE ENTRY IS COMPLETE BEFORE THE READERS WITHOUT THE LOCK SEE IT
+        __sync_synchronize();
+        size_ = size_ + 1;
+
+        return *commands_[size_ - 1];
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    /// the entries published so far, in the order the commands were first seen
+    std::vector<const CommandLatency *> commands() const
+    {
+        std::vector<const CommandLatency *> commands;
+
+        int n = size_;
+        __sync_synchronize();
+
+        for(int i = 0; i < n; i++)
+            commands.push_back(commands_[i]);
+        if(n == MAX_COMMANDS && commands_[MAX_COMMANDS])
+            commands.push_back(commands_[MAX_COMMANDS]);
+
+        return commands;
+    }
+
+    /// one line per command and phase: the samples, percentiles and the
+    /// maximum in [us], every line prefixed with 'prefix'
+    void report(std::ostream & out, const std::string & prefix = "latency: ") const
+    {
+        out << prefix << std::left << std::setw(32) << "command" << std::setw(12) << "phase" << std::right
+            << std::setw(10) << "samples" << std::setw(11) << "mean" << std::setw(11) << "p50"
+            << std::setw(11) << "p90" << std::setw(11) << "p99" << std::setw(11) << "p99.9"
+            << std::setw(11) << "max" << " [us]" << std::endl;
+
+        std::vector<const CommandLatency *> all = commands();
+
+        for(std::size_t i = 0; i < all.size(); i++)
+        {
+            const CommandLatency * c = all[i];
+
+            line(out, prefix, c->command, "queued", c->queued);
+            line(out, prefix, "", "first byte", c->firstByte);
+            line(out, prefix, "", "transfer", c->transfer);
+            line(out, prefix, "", "round trip", c->roundTrip);
+
+            if(c->bytes > 0)
+                out << prefix << std::setw(32) << "" << c->bytes << " bytes received" << std::endl;
+        }
+    }
+
+    /// report() as a string, e.g. for the reply of a daemon command
+    std::string report(const std::string & prefix = "latency: ") const
+    {
+        std::stringstream ss;
+        report(ss, prefix);
+        return ss.str();
+    }
+
+private:
+    CommandLatencies(const CommandLatencies &);
+    CommandLatencies & operator=(const CommandLatencies &);
+
+    static void line(std::ostream & out, const std::string & prefix, const std::string & command,
+                     const char * phase, const LatencyHistogram & h)
+    {
+        /// E.G. NO FIRST BYTE OF A COMMAND WITHOUT A RESPONSE
+        if(h.count() == 0)
+            return;
+
+        out << prefix << std::left << std::setw(32) << command << std::setw(12) << phase << std::right
+            << std::setw(10) << h.count() << std::fixed << std::setprecision(1)
+            << std::setw(11) << h.mean() / 1E3
+            << std::setw(11) << h.percentile(0.50) / 1E3
+            << std::setw(11) << h.percentile(0.90) / 1E3
+            << std::setw(11) << h.percentile(0.99) / 1E3
+            << std::setw(11) << h.percentile(0.999) / 1E3
+            << std::setw(11) << h.max() / 1E3 << std::endl;
+        out.unsetf(std::ios::fixed);
+    }
+
+    CommandLatency * commands_[MAX_COMMANDS + 1]; // never freed, see commandLatencies()
+    volatile int size_;
+    boost::mutex mutex_;
+};
+
+/// the latencies of the commands of every multiplexer of the process. never
+/// destroyed, so they can still be printed from an atexit() handler
+inline CommandLatencies & commandLatencies()
+{
+    static CommandLatencies * latencies = new CommandLatencies();
+    return *latencies;
+}
+
+/// prints the latencies of the commands, if any were sent; for atexit(),
+/// so they are printed also when the session ends with exit()
+inline void printCommandLatencies()
+{
+    if(!commandLatencies().empty())
+        commandLatencies().report(std::cout);
+}
+
+#endif // COMMAND_LATENCY_HPP
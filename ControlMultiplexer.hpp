@@ -0,0 +1,517 @@
+#ifndef CONTROL_MULTIPLEXER_HPP
+#define CONTROL_MULTIPLEXER_HPP
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/future.hpp>
+#include <sys/socket.h>
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "AcquisitionMetrics.hpp"
+#include "Checksum.hpp"
+#include "CommandLatency.hpp"
+#include "Placement.hpp"
+#include "SocketJournal.hpp"
+
+/// [bytes] received from the socket at a time and checksummed at once,
+/// while the data are still in the cache
+const std::size_t RECEIVE_PIECE = 256 * 1024;
+
+/// moves up to 'bytes' bytes which 'read_until' has already pulled into
+/// 'buffer' to 'dst', adding them to 'crc'; returns their number
+inline std::size_t takeBuffered(boost::asio::streambuf & buffer, char * dst, std::size_t bytes, uint32_t & crc)
+{
+    std::size_t buffered = std::min(bytes, buffer.size());
+
+    if(buffered > 0)
+    {
+        boost::asio::buffer_copy(boost::asio::buffer(dst, buffered), buffer.data());
+        buffer.consume(buffered);
+        crc = crc32c(dst, buffered, crc);
+    }
+
+    return buffered;
+}
+
+/// reads exactly 'bytes' bytes of data following a line read into 'buffer'
+/// to 'dst' and returns their CRC32C; the bytes already in 'buffer' come
+/// first, the rest is read piece by piece and every piece is checksummed
+/// as soon as it has arrived; 'tap' gets the bytes as they are taken
+inline uint32_t receiveChecksummed(boost::asio::ip::tcp::socket & socket, boost::asio::streambuf & buffer,
+                                   char * dst, std::size_t bytes, const JournalTap & tap = JournalTap())
+{
+    uint32_t crc = 0;
+    std::size_t buffered = takeBuffered(buffer, dst, bytes, crc);
+    tap.received(dst, buffered);
+    dst += buffered;
+    bytes -= buffered;
+
+    while(bytes > 0)
+    {
+        std::size_t got = socket.read_some(boost::asio::buffer(dst, std::min(bytes, RECEIVE_PIECE)));
+        crc = crc32c(dst, got, crc);
+        tap.received(dst, got);
+        dst += got;
+        bytes -= got;
+    }
+
+    return crc;
+}
+
+/// what follows a request on the control socket
+enum CONTROL_RESPONSE
+{
+    CONTROL_NO_RESPONSE, // nothing, e.g. 'bye' or 'getPostMortemData' (answered on POST_MORTEM_SOCKET)
+    CONTROL_LINE, // one line, the status or a token such as "welcome"
+    CONTROL_HISTOGRAM // a size line, the histogram and the status line
+};
+
+enum CONTROL_PRIORITY
+{
+    CONTROL_NORMAL,
+    CONTROL_URGENT // sent before every queued normal request, e.g. 'stopAcquisition'
+};
+
+/// one command of the control protocol: the name line and one line per argument
+struct ControlRequest
+{
+    explicit ControlRequest(const std::string & name, CONTROL_RESPONSE response = CONTROL_LINE,
+                            CONTROL_PRIORITY priority = CONTROL_NORMAL)
+        : text(name + "\n"), response(response), priority(priority)
+    {}
+
+    template <typename T>
+    ControlRequest & arg(const T & value)
+    {
+        text += boost::lexical_cast<std::string>(value) + "\n";
+        return *this;
+    }
+
+    std::string text; // as sent, in a single write
+    CONTROL_RESPONSE response;
+    CONTROL_PRIORITY priority;
+};
+
+struct ControlResponse
+{
+    std::string line; // the response line, the status line after a histogram
+    std::vector<int32_t> histogram; // CONTROL_HISTOGRAM only
+    uint32_t crc; // CRC32C of the histogram as received
+};
+
+typedef boost::shared_future<ControlResponse> ControlFuture;
+
+/// called from the thread of the multiplexer when a request is done, or
+/// from the thread of submit() when the multiplexer is already closed;
+/// 'error' is empty on success. it is called without a lock held, so it may
+/// submit the next request; an exception it throws is logged and dropped
+typedef boost::function<void (const ControlResponse &, const std::string & error)> ControlHandler;
+
+/// runs a function on some thread later, e.g. io_service::post
+typedef boost::function<void (const boost::function<void ()> &)> ControlExecutor;
+
+/// owns the control socket once it is connected: any thread submits
+/// requests and gets a future (and optionally a handler call) back. a
+/// single thread sends every request in one write and reads its whole
+/// response before the next one, so the commands of different threads
+/// never interleave and every response goes back to its request. urgent
+/// requests jump ahead of the queued normal ones, not of the request in
+/// flight.
+///
+/// with an executor the multiplexer has no thread of its own: the queue is
+/// drained by a function given to the executor whenever requests arrive,
+/// so the many multiplexers of a DeviceManager share the threads of one
+/// io_service and an idle device costs no thread.
+///
+/// every request is timed, see CommandLatency.hpp; with a journal the
+/// requests and every byte of the responses are also recorded, see SocketJournal.hpp.
+class ControlMultiplexer
+{
+public:
+
+    ControlMultiplexer(boost::asio::ip::tcp::socket & socket, boost::asio::streambuf & buffer,
+                       ControlExecutor executor = ControlExecutor(), JournalTap tap = JournalTap())
+        : socket_(socket), buffer_(buffer), executor_(executor), tap_(tap), closed_(false), busy_(false), draining_(false)
+    {
+        if(!executor_)
+            thread_ = boost::thread(boost::bind(&ControlMultiplexer::worker, this));
+    }
+
+    ~ControlMultiplexer()
+    {
+        close();
+    }
+
+    ControlFuture submit(const ControlRequest & request, ControlHandler handler = ControlHandler())
+    {
+        Pending p;
+        p.request = request;
+        p.promise.reset(new boost::promise<ControlResponse>());
+        p.handler = handler;
+        p.submitted = LatencyClock::now();
+
+        ControlFuture future(p.promise->get_future());
+        bool drain = false;
+        std::string error;
+
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+
+            if(closed_)
+                error = closedError();
+            else
+            {
+                (request.priority == CONTROL_URGENT ? urgent_ : normal_).push_back(p);
+                gaugeMetric(acquisitionMetrics().controlQueue, 1);
+
+                if(executor_ && !draining_)
+                    drain = draining_ = true;
+            }
+        }
+
+        if(!error.empty())
+            fail(p, error);
+        else if(drain)
+            executor_(boost::bind(&ControlMultiplexer::drain, this));
+        else
+            wakeup_.notify_one();
+
+        return future;
+    }
+
+    /// restricts the thread of the multiplexer to 'cpus', see Placement.hpp;
+    /// false with an executor
+    bool setAffinity(const std::vector<int> & cpus)
+    {
+        return !executor_ && setThreadAffinity(thread_.native_handle(), cpus);
+    }
+
+    /// fails the queued requests and stops the thread; a request in
+    /// flight is interrupted by shutting the socket down. with an executor
+    /// it waits for a drain under way, so the executor must still run
+    void close()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            closed_ = true;
+
+            if(busy_)
+                ::shutdown(socket_.native_handle(), SHUT_RDWR);
+        }
+
+        wakeup_.notify_one();
+
+        if(thread_.joinable())
+            thread_.join();
+
+        std::vector<Pending> failed;
+        std::string error;
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while(draining_)
+                drained_.wait(lock);
+
+            error = takeQueued(failed);
+        }
+
+        failAll(failed, error);
+    }
+
+private:
+
+    struct Pending
+    {
+        ControlRequest request;
+        boost::shared_ptr<boost::promise<ControlResponse> > promise;
+        ControlHandler handler;
+        LatencyClock::time_point submitted;
+
+        Pending() : request("") {}
+    };
+
+    void worker()
+    {
+        for(;;)
+        {
+            Pending p;
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex_);
+
+                while(urgent_.empty() && normal_.empty() && !closed_)
+                    wakeup_.wait(lock);
+
+                if(closed_)
+                    break;
+
+                p = next();
+            }
+
+            process(p);
+        }
+
+        std::vector<Pending> failed;
+        std::string error;
+
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            error = takeQueued(failed);
+        }
+
+        failAll(failed, error);
+    }
+
+    /// the thread of the multiplexer with an executor: runs until the queue is empty
+    void drain()
+    {
+        for(;;)
+        {
+            Pending p;
+
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+
+                if(closed_)
+                    break;
+
+                if(urgent_.empty() && normal_.empty())
+                {
+                    draining_ = false;
+                    drained_.notify_all();
+                    return;
+                }
+
+                p = next();
+            }
+
+            process(p);
+        }
+
+        /// CLOSED: THE REQUESTS LEFT ARE FAILED BEFORE close() STOPS WAITING FOR THE DRAIN
+        std::vector<Pending> failed;
+        std::string error;
+
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            error = takeQueued(failed);
+        }
+
+        failAll(failed, error);
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        draining_ = false;
+        drained_.notify_all();
+    }
+
+    /// the next request, urgent ones first; called with 'mutex_' held
+    Pending next()
+    {
+        std::deque<Pending> & queue = urgent_.empty() ? normal_ : urgent_;
+        Pending p = queue.front();
+        queue.pop_front();
+        gaugeMetric(acquisitionMetrics().controlQueue, -1);
+        busy_ = true;
+        return p;
+    }
+
+    /// the request 'p' on the socket; its promise and handler are completed
+    /// after the lock is released, so a handler may submit again
+    void process(Pending & p)
+    {
+        ControlResponse response;
+        std::string error;
+
+        try
+        {
+            response = transact(p.request, p.submitted);
+        }
+        catch(std::exception & e)
+        {
+            error = std::string("ControlMultiplexer: ") + e.what();
+        }
+
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            busy_ = false;
+
+            /// THE STREAM IS OUT OF STEP WITH THE REQUESTS, NOTHING MORE CAN BE SENT
+            if(!error.empty())
+            {
+                error_ = error;
+                closed_ = true;
+            }
+        }
+
+        if(error.empty())
+            complete(p, response);
+        else
+            fail(p, error);
+    }
+
+    /// the error of a closed multiplexer; called with 'mutex_' held
+    std::string closedError() const
+    {
+        return error_.empty() ? "ControlMultiplexer: closed" : error_;
+    }
+
+    /// moves the requests left at close to 'failed', for failAll() once
+    /// the lock is released, and returns their error; called with 'mutex_' held
+    std::string takeQueued(std::vector<Pending> & failed)
+    {
+        gaugeMetric(acquisitionMetrics().controlQueue, -(int)(urgent_.size() + normal_.size()));
+
+        failed.insert(failed.end(), urgent_.begin(), urgent_.end());
+        failed.insert(failed.end(), normal_.begin(), normal_.end());
+        urgent_.clear();
+        normal_.clear();
+
+        return closedError();
+    }
+
+    ControlResponse transact(const ControlRequest & request, LatencyClock::time_point submitted)
+    {
+        ControlResponse response;
+        response.crc = 0;
+
+        CommandLatency & latency = commandLatencies().forCommand(request.text);
+
+        std::cout << "\n\n ..  SENDING : " << request.text << "\n" << std::endl;
+
+        LatencyClock::time_point written = LatencyClock::now();
+        latency.queued.record(elapsedNs(submitted, written));
+
+        tap_.sent(request.text);
+        boost::asio::write(socket_, boost::asio::buffer(request.text));
+
+        if(request.response == CONTROL_NO_RESPONSE)
+        {
+            latency.roundTrip.record(elapsedNs(written, LatencyClock::now()));
+            return response;
+        }
+
+        /// THE FIRST BYTE, UNLESS IT CAME WITH THE LAST RESPONSE
+        if(buffer_.size() == 0)
+            socket_.read_some(boost::asio::null_buffers());
+
+        LatencyClock::time_point firstByte = LatencyClock::now();
+        std::size_t bytes = 0;
+
+        if(request.response == CONTROL_HISTOGRAM)
+        {
+            std::string sizeLine = readLine("Received size: ");
+            int size = boost::lexical_cast<int>(sizeLine);
+            response.histogram.resize(size / sizeof(int32_t));
+            bytes += sizeLine.size() + 1;
+
+            if(size > 0)
+                response.crc = receiveChecksummed(socket_, buffer_, reinterpret_cast<char *>(&response.histogram[0]),
+                                                  response.histogram.size() * sizeof(int32_t), tap_);
+            bytes += response.histogram.size() * sizeof(int32_t);
+        }
+
+        response.line = readLine("Received: ");
+        bytes += response.line.size() + 1;
+
+        LatencyClock::time_point done = LatencyClock::now();
+        latency.firstByte.record(elapsedNs(written, firstByte));
+        latency.transfer.record(elapsedNs(firstByte, done));
+        latency.roundTrip.record(elapsedNs(written, done));
+        latency.addBytes(bytes);
+
+        AcquisitionMetrics & metrics = acquisitionMetrics();
+        countMetric(metrics.controlBytes, bytes);
+
+        if(request.response == CONTROL_HISTOGRAM)
+        {
+            countMetric(metrics.histogramsPolled);
+            rateMetric(metrics.histogramBytesPerS, bytes, elapsedNs(firstByte, done));
+        }
+
+        return response;
+    }
+
+    std::string readLine(const char * label)
+    {
+        boost::asio::read_until(socket_, buffer_, '\n');
+
+        std::string line;
+        std::istream is(&buffer_);
+        std::getline(is, line);
+        tap_.receivedLine(line);
+
+        std::cout << label << line << "\n";
+        return line;
+    }
+
+    static void complete(Pending & p, const ControlResponse & response)
+    {
+        p.promise->set_value(response);
+        callHandler(p, response, "");
+    }
+
+    static void fail(Pending & p, const std::string & error)
+    {
+        countMetric(acquisitionMetrics().droppedRequests);
+
+        p.promise->set_exception(boost::copy_exception(std::runtime_error(error)));
+        callHandler(p, ControlResponse(), error);
+    }
+
+    static void failAll(std::vector<Pending> & failed, const std::string & error)
+    {
+        for(std::size_t i = 0; i < failed.size(); i++)
+            fail(failed[i], error);
+    }
+
+    /// the promise is already satisfied: an exception of the handler concerns
+    /// the caller only and must neither close the multiplexer nor end its thread
+    static void callHandler(Pending & p, const ControlResponse & response, const std::string & error)
+    {
+        if(!p.handler)
+            return;
+
+        try
+        {
+            p.handler(response, error);
+        }
+        catch(std::exception & e)
+        {
+            std::cout << "ControlMultiplexer: the handler of '" << p.request.text.substr(0, p.request.text.find('\n'))
+                      << "' failed: " << e.what() << std::endl;
+        }
+    }
+
+private:
+    boost::asio::ip::tcp::socket & socket_;
+    boost::asio::streambuf & buffer_;
+    ControlExecutor executor_;
+    JournalTap tap_;
+    boost::thread thread_; // without an executor
+    boost::mutex mutex_;
+    boost::condition_variable wakeup_;
+    boost::condition_variable drained_;
+    std::deque<Pending> urgent_;
+    std::deque<Pending> normal_;
+    bool closed_;
+    bool busy_; // a request is in flight
+    bool draining_; // drain() is queued on the executor or running
+    std::string error_;
+};
+
+#endif // CONTROL_MULTIPLEXER_HPP
@@ -0,0 +1,212 @@
+#ifndef CONTROL_SEQUENCE_HPP
+#define CONTROL_SEQUENCE_HPP
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ControlMultiplexer.hpp"
+
+/// acquisition sequences as stackless coroutines: the body of step() reads
+/// like the blocking sequences, but every SEQUENCE_AWAIT() starts an
+/// operation and returns to the event loop; the completion of the operation
+/// enters step() again right after it. many sequences thus run on the one
+/// thread of an io_service, each costing an object and no stack.
+///
+///     void step()
+///     {
+///         SEQUENCE_REENTER
+///         {
+///             SEQUENCE_AWAIT(setupHistogram(threshold_));
+///             expect(RESPONSE_OK);
+///
+///             for(i_ = 0; i_ < n_; i_++)
+///             {
+///                 SEQUENCE_AWAIT(getHistogram());
+///                 use(response());
+///             }
+///         }
+///     }
+///
+/// as with the coroutines of asio (which come after Boost 1.53) step() is
+/// a switch on the resume point: the locals of step() do not survive an
+/// await, the state of a sequence lives in its members.
+
+#define SEQUENCE_REENTER switch(resumePoint_) case 0:
+
+#define SEQUENCE_AWAIT(operation) \
+    do \
+    { \
+        resumePoint_ = __LINE__; \
+        suspended_ = true; \
+        operation; \
+        return; \
+        case __LINE__: ; \
+    } \
+    while(0)
+
+/// one sequence of commands on CONTROL_SOCKET; an error of an awaited
+/// operation is thrown from the event loop, i.e. from io_service::run()
+class ControlSequence : public boost::enable_shared_from_this<ControlSequence>
+{
+public:
+
+    ControlSequence(const std::string & name, ControlMultiplexer & control, boost::asio::io_service & io_service)
+        : resumePoint_(0), suspended_(false), name_(name), control_(control), io_service_(io_service),
+        timer_(io_service), finished_(false)
+    {}
+
+    virtual ~ControlSequence()
+    {}
+
+    /// runs the sequence from the event loop of the io_service; it keeps
+    /// io_service::run() going until it ends
+    void start()
+    {
+        work_.reset(new boost::asio::io_service::work(io_service_));
+        io_service_.post(boost::bind(&ControlSequence::resume, shared_from_this(), std::string()));
+    }
+
+    bool finished() const
+    {
+        return finished_;
+    }
+
+    const std::string & name() const
+    {
+        return name_;
+    }
+
+protected:
+
+    /// the body of the sequence, see above
+    virtual void step() = 0;
+
+    /// awaitable: sends 'request'; response() holds the response afterwards
+    void request(const ControlRequest & request)
+    {
+        control_.submit(request, boost::bind(&ControlSequence::post_response, shared_from_this(), _1, _2));
+    }
+
+    /// awaitable
+    void setupHistogram(double threshold)
+    {
+        request(ControlRequest("procedure setupHistogram").arg(0).arg(threshold));
+    }
+
+    /// awaitable: the histogram is in response().histogram
+    void getHistogram()
+    {
+        request(ControlRequest("function getHistogram", CONTROL_HISTOGRAM).arg(0));
+    }
+
+    /// awaitable
+    void stopAcquisition()
+    {
+        request(ControlRequest("procedure stopAcquisition", CONTROL_LINE, CONTROL_URGENT).arg(0));
+    }
+
+    /// awaitable
+    void sleep(long ms)
+    {
+        timer_.expires_from_now(boost::posix_time::milliseconds(ms));
+        timer_.async_wait(boost::bind(&ControlSequence::handle_timer, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    /// completion handler for any other operation awaited; the operation
+    /// calls it once, with an empty string on success
+    boost::function<void (const std::string &)> resumer()
+    {
+        return boost::bind(&ControlSequence::post_resume, shared_from_this(), _1);
+    }
+
+    const ControlResponse & response() const
+    {
+        return response_;
+    }
+
+    /// throws unless the last response contains 'token'
+    void expect(const std::string & token) const
+    {
+        if(response_.line.find(token) == std::string::npos)
+            throw std::runtime_error(name_ + ": expected " + token + ", received " + response_.line);
+    }
+
+protected:
+    int resumePoint_; // SEQUENCE_REENTER / SEQUENCE_AWAIT
+    bool suspended_;
+
+private:
+
+    /// called by the thread of the multiplexer: back to the event loop
+    void post_response(const ControlResponse & response, const std::string & error)
+    {
+        io_service_.post(boost::bind(&ControlSequence::handle_response, shared_from_this(), response, error));
+    }
+
+    void handle_response(const ControlResponse & response, const std::string & error)
+    {
+        response_ = response;
+        resume(error);
+    }
+
+    void handle_timer(const boost::system::error_code & ec)
+    {
+        resume(ec ? ec.message() : std::string());
+    }
+
+    void post_resume(const std::string & error)
+    {
+        io_service_.post(boost::bind(&ControlSequence::resume, shared_from_this(), error));
+    }
+
+    void resume(const std::string & error)
+    {
+        if(!error.empty())
+        {
+            work_.reset();
+            throw std::runtime_error(name_ + ": " + error);
+        }
+
+        suspended_ = false;
+        step();
+
+        /// FELL OFF THE END OF step()
+        if(!suspended_)
+        {
+            finished_ = true;
+            work_.reset();
+        }
+    }
+
+private:
+    std::string name_;
+    ControlMultiplexer & control_;
+    boost::asio::io_service & io_service_;
+    boost::asio::deadline_timer timer_;
+    std::auto_ptr<boost::asio::io_service::work> work_;
+    ControlResponse response_;
+    bool finished_;
+};
+
+/// runs 'sequences' concurrently on the calling thread and returns when all have ended
+inline void runSequences(boost::asio::io_service & io_service, const std::vector<boost::shared_ptr<ControlSequence> > & sequences)
+{
+    /// THE io_service MAY HAVE RUN OUT OF WORK BEFORE
+    io_service.reset();
+
+    for(std::size_t i = 0; i < sequences.size(); i++)
+        sequences[i]->start();
+
+    io_service.run();
+}
+
+#endif // CONTROL_SEQUENCE_HPP
@@ -0,0 +1,267 @@
+#ifndef DAEMON_SOCKET_HPP
+#define DAEMON_SOCKET_HPP
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// the command socket of the daemon mode: a UNIX stream socket on which
+/// local programs send one command per line and get one reply per command.
+/// the commands of a connection are handled one after the other, a reply
+/// may be sent later from the event loop (e.g. after a round trip to the
+/// ROSY); the replies end with an empty line, so they can span lines.
+///
+///     $ Client rosy.sock SEND status
+///
+/// everything runs on the io_service of the client, no thread is added.
+
+/// called for every command line; 'reply' is called once with the reply,
+/// from the event loop
+typedef boost::function<void (const std::string & reply)> DaemonReply;
+typedef boost::function<void (const std::string & command, const DaemonReply & reply)> DaemonHandler;
+
+namespace detail
+{
+
+/// one connection to the command socket
+class DaemonConnection : public boost::enable_shared_from_this<DaemonConnection>
+{
+public:
+
+    DaemonConnection(boost::asio::io_service & io_service, const DaemonHandler & handler)
+        : socket_(io_service), handler_(handler)
+    {}
+
+    boost::asio::local::stream_protocol::socket & socket()
+    {
+        return socket_;
+    }
+
+    void readCommand()
+    {
+        boost::asio::async_read_until(socket_, buffer_, '\n',
+            boost::bind(&DaemonConnection::handle_command, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    /// no more commands are read; a reply being sent is still completed
+    void stopReading()
+    {
+        boost::system::error_code ec;
+        socket_.shutdown(boost::asio::local::stream_protocol::socket::shutdown_receive, ec);
+    }
+
+private:
+
+    void handle_command(const boost::system::error_code & ec)
+    {
+        /// THE PEER HAS GONE, NOTHING MORE TO DO
+        if(ec)
+            return;
+
+        std::string command;
+        std::istream is(&buffer_);
+        std::getline(is, command);
+
+        if(!command.empty() && command[command.size() - 1] == '\r')
+            command.erase(command.size() - 1);
+
+        if(command.empty())
+        {
+            readCommand();
+            return;
+        }
+
+        handler_(command, boost::bind(&DaemonConnection::send_reply, shared_from_this(), _1));
+    }
+
+    void send_reply(const std::string & reply)
+    {
+        reply_ = reply;
+        if(reply_.empty() || reply_[reply_.size() - 1] != '\n')
+            reply_ += "\n";
+        reply_ += "\n";
+
+        boost::asio::async_write(socket_, boost::asio::buffer(reply_),
+            boost::bind(&DaemonConnection::handle_reply, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void handle_reply(const boost::system::error_code & ec)
+    {
+        if(!ec)
+            readCommand();
+    }
+
+private:
+    boost::asio::local::stream_protocol::socket socket_;
+    boost::asio::streambuf buffer_;
+    std::string reply_; // kept until written
+    DaemonHandler handler_;
+};
+
+/// removes the socket file of a daemon which has ended without close();
+/// anything else at 'path', a file which is not a socket or the socket of
+/// a daemon still running, is left alone and throws
+inline void removeStaleSocket(const std::string & path)
+{
+    struct stat st;
+    if(::lstat(path.c_str(), &st) != 0)
+    {
+        if(errno == ENOENT)
+            return;
+        throw std::runtime_error("DaemonSocket: cannot stat " + path + ": " + std::strerror(errno));
+    }
+
+    if(!S_ISSOCK(st.st_mode))
+        throw std::runtime_error("DaemonSocket: " + path + " exists and is not a socket");
+
+    /// ONLY A SOCKET NOBODY LISTENS ON ANY MORE IS STALE
+    boost::asio::io_service io_service;
+    boost::asio::local::stream_protocol::socket probe(io_service);
+    boost::system::error_code ec;
+    probe.connect(boost::asio::local::stream_protocol::endpoint(path), ec);
+
+    if(ec != boost::asio::error::connection_refused)
+        throw std::runtime_error("DaemonSocket: daemon already running on " + path);
+
+    ::unlink(path.c_str());
+}
+
+} // namespace detail
+
+/// listens on the UNIX socket 'path'; a stale socket file of an earlier
+/// daemon is replaced, the file is removed again by close()
+class DaemonSocket
+{
+public:
+
+    DaemonSocket(boost::asio::io_service & io_service, const std::string & path, const DaemonHandler & handler)
+        : io_service_(io_service), acceptor_(io_service), path_(path), handler_(handler)
+    {
+        detail::removeStaleSocket(path);
+
+        boost::asio::local::stream_protocol::endpoint endpoint(path);
+        acceptor_.open(endpoint.protocol());
+        acceptor_.bind(endpoint);
+        acceptor_.listen();
+
+        accept();
+    }
+
+    ~DaemonSocket()
+    {
+        close();
+    }
+
+    const std::string & path() const
+    {
+        return path_;
+    }
+
+    /// stops accepting connections and reading commands, so the event loop
+    /// runs out of work once the replies under way are sent
+    void close()
+    {
+        if(!acceptor_.is_open())
+            return;
+
+        boost::system::error_code ec;
+        acceptor_.close(ec);
+        ::unlink(path_.c_str());
+
+        for(std::size_t i = 0; i < connections_.size(); i++)
+            if(boost::shared_ptr<detail::DaemonConnection> connection = connections_[i].lock())
+                connection->stopReading();
+
+        connections_.clear();
+    }
+
+private:
+
+    void accept()
+    {
+        boost::shared_ptr<detail::DaemonConnection> connection(new detail::DaemonConnection(io_service_, handler_));
+
+        acceptor_.async_accept(connection->socket(),
+            boost::bind(&DaemonSocket::handle_accept, this, connection, boost::asio::placeholders::error));
+    }
+
+    void handle_accept(boost::shared_ptr<detail::DaemonConnection> connection, const boost::system::error_code & ec)
+    {
+        /// CLOSED
+        if(ec == boost::asio::error::operation_aborted || !acceptor_.is_open())
+            return;
+
+        if(!ec)
+        {
+            /// FORGET THE CONNECTIONS WHICH HAVE ENDED
+            std::vector<boost::weak_ptr<detail::DaemonConnection> > open;
+            for(std::size_t i = 0; i < connections_.size(); i++)
+                if(!connections_[i].expired())
+                    open.push_back(connections_[i]);
+
+            open.push_back(connection);
+            connections_.swap(open);
+
+            connection->readCommand();
+        }
+
+        accept();
+    }
+
+private:
+    boost::asio::io_service & io_service_;
+    boost::asio::local::stream_protocol::acceptor acceptor_;
+    std::string path_;
+    DaemonHandler handler_;
+    std::vector<boost::weak_ptr<detail::DaemonConnection> > connections_;
+};
+
+/// sends 'command' to the daemon listening on 'path' and returns its reply,
+/// without the empty line which ends it
+inline std::string sendDaemonCommand(const std::string & path, const std::string & command)
+{
+    boost::asio::io_service io_service;
+    boost::asio::local::stream_protocol::socket socket(io_service);
+    boost::system::error_code ec;
+
+    socket.connect(boost::asio::local::stream_protocol::endpoint(path), ec);
+    if(ec)
+        throw std::runtime_error("DaemonSocket: cannot connect to " + path + ": " + ec.message());
+
+    boost::asio::write(socket, boost::asio::buffer(command + "\n"));
+
+    boost::asio::streambuf buffer;
+    std::istream is(&buffer);
+    std::string reply, line;
+
+    for(;;)
+    {
+        boost::asio::read_until(socket, buffer, '\n');
+        std::getline(is, line);
+
+        if(line.empty())
+            break;
+
+        reply += line + "\n";
+    }
+
+    return reply;
+}
+
+#endif // DAEMON_SOCKET_HPP
@@ -0,0 +1,347 @@
+#ifndef EDGE_FINDER_HPP
+#define EDGE_FINDER_HPP
+
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROSY_HAVE_SSE2_SEARCH 1
+#endif
+
+#include "CaptureStore.hpp"
+#include "TaskPool.hpp"
+#include "VoltageConversion.hpp"
+
+/// software re-trigger: finds every threshold crossing in a post mortem channel.
+///
+/// the hysteresis band is [threshold - hysteresis/2, threshold + hysteresis/2);
+/// a rising edge is reported at the first sample at or above the band after the
+/// signal was below it, a falling edge at the first sample below the band after
+/// the signal was at or above it. the first sample outside the band only sets
+/// the initial state, the signal before it is unknown.
+
+enum EDGE_DIRECTION
+{
+    EDGE_RISING = 1, EDGE_FALLING = 2, EDGE_RISE_FALL = 3
+};
+
+/// parses the direction as used for 'triggerDirection': RISING | FALLING | RISE_FALL
+inline EDGE_DIRECTION parseEdgeDirection(const std::string & direction)
+{
+    if(direction == "RISING")
+        return EDGE_RISING;
+    if(direction == "FALLING")
+        return EDGE_FALLING;
+    if(direction == "RISE_FALL")
+        return EDGE_RISE_FALL;
+
+    throw std::runtime_error("parseEdgeDirection: unknown direction " + direction);
+}
+
+struct Edge
+{
+    uint64_t sample; // index of the sample within the channel
+    bool rising;
+};
+
+/// samples per segment scanned by one thread
+const uint64_t EDGE_SEGMENT_SAMPLES = 1 << 22;
+
+namespace detail
+{
+
+enum EDGE_STATE
+{
+    EDGE_STATE_UNKNOWN, EDGE_STATE_BELOW, EDGE_STATE_ABOVE
+};
+
+/// what to look for: samples at or above 'upper' and/or below 'lower'
+enum EDGE_SEARCH
+{
+    SEARCH_ABOVE = 1, SEARCH_BELOW = 2
+};
+
+inline std::size_t findScalar(const int16_t * p, std::size_t n, int16_t lower, int16_t upper, int search)
+{
+    for(std::size_t i = 0; i < n; i++)
+    {
+        if((search & SEARCH_ABOVE) && p[i] >= upper)
+            return i;
+        if((search & SEARCH_BELOW) && p[i] < lower)
+            return i;
+    }
+
+    return n;
+}
+
+#ifdef ROSY_HAVE_SSE2_SEARCH
+inline unsigned firstSetLane(uint32_t byteMask)
+{
+    return __builtin_ctz(byteMask) / 2;
+}
+
+inline std::size_t findSSE2(const int16_t * p, std::size_t n, int16_t lower, int16_t upper, int search)
+{
+    const __m128i lo = _mm_set1_epi16(lower);
+    const __m128i up = _mm_set1_epi16(upper);
+    const __m128i above = _mm_set1_epi16((search & SEARCH_ABOVE) ? -1 : 0);
+    const __m128i below = _mm_set1_epi16((search & SEARCH_BELOW) ? -1 : 0);
+    std::size_t i = 0;
+
+    for(; i + 8 <= n; i += 8)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        __m128i m = _mm_or_si128(_mm_andnot_si128(_mm_cmplt_epi16(x, up), above),
+                                 _mm_and_si128(_mm_cmplt_epi16(x, lo), below));
+        uint32_t bits = _mm_movemask_epi8(m);
+
+        if(bits)
+            return i + firstSetLane(bits);
+    }
+
+    return i + findScalar(p + i, n - i, lower, upper, search);
+}
+
+__attribute__((target("avx2")))
+inline std::size_t findAVX2(const int16_t * p, std::size_t n, int16_t lower, int16_t upper, int search)
+{
+    const __m256i lo = _mm256_set1_epi16(lower);
+    const __m256i up = _mm256_set1_epi16(upper);
+    const __m256i above = _mm256_set1_epi16((search & SEARCH_ABOVE) ? -1 : 0);
+    const __m256i below = _mm256_set1_epi16((search & SEARCH_BELOW) ? -1 : 0);
+    std::size_t i = 0;
+
+    /// 64 SAMPLES PER ITERATION, THE EXACT LANE IS ONLY LOOKED FOR ON A HIT
+    for(; i + 64 <= n; i += 64)
+    {
+        __m256i m[4];
+
+        for(int k = 0; k < 4; k++)
+        {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i + 16 * k));
+            m[k] = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpgt_epi16(up, x), above),
+                                   _mm256_and_si256(_mm256_cmpgt_epi16(lo, x), below));
+        }
+
+        __m256i any = _mm256_or_si256(_mm256_or_si256(m[0], m[1]), _mm256_or_si256(m[2], m[3]));
+
+        if(!_mm256_testz_si256(any, any))
+        {
+            for(int k = 0; k < 4; k++)
+            {
+                uint32_t bits = _mm256_movemask_epi8(m[k]);
+                if(bits)
+                    return i + 16 * k + firstSetLane(bits);
+            }
+        }
+    }
+
+    return i + findSSE2(p + i, n - i, lower, upper, search);
+}
+#endif
+
+typedef std::size_t (*FindKernel)(const int16_t *, std::size_t, int16_t, int16_t, int);
+
+inline FindKernel selectFindKernel()
+{
+#ifdef ROSY_HAVE_SSE2_SEARCH
+    if(__builtin_cpu_supports("avx2"))
+        return findAVX2;
+    return findSSE2;
+#else
+    return findScalar;
+#endif
+}
+
+/// result of the scan of one segment, started in an unknown state
+struct EdgeSegment
+{
+    const int16_t * data;
+    uint64_t first; // index of the first sample of the segment
+    uint64_t count;
+
+    EDGE_STATE firstState; // state set by the first sample outside the band
+    uint64_t firstSample; // index of that sample
+    EDGE_STATE lastState;
+    std::vector<Edge> edges; // edges after 'firstSample'
+};
+
+} // namespace detail
+
+/// index of the first sample at or above 'upper' and/or below 'lower', 'n' if none
+inline std::size_t findOutside(const int16_t * p, std::size_t n, int16_t lower, int16_t upper, int search)
+{
+    static const detail::FindKernel kernel = detail::selectFindKernel();
+    return kernel(p, n, lower, upper, search);
+}
+
+/// finds the edges of one channel; the channel can be passed in consecutive
+/// windows, the state is carried from one window to the next. every window
+/// is split into segments which are scanned in parallel and stitched after.
+class EdgeFinder
+{
+public:
+
+    EdgeFinder(EDGE_DIRECTION direction, int16_t lower, int16_t upper)
+        : direction_(direction), lower_(lower), upper_(std::max(lower, upper)),
+        state_(detail::EDGE_STATE_UNKNOWN), position_(0)
+    {}
+
+    /// thresholds in mV, converted to ADC counts with the range of the channel
+    EdgeFinder(EDGE_DIRECTION direction, VERTICAL_RANGE range, double thresholdMv, double hysteresisMv, double offsetMv = 0)
+        : direction_(direction),
+        lower_(millivoltsToCounts(range, thresholdMv - offsetMv - hysteresisMv / 2)),
+        upper_(millivoltsToCounts(range, thresholdMv - offsetMv + hysteresisMv / 2)),
+        state_(detail::EDGE_STATE_UNKNOWN), position_(0)
+    {}
+
+    void scan(const int16_t * data, uint64_t n)
+    {
+        std::vector<detail::EdgeSegment> segments;
+
+        for(uint64_t first = 0; first < n; first += EDGE_SEGMENT_SAMPLES)
+        {
+            detail::EdgeSegment s;
+            s.data = data + first;
+            s.first = position_ + first;
+            s.count = std::min(EDGE_SEGMENT_SAMPLES, n - first);
+            s.firstState = detail::EDGE_STATE_UNKNOWN;
+            s.firstSample = 0;
+            s.lastState = detail::EDGE_STATE_UNKNOWN;
+            segments.push_back(s);
+        }
+
+        /// SCAN THE SEGMENTS IN PARALLEL ...
+        parallelFor(0, segments.size(), 1, boost::bind(&EdgeFinder::scanSegments, this, &segments, _1, _2));
+
+        /// ... AND STITCH THEM IN ORDER
+        for(std::size_t i = 0; i < segments.size(); i++)
+        {
+            detail::EdgeSegment & s = segments[i];
+
+            if(s.firstState == detail::EDGE_STATE_UNKNOWN)
+                continue;
+
+            if(state_ != detail::EDGE_STATE_UNKNOWN && state_ != s.firstState)
+                report(s.firstSample, s.firstState == detail::EDGE_STATE_ABOVE, edges_);
+
+            edges_.insert(edges_.end(), s.edges.begin(), s.edges.end());
+            state_ = s.lastState;
+        }
+
+        position_ += n;
+    }
+
+    const std::vector<Edge> & edges() const
+    {
+        return edges_;
+    }
+
+    int16_t lower() const
+    {
+        return lower_;
+    }
+
+    int16_t upper() const
+    {
+        return upper_;
+    }
+
+private:
+
+    void scanSegments(std::vector<detail::EdgeSegment> * segments, uint64_t begin, uint64_t end) const
+    {
+        for(uint64_t i = begin; i < end; i++)
+            scanSegment((*segments)[i]);
+    }
+
+    void scanSegment(detail::EdgeSegment & s) const
+    {
+        using namespace detail;
+
+        std::size_t i = findOutside(s.data, s.count, lower_, upper_, SEARCH_ABOVE | SEARCH_BELOW);
+
+        s.firstState = EDGE_STATE_UNKNOWN;
+        s.lastState = EDGE_STATE_UNKNOWN;
+
+        if(i == s.count)
+            return;
+
+        s.firstSample = s.first + i;
+        s.firstState = (s.data[i] >= upper_) ? EDGE_STATE_ABOVE : EDGE_STATE_BELOW;
+        s.lastState = s.firstState;
+
+        for(;;)
+        {
+            bool above = (s.lastState == EDGE_STATE_ABOVE);
+            std::size_t j = findOutside(s.data + i, s.count - i, lower_, upper_, above ? SEARCH_BELOW : SEARCH_ABOVE);
+
+            if(j == s.count - i)
+                return;
+
+            i += j;
+            s.lastState = above ? EDGE_STATE_BELOW : EDGE_STATE_ABOVE;
+            report(s.first + i, !above, s.edges);
+        }
+    }
+
+    void report(uint64_t sample, bool rising, std::vector<Edge> & edges) const
+    {
+        if(rising ? (direction_ & EDGE_RISING) : (direction_ & EDGE_FALLING))
+        {
+            Edge e = { sample, rising };
+            edges.push_back(e);
+        }
+    }
+
+private:
+    EDGE_DIRECTION direction_;
+    int16_t lower_;
+    int16_t upper_;
+    detail::EDGE_STATE state_;
+    uint64_t position_;
+    std::vector<Edge> edges_;
+};
+
+/// finds the edges of all the channels of a capture and saves them to 'path'
+/// as text: channel , sample , time [s] , RISING | FALLING; the channels
+/// are scanned window by window within the memory budget
+inline void saveCaptureEdges(CaptureStore & capture, const std::string & direction,
+                             double thresholdMv, double hysteresisMv, const std::string & path)
+{
+    std::fstream out(path.c_str(), std::fstream::out);
+    double period = capture.header().effectiveSamplingPeriod;
+
+    for(int c = 0; c < capture.numberOfChannels(); c++)
+    {
+        EdgeFinder finder(parseEdgeDirection(direction), capture.channelRange(c), thresholdMv, hysteresisMv);
+        uint64_t n = capture.samplesPerChannel();
+
+        for(uint64_t first = 0; first < n; first += capture.windowSamples())
+        {
+            uint64_t count = std::min(capture.windowSamples(), n - first);
+            finder.scan(capture.window(c, first, count), count);
+        }
+
+        const std::vector<Edge> & edges = finder.edges();
+
+        for(std::size_t i = 0; i < edges.size(); i++)
+            out << capture.channelName(c) << " , " << edges[i].sample << " , " << edges[i].sample * period
+                << " , " << (edges[i].rising ? "RISING" : "FALLING") << "\n";
+
+        std::cout << "channel " << capture.channelName(c) << " : " << edges.size() << " " << direction
+                  << " edges at " << thresholdMv << " mV, hysteresis " << hysteresisMv << " mV" << std::endl;
+    }
+
+    if(!out)
+        throw std::runtime_error("saveCaptureEdges: cannot write " + path);
+}
+
+#endif // EDGE_FINDER_HPP
@@ -0,0 +1,291 @@
+#ifndef JOURNAL_PLAYER_HPP
+#define JOURNAL_PLAYER_HPP
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <sys/socket.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "CommandLatency.hpp"
+#include "SocketJournal.hpp"
+
+/// the ROSY of a journal: the client connects to it on the loopback
+/// interface as to the device and gets the recorded traffic back, byte for
+/// byte, so a session runs again on the same data. every recorded request
+/// must come again before what was received after it is replayed: the
+/// responses follow their requests, and the post mortem data follow the
+/// request they were received after. a request which differs from the
+/// journal ends the replay.
+///
+/// with 'timed' the bytes keep their times after the last request, as
+/// recorded; otherwise they are sent as fast as possible, so the client
+/// runs at its own maximum rate, whatever the link was.
+class JournalPlayer
+{
+public:
+
+    JournalPlayer(const std::string & path, bool timed)
+        : path_(path), timed_(timed), control_(io_service_), postMortem_(io_service_),
+        controlSocket_(io_service_), postMortemSocket_(io_service_),
+        requests_(0), anchorNs_(0), stopped_(false), bytes_(0)
+    {
+        JournalReader reader(path);
+        header_ = reader.header();
+
+        listen(control_);
+        listen(postMortem_);
+
+        anchor_ = anchorAt_ = LatencyClock::now();
+        controlThread_ = boost::thread(boost::bind(&JournalPlayer::playControl, this));
+        postMortemThread_ = boost::thread(boost::bind(&JournalPlayer::playPostMortem, this));
+
+        std::cout << "JournalPlayer: " << path << ", mode " << header_.mode << ", replayed "
+                  << (timed ? "at the original timing" : "as fast as possible") << " on 127.0.0.1, ports "
+                  << controlPort() << " and " << postMortemPort() << std::endl;
+    }
+
+    ~JournalPlayer()
+    {
+        stop();
+    }
+
+    const JournalFileHeader & header() const
+    {
+        return header_;
+    }
+
+    int controlPort() const
+    {
+        return control_.local_endpoint().port();
+    }
+
+    int postMortemPort() const
+    {
+        return postMortem_.local_endpoint().port();
+    }
+
+    /// closes the connections, waits for the threads and prints what was replayed
+    void stop()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+
+            if(stopped_)
+                return;
+
+            stopped_ = true;
+            requestArrived_.notify_all();
+        }
+
+        /// WAKES THE BLOCKING accept() AND read() CALLS UP
+        ::shutdown(control_.native_handle(), SHUT_RDWR);
+        ::shutdown(postMortem_.native_handle(), SHUT_RDWR);
+        ::shutdown(controlSocket_.native_handle(), SHUT_RDWR);
+        ::shutdown(postMortemSocket_.native_handle(), SHUT_RDWR);
+
+        controlThread_.join();
+        postMortemThread_.join();
+
+        double seconds = elapsedNs(anchor_, finished_) / 1E9;
+
+        std::cout << "JournalPlayer: " << requests_ << " requests, " << bytes_ << " bytes replayed in "
+                  << seconds << " s, " << (seconds > 0 ? bytes_ / seconds / 1E6 : 0) << " MB/s" << std::endl;
+        if(!error_.empty())
+            std::cout << "JournalPlayer: " << error_ << std::endl;
+    }
+
+private:
+
+    typedef boost::asio::ip::tcp tcp;
+
+    void listen(tcp::acceptor & acceptor)
+    {
+        /// A FREE PORT, SO A REPLAY NEVER MEETS A DEVICE OR A SIMULATOR
+        tcp::endpoint endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0);
+
+        acceptor.open(endpoint.protocol());
+        acceptor.bind(endpoint);
+        acceptor.listen();
+    }
+
+    /// the requests and responses, in the order of the journal
+    void playControl()
+    {
+        try
+        {
+            boost::system::error_code ec;
+            control_.accept(controlSocket_, ec);
+            if(ec)
+                return;
+
+            controlSocket_.set_option(tcp::no_delay(true));
+
+            JournalReader reader(path_);
+            JournalRecordHeader record;
+            std::vector<char> data;
+            std::vector<char> request;
+
+            while(reader.next(JOURNAL_CONTROL_SOCKET, record, data))
+            {
+                if(record.direction == JOURNAL_SENT)
+                {
+                    request.resize(data.size());
+                    if(!request.empty())
+                        boost::asio::read(controlSocket_, boost::asio::buffer(request));
+
+                    if(request != data)
+                        throw std::runtime_error("request " + boost::lexical_cast<std::string>(reader.requests())
+                                                 + " differs from the journal: " + line(request) + " instead of " + line(data));
+
+                    arrived(record.timeNs);
+                }
+                else
+                    send(controlSocket_, record, data);
+            }
+
+            /// THE JOURNAL IS OVER: ONLY THE END OF THE SESSION MAY COME
+            char extra[256];
+            std::size_t got = controlSocket_.read_some(boost::asio::buffer(extra), ec);
+            if(!ec && got > 0)
+                throw std::runtime_error("the client sent more than the journal has: "
+                                         + line(std::vector<char>(extra, extra + got)));
+        }
+        catch(std::exception & e)
+        {
+            failed(e.what());
+        }
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        finished_ = LatencyClock::now();
+    }
+
+    /// the post mortem data, each after the requests it was received after
+    void playPostMortem()
+    {
+        try
+        {
+            boost::system::error_code ec;
+            postMortem_.accept(postMortemSocket_, ec);
+            if(ec)
+                return;
+
+            JournalReader reader(path_);
+            JournalRecordHeader record;
+            std::vector<char> data;
+
+            while(reader.next(JOURNAL_POST_MORTEM_SOCKET, record, data))
+            {
+                {
+                    boost::unique_lock<boost::mutex> lock(mutex_);
+
+                    while(requests_ < reader.requests() && !stopped_)
+                        requestArrived_.wait(lock);
+
+                    if(stopped_)
+                        return;
+                }
+
+                send(postMortemSocket_, record, data);
+            }
+        }
+        catch(std::exception & e)
+        {
+            failed(e.what());
+        }
+    }
+
+    /// a request of the journal has come again: the times of what follows count from now
+    void arrived(uint64_t timeNs)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+
+        requests_++;
+        anchorNs_ = timeNs;
+        anchorAt_ = LatencyClock::now();
+        requestArrived_.notify_all();
+    }
+
+    void send(tcp::socket & socket, const JournalRecordHeader & record, const std::vector<char> & data)
+    {
+        if(timed_)
+        {
+            LatencyClock::time_point at;
+
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+                at = anchorAt_ + boost::chrono::nanoseconds(record.timeNs > anchorNs_ ? record.timeNs - anchorNs_ : 0);
+            }
+
+            LatencyClock::time_point now = LatencyClock::now();
+            if(at > now)
+                boost::this_thread::sleep_for(at - now);
+        }
+
+        if(!data.empty())
+            boost::asio::write(socket, boost::asio::buffer(data));
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        bytes_ += data.size();
+    }
+
+    void failed(const std::string & error)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+
+            /// THE CONNECTIONS CLOSED BY stop()
+            if(stopped_)
+                return;
+
+            if(error_.empty())
+                error_ = error;
+        }
+
+        std::cout << "JournalPlayer: " << error << std::endl;
+
+        /// THE CLIENT GETS AN ERROR INSTEAD OF WAITING FOR A RESPONSE WHICH NEVER COMES
+        ::shutdown(controlSocket_.native_handle(), SHUT_RDWR);
+        ::shutdown(postMortemSocket_.native_handle(), SHUT_RDWR);
+    }
+
+    /// the first line of 'text', for the messages
+    static std::string line(const std::vector<char> & text)
+    {
+        std::string s(text.begin(), text.end());
+        return "'" + s.substr(0, s.find('\n')) + "'";
+    }
+
+private:
+    std::string path_;
+    bool timed_;
+    JournalFileHeader header_;
+    boost::asio::io_service io_service_; // only for the blocking sockets
+    tcp::acceptor control_;
+    tcp::acceptor postMortem_;
+    tcp::socket controlSocket_;
+    tcp::socket postMortemSocket_;
+    boost::thread controlThread_;
+    boost::thread postMortemThread_;
+
+    boost::mutex mutex_;
+    boost::condition_variable requestArrived_;
+    uint64_t requests_; // of the journal, come again
+    uint64_t anchorNs_; // time in the journal of the last request
+    LatencyClock::time_point anchorAt_; // when it came again
+    LatencyClock::time_point anchor_; // start of the replay
+    LatencyClock::time_point finished_; // end of the control connection
+    bool stopped_;
+    std::string error_;
+    uint64_t bytes_;
+};
+
+#endif // JOURNAL_PLAYER_HPP
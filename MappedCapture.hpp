@@ -0,0 +1,160 @@
+#ifndef MAPPED_CAPTURE_HPP
+#define MAPPED_CAPTURE_HPP
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <stdint.h>
+
+#include "CaptureFormat.hpp"
+
+/// files up to this size are completely pre-faulted with MAP_POPULATE;
+/// bigger ones are faulted in block by block, so that a 1E9 sample
+/// capture does not pin gigabytes of page cache at once
+const uint64_t MAPPED_CAPTURE_POPULATE_LIMIT = 256ULL * 1024 * 1024;
+
+/// capture file (see CaptureFormat.hpp) which the post mortem blocks
+/// are received into directly; the file is sized up front and mapped
+/// shared, so other processes can read the capture while it is being written
+class MappedCaptureFile
+{
+public:
+
+    MappedCaptureFile(const std::string & path, const CaptureFileHeader & h)
+        : path_(path), fd_(-1), base_(0), length_(0), checksums_(h.numberOfChannels)
+    {
+        length_ = captureFileSize(h);
+
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd_ < 0)
+            fail("cannot open");
+
+        if(::ftruncate(fd_, length_) != 0)
+            fail("cannot resize");
+
+        int flags = MAP_SHARED;
+        if(length_ <= MAPPED_CAPTURE_POPULATE_LIMIT)
+            flags |= MAP_POPULATE;
+
+        void * p = ::mmap(0, length_, PROT_READ | PROT_WRITE, flags, fd_, 0);
+        if(p == MAP_FAILED)
+            fail("cannot map");
+
+        base_ = static_cast<char *>(p);
+        ::madvise(base_, length_, MADV_SEQUENTIAL);
+
+        std::memset(base_, 0, h.headerSize);
+        std::memcpy(base_, &h, sizeof(h));
+    }
+
+    ~MappedCaptureFile()
+    {
+        if(base_)
+        {
+            ::msync(base_, length_, MS_SYNC);
+            ::munmap(base_, length_);
+        }
+
+        if(fd_ >= 0)
+            ::close(fd_);
+    }
+
+    CaptureFileHeader * header()
+    {
+        return reinterpret_cast<CaptureFileHeader *>(base_);
+    }
+
+    /// start of 'bytes' bytes at 'offset' within the data of 'channel';
+    /// the range is advised to the kernel as needed soon
+    char * region(int channel, uint64_t offset, uint64_t bytes)
+    {
+        char * p = base_ + header()->headerSize + channel * header()->bytesPerChannel + offset;
+        advise(p, bytes, MADV_WILLNEED);
+        return p;
+    }
+
+    /// writes the range back to the file and drops it from the resident set,
+    /// so the memory footprint stays constant whatever the capture size;
+    /// called from the persist stage, i.e. in the background of the transfer.
+    /// 'crc' is the CRC32C of the range as received
+    void flush(const char * p, uint64_t bytes, uint32_t crc, bool completesBlock = true)
+    {
+        const CaptureFileHeader * h = header();
+        uint64_t position = p - (base_ + h->headerSize);
+        int channel = position / h->bytesPerChannel;
+        uint32_t blockCrc = checksums_.add(channel, crc, bytes, completesBlock);
+
+        char * start = pageStart(p);
+
+        if(::msync(start, (p + bytes) - start, MS_SYNC) != 0)
+            throw std::runtime_error("MappedCaptureFile: cannot sync " + path_ + ": " + std::strerror(errno));
+
+        /// only the pages completely inside the range are dropped,
+        /// the neighbouring blocks may still be being written
+        char * first = pageStart(p + pageSize() - 1);
+        char * last = pageStart(p + bytes);
+        if(last > first)
+            ::madvise(first, last - first, MADV_DONTNEED);
+
+        if(completesBlock)
+        {
+            uint32_t * checksums = reinterpret_cast<uint32_t *>(base_ + captureChecksumOffset(*h));
+            checksums[position / h->blockBytes] = blockCrc;
+
+            __sync_fetch_and_add(&header()->blocksCompleted, 1);
+        }
+    }
+
+    const std::string & path() const
+    {
+        return path_;
+    }
+
+private:
+
+    static long pageSize()
+    {
+        static const long size = ::sysconf(_SC_PAGESIZE);
+        return size;
+    }
+
+    char * pageStart(const char * p) const
+    {
+        return base_ + ((p - base_) / pageSize()) * pageSize();
+    }
+
+    void advise(const char * p, uint64_t bytes, int advice)
+    {
+        char * start = pageStart(p);
+        ::madvise(start, (p + bytes) - start, advice);
+    }
+
+    void fail(const char * what)
+    {
+        std::string msg = std::string("MappedCaptureFile: ") + what + " " + path_ + ": " + std::strerror(errno);
+
+        if(base_)
+            ::munmap(base_, length_);
+        if(fd_ >= 0)
+            ::close(fd_);
+
+        base_ = 0;
+        fd_ = -1;
+
+        throw std::runtime_error(msg);
+    }
+
+private:
+    std::string path_;
+    int fd_;
+    char * base_;
+    uint64_t length_;
+    BlockChecksums checksums_;
+};
+
+#endif // MAPPED_CAPTURE_HPP
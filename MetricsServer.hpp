@@ -0,0 +1,184 @@
+#ifndef METRICS_SERVER_HPP
+#define METRICS_SERVER_HPP
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <istream>
+#include <sstream>
+#include <string>
+
+#include "AcquisitionMetrics.hpp"
+#include "RosySettings.hpp"
+
+/// the metrics endpoint: a minimal HTTP server on a local TCP port which
+/// answers 'GET /metrics' with renderMetrics(), for the monitoring to scrape:
+///
+///     $ curl http://127.0.0.1:9464/metrics
+///
+/// it runs on an io_service and a thread of its own, not on the one of the
+/// acquisition: most modes of the client block their thread in the
+/// transfers, and a scrape only reads the atomic counters, so it neither
+/// waits for the acquisition nor holds it up.
+
+/// [bytes] of a request, the headers included; a longer one is not answered
+const std::size_t METRICS_MAX_REQUEST = 8192;
+
+namespace detail
+{
+
+/// one connection to the endpoint: one request, one response, closed
+class MetricsConnection : public boost::enable_shared_from_this<MetricsConnection>
+{
+public:
+
+    explicit MetricsConnection(boost::asio::io_service & io_service)
+        : socket_(io_service), buffer_(METRICS_MAX_REQUEST)
+    {}
+
+    boost::asio::ip::tcp::socket & socket()
+    {
+        return socket_;
+    }
+
+    void readRequest()
+    {
+        boost::asio::async_read_until(socket_, buffer_, "\r\n\r\n",
+            boost::bind(&MetricsConnection::handle_request, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+private:
+
+    void handle_request(const boost::system::error_code & ec)
+    {
+        /// THE PEER HAS GONE OR THE REQUEST IS TOO LONG: THE CONNECTION IS DROPPED
+        if(ec)
+            return;
+
+        std::string method, target;
+        std::istream is(&buffer_);
+        is >> method >> target;
+
+        if(method != "GET")
+            respond("405 Method Not Allowed", "only GET\n");
+        else if(target == "/metrics")
+            respond("200 OK", renderMetrics());
+        else
+            respond("404 Not Found", "the metrics are at /metrics\n");
+    }
+
+    void respond(const std::string & status, const std::string & body)
+    {
+        std::stringstream ss;
+
+        ss << "HTTP/1.0 " << status << "\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << body.size() << "\r\n"
+           << "Connection: close\r\n\r\n" << body;
+        response_ = ss.str();
+
+        boost::asio::async_write(socket_, boost::asio::buffer(response_),
+            boost::bind(&MetricsConnection::handle_response, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void handle_response(const boost::system::error_code &)
+    {
+        boost::system::error_code ec;
+        socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    }
+
+private:
+    boost::asio::ip::tcp::socket socket_;
+    boost::asio::streambuf buffer_;
+    std::string response_; // kept until written
+};
+
+} // namespace detail
+
+/// listens on 'address':'port' from construction to destruction
+class MetricsServer
+{
+public:
+
+    MetricsServer(const std::string & address, int port)
+        : acceptor_(io_service_)
+    {
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(address), port);
+
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen();
+
+        accept();
+
+        thread_ = boost::thread(boost::bind(&MetricsServer::run, this));
+    }
+
+    ~MetricsServer()
+    {
+        io_service_.stop();
+        thread_.join();
+    }
+
+private:
+
+    void run()
+    {
+        io_service_.run();
+    }
+
+    void accept()
+    {
+        boost::shared_ptr<detail::MetricsConnection> connection(new detail::MetricsConnection(io_service_));
+
+        acceptor_.async_accept(connection->socket(),
+            boost::bind(&MetricsServer::handle_accept, this, connection, boost::asio::placeholders::error));
+    }
+
+    void handle_accept(boost::shared_ptr<detail::MetricsConnection> connection, const boost::system::error_code & ec)
+    {
+        if(ec == boost::asio::error::operation_aborted)
+            return;
+
+        if(!ec)
+            connection->readRequest();
+
+        accept();
+    }
+
+private:
+    boost::asio::io_service io_service_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::thread thread_;
+};
+
+/// the endpoint of the settings; 0 without a port or if the port cannot be
+/// had, e.g. while another client holds it: the acquisition goes on without
+inline MetricsServer * startMetricsServer(MetricsSettings * mt)
+{
+    if(mt->port <= 0)
+        return 0;
+
+    try
+    {
+        MetricsServer * server = new MetricsServer(mt->address, mt->port);
+        std::cout << "metrics: http://" << mt->address << ":" << mt->port << "/metrics" << std::endl;
+        return server;
+    }
+    catch(std::exception & e)
+    {
+        std::cout << "metrics: no endpoint on " << mt->address << ":" << mt->port << ": " << e.what() << std::endl;
+        return 0;
+    }
+}
+
+#endif // METRICS_SERVER_HPP
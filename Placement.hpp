@@ -0,0 +1,285 @@
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <dirent.h>
+#include <ifaddrs.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/// placement of the threads and buffers on a multi-socket machine: the
+/// threads which receive from the ROSY (control and post mortem sockets,
+/// the pipeline stages) and their buffers go to the NUMA node of the NIC
+/// the sockets use, the workers of the analysis pool to the other nodes.
+///
+/// the topology comes from sysfs, so nothing beyond the kernel is needed:
+///   /sys/devices/system/node/node<N>/cpulist   CPUs of every node
+///   /sys/class/net/<interface>/device/numa_node   node of a PCI NIC
+/// buffers follow the first touch of the pinned receive thread; with
+/// 'bindMemory' they are also moved to the node explicitly with mbind(2).
+
+/// CPUs of one NUMA node
+struct NumaNode
+{
+    int id;
+    std::vector<int> cpus;
+};
+
+/// what planPlacement() chose, printed at startup by printPlacement()
+struct PlacementPlan
+{
+    std::string interface; // NIC of the sockets, "" if not found
+    int nicNode; // its node, -1 if unknown (virtual NIC, loopback, no NUMA)
+    int receiveNode;
+    std::vector<int> receiveCpus; // receive threads and pipeline stages
+    std::vector<int> analysisCpus; // workers of the analysis pool
+};
+
+namespace detail
+{
+
+/// "0-3,8,10-11" as in the cpulist files
+inline std::vector<int> parseCpuList(const std::string & list)
+{
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+
+    while(std::getline(ss, range, ','))
+    {
+        if(range.empty() || range == "\n")
+            continue;
+
+        int first = std::atoi(range.c_str());
+        std::string::size_type dash = range.find('-');
+        int last = (dash == std::string::npos) ? first : std::atoi(range.c_str() + dash + 1);
+
+        for(int c = first; c <= last; c++)
+            cpus.push_back(c);
+    }
+
+    return cpus;
+}
+
+inline std::string readFirstLine(const std::string & path)
+{
+    std::ifstream file(path.c_str());
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+inline bool byNodeId(const NumaNode & a, const NumaNode & b)
+{
+    return a.id < b.id;
+}
+
+inline std::string formatCpuList(const std::vector<int> & cpus)
+{
+    std::stringstream ss;
+
+    for(std::size_t i = 0; i < cpus.size(); )
+    {
+        std::size_t j = i;
+        while(j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+            j++;
+
+        ss << (i > 0 ? "," : "") << cpus[i];
+        if(j > i)
+            ss << "-" << cpus[j];
+
+        i = j + 1;
+    }
+
+    return ss.str();
+}
+
+} // namespace detail
+
+/// the NUMA nodes with CPUs; one node of all the online CPUs without NUMA
+inline std::vector<NumaNode> numaTopology()
+{
+    std::vector<NumaNode> nodes;
+    DIR * dir = ::opendir("/sys/devices/system/node");
+
+    if(dir)
+    {
+        while(dirent * entry = ::readdir(dir))
+        {
+            if(std::strncmp(entry->d_name, "node", 4) != 0 || entry->d_name[4] < '0' || entry->d_name[4] > '9')
+                continue;
+
+            NumaNode node;
+            node.id = std::atoi(entry->d_name + 4);
+            node.cpus = detail::parseCpuList(detail::readFirstLine(std::string("/sys/devices/system/node/")
+                                                                   + entry->d_name + "/cpulist"));
+            if(!node.cpus.empty())
+                nodes.push_back(node);
+        }
+
+        ::closedir(dir);
+    }
+
+    if(nodes.empty())
+    {
+        NumaNode node;
+        node.id = 0;
+        for(long c = 0; c < ::sysconf(_SC_NPROCESSORS_ONLN); c++)
+            node.cpus.push_back((int)c);
+        nodes.push_back(node);
+    }
+
+    std::sort(nodes.begin(), nodes.end(), detail::byNodeId);
+    return nodes;
+}
+
+/// the interface which has the local address 'address', "" if none
+inline std::string interfaceOfAddress(const std::string & address)
+{
+    ifaddrs * list = 0;
+    std::string name;
+
+    if(::getifaddrs(&list) != 0)
+        return name;
+
+    for(ifaddrs * a = list; a && name.empty(); a = a->ifa_next)
+    {
+        if(!a->ifa_addr)
+            continue;
+
+        char text[INET6_ADDRSTRLEN] = "";
+
+        if(a->ifa_addr->sa_family == AF_INET)
+            ::inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in *>(a->ifa_addr)->sin_addr, text, sizeof(text));
+        else if(a->ifa_addr->sa_family == AF_INET6)
+            ::inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6 *>(a->ifa_addr)->sin6_addr, text, sizeof(text));
+
+        if(address == text)
+            name = a->ifa_name;
+    }
+
+    ::freeifaddrs(list);
+    return name;
+}
+
+/// NUMA node of the NIC 'interface', -1 if unknown
+inline int interfaceNumaNode(const std::string & interface)
+{
+    if(interface.empty())
+        return -1;
+
+    std::string line = detail::readFirstLine("/sys/class/net/" + interface + "/device/numa_node");
+    return line.empty() ? -1 : std::atoi(line.c_str());
+}
+
+/// restricts the thread 'thread' to 'cpus'; false if the kernel refused
+inline bool setThreadAffinity(pthread_t thread, const std::vector<int> & cpus)
+{
+    if(cpus.empty())
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for(std::size_t i = 0; i < cpus.size(); i++)
+        if(cpus[i] < CPU_SETSIZE)
+            CPU_SET(cpus[i], &set);
+
+    return ::pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+/// moves the pages of 'bytes' bytes at 'p' to 'node' and keeps them there;
+/// false if the kernel refused, e.g. without NUMA support
+inline bool bindMemoryToNode(const void * p, std::size_t bytes, int node)
+{
+#ifdef SYS_mbind
+    const int MPOL_BIND_ = 2; // <numaif.h>, without linking libnuma
+    const unsigned MPOL_MF_MOVE_ = 1 << 1;
+    const int BITS = 8 * sizeof(unsigned long);
+
+    if(bytes == 0 || node < 0 || node >= 16 * BITS)
+        return false;
+
+    unsigned long mask[16] = { 0 };
+    mask[node / BITS] = 1UL << (node % BITS);
+
+    uintptr_t page = (uintptr_t)::sysconf(_SC_PAGESIZE);
+    uintptr_t first = reinterpret_cast<uintptr_t>(p) & ~(page - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(p) + bytes + page - 1) & ~(page - 1);
+
+    /// THE KERNEL READS maxnode - 1 BITS OF THE MASK
+    return ::syscall(SYS_mbind, first, end - first, MPOL_BIND_, mask, sizeof(mask) * 8 + 1, MPOL_MF_MOVE_) == 0;
+#else
+    return false;
+#endif
+}
+
+/// the plan for the sockets bound to the local address 'localAddress';
+/// 'interface' overrides the NIC found from the address, 'receiveNode'
+/// (if >= 0) the node of the NIC
+inline PlacementPlan planPlacement(const std::string & localAddress, const std::string & interface, int receiveNode)
+{
+    std::vector<NumaNode> nodes = numaTopology();
+    PlacementPlan plan;
+
+    plan.interface = interface.empty() ? interfaceOfAddress(localAddress) : interface;
+    plan.nicNode = interfaceNumaNode(plan.interface);
+
+    /// THE NODE ASKED FOR, ELSE THE ONE OF THE NIC, ELSE THE FIRST ONE
+    plan.receiveNode = nodes[0].id;
+    int wanted = (receiveNode >= 0) ? receiveNode : plan.nicNode;
+
+    for(std::size_t i = 0; i < nodes.size(); i++)
+    {
+        if(nodes[i].id == wanted)
+            plan.receiveNode = wanted;
+    }
+
+    for(std::size_t i = 0; i < nodes.size(); i++)
+    {
+        std::vector<int> & cpus = (nodes[i].id == plan.receiveNode) ? plan.receiveCpus : plan.analysisCpus;
+        cpus.insert(cpus.end(), nodes[i].cpus.begin(), nodes[i].cpus.end());
+    }
+
+    /// A SINGLE NODE IS SHARED
+    if(plan.analysisCpus.empty())
+        plan.analysisCpus = plan.receiveCpus;
+
+    return plan;
+}
+
+/// the startup report of the topology and the placement chosen
+inline void printPlacement(const PlacementPlan & plan)
+{
+    std::vector<NumaNode> nodes = numaTopology();
+
+    std::cout << "placement: " << nodes.size() << " NUMA node" << (nodes.size() > 1 ? "s" : "") << std::endl;
+    for(std::size_t i = 0; i < nodes.size(); i++)
+        std::cout << "placement: \t node " << nodes[i].id << ", CPUs " << detail::formatCpuList(nodes[i].cpus) << std::endl;
+
+    std::cout << "placement: NIC " << (plan.interface.empty() ? "not found" : plan.interface) << ", node ";
+    if(plan.nicNode < 0)
+        std::cout << "unknown" << std::endl;
+    else
+        std::cout << plan.nicNode << std::endl;
+
+    std::cout << "placement: receive threads and buffers on node " << plan.receiveNode
+              << ", CPUs " << detail::formatCpuList(plan.receiveCpus) << std::endl;
+    std::cout << "placement: analysis workers on CPUs " << detail::formatCpuList(plan.analysisCpus) << std::endl;
+}
+
+#endif // PLACEMENT_HPP
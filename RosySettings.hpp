@@ -0,0 +1,209 @@
+#ifndef ROSY_SETTINGS_HPP
+#define ROSY_SETTINGS_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/// vertical (i.e. voltage) range on the input channels of the device;
+/// values from 3 to 10 (+-100 mV ... +- 20 V, respectively);
+/// value -1 means that the channel is disabled in POST MORTEM
+enum VERTICAL_RANGE
+{
+    RANGE_100_MV = 3, RANGE_200_MV, RANGE_500_MV,
+    RANGE_1_V, RANGE_2_V, RANGE_5_V, RANGE_10_V, RANGE_20_V,
+    DISABLE_CHANNEL = -1
+};
+
+/// Time Loss device ID == 0;
+/// Post Mortem device ID == 1;
+/// these ID values are used in 'postMortemViaTimeLossDeviceTest'
+/// example function, which demonstrates how to swap
+/// the functionality of the two devices, in order to
+/// be able to read out (using a regular POST MORTEM operation)
+/// the raw data from the input channels on the Time Loss device.
+enum DEVICE_ID
+{
+    TIME_LOSS_DEVICE, POST_MORTEM_DEVICE
+};
+
+struct TimeLossSettings
+{
+    int numberOfIterations;
+    double threshold;
+    bool saveToFile;
+    bool printSomeData;
+};
+
+/// how the post mortem data are saved when 'saveToFile' is set
+enum SAVE_FORMAT
+{
+    SAVE_TEXT, // one ./PM-<counter>.txt file per block
+    SAVE_BINARY, // one self-describing ./<time>_PM.bin capture file, see CaptureFormat.hpp
+    SAVE_MAPPED, // as SAVE_BINARY, blocks received directly into the memory-mapped file
+    SAVE_CHUNKED // one ./<time>_PM.pmc file of compressed chunks, see ChunkedCapture.hpp
+};
+
+/// compression of the chunks of a SAVE_CHUNKED capture
+enum CHUNK_CODEC
+{
+    CODEC_NONE, // raw samples
+    CODEC_DELTA, // differences of consecutive samples as varints
+    CODEC_RICE // linear prediction and Rice coding, see WaveformCodec.hpp
+};
+
+struct PostMortemSettings
+{
+    double delay; // [number of samples]
+    // positive delay => acquisition starts after the specified number of samples AFTER trigger
+    // negative delay => the specified number of samples are acquired BEFORE trigger
+
+    VERTICAL_RANGE range_A; // 3..10 ; -1 means "disable channel"
+    VERTICAL_RANGE range_B; // 3..10 ; -1 means "disable channel"
+    VERTICAL_RANGE range_C; // 3..10 ; -1 means "disable channel"
+    VERTICAL_RANGE range_D; // 3..10 ; -1 means "disable channel"
+    std::string triggerChannel; // A | B | C | D | EXT
+    std::string triggerDirection; // RISING | FALLING | RISE_FALL
+    int numberOfSamples; // -1 means maximum possible number of samples
+
+    double samplingPeriod; // [s]
+    // -1 means the minimum possible sampling period
+    //
+    // for 1 channel, minimum possible period is 200 ps
+    // for 2 channels (only A+C or B+D), minimum possible period is 400 ps
+    // for 3 or 4 channels, minimum possible period is 800 ps
+
+    short triggerThreshold; // [mV], from 1 to 1000
+    bool saveToFile;
+    SAVE_FORMAT saveFormat; // SAVE_TEXT | SAVE_BINARY | SAVE_MAPPED | SAVE_CHUNKED
+    CHUNK_CODEC chunkCodec; // SAVE_CHUNKED only: CODEC_NONE | CODEC_DELTA | CODEC_RICE
+    int chunkSamples; // SAVE_CHUNKED only: [samples] per chunk, the unit of random access
+    bool printSomeData;
+
+    bool convertToMillivolts; // samples are also converted to mV while they arrive,
+    // the mV values are printed and added to the SAVE_TEXT files
+    double offsetCorrection[4]; // [mV], added to the converted samples of channel A .. D
+    bool computeEnvelope; // min/max envelope of the channels, built while the blocks
+    // arrive and saved next to the capture as ./<time>_PM.env
+
+    bool findEdges; // software re-trigger over the whole capture,
+    // the crossings are saved to ./<time>_PM_edges.txt
+    std::string edgeDirection; // RISING | FALLING | RISE_FALL
+    double edgeThreshold; // [mV]
+    double edgeHysteresis; // [mV], width of the band around the threshold
+
+    bool computeSpectrum; // Welch power spectral density of the whole capture,
+    // saved to ./<time>_PM_psd.txt
+    int spectrumSegment; // [samples] per Welch segment, sets the frequency resolution
+
+    uint64_t memoryBudget; // [bytes] for the pipeline buffers, the envelope, the chunks being compressed
+    // and the analyses of the whole capture; larger captures are received in slices and analysed
+    // from a spill file, a budget below the smallest pipeline fails before the transfer
+};
+
+/// where the threads and buffers of the client go on a multi-socket
+/// machine, see Placement.hpp
+struct PlacementSettings
+{
+    bool pinThreads; // receive threads near the NIC, analysis workers on the other nodes
+    std::string interface; // NIC of the sockets, "" to find it from their local address
+    int receiveNode; // NUMA node of the receive threads and buffers, -1 for the node of the NIC
+    bool bindMemory; // also move the receive buffers to that node with mbind(2),
+    // beyond the first touch of the pinned receive thread
+};
+
+/// the resident daemon mode, which keeps the session and the devices and
+/// replaces a loop of short-lived clients, see DaemonSocket.hpp
+struct DaemonSettings
+{
+    std::string socketPath; // UNIX socket of the commands
+    long histogramPeriodMs; // [ms] between two histograms of the schedule
+    bool startAcquisition; // set up the time loss histograms at startup,
+    // else they wait for the 'start' command
+};
+
+/// many ROSY units driven from one process, see DeviceManager
+struct DeviceManagerSettings
+{
+    std::vector<std::string> hosts; // IP addresses of the ROSY units
+    long histogramPeriodMs; // [ms] between two histograms of a device
+    int histogramsPerDevice; // 0 means until SIGINT / SIGTERM
+    int maxTransfers; // connections, histograms and releases in flight over all the devices;
+    // the others wait for a slot, so the load follows the transfers, not the devices
+    int threads; // of the shared io_service, 0 means maxTransfers + 1
+    long statsPeriodMs; // [ms] between two reports of the statistics, 0 means only at the end
+    bool directoryPerDevice; // the files of a device go to ./<host>/, else all to ./
+};
+
+/// the benchmark suite of the acquisition paths, run against a simulated
+/// ROSY on the loopback interface, see Benchmark.hpp
+struct BenchmarkSettings
+{
+    std::string resultsPath; // JSON results of the run
+    std::string baselinePath; // results of an earlier build to compare with, "" for none
+    double tolerance; // relative change of a metric reported as a regression
+    int port; // control port of the simulated ROSY, the post mortem port is the next one
+    long triggerDelayMs; // [ms] from 'getPostMortemData' to the trigger of the simulated ROSY
+    std::vector<int> histogramBins; // bin counts of the histogram polls
+    int histogramPolls; // per bin count
+    int maxChannels; // post mortem throughput with 1 .. maxChannels channels
+    std::vector<int> blockCounts; // blocks the data of a channel are announced in
+    int samplesPerChannel; // of every post mortem
+    int repetitions; // of every post mortem case
+    int saveChannels; // of the post mortems saved in every format
+    std::string outputDirectory; // of the saved captures, emptied after every case
+};
+
+/// the journal of the traffic of a session and its replay, see SocketJournal.hpp
+struct JournalSettings
+{
+    std::string recordPath; // journal of the session, "" for none
+    bool replayTimed; // REPLAY at the original timing, else as fast as possible
+};
+
+/// the HTTP endpoint scraped by the monitoring, see MetricsServer.hpp
+struct MetricsSettings
+{
+    std::string address; // local address to listen on
+    int port; // 0 means no endpoint
+};
+
+/// vertical range of the device channel 'channel' (0 = A .. 3 = D)
+inline VERTICAL_RANGE channelRange(const PostMortemSettings * ps, int channel)
+{
+    switch(channel)
+    {
+    case 0: return ps->range_A;
+    case 1: return ps->range_B;
+    case 2: return ps->range_C;
+    case 3: return ps->range_D;
+    default: return DISABLE_CHANNEL;
+    }
+}
+
+/// device channel (0 = A .. 3 = D) of the 'index'-th enabled channel,
+/// i.e. of the 'index'-th channel in the post mortem data; -1 if there is none
+inline int deviceChannel(const PostMortemSettings * ps, int index)
+{
+    for(int c = 0; c < 4; c++)
+        if(channelRange(ps, c) > 0 && index-- == 0)
+            return c;
+
+    return -1;
+}
+
+/// sampling period the device uses for 'numberOfChannels' enabled channels;
+/// -1 in the settings selects the minimum possible period
+inline double effectiveSamplingPeriod(const PostMortemSettings * ps, int numberOfChannels)
+{
+    if(ps->samplingPeriod > 0)
+        return ps->samplingPeriod;
+
+    if(numberOfChannels <= 1)
+        return 200E-12;
+    if(numberOfChannels == 2)
+        return 400E-12;
+    return 800E-12;
+}
+
+#endif // ROSY_SETTINGS_HPP
@@ -0,0 +1,800 @@
+#ifndef ROSY_SIMULATOR_HPP
+#define ROSY_SIMULATOR_HPP
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/uniform_01.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/// a ROSY on the local machine: the text protocol of the control socket
+/// (port 3893) and the post mortem socket (port 3894), with generated
+/// histograms and waveforms, a limited bandwidth, a latency, a trigger
+/// delay and faults on demand, so the client can be measured without the
+/// device. every connection is served by a thread of its own; a post mortem
+/// connection belongs to the first control session of the same peer which
+/// has none yet, as the client connects CONTROL_SOCKET first.
+
+/// the time loss histogram returned by 'getHistogram'
+enum HISTOGRAM_SHAPE
+{
+    HISTOGRAM_FLAT, // 'histogramCounts' in every bin
+    HISTOGRAM_RAMP, // bin i holds i
+    HISTOGRAM_DECAY, // exponential decay over the bins
+    HISTOGRAM_PEAK, // a gaussian peak in the middle
+    HISTOGRAM_NOISE // random counts
+};
+
+/// the samples of the post mortem channels
+enum WAVEFORM_SHAPE
+{
+    WAVEFORM_SINE,
+    WAVEFORM_SQUARE,
+    WAVEFORM_PULSES, // decaying pulses every 'waveformPeriod' samples
+    WAVEFORM_NOISE // only 'waveformNoise'
+};
+
+/// samples of the noise table of the waveforms, a power of 2
+const int SIMULATOR_NOISE_SAMPLES = 1 << 16;
+
+/// faults the simulator can inject, as bits of SimulatorSettings::faults
+enum SIMULATOR_FAULT
+{
+    FAULT_ERROR_STATUS = 1, // a status other than RESPONSE_OK
+    FAULT_DISCONNECT = 2, // the control connection is closed in the middle of a response
+    FAULT_STALL = 4, // the response is delayed by 'stallMs'
+    FAULT_CORRUPT = 8 // a byte of the histogram or post mortem data is flipped
+};
+
+struct SimulatorSettings
+{
+    std::string address; // to listen on, "0.0.0.0" for every interface
+    int controlPort; // 3893
+    int postMortemPort; // 3894
+
+    HISTOGRAM_SHAPE histogramShape;
+    int histogramBins; // 1.6 ns each
+    int histogramCounts; // height of the shape
+    WAVEFORM_SHAPE waveformShape;
+    int waveformPeriod; // [samples] per cycle, or between two pulses
+    double waveformAmplitude; // fraction of the full scale of the int16 samples
+    double waveformNoise; // fraction of the full scale, rms of the noise added to every waveform
+    int postMortemBlocks; // blocks the data of a channel are announced in
+    int maxPostMortemSamples; // per channel, for numberOfSamples == -1
+
+    double bandwidth; // [bytes/s] of the histogram and post mortem data, 0 means unlimited
+    long latencyMs; // before every response
+    long triggerDelayMs; // from 'getPostMortemData' to the trigger
+    double faultRate; // probability of a fault per response
+    int faults; // SIMULATOR_FAULT bits the faults are chosen from
+    long stallMs; // FAULT_STALL
+    unsigned seed; // of the histograms, waveforms and faults, for reproducible runs
+};
+
+inline SimulatorSettings defaultSimulatorSettings()
+{
+    SimulatorSettings s;
+
+    s.address = "127.0.0.1";
+    s.controlPort = 3893;
+    s.postMortemPort = 3894;
+
+    s.histogramShape = HISTOGRAM_DECAY;
+    s.histogramBins = 1000;
+    s.histogramCounts = 1000;
+    s.waveformShape = WAVEFORM_SINE;
+    s.waveformPeriod = 1000;
+    s.waveformAmplitude = 0.25;
+    s.waveformNoise = 0.01;
+    s.postMortemBlocks = 4;
+    s.maxPostMortemSamples = 10000000;
+
+    s.bandwidth = 0;
+    s.latencyMs = 0;
+    s.triggerDelayMs = 200;
+    s.faultRate = 0;
+    s.faults = FAULT_ERROR_STATUS | FAULT_DISCONNECT | FAULT_STALL | FAULT_CORRUPT;
+    s.stallMs = 2000;
+    s.seed = 1;
+
+    return s;
+}
+
+/// sets the field 'name' of 's' from the "name=value" 'option'; "" on success, else why not
+inline std::string applySimulatorOption(SimulatorSettings & s, const std::string & option)
+{
+    std::string::size_type eq = option.find('=');
+    if(eq == std::string::npos)
+        return "expected name=value: " + option;
+
+    std::string name = option.substr(0, eq);
+    std::string value = option.substr(eq + 1);
+
+    static const char * histograms[] = { "FLAT", "RAMP", "DECAY", "PEAK", "NOISE" };
+    static const char * waveforms[] = { "SINE", "SQUARE", "PULSES", "NOISE" };
+    static const char * faults[] = { "ERROR_STATUS", "DISCONNECT", "STALL", "CORRUPT" };
+
+    try
+    {
+        if(name == "address") s.address = value;
+        else if(name == "controlPort") s.controlPort = boost::lexical_cast<int>(value);
+        else if(name == "postMortemPort") s.postMortemPort = boost::lexical_cast<int>(value);
+        else if(name == "histogramShape" || name == "waveformShape")
+        {
+            bool histogram = (name == "histogramShape");
+            int n = histogram ? 5 : 4;
+            int i = 0;
+
+            while(i < n && value != (histogram ? histograms[i] : waveforms[i]))
+                i++;
+            if(i == n)
+                return "unknown " + name + " " + value;
+
+            if(histogram)
+                s.histogramShape = (HISTOGRAM_SHAPE)i;
+            else
+                s.waveformShape = (WAVEFORM_SHAPE)i;
+        }
+        else if(name == "histogramBins") s.histogramBins = boost::lexical_cast<int>(value);
+        else if(name == "histogramCounts") s.histogramCounts = boost::lexical_cast<int>(value);
+        else if(name == "waveformPeriod") s.waveformPeriod = std::max(2, boost::lexical_cast<int>(value));
+        else if(name == "waveformAmplitude") s.waveformAmplitude = boost::lexical_cast<double>(value);
+        else if(name == "waveformNoise") s.waveformNoise = boost::lexical_cast<double>(value);
+        else if(name == "postMortemBlocks") s.postMortemBlocks = std::max(1, boost::lexical_cast<int>(value));
+        else if(name == "maxPostMortemSamples") s.maxPostMortemSamples = boost::lexical_cast<int>(value);
+        else if(name == "bandwidth") s.bandwidth = boost::lexical_cast<double>(value);
+        else if(name == "latencyMs") s.latencyMs = boost::lexical_cast<long>(value);
+        else if(name == "triggerDelayMs") s.triggerDelayMs = boost::lexical_cast<long>(value);
+        else if(name == "faultRate") s.faultRate = boost::lexical_cast<double>(value);
+        else if(name == "faults")
+        {
+            /// E.G. DISCONNECT,STALL
+            s.faults = 0;
+            std::stringstream ss(value);
+
+            for(std::string fault; std::getline(ss, fault, ','); )
+            {
+                int i = 0;
+                while(i < 4 && fault != faults[i])
+                    i++;
+                if(i == 4)
+                    return "unknown fault " + fault;
+
+                s.faults |= 1 << i;
+            }
+        }
+        else if(name == "stallMs") s.stallMs = boost::lexical_cast<long>(value);
+        else if(name == "seed") s.seed = boost::lexical_cast<unsigned>(value);
+        else
+            return "unknown option " + name;
+    }
+    catch(boost::bad_lexical_cast &)
+    {
+        return "invalid value " + value + " of " + name;
+    }
+
+    return "";
+}
+
+class RosySimulator
+{
+public:
+
+    explicit RosySimulator(const SimulatorSettings & settings)
+        : settings_(settings), control_(io_service_), postMortem_(io_service_), random_(settings.seed),
+        threads_(0), stopped_(false), connections_(0), histograms_(0), postMortems_(0), bytes_(0), faults_(0)
+    {
+        listen(control_, settings.controlPort);
+        listen(postMortem_, settings.postMortemPort);
+
+        buildTables();
+    }
+
+    ~RosySimulator()
+    {
+        stop();
+    }
+
+    /// accepts connections in two threads of its own and returns
+    void start()
+    {
+        spawn(boost::bind(&RosySimulator::acceptControl, this));
+        spawn(boost::bind(&RosySimulator::acceptPostMortem, this));
+
+        std::cout << "RosySimulator: listening on " << settings_.address << ", ports "
+                  << settings_.controlPort << " and " << settings_.postMortemPort << std::endl;
+    }
+
+    /// closes every connection and waits for the threads
+    void stop()
+    {
+        std::vector<boost::shared_ptr<Session> > sessions;
+
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+
+            if(stopped_)
+                return;
+
+            stopped_ = true;
+            sessions = sessions_;
+        }
+
+        /// WAKES THE BLOCKING accept() AND read() CALLS UP
+        ::shutdown(control_.native_handle(), SHUT_RDWR);
+        ::shutdown(postMortem_.native_handle(), SHUT_RDWR);
+
+        for(std::size_t i = 0; i < sessions.size(); i++)
+            sessions[i]->shutdown();
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while(threads_ > 0)
+                threadsDone_.wait(lock);
+        }
+
+        printStats();
+    }
+
+    void printStats()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+
+        std::cout << "RosySimulator: " << connections_ << " connections, " << histograms_ << " histograms, "
+                  << postMortems_ << " post mortems, " << bytes_ << " bytes of data, " << faults_ << " faults" << std::endl;
+    }
+
+private:
+
+    typedef boost::asio::ip::tcp tcp;
+
+    /// one client: its control connection and, once connected, its post mortem connection
+    struct Session
+    {
+        Session(boost::asio::io_service & io_service, unsigned seed)
+            : control(io_service), random(seed), closed(false), armed(false), channels(0), samples(0), timelossDevice(0)
+        {}
+
+        void shutdown()
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+
+            closed = true;
+            ::shutdown(control.native_handle(), SHUT_RDWR);
+            if(postMortem)
+                ::shutdown(postMortem->native_handle(), SHUT_RDWR);
+
+            attached.notify_all();
+        }
+
+        tcp::socket control;
+        boost::asio::streambuf buffer;
+        std::string peer;
+        boost::random::mt19937 random; // of its histograms and waveforms
+
+        boost::mutex mutex; // taken after RosySimulator::mutex_, never before it
+        bool closed;
+        boost::condition_variable attached; // the post mortem connection has arrived, or the end
+        boost::shared_ptr<tcp::socket> postMortem;
+        bool armed; // 'getPostMortemData' waits for its trigger
+        boost::posix_time::ptime triggerAt;
+        int channels; // of the last 'setupPostMortem'
+        int samples; // per channel
+        int timelossDevice; // 'setTimelossDevice'
+    };
+
+    void listen(tcp::acceptor & acceptor, int port)
+    {
+        tcp::endpoint endpoint(boost::asio::ip::address::from_string(settings_.address), (unsigned short)port);
+
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+        acceptor.bind(endpoint);
+        acceptor.listen();
+    }
+
+    bool stopped()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return stopped_;
+    }
+
+    /// runs 'f' in a thread of its own, which stop() waits for
+    void spawn(const boost::function<void ()> & f)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            threads_++;
+        }
+
+        boost::shared_ptr<boost::function<void ()> > task(new boost::function<void ()>(f));
+        boost::thread(boost::bind(&RosySimulator::runThread, this, task)).detach();
+    }
+
+    void runThread(boost::shared_ptr<boost::function<void ()> > task)
+    {
+        /// WHAT 'f' HOLDS (E.G. A SESSION AND ITS SOCKETS) GOES BEFORE stop() MAY RETURN,
+        /// NOT WITH THE THREAD AFTER THE SIMULATOR IS GONE
+        boost::function<void ()> f;
+        f.swap(*task);
+        f();
+        f.clear();
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if(--threads_ == 0)
+            threadsDone_.notify_all();
+    }
+
+    void acceptControl()
+    {
+        for(unsigned n = 1; !stopped(); n++)
+        {
+            boost::shared_ptr<Session> session(new Session(io_service_, settings_.seed + n));
+            boost::system::error_code ec;
+
+            control_.accept(session->control, ec);
+            if(ec)
+                continue;
+
+            session->control.set_option(tcp::no_delay(true));
+            session->peer = session->control.remote_endpoint().address().to_string();
+
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+
+                if(stopped_)
+                    break;
+
+                sessions_.push_back(session);
+                connections_++;
+            }
+
+            spawn(boost::bind(&RosySimulator::serve, this, session));
+        }
+    }
+
+    void acceptPostMortem()
+    {
+        while(!stopped())
+        {
+            boost::shared_ptr<tcp::socket> socket(new tcp::socket(io_service_));
+            boost::system::error_code ec;
+
+            postMortem_.accept(*socket, ec);
+            if(ec)
+                continue;
+
+            std::string peer = socket->remote_endpoint().address().to_string();
+
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            connections_++;
+
+            for(std::size_t i = 0; i < sessions_.size(); i++)
+            {
+                Session & s = *sessions_[i];
+                boost::lock_guard<boost::mutex> sessionLock(s.mutex);
+
+                if(s.peer == peer && !s.postMortem)
+                {
+                    s.postMortem = socket;
+                    s.attached.notify_all();
+                    break;
+                }
+            }
+        }
+    }
+
+    /// the control connection of 'session', until the client says 'bye' or goes
+    void serve(boost::shared_ptr<Session> session)
+    {
+        try
+        {
+            for(;;)
+            {
+                std::string command = readLine(*session);
+
+                if(command == "hello")
+                    respond(*session, "hello");
+                else if(command.compare(0, 7, "version") == 0)
+                    respond(*session, "welcome");
+                else if(command == "function acquireDevice" || command == "procedure releaseDevice")
+                {
+                    readLine(*session); // device
+                    respond(*session, status());
+                }
+                else if(command == "procedure stopAcquisition")
+                {
+                    readLine(*session); // device
+
+                    /// A POST MORTEM NOT TRIGGERED YET IS CANCELLED
+                    {
+                        boost::lock_guard<boost::mutex> lock(session->mutex);
+                        session->armed = false;
+                    }
+
+                    respond(*session, status());
+                }
+                else if(command == "procedure setupHistogram")
+                {
+                    readLine(*session); // device
+                    readLine(*session); // threshold
+                    respond(*session, status());
+                }
+                else if(command == "procedure setTimelossDevice")
+                {
+                    readLine(*session); // device
+                    int value = boost::lexical_cast<int>(readLine(*session));
+
+                    {
+                        boost::lock_guard<boost::mutex> lock(session->mutex);
+                        session->timelossDevice = value;
+                    }
+
+                    respond(*session, status());
+                }
+                else if(command == "function getHistogram")
+                {
+                    readLine(*session); // device
+                    sendHistogram(*session);
+                }
+                else if(command == "procedure setupPostMortem")
+                {
+                    std::vector<std::string> args;
+                    for(int i = 0; i < 11; i++)
+                        args.push_back(readLine(*session));
+
+                    setupPostMortem(*session, args);
+                    respond(*session, status());
+                }
+                else if(command == "function getPostMortemData")
+                {
+                    readLine(*session); // device
+
+                    /// THE RESPONSE COMES ON THE POST MORTEM SOCKET, FROM A THREAD OF ITS OWN
+                    {
+                        boost::lock_guard<boost::mutex> lock(session->mutex);
+                        session->armed = true;
+                        session->triggerAt = boost::posix_time::microsec_clock::universal_time()
+                                             + boost::posix_time::milliseconds(settings_.triggerDelayMs);
+                    }
+
+                    spawn(boost::bind(&RosySimulator::trigger, this, session));
+                }
+                else if(command == "bye")
+                    break;
+                else
+                    std::cout << "RosySimulator: " << session->peer << ": unknown command " << command << std::endl;
+            }
+        }
+        catch(std::exception & e)
+        {
+            /// THE CLIENT HAS GONE, OR A FAULT HAS CLOSED THE CONNECTION
+        }
+
+        session->shutdown();
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        sessions_.erase(std::remove(sessions_.begin(), sessions_.end(), session), sessions_.end());
+    }
+
+    std::string readLine(Session & session)
+    {
+        boost::asio::read_until(session.control, session.buffer, '\n');
+
+        std::string line;
+        std::istream is(&session.buffer);
+        std::getline(is, line);
+
+        if(!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+
+        return line;
+    }
+
+    /// the response line of a command, after the latency and maybe a fault
+    void respond(Session & session, const std::string & line)
+    {
+        delay();
+        writeLine(session.control, line);
+    }
+
+    void writeLine(tcp::socket & socket, const std::string & line)
+    {
+        boost::asio::write(socket, boost::asio::buffer(line + "\n"));
+    }
+
+    /// RESPONSE_OK, or an error status with FAULT_ERROR_STATUS
+    std::string status()
+    {
+        return fault(FAULT_ERROR_STATUS) ? "1" : "0";
+    }
+
+    void delay()
+    {
+        long ms = settings_.latencyMs + (fault(FAULT_STALL) ? settings_.stallMs : 0);
+
+        if(ms > 0)
+            boost::this_thread::sleep(boost::posix_time::milliseconds(ms));
+    }
+
+    /// true if a fault of 'kind' is injected now
+    bool fault(SIMULATOR_FAULT kind)
+    {
+        if(!(settings_.faults & kind) || settings_.faultRate <= 0)
+            return false;
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+
+        if(uniform() >= settings_.faultRate)
+            return false;
+
+        faults_++;
+        return true;
+    }
+
+    /// in [0, 1); called with 'mutex_' held
+    double uniform()
+    {
+        return boost::random::uniform_01<double>()(random_);
+    }
+
+    void sendHistogram(Session & session)
+    {
+        std::vector<int32_t> histogram(histogram_);
+
+        if(settings_.histogramShape == HISTOGRAM_NOISE)
+        {
+            histogram.resize(settings_.histogramBins);
+            for(int i = 0; i < settings_.histogramBins; i++)
+                histogram[i] = histogramBin(session.random, i);
+        }
+
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            histograms_++;
+        }
+
+        std::size_t bytes = histogram.size() * sizeof(int32_t);
+
+        delay();
+        writeLine(session.control, boost::lexical_cast<std::string>(bytes));
+
+        if(bytes > 0 && fault(FAULT_CORRUPT))
+            reinterpret_cast<char *>(&histogram[0])[bytes / 2] ^= 0x10;
+
+        if(bytes > 0 && fault(FAULT_DISCONNECT))
+        {
+            /// HALF OF THE HISTOGRAM, THEN THE CONNECTION IS GONE
+            writeThrottled(session.control, reinterpret_cast<const char *>(&histogram[0]), bytes / 2);
+            throw std::runtime_error("RosySimulator: disconnected by a fault");
+        }
+
+        if(bytes > 0)
+            writeThrottled(session.control, reinterpret_cast<const char *>(&histogram[0]), bytes);
+
+        writeLine(session.control, status());
+    }
+
+    int32_t histogramBin(boost::random::mt19937 & random, int i)
+    {
+        double n = settings_.histogramBins;
+        double counts = settings_.histogramCounts;
+
+        switch(settings_.histogramShape)
+        {
+        case HISTOGRAM_FLAT: return (int32_t)counts;
+        case HISTOGRAM_RAMP: return i;
+        case HISTOGRAM_DECAY: return (int32_t)(counts * std::exp(-5.0 * i / n));
+        case HISTOGRAM_PEAK: return (int32_t)(counts * std::exp(-0.5 * std::pow((i - n / 2) / (n / 20), 2)));
+        default: return (int32_t)(counts * boost::random::uniform_01<double>()(random));
+        }
+    }
+
+    void setupPostMortem(Session & session, const std::vector<std::string> & args)
+    {
+        /// device, delay, ranges A .. D, trigger channel, threshold, direction, samples, sampling period
+        int channels = 0;
+        for(int r = 2; r < 6; r++)
+            if(boost::lexical_cast<int>(args[r]) > 0)
+                channels++;
+
+        int samples = boost::lexical_cast<int>(args[9]);
+        if(samples <= 0)
+            samples = settings_.maxPostMortemSamples / std::max(channels, 1);
+
+        boost::lock_guard<boost::mutex> lock(session.mutex);
+        session.channels = channels;
+        session.samples = samples;
+    }
+
+    /// the post mortem of 'session' once its trigger time has come
+    void trigger(boost::shared_ptr<Session> session)
+    {
+        boost::shared_ptr<tcp::socket> socket;
+        int channels = 0, samples = 0;
+
+        {
+            boost::unique_lock<boost::mutex> lock(session->mutex);
+
+            while(!session->postMortem && !session->closed)
+                session->attached.wait(lock);
+
+            if(!session->postMortem)
+                return;
+
+            lock.unlock();
+            boost::this_thread::sleep(session->triggerAt);
+            lock.lock();
+
+            /// CANCELLED BY 'stopAcquisition'
+            if(!session->armed)
+                return;
+
+            session->armed = false;
+            socket = session->postMortem;
+            channels = session->channels;
+            samples = session->samples;
+        }
+
+        /// THE BLOCKS MUST DIVIDE THE SAMPLES OF A CHANNEL
+        int blocks = std::max(1, std::min(settings_.postMortemBlocks, samples));
+        while(samples % blocks != 0)
+            blocks--;
+
+        try
+        {
+            writeLine(*socket, "0");
+            writeLine(*socket, boost::lexical_cast<std::string>((uint64_t)samples * sizeof(int16_t)));
+            writeLine(*socket, boost::lexical_cast<std::string>(blocks));
+
+            const int piece = 65536;
+            std::vector<int16_t> data(piece);
+            bool corrupt = fault(FAULT_CORRUPT);
+
+            for(int k = 0; k < channels; k++)
+            {
+                for(int first = 0; first < samples; first += piece)
+                {
+                    int n = std::min(piece, samples - first);
+                    waveform(*session, k, first, n, &data[0]);
+
+                    if(corrupt && k == 0 && first == 0)
+                        data[n / 2] ^= 0x0100;
+
+                    writeThrottled(*socket, reinterpret_cast<const char *>(&data[0]), n * sizeof(int16_t));
+                }
+            }
+
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            postMortems_++;
+        }
+        catch(std::exception & e)
+        {
+            std::cout << "RosySimulator: " << session->peer << ": post mortem not sent, " << e.what() << std::endl;
+        }
+    }
+
+    /// the histogram and a period of every channel are computed once, the
+    /// noise is a table read from a random place: the simulator must send
+    /// faster than the client receives
+    void buildTables()
+    {
+        if(settings_.histogramShape != HISTOGRAM_NOISE)
+        {
+            histogram_.resize(std::max(settings_.histogramBins, 0));
+            for(std::size_t i = 0; i < histogram_.size(); i++)
+                histogram_[i] = histogramBin(random_, (int)i);
+        }
+
+        const double full = 32767;
+        const double pi = 3.14159265358979323846;
+        double amplitude = settings_.waveformAmplitude * full;
+        double period = settings_.waveformPeriod;
+
+        for(int k = 0; k < 4; k++)
+        {
+            shapes_[k].resize(settings_.waveformPeriod);
+
+            for(int j = 0; j < settings_.waveformPeriod; j++)
+            {
+                double phase = std::fmod(j / period + 0.25 * k, 1.0);
+                double v = 0;
+
+                switch(settings_.waveformShape)
+                {
+                case WAVEFORM_SINE: v = amplitude * std::sin(2 * pi * phase); break;
+                case WAVEFORM_SQUARE: v = (phase < 0.5) ? amplitude : -amplitude; break;
+                case WAVEFORM_PULSES: v = amplitude * std::exp(-phase * period / 20.0); break;
+                default: break;
+                }
+
+                shapes_[k][j] = v;
+            }
+        }
+
+        boost::random::normal_distribution<double> noise(0, settings_.waveformNoise * full);
+
+        noise_.resize(SIMULATOR_NOISE_SAMPLES);
+        for(int i = 0; i < SIMULATOR_NOISE_SAMPLES; i++)
+            noise_[i] = (settings_.waveformNoise > 0) ? noise(random_) : 0;
+    }
+
+    /// samples 'first' .. 'first' + 'n' - 1 of channel 'k'
+    void waveform(Session & session, int k, int first, int n, int16_t * data)
+    {
+        const double full = 32767;
+        const std::vector<double> & shape = shapes_[k % 4];
+
+        std::size_t p = first % shape.size();
+        uint32_t r = session.random() & (SIMULATOR_NOISE_SAMPLES - 1);
+
+        for(int i = 0; i < n; i++)
+        {
+            data[i] = (int16_t)std::max(-full, std::min(full, shape[p] + noise_[r]));
+
+            if(++p == shape.size())
+                p = 0;
+            r = (r + 1) & (SIMULATOR_NOISE_SAMPLES - 1);
+        }
+    }
+
+    /// writes 'bytes' bytes at no more than 'bandwidth' bytes per second
+    void writeThrottled(tcp::socket & socket, const char * data, std::size_t bytes)
+    {
+        const std::size_t piece = 64 * 1024;
+        boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+        for(std::size_t sent = 0; sent < bytes; )
+        {
+            std::size_t n = std::min(piece, bytes - sent);
+            boost::asio::write(socket, boost::asio::buffer(data + sent, n));
+            sent += n;
+
+            if(settings_.bandwidth > 0)
+                boost::this_thread::sleep(start + boost::posix_time::microseconds((int64_t)(sent / settings_.bandwidth * 1E6)));
+        }
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        bytes_ += bytes;
+    }
+
+private:
+    SimulatorSettings settings_;
+    boost::asio::io_service io_service_; // only for the blocking sockets
+    tcp::acceptor control_;
+    tcp::acceptor postMortem_;
+    boost::mutex mutex_;
+    std::vector<boost::shared_ptr<Session> > sessions_;
+    boost::random::mt19937 random_; // of the faults, under 'mutex_'
+    std::vector<int32_t> histogram_; // unless HISTOGRAM_NOISE, see buildTables()
+    std::vector<double> shapes_[4]; // a period of every channel
+    std::vector<double> noise_; // SIMULATOR_NOISE_SAMPLES of 'waveformNoise'
+    int threads_; // running, see spawn()
+    boost::condition_variable threadsDone_;
+    bool stopped_;
+    uint64_t connections_;
+    uint64_t histograms_;
+    uint64_t postMortems_;
+    uint64_t bytes_;
+    uint64_t faults_;
+};
+
+#endif // ROSY_SIMULATOR_HPP
@@ -0,0 +1,311 @@
+#ifndef SCOPE_PIPELINE_HPP
+#define SCOPE_PIPELINE_HPP
+
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "AcquisitionMetrics.hpp"
+#include "Placement.hpp"
+
+/// number of post mortem blocks which can be in flight at the same time
+/// (being received, processed or persisted); this is also the number
+/// of block buffers allocated by the pipeline, unless the receive stage
+/// provides the memory itself
+const int SCOPE_PIPELINE_DEPTH = 4;
+
+/// buffers the pipeline allocates for every slot
+enum PIPELINE_BUFFERS
+{
+    RECEIVE_BUFFERS = 1, // raw samples; without it the receive stage provides the memory
+    MILLIVOLT_BUFFERS = 2 // samples converted to mV by the process stage
+};
+
+/// one block of post mortem samples travelling through the pipeline
+struct ScopeBlock
+{
+    int channel; // index of the enabled channel, 0 .. numberOfChannels-1
+    int block; // index of the block within the channel, 0 .. num_of_blocks-1
+    uint64_t offset; // [samples], position of the first sample within the channel
+    bool last; // last slice of the block, see pipelineSliceSamples()
+    int16_t * samples;
+    float * millivolts; // MILLIVOLT_BUFFERS only, 0 otherwise
+    int count; // [samples]
+    uint32_t crc; // CRC32C of the samples as received
+    int slot; // ring slot, i.e. in-flight token, of the block
+};
+
+/// bounded ring buffer connecting two pipeline stages;
+/// push() blocks while the ring is full, pop() blocks while it is empty;
+/// after close() push() fails and pop() fails as soon as the ring is drained
+template <typename T>
+class BlockRing
+{
+public:
+
+    explicit BlockRing(int capacity)
+        : items_(capacity), head_(0), count_(0), closed_(false)
+    {}
+
+    bool push(const T & item)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+
+        while(count_ == (int)items_.size() && !closed_)
+            notFull_.wait(lock);
+
+        if(closed_)
+            return false;
+
+        items_[(head_ + count_) % items_.size()] = item;
+        count_++;
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    bool pop(T & item)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+
+        while(count_ == 0 && !closed_)
+            notEmpty_.wait(lock);
+
+        if(count_ == 0)
+            return false;
+
+        item = items_[head_];
+        head_ = (head_ + 1) % items_.size();
+        count_--;
+        notFull_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        closed_ = true;
+        notFull_.notify_all();
+        notEmpty_.notify_all();
+    }
+
+private:
+    std::vector<T> items_;
+    int head_;
+    int count_;
+    bool closed_;
+    boost::mutex mutex_;
+    boost::condition_variable notFull_;
+    boost::condition_variable notEmpty_;
+};
+
+/// three stage pipeline for the post mortem data transfer:
+///
+///   receive (caller thread) -> process (own thread) -> persist (own thread)
+///
+/// the receive stage takes a free buffer with acquire(), fills it from
+/// the socket and passes it on with submit(); the process stage (printing,
+/// conversion, analysis) and the persist stage (saving) run concurrently,
+/// so the transfer of block k+1 overlaps the processing of block k.
+/// blocks leave every stage in the order they were submitted.
+///
+/// without RECEIVE_BUFFERS the receive stage passes its own memory to
+/// acquire(); the slots then only limit the number of blocks in flight.
+class ScopePipeline
+{
+public:
+
+    typedef boost::function<void (ScopeBlock &)> Stage;
+
+    ScopePipeline(int blockSamples, int buffers, Stage process, Stage persist, int depth = SCOPE_PIPELINE_DEPTH)
+        : slots_(depth, std::vector<int16_t>((buffers & RECEIVE_BUFFERS) ? blockSamples : 0)),
+        millivolts_(depth, std::vector<float>((buffers & MILLIVOLT_BUFFERS) ? blockSamples : 0)),
+        free_(depth), toProcess_(depth), toPersist_(depth),
+        process_(process), persist_(persist), blocks_(0), finished_(false)
+    {
+        for(int i = 0; i < depth; i++)
+            free_.push(i);
+
+        processThread_ = boost::thread(&ScopePipeline::processLoop, this);
+        persistThread_ = boost::thread(&ScopePipeline::persistLoop, this);
+    }
+
+    ~ScopePipeline()
+    {
+        shutdown();
+    }
+
+    /// receive stage: waits for a free buffer; returns false if one of
+    /// the other stages has failed and the pipeline was shut down
+    bool acquire(int channel, int block, ScopeBlock & b)
+    {
+        int slot;
+
+        if(!free_.pop(slot))
+            return false;
+
+        b.channel = channel;
+        b.block = block;
+        b.offset = 0;
+        b.last = true;
+        b.samples = &slots_[slot][0];
+        b.millivolts = millivoltsOf(slot);
+        b.count = (int)slots_[slot].size();
+        b.crc = 0;
+        b.slot = slot;
+        return true;
+    }
+
+    /// receive stage: as above, for a block received into memory
+    /// owned by the caller, e.g. a memory-mapped output file
+    bool acquire(int channel, int block, int16_t * samples, int count, ScopeBlock & b)
+    {
+        int slot;
+
+        if(!free_.pop(slot))
+            return false;
+
+        b.channel = channel;
+        b.block = block;
+        b.offset = 0;
+        b.last = true;
+        b.samples = samples;
+        b.millivolts = millivoltsOf(slot);
+        b.count = count;
+        b.crc = 0;
+        b.slot = slot;
+        return true;
+    }
+
+    /// receive stage: hands a filled buffer over to the process stage
+    bool submit(const ScopeBlock & b)
+    {
+        if(!toProcess_.push(b))
+            return false;
+
+        gaugeMetric(blocks_, 1);
+        gaugeMetric(acquisitionMetrics().pipelineBlocks, 1);
+        return true;
+    }
+
+    /// moves the buffers of the pipeline to the NUMA node 'node', see Placement.hpp
+    bool bindBuffers(int node)
+    {
+        bool bound = true;
+
+        for(std::size_t i = 0; i < slots_.size(); i++)
+        {
+            if(!slots_[i].empty())
+                bound = bindMemoryToNode(&slots_[i][0], slots_[i].size() * sizeof(int16_t), node) && bound;
+            if(!millivolts_[i].empty())
+                bound = bindMemoryToNode(&millivolts_[i][0], millivolts_[i].size() * sizeof(float), node) && bound;
+        }
+
+        return bound;
+    }
+
+    /// waits until all submitted blocks went through all the stages;
+    /// throws if any of the stages has failed
+    void finish()
+    {
+        shutdown();
+
+        if(!error_.empty())
+            throw std::runtime_error("ScopePipeline: " + error_);
+    }
+
+private:
+
+    float * millivoltsOf(int slot)
+    {
+        return millivolts_[slot].empty() ? 0 : &millivolts_[slot][0];
+    }
+
+    void processLoop()
+    {
+        ScopeBlock b;
+
+        try
+        {
+            while(toProcess_.pop(b))
+            {
+                process_(b);
+                toPersist_.push(b);
+            }
+        }
+        catch(std::exception & e)
+        {
+            fail(e.what());
+        }
+
+        toPersist_.close();
+    }
+
+    void persistLoop()
+    {
+        ScopeBlock b;
+
+        try
+        {
+            while(toPersist_.pop(b))
+            {
+                persist_(b);
+                free_.push(b.slot);
+
+                gaugeMetric(blocks_, -1);
+                gaugeMetric(acquisitionMetrics().pipelineBlocks, -1);
+            }
+        }
+        catch(std::exception & e)
+        {
+            fail(e.what());
+        }
+    }
+
+    void fail(const std::string & what)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(errorMutex_);
+            if(error_.empty())
+                error_ = what;
+        }
+
+        free_.close();
+        toProcess_.close();
+        toPersist_.close();
+    }
+
+    void shutdown()
+    {
+        if(finished_)
+            return;
+
+        finished_ = true;
+
+        toProcess_.close();
+        processThread_.join();
+        persistThread_.join();
+
+        /// THE BLOCKS LEFT IN THE RINGS BY A FAILED STAGE LEAVE THE GAUGE TOO
+        gaugeMetric(acquisitionMetrics().pipelineBlocks, -blocks_);
+    }
+
+private:
+    std::vector<std::vector<int16_t> > slots_;
+    std::vector<std::vector<float> > millivolts_;
+    BlockRing<int> free_;
+    BlockRing<ScopeBlock> toProcess_;
+    BlockRing<ScopeBlock> toPersist_;
+    Stage process_;
+    Stage persist_;
+    boost::thread processThread_;
+    boost::thread persistThread_;
+    boost::mutex errorMutex_;
+    std::string error_;
+    volatile int blocks_; // submitted and not yet persisted
+    bool finished_;
+};
+
+#endif // SCOPE_PIPELINE_HPP
@@ -0,0 +1,354 @@
+#ifndef SEQUENCE_SCRIPT_HPP
+#define SEQUENCE_SCRIPT_HPP
+
+#include <boost/lexical_cast.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "RosySettings.hpp"
+
+/// the acquisition sequence of the client as a text file instead of a mode
+/// compiled into main(): one step per line, '#' starts a comment.
+///
+///     set tl.threshold 15          # any field of TimeLossSettings / PostMortemSettings
+///     setupHistogram               # 'procedure setupHistogram' with tl.threshold
+///     poll 10 1000                 # 10 histograms, 1000 ms apart
+///     set pm.range_A RANGE_1_V
+///     setupPostMortem              # 'procedure setupPostMortem' with the pm.* settings
+///     arm                          # 'function getPostMortemData'
+///     wait                         # the trigger and the post mortem data
+///     stop                         # 'procedure stopAcquisition'
+///     read                         # one histogram
+///     sleep 500                    # [ms]
+///     setTimelossDevice 1          # 1: post mortem from the inputs of the Time Loss device, 0: back
+///
+/// the whole file is checked before anything is sent to the ROSY: unknown
+/// steps, settings or values and steps out of order (a 'poll' before any
+/// 'setupHistogram', a 'wait' without 'arm', ...) are all reported at once.
+/// the steps run in one session, see ScriptSequence in Client.cpp.
+
+enum SCRIPT_OPERATION
+{
+    SCRIPT_SET, SCRIPT_SETUP_HISTOGRAM, SCRIPT_POLL, SCRIPT_READ, SCRIPT_SETUP_POST_MORTEM,
+    SCRIPT_ARM, SCRIPT_WAIT, SCRIPT_STOP, SCRIPT_SLEEP, SCRIPT_SET_TIMELOSS_DEVICE
+};
+
+struct ScriptStep
+{
+    SCRIPT_OPERATION operation;
+    std::string text; // the line, without the comment
+    int line;
+    std::string name; // SCRIPT_SET: the setting
+    std::string value; // SCRIPT_SET: its value
+    int count; // SCRIPT_POLL: histograms; SCRIPT_SET_TIMELOSS_DEVICE: 0 | 1
+    long ms; // SCRIPT_POLL: period; SCRIPT_SLEEP: duration
+};
+
+struct SequenceScript
+{
+    std::string path;
+    std::vector<ScriptStep> steps;
+};
+
+namespace detail
+{
+
+inline bool parseScriptBool(const std::string & value, bool & b)
+{
+    if(value == "true" || value == "1" || value == "yes")
+        b = true;
+    else if(value == "false" || value == "0" || value == "no")
+        b = false;
+    else
+        return false;
+
+    return true;
+}
+
+template <typename T>
+bool parseScriptNumber(const std::string & value, T & number)
+{
+    try
+    {
+        number = boost::lexical_cast<T>(value);
+        return true;
+    }
+    catch(boost::bad_lexical_cast &)
+    {
+        return false;
+    }
+}
+
+inline bool parseScriptRange(const std::string & value, VERTICAL_RANGE & range)
+{
+    static const char * names[] = { "RANGE_100_MV", "RANGE_200_MV", "RANGE_500_MV", "RANGE_1_V",
+                                    "RANGE_2_V", "RANGE_5_V", "RANGE_10_V", "RANGE_20_V" };
+
+    for(int r = 0; r < 8; r++)
+    {
+        if(value == names[r])
+        {
+            range = (VERTICAL_RANGE)(RANGE_100_MV + r);
+            return true;
+        }
+    }
+
+    int number = 0;
+    if(value == "DISABLE_CHANNEL" || (parseScriptNumber(value, number) && number == -1))
+        range = DISABLE_CHANNEL;
+    else if(parseScriptNumber(value, number) && number >= RANGE_100_MV && number <= RANGE_20_V)
+        range = (VERTICAL_RANGE)number;
+    else
+        return false;
+
+    return true;
+}
+
+/// true if 'value' is one of the 'n' 'names'; 'index' is its position
+inline bool parseScriptChoice(const std::string & value, const char * const * names, int n, int & index)
+{
+    for(index = 0; index < n; index++)
+        if(value == names[index])
+            return true;
+
+    return false;
+}
+
+} // namespace detail
+
+/// sets the field 'name' of 'tlc' or 'ps' to 'value'; "" on success, else why not
+inline std::string applyScriptSetting(const std::string & name, const std::string & value,
+                                      TimeLossSettings * tlc, PostMortemSettings * ps)
+{
+    static const char * channels[] = { "A", "B", "C", "D", "EXT" };
+    static const char * directions[] = { "RISING", "FALLING", "RISE_FALL" };
+    static const char * formats[] = { "SAVE_TEXT", "SAVE_BINARY", "SAVE_MAPPED", "SAVE_CHUNKED" };
+    static const char * codecs[] = { "CODEC_NONE", "CODEC_DELTA", "CODEC_RICE" };
+
+    bool ok = false;
+    int index = 0;
+
+    if(name == "tl.threshold") ok = detail::parseScriptNumber(value, tlc->threshold);
+    else if(name == "tl.saveToFile") ok = detail::parseScriptBool(value, tlc->saveToFile);
+    else if(name == "tl.printSomeData") ok = detail::parseScriptBool(value, tlc->printSomeData);
+    else if(name == "pm.delay") ok = detail::parseScriptNumber(value, ps->delay);
+    else if(name == "pm.range_A") ok = detail::parseScriptRange(value, ps->range_A);
+    else if(name == "pm.range_B") ok = detail::parseScriptRange(value, ps->range_B);
+    else if(name == "pm.range_C") ok = detail::parseScriptRange(value, ps->range_C);
+    else if(name == "pm.range_D") ok = detail::parseScriptRange(value, ps->range_D);
+    else if(name == "pm.triggerChannel")
+    {
+        if((ok = detail::parseScriptChoice(value, channels, 5, index)))
+            ps->triggerChannel = value;
+    }
+    else if(name == "pm.triggerDirection")
+    {
+        if((ok = detail::parseScriptChoice(value, directions, 3, index)))
+            ps->triggerDirection = value;
+    }
+    else if(name == "pm.triggerThreshold")
+        ok = detail::parseScriptNumber(value, ps->triggerThreshold) && ps->triggerThreshold >= 1 && ps->triggerThreshold <= 1000;
+    else if(name == "pm.numberOfSamples")
+        ok = detail::parseScriptNumber(value, ps->numberOfSamples) && (ps->numberOfSamples >= 100 || ps->numberOfSamples == -1);
+    else if(name == "pm.samplingPeriod") ok = detail::parseScriptNumber(value, ps->samplingPeriod);
+    else if(name == "pm.saveToFile") ok = detail::parseScriptBool(value, ps->saveToFile);
+    else if(name == "pm.saveFormat")
+    {
+        if((ok = detail::parseScriptChoice(value, formats, 4, index)))
+            ps->saveFormat = (SAVE_FORMAT)index;
+    }
+    else if(name == "pm.chunkCodec")
+    {
+        if((ok = detail::parseScriptChoice(value, codecs, 3, index)))
+            ps->chunkCodec = (CHUNK_CODEC)index;
+    }
+    else if(name == "pm.chunkSamples") ok = detail::parseScriptNumber(value, ps->chunkSamples) && ps->chunkSamples > 0;
+    else if(name == "pm.printSomeData") ok = detail::parseScriptBool(value, ps->printSomeData);
+    else if(name == "pm.convertToMillivolts") ok = detail::parseScriptBool(value, ps->convertToMillivolts);
+    else if(name == "pm.computeEnvelope") ok = detail::parseScriptBool(value, ps->computeEnvelope);
+    else if(name == "pm.findEdges") ok = detail::parseScriptBool(value, ps->findEdges);
+    else if(name == "pm.edgeDirection")
+    {
+        if((ok = detail::parseScriptChoice(value, directions, 3, index)))
+            ps->edgeDirection = value;
+    }
+    else if(name == "pm.edgeThreshold") ok = detail::parseScriptNumber(value, ps->edgeThreshold);
+    else if(name == "pm.edgeHysteresis") ok = detail::parseScriptNumber(value, ps->edgeHysteresis) && ps->edgeHysteresis >= 0;
+    else if(name == "pm.computeSpectrum") ok = detail::parseScriptBool(value, ps->computeSpectrum);
+    else if(name == "pm.spectrumSegment") ok = detail::parseScriptNumber(value, ps->spectrumSegment) && ps->spectrumSegment > 1;
+    else if(name == "pm.memoryBudget") ok = detail::parseScriptNumber(value, ps->memoryBudget) && ps->memoryBudget > 0;
+    else
+        return "unknown setting " + name;
+
+    return ok ? std::string() : "invalid value " + value + " of " + name;
+}
+
+/// reads and checks the sequence file 'path'; throws with every error found
+inline SequenceScript loadSequenceScript(const std::string & path)
+{
+    std::ifstream file(path.c_str());
+    if(!file)
+        throw std::runtime_error("SequenceScript: cannot open " + path);
+
+    SequenceScript script;
+    script.path = path;
+
+    std::stringstream errors;
+    int numberOfErrors = 0;
+
+    /// SCRATCH SETTINGS, ONLY TO CHECK THE VALUES
+    TimeLossSettings tlc = TimeLossSettings();
+    PostMortemSettings ps = PostMortemSettings();
+
+    /// WHAT THE STEPS SO FAR HAVE SET UP, TO CHECK THE ORDER
+    bool histogramReady = false;
+    bool postMortemReady = false;
+    int armedLine = 0;
+
+    std::string text;
+    for(int line = 1; std::getline(file, text); line++)
+    {
+        std::string::size_type comment = text.find('#');
+        if(comment != std::string::npos)
+            text.erase(comment);
+
+        std::stringstream ss(text);
+        std::vector<std::string> words;
+        for(std::string word; ss >> word; )
+            words.push_back(word);
+
+        if(words.empty())
+            continue;
+
+        ScriptStep step;
+        step.text = text.substr(text.find_first_not_of(" \t"));
+        step.text.erase(step.text.find_last_not_of(" \t\r") + 1);
+        step.line = line;
+        step.count = 0;
+        step.ms = 0;
+
+        const std::string & op = words[0];
+        std::size_t arguments = words.size() - 1;
+        std::string error;
+
+        if(op == "set")
+        {
+            step.operation = SCRIPT_SET;
+
+            if(arguments != 2)
+                error = "set <setting> <value>";
+            else
+            {
+                step.name = words[1];
+                step.value = words[2];
+                error = applyScriptSetting(step.name, step.value, &tlc, &ps);
+
+                if(error.empty() && armedLine > 0 && step.name.compare(0, 3, "pm.") == 0)
+                    error = "post mortem settings cannot change between 'arm' and 'wait'";
+            }
+        }
+        else if(op == "poll")
+        {
+            step.operation = SCRIPT_POLL;
+
+            if(arguments != 2 || !detail::parseScriptNumber(words[1], step.count) || step.count <= 0
+               || !detail::parseScriptNumber(words[2], step.ms) || step.ms < 0)
+                error = "poll <histograms > 0> <period ms >= 0>";
+            else if(!histogramReady)
+                error = "poll before setupHistogram";
+        }
+        else if(op == "sleep")
+        {
+            step.operation = SCRIPT_SLEEP;
+
+            if(arguments != 1 || !detail::parseScriptNumber(words[1], step.ms) || step.ms < 0)
+                error = "sleep <ms >= 0>";
+        }
+        else if(op == "setTimelossDevice")
+        {
+            step.operation = SCRIPT_SET_TIMELOSS_DEVICE;
+
+            if(arguments != 1 || (words[1] != "0" && words[1] != "1"))
+                error = "setTimelossDevice <0 | 1>";
+            else
+                step.count = (words[1] == "1");
+        }
+        else if(arguments > 0 && (op == "setupHistogram" || op == "read" || op == "setupPostMortem"
+                                  || op == "arm" || op == "wait" || op == "stop"))
+            error = op + " takes no arguments";
+        else if(op == "setupHistogram")
+        {
+            step.operation = SCRIPT_SETUP_HISTOGRAM;
+            histogramReady = true;
+        }
+        else if(op == "read")
+        {
+            step.operation = SCRIPT_READ;
+
+            if(!histogramReady)
+                error = "read before setupHistogram";
+        }
+        else if(op == "setupPostMortem")
+        {
+            step.operation = SCRIPT_SETUP_POST_MORTEM;
+
+            if(armedLine > 0)
+                error = "setupPostMortem between 'arm' and 'wait'";
+
+            postMortemReady = true;
+        }
+        else if(op == "arm")
+        {
+            step.operation = SCRIPT_ARM;
+
+            if(!postMortemReady)
+                error = "arm before setupPostMortem";
+            else if(armedLine > 0)
+                error = "arm again before 'wait'";
+
+            armedLine = line;
+        }
+        else if(op == "wait")
+        {
+            step.operation = SCRIPT_WAIT;
+
+            if(armedLine == 0)
+                error = "wait without arm";
+
+            armedLine = 0;
+        }
+        else if(op == "stop")
+            step.operation = SCRIPT_STOP;
+        else
+            error = "unknown step " + op;
+
+        if(!error.empty())
+        {
+            errors << "\n\t" << path << ":" << line << ": " << error;
+            numberOfErrors++;
+        }
+        else
+            script.steps.push_back(step);
+    }
+
+    if(armedLine > 0)
+    {
+        errors << "\n\t" << path << ":" << armedLine << ": arm without wait";
+        numberOfErrors++;
+    }
+
+    if(numberOfErrors > 0)
+        throw std::runtime_error("SequenceScript: " + boost::lexical_cast<std::string>(numberOfErrors)
+                                 + " error(s) in " + path + errors.str());
+
+    if(script.steps.empty())
+        throw std::runtime_error("SequenceScript: no steps in " + path);
+
+    return script;
+}
+
+#endif // SEQUENCE_SCRIPT_HPP
@@ -0,0 +1,54 @@
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/bind.hpp>
+#include <iostream>
+#include <string>
+
+#include "RosySimulator.hpp"
+
+/// a simulated ROSY for the client, see RosySimulator.hpp; runs until SIGINT or SIGTERM
+int main(int argc, char* argv[])
+{
+    try
+    {
+        /// ***** SIMULATOR SETTINGS *****
+
+        SimulatorSettings s = defaultSimulatorSettings();
+
+        /// E.G. Simulator bandwidth=100e6 latencyMs=2 triggerDelayMs=5000 faultRate=0.01 faults=DISCONNECT
+        for(int i = 1; i < argc; i++)
+        {
+            std::string error = applySimulatorOption(s, argv[i]);
+
+            if(!error.empty())
+            {
+                std::cout << "\n Usage: Simulator [name=value ...]\n" << std::endl;
+                std::cout << "\t address=127.0.0.1 controlPort=3893 postMortemPort=3894" << std::endl;
+                std::cout << "\t histogramShape=< FLAT | RAMP | DECAY | PEAK | NOISE > histogramBins=1000 histogramCounts=1000" << std::endl;
+                std::cout << "\t waveformShape=< SINE | SQUARE | PULSES | NOISE > waveformPeriod=1000 [samples]" << std::endl;
+                std::cout << "\t waveformAmplitude=0.25 waveformNoise=0.01 [of the full scale]" << std::endl;
+                std::cout << "\t postMortemBlocks=4 maxPostMortemSamples=10000000" << std::endl;
+                std::cout << "\t bandwidth=0 [bytes/s, 0 is unlimited] latencyMs=0 triggerDelayMs=200" << std::endl;
+                std::cout << "\t faultRate=0 faults=ERROR_STATUS,DISCONNECT,STALL,CORRUPT stallMs=2000 seed=1" << std::endl;
+                std::cout << "\n " << error << std::endl;
+                return 1;
+            }
+        }
+
+        /// ************************************
+
+        RosySimulator simulator(s);
+        simulator.start();
+
+        boost::asio::io_service io_service;
+        boost::asio::signal_set signals(io_service, SIGINT, SIGTERM);
+        signals.async_wait(boost::bind(&RosySimulator::stop, &simulator));
+        io_service.run();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,347 @@
+#ifndef SOCKET_JOURNAL_HPP
+#define SOCKET_JOURNAL_HPP
+
+#include <boost/static_assert.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "CommandLatency.hpp"
+
+/// binary journal of the traffic of a session:
+///
+///   [header, JOURNAL_HEADER_SIZE bytes][record][record]...
+///   record: [JournalRecordHeader][size bytes]
+///
+/// every byte the client takes from CONTROL_SOCKET and POST_MORTEM_SOCKET
+/// is recorded in the order it was taken, with the time, and so is every
+/// request it sends: the requests pace the replay, see JournalPlayer. the
+/// time of a received byte is when the client read it from the socket, so
+/// a client slower than the link shows in the journal as a slower link.
+/// the header names the mode the session ran, so REPLAY can run it again.
+
+const char JOURNAL_MAGIC[8] = { 'R', 'O', 'S', 'Y', 'J', 'R', 'N', 'L' };
+const uint32_t JOURNAL_FORMAT_VERSION = 1;
+const uint32_t JOURNAL_HEADER_SIZE = 512;
+
+/// [bytes] of records collected before they are written together
+const std::size_t JOURNAL_BUFFER = 1 << 20;
+
+/// as CONTROL_SOCKET and POST_MORTEM_SOCKET
+enum JOURNAL_SOCKET
+{
+    JOURNAL_CONTROL_SOCKET, JOURNAL_POST_MORTEM_SOCKET
+};
+
+enum JOURNAL_DIRECTION
+{
+    JOURNAL_RECEIVED, // from the ROSY
+    JOURNAL_SENT // to the ROSY
+};
+
+struct JournalFileHeader
+{
+    char magic[8]; // JOURNAL_MAGIC
+    uint32_t version; // JOURNAL_FORMAT_VERSION
+    uint32_t headerSize; // [bytes], offset of the first record
+    uint64_t timestampNs; // start of the session, ns since the epoch (UTC)
+    char mode[16]; // of the session, e.g. PM
+    char argument[256]; // its argument, e.g. the sequence file of RUN
+};
+
+BOOST_STATIC_ASSERT(sizeof(JournalFileHeader) <= JOURNAL_HEADER_SIZE);
+
+struct JournalRecordHeader
+{
+    uint64_t timeNs; // since the start of the session
+    uint32_t size; // [bytes] following
+    uint8_t socket; // JOURNAL_SOCKET
+    uint8_t direction; // JOURNAL_DIRECTION
+    uint16_t reserved;
+};
+
+BOOST_STATIC_ASSERT(sizeof(JournalRecordHeader) == 16);
+
+/// writes the journal of a session; record() is safe from any thread
+class SocketJournal
+{
+public:
+
+    SocketJournal(const std::string & path, const std::string & mode, const std::string & argument)
+        : path_(path), start_(LatencyClock::now()), bytes_(0)
+    {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd_ < 0)
+            fail("cannot open");
+
+        char block[JOURNAL_HEADER_SIZE];
+        std::memset(block, 0, sizeof(block));
+
+        JournalFileHeader * h = reinterpret_cast<JournalFileHeader *>(block);
+        std::memcpy(h->magic, JOURNAL_MAGIC, sizeof(h->magic));
+        h->version = JOURNAL_FORMAT_VERSION;
+        h->headerSize = JOURNAL_HEADER_SIZE;
+
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        h->timestampNs = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+        std::strncpy(h->mode, mode.c_str(), sizeof(h->mode) - 1);
+        std::strncpy(h->argument, argument.c_str(), sizeof(h->argument) - 1);
+
+        writeAll(block, sizeof(block));
+    }
+
+    ~SocketJournal()
+    {
+        try
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            flush();
+        }
+        catch(std::exception &)
+        {
+        }
+
+        ::close(fd_);
+    }
+
+    void record(int socket, int direction, const void * data, std::size_t bytes)
+    {
+        JournalRecordHeader h;
+        h.timeNs = elapsedNs(start_, LatencyClock::now());
+        h.size = (uint32_t)bytes;
+        h.socket = (uint8_t)socket;
+        h.direction = (uint8_t)direction;
+        h.reserved = 0;
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+
+        if(buffer_.size() + sizeof(h) + bytes > JOURNAL_BUFFER)
+            flush();
+
+        const char * p = static_cast<const char *>(data);
+        buffer_.insert(buffer_.end(), reinterpret_cast<const char *>(&h), reinterpret_cast<const char *>(&h) + sizeof(h));
+
+        /// LARGE PIECES OF DATA GO TO THE FILE WITHOUT A COPY
+        if(bytes > JOURNAL_BUFFER / 2)
+        {
+            flush();
+            writeAll(p, bytes);
+        }
+        else
+            buffer_.insert(buffer_.end(), p, p + bytes);
+
+        bytes_ += bytes;
+    }
+
+    /// [bytes] recorded, without the headers
+    uint64_t bytes()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return bytes_;
+    }
+
+    const std::string & path() const
+    {
+        return path_;
+    }
+
+private:
+
+    /// called with 'mutex_' held
+    void flush()
+    {
+        if(!buffer_.empty())
+            writeAll(&buffer_[0], buffer_.size());
+        buffer_.clear();
+    }
+
+    void writeAll(const char * p, std::size_t bytes)
+    {
+        while(bytes > 0)
+        {
+            ssize_t written = ::write(fd_, p, bytes);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                fail("cannot write");
+
+            p += written;
+            bytes -= written;
+        }
+    }
+
+    void fail(const std::string & what)
+    {
+        throw std::runtime_error("SocketJournal: " + what + " " + path_ + ": " + std::strerror(errno));
+    }
+
+private:
+    SocketJournal(const SocketJournal &);
+    SocketJournal & operator=(const SocketJournal &);
+
+    std::string path_;
+    int fd_;
+    LatencyClock::time_point start_;
+    boost::mutex mutex_;
+    std::vector<char> buffer_; // records not yet written
+    uint64_t bytes_;
+};
+
+/// the traffic of one socket into a journal; does nothing without one
+struct JournalTap
+{
+    explicit JournalTap(SocketJournal * journal = 0, int socket = JOURNAL_CONTROL_SOCKET)
+        : journal(journal), socket(socket)
+    {}
+
+    void received(const void * data, std::size_t bytes) const
+    {
+        if(journal && bytes > 0)
+            journal->record(socket, JOURNAL_RECEIVED, data, bytes);
+    }
+
+    /// a line taken from the socket, without its '\n'
+    void receivedLine(const std::string & line) const
+    {
+        if(journal)
+            received((line + "\n").data(), line.size() + 1);
+    }
+
+    void sent(const std::string & data) const
+    {
+        if(journal)
+            journal->record(socket, JOURNAL_SENT, data.data(), data.size());
+    }
+
+    SocketJournal * journal;
+    int socket;
+};
+
+/// reads a journal record by record; the records of the other socket are
+/// skipped, and counted if they are requests
+class JournalReader
+{
+public:
+
+    explicit JournalReader(const std::string & path)
+        : path_(path), requests_(0)
+    {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if(fd_ < 0)
+            throw std::runtime_error("JournalReader: cannot open " + path + ": " + std::strerror(errno));
+
+        char block[JOURNAL_HEADER_SIZE];
+
+        if(!readAll(block, sizeof(block)))
+            fail("no header in");
+
+        std::memcpy(&header_, block, sizeof(header_));
+
+        if(std::memcmp(header_.magic, JOURNAL_MAGIC, sizeof(header_.magic)) != 0)
+            fail("not a journal:");
+        if(header_.version > JOURNAL_FORMAT_VERSION)
+            fail("journal of a newer version:");
+
+        header_.mode[sizeof(header_.mode) - 1] = 0;
+        header_.argument[sizeof(header_.argument) - 1] = 0;
+
+        if(::lseek(fd_, header_.headerSize, SEEK_SET) < 0)
+            fail("cannot seek in");
+    }
+
+    ~JournalReader()
+    {
+        ::close(fd_);
+    }
+
+    const JournalFileHeader & header() const
+    {
+        return header_;
+    }
+
+    /// the next record of 'socket' and its bytes; false at the end of the journal
+    bool next(int socket, JournalRecordHeader & record, std::vector<char> & data)
+    {
+        for(;;)
+        {
+            if(!readAll(reinterpret_cast<char *>(&record), sizeof(record)))
+                return false;
+
+            if(record.socket == socket)
+            {
+                data.resize(record.size);
+                if(record.size > 0 && !readAll(&data[0], record.size))
+                    fail("truncated record in");
+
+                if(record.direction == JOURNAL_SENT)
+                    requests_++;
+                return true;
+            }
+
+            if(record.direction == JOURNAL_SENT)
+                requests_++;
+
+            if(::lseek(fd_, record.size, SEEK_CUR) < 0)
+                fail("cannot seek in");
+        }
+    }
+
+    /// requests of all the sockets up to the last record returned
+    uint64_t requests() const
+    {
+        return requests_;
+    }
+
+private:
+
+    /// false at the end of the file before the first byte
+    bool readAll(char * p, std::size_t bytes)
+    {
+        std::size_t done = 0;
+
+        while(done < bytes)
+        {
+            ssize_t got = ::read(fd_, p + done, bytes - done);
+            if(got < 0 && errno == EINTR)
+                continue;
+            if(got < 0)
+                fail("cannot read");
+            if(got == 0)
+            {
+                if(done == 0)
+                    return false;
+                fail("truncated record in");
+            }
+
+            done += got;
+        }
+
+        return true;
+    }
+
+    void fail(const std::string & what)
+    {
+        throw std::runtime_error("JournalReader: " + what + " " + path_);
+    }
+
+private:
+    JournalReader(const JournalReader &);
+    JournalReader & operator=(const JournalReader &);
+
+    std::string path_;
+    int fd_;
+    JournalFileHeader header_;
+    uint64_t requests_;
+};
+
+#endif // SOCKET_JOURNAL_HPP
@@ -0,0 +1,562 @@
+#ifndef SPECTRUM_HPP
+#define SPECTRUM_HPP
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#define ROSY_HAVE_SSE_FFT 1
+#endif
+
+#include "CaptureStore.hpp"
+#include "TaskPool.hpp"
+#include "VoltageConversion.hpp"
+
+/// dependency-free mixed radix FFT and Welch power spectral density.
+///
+/// the FFT is an iterative self-sorting (Stockham) mixed radix transform:
+/// radix 4, 2 and 3 passes and one direct DFT pass for every other prime
+/// factor of the length, so every length is supported. the passes
+/// alternate between two buffers and need no bit reversal. they are
+/// templates on the sample type: with SSE 'Float4' four independent
+/// transforms (four Welch segments) run in the four lanes of every
+/// instruction. the twiddles of every length are computed once and cached.
+
+template <typename T>
+struct Complex
+{
+    T re;
+    T im;
+};
+
+#ifdef ROSY_HAVE_SSE_FFT
+/// four floats, one per independent transform
+struct Float4
+{
+    __m128 v;
+
+    Float4() {}
+    Float4(__m128 x) : v(x) {}
+    explicit Float4(float x) : v(_mm_set1_ps(x)) {}
+};
+
+inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, float b) { return _mm_mul_ps(a.v, _mm_set1_ps(b)); }
+inline Float4 & operator+=(Float4 & a, Float4 b) { a.v = _mm_add_ps(a.v, b.v); return a; }
+
+typedef Float4 SpectrumLanes;
+const int SPECTRUM_LANES = 4;
+#else
+typedef float SpectrumLanes;
+const int SPECTRUM_LANES = 1;
+#endif
+
+/// multiplication by a twiddle factor, the same for all the lanes
+template <typename T>
+inline Complex<T> operator*(const Complex<T> & a, const Complex<float> & w)
+{
+    Complex<T> r;
+    r.re = a.re * w.re - a.im * w.im;
+    r.im = a.re * w.im + a.im * w.re;
+    return r;
+}
+
+template <typename T>
+inline Complex<T> operator+(const Complex<T> & a, const Complex<T> & b)
+{
+    Complex<T> r;
+    r.re = a.re + b.re;
+    r.im = a.im + b.im;
+    return r;
+}
+
+template <typename T>
+inline Complex<T> operator-(const Complex<T> & a, const Complex<T> & b)
+{
+    Complex<T> r;
+    r.re = a.re - b.re;
+    r.im = a.im - b.im;
+    return r;
+}
+
+/// factors and twiddles of a forward transform of one length
+class FFTPlan
+{
+public:
+
+    explicit FFTPlan(int n)
+        : n_(n), twiddles_(n)
+    {
+        if(n < 1)
+            throw std::runtime_error("FFTPlan: invalid length");
+
+        for(int i = 0; i < n; i++)
+        {
+            double phase = -2.0 * M_PI * i / n;
+            twiddles_[i].re = (float)std::cos(phase);
+            twiddles_[i].im = (float)std::sin(phase);
+        }
+
+        /// AS MANY RADIX 4 PASSES AS POSSIBLE, THEN 2, 3 AND THE OTHER PRIMES
+        for(; n % 4 == 0; n /= 4)
+            radices_.push_back(4);
+
+        for(int f = 2; n > 1; f = (f == 2) ? 3 : f + 2)
+        {
+            if((uint64_t)f * f > (uint64_t)n)
+                f = n;
+
+            for(; n % f == 0; n /= f)
+                radices_.push_back(f);
+        }
+    }
+
+    int size() const
+    {
+        return n_;
+    }
+
+    /// out[k] = sum in[j] * exp(-2 pi i j k / n); 'in' and 'out' must not
+    /// overlap, 'in' is overwritten: the passes alternate between the two
+    template <typename T>
+    void forward(Complex<T> * in, Complex<T> * out) const
+    {
+        Complex<T> * x = in;
+        Complex<T> * y = out;
+
+        if(radices_.empty())
+            std::copy(in, in + n_, out);
+
+        /// 'length' SAMPLES LEFT TO TRANSFORM IN EACH OF 'stride' INTERLEAVED SEQUENCES
+        int length = n_;
+        int stride = 1;
+
+        for(std::size_t i = 0; i < radices_.size(); i++)
+        {
+            int p = radices_[i];
+            length /= p;
+
+            /// AFTER AN ODD NUMBER OF PASSES THE DATA ARE IN 'out' ALREADY:
+            /// THE LAST PASS, WHICH WRITES WHERE IT READS, IS DONE IN PLACE
+            if(i + 1 == radices_.size() && x == out)
+                y = out;
+
+            switch(p)
+            {
+            case 2: pass2(x, y, length, stride); break;
+            case 3: pass3(x, y, length, stride); break;
+            case 4: pass4(x, y, length, stride); break;
+            default: passGeneric(x, y, p, length, stride); break;
+            }
+
+            stride *= p;
+            std::swap(x, y);
+        }
+    }
+
+private:
+
+    /// one pass of the self-sorting (Stockham) decimation in frequency: for
+    /// every j < m and every interleaved sequence q < s, the p inputs
+    ///   a[r] = x[q + s * (j + r * m)]
+    /// give the p outputs
+    ///   y[q + s * (p * j + k)] = DFT_p(a)[k] * w^(j * k * s),  w = exp(-2 pi i / n)
+    /// so no reordering of the result is needed after the last pass. every
+    /// group of p inputs is read before its outputs are written, so the
+    /// last pass, where m = 1 and the outputs are the inputs, may have x == y
+    template <typename T>
+    void pass2(const Complex<T> * x, Complex<T> * y, int m, int s) const
+    {
+        for(int j = 0; j < m; j++)
+        {
+            const Complex<float> & w1 = twiddles_[j * s];
+
+            for(int q = 0; q < s; q++)
+            {
+                Complex<T> a0 = x[q + s * j];
+                Complex<T> a1 = x[q + s * (j + m)];
+                Complex<T> * b = y + q + s * 2 * j;
+
+                b[0] = a0 + a1;
+                b[s] = (a0 - a1) * w1;
+            }
+        }
+    }
+
+    template <typename T>
+    void pass3(const Complex<T> * x, Complex<T> * y, int m, int s) const
+    {
+        /// sin(2 pi / 3)
+        const float h = 0.86602540378443865f;
+
+        for(int j = 0; j < m; j++)
+        {
+            const Complex<float> & w1 = twiddles_[j * s];
+            const Complex<float> & w2 = twiddles_[2 * j * s];
+
+            for(int q = 0; q < s; q++)
+            {
+                Complex<T> a0 = x[q + s * j];
+                Complex<T> a1 = x[q + s * (j + m)];
+                Complex<T> a2 = x[q + s * (j + 2 * m)];
+                Complex<T> sum = a1 + a2;
+                Complex<T> diff = a1 - a2;
+                Complex<T> * b = y + q + s * 3 * j;
+
+                /// a0 + a1 w3^k + a2 w3^2k WITH w3 = -1/2 - i h
+                Complex<T> c;
+                c.re = a0.re - sum.re * 0.5f;
+                c.im = a0.im - sum.im * 0.5f;
+
+                Complex<T> b1, b2;
+                b1.re = c.re + diff.im * h;
+                b1.im = c.im - diff.re * h;
+                b2.re = c.re - diff.im * h;
+                b2.im = c.im + diff.re * h;
+
+                b[0] = a0 + sum;
+                b[s] = b1 * w1;
+                b[2 * s] = b2 * w2;
+            }
+        }
+    }
+
+    template <typename T>
+    void pass4(const Complex<T> * x, Complex<T> * y, int m, int s) const
+    {
+        for(int j = 0; j < m; j++)
+        {
+            const Complex<float> & w1 = twiddles_[j * s];
+            const Complex<float> & w2 = twiddles_[2 * j * s];
+            const Complex<float> & w3 = twiddles_[3 * j * s];
+
+            for(int q = 0; q < s; q++)
+            {
+                Complex<T> a0 = x[q + s * j];
+                Complex<T> a1 = x[q + s * (j + m)];
+                Complex<T> a2 = x[q + s * (j + 2 * m)];
+                Complex<T> a3 = x[q + s * (j + 3 * m)];
+                Complex<T> * b = y + q + s * 4 * j;
+
+                Complex<T> d[4];
+                dft4(a0, a1, a2, a3, d);
+
+                b[0] = d[0];
+                b[s] = d[1] * w1;
+                b[2 * s] = d[2] * w2;
+                b[3 * s] = d[3] * w3;
+            }
+        }
+    }
+
+    /// the 4 point DFT of a0 .. a3 to d[0] .. d[3]
+    template <typename T>
+    static void dft4(const Complex<T> & a0, const Complex<T> & a1, const Complex<T> & a2, const Complex<T> & a3,
+                     Complex<T> * d)
+    {
+        Complex<T> even = a0 + a2;
+        Complex<T> odd = a0 - a2;
+        Complex<T> sum = a1 + a3;
+
+        /// -i (a1 - a3)
+        Complex<T> turned;
+        turned.re = a1.im - a3.im;
+        turned.im = a3.re - a1.re;
+
+        d[0] = even + sum;
+        d[1] = odd + turned;
+        d[2] = even - sum;
+        d[3] = odd - turned;
+    }
+
+    /// any other prime p, as a direct DFT of p points
+    template <typename T>
+    void passGeneric(const Complex<T> * x, Complex<T> * y, int p, int m, int s) const
+    {
+        /// w^(n/p) IS THE p-TH ROOT OF UNITY
+        const int root = n_ / p;
+        std::vector<Complex<T> > a(p);
+
+        for(int j = 0; j < m; j++)
+        {
+            for(int q = 0; q < s; q++)
+            {
+                for(int r = 0; r < p; r++)
+                    a[r] = x[q + s * (j + r * m)];
+
+                Complex<T> * b = y + q + s * p * j;
+
+                for(int k = 0; k < p; k++)
+                {
+                    Complex<T> dft = a[0];
+
+                    /// rk = r * k MODULO p
+                    for(int r = 1, rk = k; r < p; r++)
+                    {
+                        dft = dft + a[r] * twiddles_[rk * root];
+
+                        rk += k;
+                        if(rk >= p)
+                            rk -= p;
+                    }
+
+                    b[k * s] = k == 0 ? dft : dft * twiddles_[j * k * s];
+                }
+            }
+        }
+    }
+
+private:
+    int n_;
+    std::vector<int> radices_; // of the passes, in order; their product is n_
+    std::vector<Complex<float> > twiddles_; // w^i, w = exp(-2 pi i / n)
+};
+
+/// the plan of length 'n', built on first use and shared afterwards
+inline const FFTPlan & fftPlan(int n)
+{
+    static boost::mutex mutex;
+    static std::map<int, boost::shared_ptr<FFTPlan> > plans;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    boost::shared_ptr<FFTPlan> & plan = plans[n];
+
+    if(!plan)
+        plan.reset(new FFTPlan(n));
+
+    return *plan;
+}
+
+/// Welch power spectral density: Hann window, 50 % overlapping segments,
+/// mean removed per segment; segments are transformed SPECTRUM_LANES at a
+/// time and spread over all the cores. the channel can be passed in
+/// windows of consecutive segments, see add()
+class WelchSpectrum
+{
+public:
+
+    /// spectrum of a channel of 'n' samples; shorter channels make one shorter segment
+    WelchSpectrum(int segmentSamples, uint64_t n)
+        : length_((int)std::max<uint64_t>(std::min<uint64_t>(segmentSamples, n), 2)),
+        hop_(std::max(1, length_ / 2)), segments_(n < (uint64_t)length_ ? 0 : (n - length_) / hop_ + 1),
+        data_(0), batch_(0), sum_(length_ / 2 + 1, 0.0), window_(length_), windowPower_(0)
+    {
+        if(segmentSamples < 2)
+            throw std::runtime_error("WelchSpectrum: segment too short");
+
+        for(int i = 0; i < length_; i++)
+        {
+            window_[i] = (float)(0.5 - 0.5 * std::cos(2.0 * M_PI * i / length_));
+            windowPower_ += (double)window_[i] * window_[i];
+        }
+    }
+
+    /// samples per segment
+    int length() const
+    {
+        return length_;
+    }
+
+    /// samples between the starts of two segments
+    int hop() const
+    {
+        return hop_;
+    }
+
+    /// segments of the whole channel
+    uint64_t segments() const
+    {
+        return segments_;
+    }
+
+    /// adds 'count' consecutive segments, the first one starting at 'data';
+    /// 'data' holds (count - 1) * hop() + length() samples
+    void add(const int16_t * data, uint64_t count)
+    {
+        const FFTPlan & plan = fftPlan(length_);
+
+        data_ = data;
+        batch_ = count;
+
+        uint64_t groups = (count + SPECTRUM_LANES - 1) / SPECTRUM_LANES;
+
+        /// THE SUMS OF THE RANGES ARE ADDED IN ORDER: THE PSD DOES NOT DEPEND ON THE SCHEDULE
+        std::vector<double> sum = parallelReduce<std::vector<double> >(0, groups, parallelGrain(groups, 1), sum_,
+            boost::bind(&WelchSpectrum::transformGroups, this, &plan, _1, _2), &WelchSpectrum::addSums);
+        sum_.swap(sum);
+    }
+
+    /// one-sided PSD [mV^2/Hz] of all the segments added, bins 0 .. length()/2;
+    /// the frequency of bin k is k / (length() * samplingPeriod)
+    std::vector<double> finish(float millivoltsPerCount, double samplingPeriod) const
+    {
+        double fs = 1.0 / samplingPeriod;
+        double scale = (double)millivoltsPerCount * millivoltsPerCount / (fs * windowPower_ * std::max<uint64_t>(segments_, 1));
+
+        std::vector<double> psd(sum_.size());
+        for(std::size_t k = 0; k < psd.size(); k++)
+        {
+            bool doubled = (k > 0) && !(length_ % 2 == 0 && (int)k == length_ / 2);
+            psd[k] = sum_[k] * scale * (doubled ? 2 : 1);
+        }
+
+        return psd;
+    }
+
+private:
+
+    /// sum over the groups 'begin' .. 'end' - 1 of SPECTRUM_LANES segments of the batch
+    std::vector<double> transformGroups(const FFTPlan * plan, uint64_t begin, uint64_t end) const
+    {
+        std::vector<Complex<SpectrumLanes> > in(length_), out(length_);
+        std::vector<double> sum(length_ / 2 + 1, 0.0);
+
+        for(uint64_t group = begin; group < end; group++)
+        {
+            uint64_t first = group * SPECTRUM_LANES;
+            int lanes = (int)std::min<uint64_t>(SPECTRUM_LANES, batch_ - first);
+
+            loadSegments(first, lanes, in);
+            plan->forward(&in[0], &out[0]);
+            accumulate(out, lanes, sum);
+        }
+
+        return sum;
+    }
+
+    static std::vector<double> addSums(const std::vector<double> & a, const std::vector<double> & b)
+    {
+        std::vector<double> sum(a);
+        for(std::size_t k = 0; k < sum.size(); k++)
+            sum[k] += b[k];
+        return sum;
+    }
+
+    /// windowed, mean-free segments 'first' .. 'first + lanes - 1' of the batch, one per lane
+    void loadSegments(uint64_t first, int lanes, std::vector<Complex<SpectrumLanes> > & in) const
+    {
+        float mean[SPECTRUM_LANES];
+        const int16_t * segment[SPECTRUM_LANES];
+
+        for(int l = 0; l < SPECTRUM_LANES; l++)
+        {
+            segment[l] = data_ + (first + std::min(l, lanes - 1)) * hop_;
+
+            double sum = 0;
+            for(int i = 0; i < length_; i++)
+                sum += segment[l][i];
+            mean[l] = (float)(sum / length_);
+        }
+
+        for(int i = 0; i < length_; i++)
+        {
+            float x[SPECTRUM_LANES];
+
+            for(int l = 0; l < SPECTRUM_LANES; l++)
+                x[l] = (segment[l][i] - mean[l]) * window_[i];
+
+            in[i].re = load(x);
+            in[i].im = SpectrumLanes(0.0f);
+        }
+    }
+
+    void accumulate(const std::vector<Complex<SpectrumLanes> > & out, int lanes, std::vector<double> & sum) const
+    {
+        for(std::size_t k = 0; k < sum.size(); k++)
+        {
+            float re[SPECTRUM_LANES];
+            float im[SPECTRUM_LANES];
+            store(out[k].re, re);
+            store(out[k].im, im);
+
+            for(int l = 0; l < lanes; l++)
+                sum[k] += (double)re[l] * re[l] + (double)im[l] * im[l];
+        }
+    }
+
+#ifdef ROSY_HAVE_SSE_FFT
+    static Float4 load(const float * x) { return _mm_loadu_ps(x); }
+    static void store(Float4 v, float * x) { _mm_storeu_ps(x, v.v); }
+#else
+    static float load(const float * x) { return *x; }
+    static void store(float v, float * x) { *x = v; }
+#endif
+
+private:
+    int length_;
+    int hop_;
+    uint64_t segments_;
+    const int16_t * data_; // the batch being added
+    uint64_t batch_; // segments in it
+    std::vector<double> sum_;
+    std::vector<float> window_;
+    double windowPower_;
+};
+
+/// Welch PSD of all the channels of a capture, saved to 'path' as text:
+/// frequency [Hz] , PSD of every channel [mV^2/Hz]; the channels are
+/// read through windows of whole segments within the memory budget
+inline void saveCaptureSpectrum(CaptureStore & capture, int segmentSamples, const std::string & path)
+{
+    double period = capture.header().effectiveSamplingPeriod;
+    std::vector<std::vector<double> > psd(capture.numberOfChannels());
+    int length = 0;
+
+    for(int c = 0; c < capture.numberOfChannels(); c++)
+    {
+        WelchSpectrum welch(segmentSamples, capture.samplesPerChannel());
+        length = welch.length();
+
+        if((uint64_t)length > capture.windowSamples())
+            throw std::runtime_error("saveCaptureSpectrum: segments longer than the memory budget allows");
+
+        uint64_t perWindow = (capture.windowSamples() - length) / welch.hop() + 1;
+
+        for(uint64_t s = 0; s < welch.segments(); s += perWindow)
+        {
+            uint64_t count = std::min(perWindow, welch.segments() - s);
+            uint64_t samples = (count - 1) * welch.hop() + length;
+            welch.add(capture.window(c, s * welch.hop(), samples), count);
+        }
+
+        psd[c] = welch.finish(millivoltsPerCount(capture.channelRange(c)), period);
+
+        std::cout << "channel " << capture.channelName(c) << " : PSD of " << capture.samplesPerChannel()
+                  << " samples, " << length << " samples per segment" << std::endl;
+    }
+
+    std::fstream out(path.c_str(), std::fstream::out);
+
+    out << "# frequency [Hz]";
+    for(int c = 0; c < capture.numberOfChannels(); c++)
+        out << " , " << capture.channelName(c) << " [mV^2/Hz]";
+    out << "\n";
+
+    out.precision(8);
+
+    for(std::size_t k = 0; !psd.empty() && k < psd[0].size(); k++)
+    {
+        out << k / (length * period);
+        for(std::size_t c = 0; c < psd.size(); c++)
+            out << " , " << psd[c][k];
+        out << "\n";
+    }
+
+    if(!out)
+        throw std::runtime_error("saveCaptureSpectrum: cannot write " + path);
+}
+
+#endif // SPECTRUM_HPP
@@ -0,0 +1,386 @@
+#ifndef TASK_POOL_HPP
+#define TASK_POOL_HPP
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "Placement.hpp"
+
+/// work-stealing pool of the analyses: one deque of tasks per worker, the
+/// owner takes the newest task from the back of its deque, an idle worker
+/// steals the oldest one from the front of another deque. tasks are run in
+/// a TaskGroup, and a thread waiting for its group runs queued tasks in
+/// the meantime, so the analyses can nest parallel loops without running
+/// out of threads. parallelFor() and parallelReduce() cut an index range,
+/// e.g. the samples of a capture, into tasks.
+
+class TaskPool;
+
+/// tasks which are waited for together; the first exception of a task is
+/// thrown again by wait()
+class TaskGroup
+{
+public:
+
+    explicit TaskGroup(TaskPool & pool);
+
+    ~TaskGroup()
+    {
+        try
+        {
+            wait();
+        }
+        catch(std::exception &)
+        {
+        }
+    }
+
+    void run(const boost::function<void ()> & task);
+
+    /// returns when every task of the group is done
+    void wait();
+
+private:
+    friend class TaskPool;
+
+    void done(const std::string & error)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+
+        if(!error.empty() && error_.empty())
+            error_ = error;
+
+        if(--pending_ == 0)
+            finished_.notify_all();
+    }
+
+private:
+    TaskPool & pool_;
+    boost::mutex mutex_;
+    boost::condition_variable finished_;
+    int pending_;
+    std::string error_;
+};
+
+class TaskPool
+{
+public:
+
+    /// 'workers' threads, one per core if 0
+    explicit TaskPool(int workers = 0)
+        : queued_(0), next_(0), stopping_(false)
+    {
+        if(workers <= 0)
+            workers = std::max(1u, boost::thread::hardware_concurrency());
+
+        for(int w = 0; w < workers; w++)
+            deques_.push_back(new Deque);
+
+        for(int w = 0; w < workers; w++)
+            workerThreads_.push_back(threads_.create_thread(boost::bind(&TaskPool::worker, this, w)));
+    }
+
+    ~TaskPool()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(sleepMutex_);
+            stopping_ = true;
+        }
+
+        wakeup_.notify_all();
+        threads_.join_all();
+
+        for(std::size_t w = 0; w < deques_.size(); w++)
+            delete deques_[w];
+    }
+
+    int workers() const
+    {
+        return (int)deques_.size();
+    }
+
+    /// restricts the workers to 'cpus', see Placement.hpp
+    bool setAffinity(const std::vector<int> & cpus)
+    {
+        bool pinned = true;
+
+        for(std::size_t w = 0; w < workerThreads_.size(); w++)
+            pinned = setThreadAffinity(workerThreads_[w]->native_handle(), cpus) && pinned;
+
+        return pinned;
+    }
+
+    /// queues 'task' of 'group': on the deque of the calling worker, on
+    /// the deques in turn from other threads
+    void submit(TaskGroup & group, const boost::function<void ()> & task)
+    {
+        int w = (current().pool == this) ? current().index : (int)(__sync_fetch_and_add(&next_, 1) % deques_.size());
+
+        Task t = { task, &group };
+        {
+            boost::lock_guard<boost::mutex> lock(deques_[w]->mutex);
+            deques_[w]->tasks.push_back(t);
+        }
+
+        __sync_fetch_and_add(&queued_, 1);
+
+        boost::lock_guard<boost::mutex> lock(sleepMutex_);
+        wakeup_.notify_one();
+    }
+
+    /// runs one queued task in the calling thread; false if there is none
+    bool runOne()
+    {
+        Task t;
+
+        if(!take(current().pool == this ? current().index : -1, t))
+            return false;
+
+        execute(t);
+        return true;
+    }
+
+private:
+
+    struct Task
+    {
+        boost::function<void ()> run;
+        TaskGroup * group;
+    };
+
+    struct Deque
+    {
+        boost::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    /// the pool and deque of the calling thread if it is a worker
+    struct Worker
+    {
+        TaskPool * pool;
+        int index;
+    };
+
+    static Worker & current()
+    {
+        static __thread Worker worker = { 0, -1 };
+        return worker;
+    }
+
+    void worker(int index)
+    {
+        current().pool = this;
+        current().index = index;
+
+        for(;;)
+        {
+            Task t;
+
+            if(take(index, t))
+            {
+                execute(t);
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(sleepMutex_);
+
+            while(queued_ == 0 && !stopping_)
+                wakeup_.wait(lock);
+
+            if(stopping_ && queued_ == 0)
+                return;
+        }
+    }
+
+    /// the newest task of deque 'own', else the oldest one of another deque
+    bool take(int own, Task & t)
+    {
+        if(own >= 0)
+        {
+            Deque & d = *deques_[own];
+            boost::lock_guard<boost::mutex> lock(d.mutex);
+
+            if(!d.tasks.empty())
+            {
+                t = d.tasks.back();
+                d.tasks.pop_back();
+                __sync_fetch_and_sub(&queued_, 1);
+                return true;
+            }
+        }
+
+        /// STEAL, STARTING AFTER THE OWN DEQUE SO THE THIEVES SPREAD OUT
+        int n = (int)deques_.size();
+
+        for(int k = 1; k <= n; k++)
+        {
+            Deque & d = *deques_[(own + k + n) % n];
+            boost::lock_guard<boost::mutex> lock(d.mutex);
+
+            if(!d.tasks.empty())
+            {
+                t = d.tasks.front();
+                d.tasks.pop_front();
+                __sync_fetch_and_sub(&queued_, 1);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static void execute(Task & t)
+    {
+        std::string error;
+
+        try
+        {
+            t.run();
+        }
+        catch(std::exception & e)
+        {
+            error = e.what();
+            if(error.empty())
+                error = "TaskPool: task failed";
+        }
+
+        t.group->done(error);
+    }
+
+private:
+    std::vector<Deque *> deques_;
+    boost::thread_group threads_;
+    std::vector<boost::thread *> workerThreads_; // owned by threads_
+    boost::mutex sleepMutex_;
+    boost::condition_variable wakeup_;
+    volatile int queued_; // tasks in all the deques
+    unsigned next_; // deque of the next task from outside the pool
+    bool stopping_;
+};
+
+inline TaskGroup::TaskGroup(TaskPool & pool)
+    : pool_(pool), pending_(0)
+{}
+
+inline void TaskGroup::run(const boost::function<void ()> & task)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        pending_++;
+    }
+
+    pool_.submit(*this, task);
+}
+
+inline void TaskGroup::wait()
+{
+    for(;;)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            if(pending_ == 0)
+                break;
+        }
+
+        /// HELP WITH QUEUED TASKS; IF THERE ARE NONE, THE REST OF THE GROUP IS RUNNING
+        if(pool_.runOne())
+            continue;
+
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while(pending_ > 0)
+            finished_.wait(lock);
+    }
+
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if(!error_.empty())
+    {
+        std::string error;
+        error.swap(error_);
+        throw std::runtime_error(error);
+    }
+}
+
+/// the pool shared by the analyses, one worker per core
+inline TaskPool & analysisPool()
+{
+    static TaskPool pool;
+    return pool;
+}
+
+/// ranges of 'grain' indices for a range of 'n', enough of them that every
+/// worker of 'pool' gets a few, at least 'minimum' indices each
+inline uint64_t parallelGrain(uint64_t n, uint64_t minimum, TaskPool & pool = analysisPool())
+{
+    const uint64_t tasksPerWorker = 4;
+    uint64_t grain = n / (pool.workers() * tasksPerWorker);
+
+    return std::max<uint64_t>(std::max<uint64_t>(grain, minimum), 1);
+}
+
+/// calls body(begin, end) for consecutive ranges of at most 'grain' indices
+/// of [first, last) on 'pool' and returns when all are done
+inline void parallelFor(uint64_t first, uint64_t last, uint64_t grain,
+                        const boost::function<void (uint64_t, uint64_t)> & body, TaskPool & pool = analysisPool())
+{
+    grain = std::max<uint64_t>(grain, 1);
+
+    /// A SINGLE RANGE IS NOT WORTH A TASK
+    if(last - first <= grain)
+    {
+        if(first < last)
+            body(first, last);
+        return;
+    }
+
+    TaskGroup group(pool);
+
+    for(uint64_t begin = first; begin < last; begin += grain)
+        group.run(boost::bind(body, begin, std::min(begin + grain, last)));
+
+    group.wait();
+}
+
+namespace detail
+{
+
+/// map() of the ranges 'rBegin' .. 'rEnd' - 1 of 'grain' indices of [first, last)
+template <typename T>
+void reduceRanges(std::vector<T> * partial, const boost::function<T (uint64_t, uint64_t)> & map,
+                  uint64_t first, uint64_t last, uint64_t grain, uint64_t rBegin, uint64_t rEnd)
+{
+    for(uint64_t r = rBegin; r < rEnd; r++)
+        (*partial)[r] = map(first + r * grain, std::min(first + (r + 1) * grain, last));
+}
+
+} // namespace detail
+
+/// map(begin, end) for the ranges of parallelFor(), combined in the order of
+/// the ranges starting with 'init', so the result does not depend on which
+/// worker ran which range
+template <typename T>
+T parallelReduce(uint64_t first, uint64_t last, uint64_t grain, const T & init,
+                 const boost::function<T (uint64_t, uint64_t)> & map,
+                 const boost::function<T (const T &, const T &)> & combine, TaskPool & pool = analysisPool())
+{
+    grain = std::max<uint64_t>(grain, 1);
+
+    uint64_t ranges = (last > first) ? (last - first + grain - 1) / grain : 0;
+    std::vector<T> partial(ranges);
+
+    parallelFor(0, ranges, 1, boost::bind(&detail::reduceRanges<T>, &partial, map, first, last, grain, _1, _2), pool);
+
+    T result = init;
+    for(uint64_t r = 0; r < ranges; r++)
+        result = combine(result, partial[r]);
+
+    return result;
+}
+
+#endif // TASK_POOL_HPP
@@ -0,0 +1,97 @@
+#ifndef TRANSFER_BUDGET_HPP
+#define TRANSFER_BUDGET_HPP
+
+#include <boost/asio/io_service.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <deque>
+
+#include "AcquisitionMetrics.hpp"
+
+/// the back-pressure over many devices: at most 'slots' transfers (a
+/// connection, a histogram, ...) are in flight at a time, the others wait
+/// for a slot in the order they asked. what runs in a slot holds it until
+/// release(), so the threads and the buffers in use follow the transfers
+/// under way, not the number of devices.
+class TransferBudget
+{
+public:
+
+    TransferBudget(boost::asio::io_service & io_service, int slots)
+        : io_service_(io_service), free_(slots > 0 ? slots : 1), slots_(slots > 0 ? slots : 1)
+    {}
+
+    ~TransferBudget()
+    {
+        gaugeMetric(acquisitionMetrics().transfersWaiting, -(int)waiting_.size());
+    }
+
+    /// runs 'transfer' through the io_service as soon as a slot is free;
+    /// true if it has to wait for one
+    bool acquire(const boost::function<void ()> & transfer)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+
+            if(free_ == 0)
+            {
+                waiting_.push_back(transfer);
+                gaugeMetric(acquisitionMetrics().transfersWaiting, 1);
+                return true;
+            }
+
+            free_--;
+        }
+
+        io_service_.post(transfer);
+        return false;
+    }
+
+    /// gives the slot of a transfer back, to the transfer waiting longest if any
+    void release()
+    {
+        boost::function<void ()> next;
+
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+
+            if(waiting_.empty())
+            {
+                free_++;
+                return;
+            }
+
+            next = waiting_.front();
+            waiting_.pop_front();
+            gaugeMetric(acquisitionMetrics().transfersWaiting, -1);
+        }
+
+        io_service_.post(next);
+    }
+
+    int inFlight()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return slots_ - free_;
+    }
+
+    int waiting()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return (int)waiting_.size();
+    }
+
+    int slots() const
+    {
+        return slots_;
+    }
+
+private:
+    boost::asio::io_service & io_service_;
+    boost::mutex mutex_;
+    std::deque<boost::function<void ()> > waiting_;
+    int free_;
+    int slots_;
+};
+
+#endif // TRANSFER_BUDGET_HPP
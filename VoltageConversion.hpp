@@ -0,0 +1,161 @@
+#ifndef VOLTAGE_CONVERSION_HPP
+#define VOLTAGE_CONVERSION_HPP
+
+#include <cstddef>
+#include <stdint.h>
+
+#include "RosySettings.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROSY_HAVE_AVX2 1
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 5)
+#define ROSY_HAVE_AVX512 1
+#endif
+#endif
+
+/// conversion of the raw post mortem samples (ADC counts) to millivolts:
+///
+///   mV = counts * scale + offset
+///
+/// the VERTICAL_RANGE codes follow the PicoScope 6000 ranges, where
+/// ADC_FULL_SCALE counts correspond to the full scale (+range) of the channel
+
+const float ADC_FULL_SCALE = 32512.0f;
+
+/// full scale of the range, [mV]; 0 for a disabled channel
+inline float rangeMillivolts(VERTICAL_RANGE range)
+{
+    switch(range)
+    {
+    case RANGE_100_MV: return 100.0f;
+    case RANGE_200_MV: return 200.0f;
+    case RANGE_500_MV: return 500.0f;
+    case RANGE_1_V: return 1000.0f;
+    case RANGE_2_V: return 2000.0f;
+    case RANGE_5_V: return 5000.0f;
+    case RANGE_10_V: return 10000.0f;
+    case RANGE_20_V: return 20000.0f;
+    default: return 0.0f;
+    }
+}
+
+/// [mV] per ADC count
+inline float millivoltsPerCount(VERTICAL_RANGE range)
+{
+    return rangeMillivolts(range) / ADC_FULL_SCALE;
+}
+
+/// ADC counts of a voltage on the range, saturated to int16_t
+inline int16_t millivoltsToCounts(VERTICAL_RANGE range, double millivolts)
+{
+    double counts = millivolts / millivoltsPerCount(range);
+
+    if(counts > 32767.0)
+        return 32767;
+    if(counts < -32768.0)
+        return -32768;
+    return (int16_t)(counts < 0 ? counts - 0.5 : counts + 0.5);
+}
+
+namespace detail
+{
+
+inline void convertScalar(const int16_t * src, float * dst, std::size_t n, float scale, float offset)
+{
+    for(std::size_t i = 0; i < n; i++)
+        dst[i] = src[i] * scale + offset;
+}
+
+#ifdef ROSY_HAVE_AVX2
+__attribute__((target("avx2")))
+inline void convertAVX2(const int16_t * src, float * dst, std::size_t n, float scale, float offset)
+{
+    const __m256 s = _mm256_set1_ps(scale);
+    const __m256 o = _mm256_set1_ps(offset);
+    std::size_t i = 0;
+
+    for(; i + 16 <= n; i += 16)
+    {
+        __m256i raw = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(raw));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(raw, 1));
+
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), s), o));
+        _mm256_storeu_ps(dst + i + 8, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(hi), s), o));
+    }
+
+    convertScalar(src + i, dst + i, n - i, scale, offset);
+}
+#endif
+
+#ifdef ROSY_HAVE_AVX512
+/// no FMA contraction, so that all the kernels give bit-identical results
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+inline void convertAVX512(const int16_t * src, float * dst, std::size_t n, float scale, float offset)
+{
+    const __m512 s = _mm512_set1_ps(scale);
+    const __m512 o = _mm512_set1_ps(offset);
+    std::size_t i = 0;
+
+    for(; i + 32 <= n; i += 32)
+    {
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 16));
+
+        _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(lo)), s), o));
+        _mm512_storeu_ps(dst + i + 16, _mm512_add_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(hi)), s), o));
+    }
+
+    convertScalar(src + i, dst + i, n - i, scale, offset);
+}
+#endif
+
+typedef void (*ConvertKernel)(const int16_t *, float *, std::size_t, float, float);
+
+/// the widest kernel the CPU supports, chosen once
+inline ConvertKernel selectConvertKernel()
+{
+#ifdef ROSY_HAVE_AVX512
+    if(__builtin_cpu_supports("avx512f"))
+        return convertAVX512;
+#endif
+#ifdef ROSY_HAVE_AVX2
+    if(__builtin_cpu_supports("avx2"))
+        return convertAVX2;
+#endif
+    return convertScalar;
+}
+
+} // namespace detail
+
+/// name of the kernel used by convertToMillivolts(), for the logs
+inline const char * convertKernelName()
+{
+    detail::ConvertKernel k = detail::selectConvertKernel();
+
+#ifdef ROSY_HAVE_AVX512
+    if(k == detail::convertAVX512)
+        return "AVX-512";
+#endif
+#ifdef ROSY_HAVE_AVX2
+    if(k == detail::convertAVX2)
+        return "AVX2";
+#endif
+    return "scalar";
+}
+
+/// converts 'n' raw samples to millivolts, dst[i] = src[i] * scale + offset
+inline void convertToMillivolts(const int16_t * src, float * dst, std::size_t n, float scale, float offset = 0.0f)
+{
+    static const detail::ConvertKernel kernel = detail::selectConvertKernel();
+    kernel(src, dst, n, scale, offset);
+}
+
+/// as above, with the scale of the vertical range of the channel
+inline void convertToMillivolts(const int16_t * src, float * dst, std::size_t n, VERTICAL_RANGE range, float offset = 0.0f)
+{
+    convertToMillivolts(src, dst, n, millivoltsPerCount(range), offset);
+}
+
+#endif // VOLTAGE_CONVERSION_HPP
@@ -0,0 +1,613 @@
+#ifndef WAVEFORM_CODEC_HPP
+#define WAVEFORM_CODEC_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROSY_HAVE_AVX2_CODEC 1
+#endif
+
+/// lossless codec of int16_t ADC samples: fixed polynomial prediction
+/// and Rice coding of the residuals.
+///
+/// the samples are coded in blocks of RICE_BLOCK_SAMPLES; every block
+/// uses the predictor of order 0 .. 3 with the smallest residuals,
+///
+///   order 0: x[i]
+///   order 1: x[i] - x[i-1]
+///   order 2: x[i] - 2 x[i-1] + x[i-2]
+///   order 3: x[i] - 3 x[i-1] + 3 x[i-2] - x[i-3]
+///
+/// with the samples before the first one taken as 0. the residuals are
+/// zigzag mapped and Rice coded with a parameter chosen per partition of
+/// RICE_PARTITION_SAMPLES. the bit stream is written LSB first:
+///
+///   block     : order (2 bits), then the partitions
+///   partition : k (5 bits), length of its longest residual code (6 bits),
+///               then the residuals
+///   residual  : q = z >> k as q zero bits and a one bit, then the k low bits of z;
+///               q >= RICE_ESCAPE is written as RICE_ESCAPE zeros and a one,
+///               followed by z in RICE_ESCAPE_BITS bits
+///
+/// every block is padded with zero bits to a whole byte.
+
+const int RICE_BLOCK_SAMPLES = 4096;
+const int RICE_PARTITION_SAMPLES = 256;
+const int RICE_MAX_ORDER = 3;
+const int RICE_MAX_K = 20;
+const int RICE_ESCAPE = 24;
+const int RICE_ESCAPE_BITS = 20; // enough for any order 3 residual of int16_t samples
+const int RICE_LONGEST = RICE_ESCAPE + 1 + RICE_ESCAPE_BITS; // bits of an escaped residual
+
+namespace detail
+{
+
+/// sum of |residual| of every predictor order over 'n' samples; 'x' is
+/// preceded by RICE_MAX_ORDER samples of history
+inline void predictionCostsScalar(const int16_t * x, int n, uint64_t cost[RICE_MAX_ORDER + 1])
+{
+    for(int o = 0; o <= RICE_MAX_ORDER; o++)
+        cost[o] = 0;
+
+    for(int i = 0; i < n; i++)
+    {
+        int32_t x0 = x[i], x1 = x[i - 1], x2 = x[i - 2], x3 = x[i - 3];
+        int32_t e1 = x0 - x1;
+        int32_t e2 = e1 - (x1 - x2);
+        int32_t e3 = e2 - (x1 - 2 * x2 + x3);
+
+        cost[0] += std::abs(x0);
+        cost[1] += std::abs(e1);
+        cost[2] += std::abs(e2);
+        cost[3] += std::abs(e3);
+    }
+}
+
+/// zigzag mapped residuals of the predictor 'order'
+inline void residualsScalar(const int16_t * x, int n, int order, uint32_t * z)
+{
+    for(int i = 0; i < n; i++)
+    {
+        int32_t x0 = x[i], x1 = x[i - 1], x2 = x[i - 2], x3 = x[i - 3];
+        int32_t e;
+
+        switch(order)
+        {
+        case 0: e = x0; break;
+        case 1: e = x0 - x1; break;
+        case 2: e = x0 - 2 * x1 + x2; break;
+        default: e = x0 - 3 * x1 + 3 * x2 - x3; break;
+        }
+
+        z[i] = (uint32_t)((e << 1) ^ (e >> 31));
+    }
+}
+
+#ifdef ROSY_HAVE_AVX2_CODEC
+__attribute__((target("avx2")))
+inline __m256i loadSamples(const int16_t * p)
+{
+    return _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+}
+
+/// 8 samples per iteration, the residuals of all the orders at once
+__attribute__((target("avx2")))
+inline void predictionCostsAVX2(const int16_t * x, int n, uint64_t cost[RICE_MAX_ORDER + 1])
+{
+    __m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+    int i = 0;
+
+    /// 32 BIT LANE SUMS CANNOT OVERFLOW WITHIN ONE BLOCK
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256i x0 = loadSamples(x + i);
+        __m256i x1 = loadSamples(x + i - 1);
+        __m256i x2 = loadSamples(x + i - 2);
+        __m256i x3 = loadSamples(x + i - 3);
+
+        __m256i d1 = _mm256_sub_epi32(x1, x2);
+        __m256i e1 = _mm256_sub_epi32(x0, x1);
+        __m256i e2 = _mm256_sub_epi32(e1, d1);
+        __m256i e3 = _mm256_sub_epi32(e2, _mm256_sub_epi32(d1, _mm256_sub_epi32(x2, x3)));
+
+        s0 = _mm256_add_epi32(s0, _mm256_abs_epi32(x0));
+        s1 = _mm256_add_epi32(s1, _mm256_abs_epi32(e1));
+        s2 = _mm256_add_epi32(s2, _mm256_abs_epi32(e2));
+        s3 = _mm256_add_epi32(s3, _mm256_abs_epi32(e3));
+    }
+
+    predictionCostsScalar(x + i, n - i, cost);
+
+    __m256i sums[RICE_MAX_ORDER + 1] = { s0, s1, s2, s3 };
+    for(int o = 0; o <= RICE_MAX_ORDER; o++)
+    {
+        uint32_t lanes[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), sums[o]);
+
+        for(int l = 0; l < 8; l++)
+            cost[o] += lanes[l];
+    }
+}
+
+__attribute__((target("avx2")))
+inline void residualsAVX2(const int16_t * x, int n, int order, uint32_t * z)
+{
+    int i = 0;
+
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256i e = loadSamples(x + i);
+
+        if(order > 0)
+        {
+            __m256i x1 = loadSamples(x + i - 1);
+            __m256i x2 = loadSamples(x + i - 2);
+
+            switch(order)
+            {
+            case 1:
+                e = _mm256_sub_epi32(e, x1);
+                break;
+            case 2:
+                e = _mm256_add_epi32(_mm256_sub_epi32(e, _mm256_slli_epi32(x1, 1)), x2);
+                break;
+            default:
+                __m256i d = _mm256_sub_epi32(x2, x1);
+                e = _mm256_sub_epi32(_mm256_add_epi32(e, _mm256_add_epi32(d, _mm256_slli_epi32(d, 1))),
+                                     loadSamples(x + i - 3));
+                break;
+            }
+        }
+
+        __m256i zz = _mm256_xor_si256(_mm256_slli_epi32(e, 1), _mm256_srai_epi32(e, 31));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(z + i), zz);
+    }
+
+    residualsScalar(x + i, n - i, order, z + i);
+}
+#endif
+
+typedef void (*PredictionCostsKernel)(const int16_t *, int, uint64_t *);
+typedef void (*ResidualsKernel)(const int16_t *, int, int, uint32_t *);
+
+inline bool codecHasAVX2()
+{
+#ifdef ROSY_HAVE_AVX2_CODEC
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+inline void predictionCosts(const int16_t * x, int n, uint64_t cost[RICE_MAX_ORDER + 1])
+{
+#ifdef ROSY_HAVE_AVX2_CODEC
+    static const PredictionCostsKernel kernel = codecHasAVX2() ? predictionCostsAVX2 : predictionCostsScalar;
+#else
+    static const PredictionCostsKernel kernel = predictionCostsScalar;
+#endif
+    kernel(x, n, cost);
+}
+
+inline void residuals(const int16_t * x, int n, int order, uint32_t * z)
+{
+#ifdef ROSY_HAVE_AVX2_CODEC
+    static const ResidualsKernel kernel = codecHasAVX2() ? residualsAVX2 : residualsScalar;
+#else
+    static const ResidualsKernel kernel = residualsScalar;
+#endif
+    kernel(x, n, order, z);
+}
+
+/// LSB first bit writer into memory sized by the caller, with
+/// at least 8 bytes of slack after the end of the stream
+class BitWriter
+{
+public:
+
+    explicit BitWriter(uint8_t * out)
+        : out_(out), begin_(out), bits_(0), count_(0)
+    {}
+
+    /// appends the 'n' (<= 56) low bits of 'value'; the whole bytes
+    /// are stored without a branch, the rest stays in 'bits_'
+    void put(uint64_t value, int n)
+    {
+        bits_ |= value << count_;
+        count_ += n;
+
+        std::memcpy(out_, &bits_, 8);
+        out_ += count_ >> 3;
+        bits_ >>= count_ & ~7;
+        count_ &= 7;
+    }
+
+    /// pads to a whole byte; returns the number of bytes written
+    std::size_t finish()
+    {
+        if(count_ > 0)
+            *out_++ = (uint8_t)bits_;
+
+        return out_ - begin_;
+    }
+
+private:
+    uint8_t * out_;
+    uint8_t * begin_;
+    uint64_t bits_;
+    int count_; // < 8 between the calls
+};
+
+/// LSB first bit reader; past the end it gives zeros, overrun() tells if any were consumed
+class BitReader
+{
+public:
+
+    BitReader(const uint8_t * data, std::size_t bytes)
+        : p_(data), end_(data + bytes), bits_(0), count_(0), padding_(0)
+    {}
+
+    /// at least 56 bits available after it
+    void refill()
+    {
+        if(end_ - p_ >= 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, p_, 8);
+            bits_ |= word << count_;
+            p_ += (63 - count_) >> 3;
+            count_ |= 56;
+            return;
+        }
+
+        while(count_ <= 56)
+        {
+            if(p_ < end_)
+                bits_ |= (uint64_t)*p_++ << count_;
+            else
+                padding_ += 8;
+            count_ += 8;
+        }
+    }
+
+    uint64_t peek() const
+    {
+        return bits_;
+    }
+
+    void skip(int n)
+    {
+        bits_ >>= n;
+        count_ -= n;
+    }
+
+    uint32_t get(int n)
+    {
+        uint32_t value = (uint32_t)(bits_ & ((1ULL << n) - 1));
+        skip(n);
+        return value;
+    }
+
+    /// skips the padding up to the next byte boundary
+    void align()
+    {
+        skip(count_ & 7);
+    }
+
+    /// true when everything up to the padding of the last byte was read
+    bool atEnd() const
+    {
+        return !overrun() && p_ == end_ && count_ - padding_ < 8;
+    }
+
+    bool overrun() const
+    {
+        return count_ < padding_;
+    }
+
+private:
+    const uint8_t * p_;
+    const uint8_t * end_;
+    uint64_t bits_;
+    int count_; // bits in 'bits_'
+    int padding_; // of them, zeros added past the end
+};
+
+/// Rice parameter for a partition of 'n' residuals summing up to 'sum'
+inline int riceParameter(uint64_t sum, int n)
+{
+    int k = 0;
+    while(k < RICE_MAX_K && ((uint64_t)n << (k + 1)) <= sum)
+        k++;
+    return k;
+}
+
+/// Rice code of one residual, 'length' bits; at most 45 bits
+inline uint64_t riceToken(uint32_t z, int k, uint32_t low, int & length)
+{
+    uint32_t q = z >> k;
+
+    if(q < (uint32_t)RICE_ESCAPE)
+    {
+        length = q + 1 + k;
+        return (1ULL << q) | ((uint64_t)(z & low) << (q + 1));
+    }
+
+    length = RICE_LONGEST;
+    return (1ULL << RICE_ESCAPE) | ((uint64_t)z << (RICE_ESCAPE + 1));
+}
+
+#ifdef ROSY_HAVE_AVX2_CODEC
+/// 4 tokens per iteration, computed in 64 bit lanes and merged at their
+/// offsets; the tokens must not be escaped and must fit in 56 bits together
+__attribute__((target("avx2")))
+inline int putQuadsAVX2(BitWriter & out, const uint32_t * z, int n, int k)
+{
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i shift = _mm256_set1_epi64x(k);
+    const __m256i prefix = _mm256_set1_epi64x(k + 1);
+    const __m256i low = _mm256_set1_epi64x((1 << k) - 1);
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+
+    for(; i + 4 <= n; i += 4)
+    {
+        __m256i zz = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i *>(z + i)));
+        __m256i q = _mm256_srlv_epi64(zz, shift);
+        __m256i token = _mm256_or_si256(_mm256_sllv_epi64(one, q),
+                                        _mm256_sllv_epi64(_mm256_and_si256(zz, low), _mm256_add_epi64(q, one)));
+        __m256i length = _mm256_add_epi64(q, prefix);
+
+        /// EXCLUSIVE PREFIX SUM OF THE LENGTHS, THE OFFSETS OF THE TOKENS
+        __m256i offset = _mm256_blend_epi32(_mm256_permute4x64_epi64(length, 0x90), zero, 0x03);
+        offset = _mm256_add_epi64(offset, _mm256_blend_epi32(_mm256_permute4x64_epi64(offset, 0x90), zero, 0x03));
+        offset = _mm256_add_epi64(offset, _mm256_blend_epi32(_mm256_permute4x64_epi64(offset, 0x40), zero, 0x0f));
+
+        __m256i placed = _mm256_sllv_epi64(token, offset);
+        __m128i merged = _mm_or_si128(_mm256_castsi256_si128(placed), _mm256_extracti128_si256(placed, 1));
+        merged = _mm_or_si128(merged, _mm_unpackhi_epi64(merged, merged));
+
+        __m256i end = _mm256_add_epi64(offset, length);
+        out.put(_mm_cvtsi128_si64(merged), (int)_mm256_extract_epi64(end, 3));
+    }
+
+    return i;
+}
+#endif
+
+/// length of the longest code of a partition
+inline int longestToken(uint32_t maxZ, int k)
+{
+    uint32_t maxQ = maxZ >> k;
+    return (maxQ < (uint32_t)RICE_ESCAPE) ? maxQ + 1 + k : RICE_LONGEST;
+}
+
+/// writes 'n' residuals; when the longest token of the partition allows it,
+/// 4 or 2 tokens are merged into one put(), which shortens the dependency
+/// chain through the writer
+inline void putResiduals(BitWriter & out, const uint32_t * z, int n, int k, int longest)
+{
+    const uint32_t low = (1u << k) - 1;
+    int i = 0;
+
+#ifdef ROSY_HAVE_AVX2_CODEC
+    static const bool avx2 = codecHasAVX2();
+
+    if(4 * longest <= 56 && avx2)
+    {
+        i = putQuadsAVX2(out, z, n, k);
+    }
+    else
+#endif
+    if(4 * longest <= 56)
+    {
+        for(; i + 4 <= n; i += 4)
+        {
+            int l0, l1, l2, l3;
+            uint64_t t0 = riceToken(z[i], k, low, l0);
+            uint64_t t1 = riceToken(z[i + 1], k, low, l1);
+            uint64_t t2 = riceToken(z[i + 2], k, low, l2);
+            uint64_t t3 = riceToken(z[i + 3], k, low, l3);
+
+            uint64_t t01 = t0 | (t1 << l0);
+            uint64_t t23 = t2 | (t3 << l2);
+            out.put(t01 | (t23 << (l0 + l1)), l0 + l1 + l2 + l3);
+        }
+    }
+    else if(2 * longest <= 56)
+    {
+        for(; i + 2 <= n; i += 2)
+        {
+            int l0, l1;
+            uint64_t t0 = riceToken(z[i], k, low, l0);
+            uint64_t t1 = riceToken(z[i + 1], k, low, l1);
+            out.put(t0 | (t1 << l0), l0 + l1);
+        }
+    }
+
+    for(; i < n; i++)
+    {
+        int l;
+        uint64_t t = riceToken(z[i], k, low, l);
+        out.put(t, l);
+    }
+}
+
+/// decodes the 'n' samples of a partition coded with the predictor ORDER;
+/// no residual code is longer than 'longest' bits, so as many of them as fit
+/// in one refill are decoded without refilling. 'x' holds the last samples.
+/// false if the stream is corrupted
+template <int ORDER>
+inline bool decodePartition(BitReader & in, int16_t * out, int n, int k, int longest, int32_t x[RICE_MAX_ORDER])
+{
+    const uint64_t low = (1ULL << k) - 1;
+    const int burst = 56 / longest;
+    int32_t x1 = x[0], x2 = x[1], x3 = x[2];
+    int i = 0;
+
+    while(i < n)
+    {
+        in.refill();
+
+        for(int end = std::min(n, i + burst); i < end; i++)
+        {
+            uint64_t bits = in.peek();
+            int q = __builtin_ctzll(bits | (1ULL << 63));
+            uint32_t z;
+
+            if(q < RICE_ESCAPE && q + 1 + k <= longest)
+            {
+                z = ((uint32_t)q << k) | (uint32_t)((bits >> (q + 1)) & low);
+                in.skip(q + 1 + k);
+            }
+            else if(q == RICE_ESCAPE && longest == RICE_LONGEST)
+            {
+                z = (uint32_t)((bits >> (RICE_ESCAPE + 1)) & ((1ULL << RICE_ESCAPE_BITS) - 1));
+                in.skip(RICE_LONGEST);
+            }
+            else
+            {
+                return false;
+            }
+
+            int32_t e = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+            int32_t x0;
+
+            switch(ORDER)
+            {
+            case 0: x0 = e; break;
+            case 1: x0 = e + x1; break;
+            case 2: x0 = e + 2 * x1 - x2; break;
+            default: x0 = e + 3 * (x1 - x2) + x3; break;
+            }
+
+            out[i] = (int16_t)x0;
+            x3 = x2;
+            x2 = x1;
+            x1 = out[i];
+        }
+    }
+
+    x[0] = x1;
+    x[1] = x2;
+    x[2] = x3;
+    return true;
+}
+
+} // namespace detail
+
+/// encodes 'n' samples, appending the result to 'out'
+inline void encodeWaveform(const int16_t * samples, std::size_t n, std::vector<uint8_t> & out)
+{
+    using namespace detail;
+
+    /// WORST CASE OF A BLOCK: ESCAPED RESIDUALS, THE HEADERS AND THE SLACK OF THE WRITER
+    uint8_t block[RICE_BLOCK_SAMPLES * RICE_LONGEST / 8 + 2 * RICE_BLOCK_SAMPLES / RICE_PARTITION_SAMPLES + 16];
+
+    int16_t history[RICE_MAX_ORDER + RICE_BLOCK_SAMPLES] = { 0 };
+    uint32_t z[RICE_BLOCK_SAMPLES];
+
+    for(std::size_t first = 0; first < n; first += RICE_BLOCK_SAMPLES)
+    {
+        int count = (int)std::min<std::size_t>(RICE_BLOCK_SAMPLES, n - first);
+
+        /// THE BLOCK, PRECEDED BY THE LAST SAMPLES OF THE PREVIOUS ONE
+        const int16_t * x;
+        if(first == 0)
+        {
+            std::memcpy(history + RICE_MAX_ORDER, samples, count * sizeof(int16_t));
+            x = history + RICE_MAX_ORDER;
+        }
+        else
+        {
+            x = samples + first;
+        }
+
+        uint64_t cost[RICE_MAX_ORDER + 1];
+        predictionCosts(x, count, cost);
+
+        int order = std::min_element(cost, cost + RICE_MAX_ORDER + 1) - cost;
+        residuals(x, count, order, z);
+
+        BitWriter writer(block);
+        writer.put(order, 2);
+
+        for(int p = 0; p < count; p += RICE_PARTITION_SAMPLES)
+        {
+            int m = std::min(RICE_PARTITION_SAMPLES, count - p);
+
+            uint64_t sum = 0;
+            uint32_t maxZ = 0;
+            for(int i = 0; i < m; i++)
+            {
+                sum += z[p + i];
+                maxZ = std::max(maxZ, z[p + i]);
+            }
+
+            int k = riceParameter(sum, m);
+            int longest = longestToken(maxZ, k);
+
+            writer.put(k | (longest << 5), 11);
+            putResiduals(writer, z + p, m, k, longest);
+        }
+
+        out.insert(out.end(), block, block + writer.finish());
+    }
+}
+
+/// decodes exactly 'n' samples from 'bytes' bytes; false if the data are corrupted
+inline bool decodeWaveform(const uint8_t * data, std::size_t bytes, int16_t * samples, std::size_t n)
+{
+    using namespace detail;
+
+    BitReader reader(data, bytes);
+    int32_t history[RICE_MAX_ORDER] = { 0 };
+
+    for(std::size_t first = 0; first < n; first += RICE_BLOCK_SAMPLES)
+    {
+        int count = (int)std::min<std::size_t>(RICE_BLOCK_SAMPLES, n - first);
+
+        reader.align();
+        reader.refill();
+        int order = reader.get(2);
+
+        for(int p = 0; p < count; p += RICE_PARTITION_SAMPLES)
+        {
+            int m = std::min(RICE_PARTITION_SAMPLES, count - p);
+
+            reader.refill();
+            int k = reader.get(5);
+            int longest = reader.get(6);
+
+            if(k > RICE_MAX_K || longest < k + 1 || longest > RICE_LONGEST)
+                return false;
+
+            int16_t * out = samples + first + p;
+            bool ok;
+
+            switch(order)
+            {
+            case 0: ok = decodePartition<0>(reader, out, m, k, longest, history); break;
+            case 1: ok = decodePartition<1>(reader, out, m, k, longest, history); break;
+            case 2: ok = decodePartition<2>(reader, out, m, k, longest, history); break;
+            default: ok = decodePartition<3>(reader, out, m, k, longest, history); break;
+            }
+
+            if(!ok)
+                return false;
+        }
+
+        if(reader.overrun())
+            return false;
+    }
+
+    return reader.atEnd();
+}
+
+#endif // WAVEFORM_CODEC_HPP
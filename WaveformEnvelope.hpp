@@ -0,0 +1,397 @@
+#ifndef WAVEFORM_ENVELOPE_HPP
+#define WAVEFORM_ENVELOPE_HPP
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROSY_HAVE_SSE2_MINMAX 1
+#endif
+
+#include "CaptureFormat.hpp"
+
+/// min/max envelope of a post mortem channel at several decimation factors:
+/// level 0 holds min and max of every ENVELOPE_BASE_FACTOR samples, every
+/// further level of ENVELOPE_BASE_FACTOR buckets of the level below,
+/// i.e. 1:64, 1:4096 and 1:262144; the last bucket of a level may be partial
+
+const int ENVELOPE_LEVELS = 3;
+const uint32_t ENVELOPE_BASE_FACTOR = 64;
+
+inline uint64_t envelopeFactor(int level)
+{
+    uint64_t factor = ENVELOPE_BASE_FACTOR;
+    for(int l = 0; l < level; l++)
+        factor *= ENVELOPE_BASE_FACTOR;
+    return factor;
+}
+
+/// number of buckets of 'level' for a channel of 'samples' samples
+inline uint64_t envelopeBuckets(int level, uint64_t samples)
+{
+    uint64_t factor = envelopeFactor(level);
+    return (samples + factor - 1) / factor;
+}
+
+struct EnvelopeBucket
+{
+    int16_t min;
+    int16_t max;
+};
+
+/// [bytes] of all the levels of the envelope of a channel of 'samples' samples
+inline uint64_t envelopeBytes(uint64_t samples)
+{
+    uint64_t buckets = 0;
+    for(int l = 0; l < ENVELOPE_LEVELS; l++)
+        buckets += envelopeBuckets(l, samples);
+    return buckets * sizeof(EnvelopeBucket);
+}
+
+namespace detail
+{
+
+inline void minMaxScalar(const int16_t * data, std::size_t buckets, EnvelopeBucket * out)
+{
+    for(std::size_t b = 0; b < buckets; b++)
+    {
+        const int16_t * p = data + b * ENVELOPE_BASE_FACTOR;
+        int16_t mn = p[0];
+        int16_t mx = p[0];
+
+        for(uint32_t i = 1; i < ENVELOPE_BASE_FACTOR; i++)
+        {
+            if(p[i] < mn) mn = p[i];
+            if(p[i] > mx) mx = p[i];
+        }
+
+        out[b].min = mn;
+        out[b].max = mx;
+    }
+}
+
+#ifdef ROSY_HAVE_SSE2_MINMAX
+inline void reduceMinMax(__m128i mn, __m128i mx, EnvelopeBucket & out)
+{
+    mn = _mm_min_epi16(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(1, 0, 3, 2)));
+    mx = _mm_max_epi16(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+    mn = _mm_min_epi16(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+    mx = _mm_max_epi16(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+    mn = _mm_min_epi16(mn, _mm_shufflelo_epi16(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+    mx = _mm_max_epi16(mx, _mm_shufflelo_epi16(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    out.min = (int16_t)_mm_extract_epi16(mn, 0);
+    out.max = (int16_t)_mm_extract_epi16(mx, 0);
+}
+
+inline void minMaxSSE2(const int16_t * data, std::size_t buckets, EnvelopeBucket * out)
+{
+    for(std::size_t b = 0; b < buckets; b++)
+    {
+        const __m128i * p = reinterpret_cast<const __m128i *>(data + b * ENVELOPE_BASE_FACTOR);
+        __m128i mn = _mm_loadu_si128(p);
+        __m128i mx = mn;
+
+        for(uint32_t i = 1; i < ENVELOPE_BASE_FACTOR / 8; i++)
+        {
+            __m128i v = _mm_loadu_si128(p + i);
+            mn = _mm_min_epi16(mn, v);
+            mx = _mm_max_epi16(mx, v);
+        }
+
+        reduceMinMax(mn, mx, out[b]);
+    }
+}
+
+__attribute__((target("avx2")))
+inline void minMaxAVX2(const int16_t * data, std::size_t buckets, EnvelopeBucket * out)
+{
+    for(std::size_t b = 0; b < buckets; b++)
+    {
+        const __m256i * p = reinterpret_cast<const __m256i *>(data + b * ENVELOPE_BASE_FACTOR);
+        __m256i mn = _mm256_loadu_si256(p);
+        __m256i mx = mn;
+
+        for(uint32_t i = 1; i < ENVELOPE_BASE_FACTOR / 16; i++)
+        {
+            __m256i v = _mm256_loadu_si256(p + i);
+            mn = _mm256_min_epi16(mn, v);
+            mx = _mm256_max_epi16(mx, v);
+        }
+
+        reduceMinMax(_mm_min_epi16(_mm256_castsi256_si128(mn), _mm256_extracti128_si256(mn, 1)),
+                     _mm_max_epi16(_mm256_castsi256_si128(mx), _mm256_extracti128_si256(mx, 1)),
+                     out[b]);
+    }
+}
+#endif
+
+typedef void (*MinMaxKernel)(const int16_t *, std::size_t, EnvelopeBucket *);
+
+inline MinMaxKernel selectMinMaxKernel()
+{
+#ifdef ROSY_HAVE_SSE2_MINMAX
+    if(__builtin_cpu_supports("avx2"))
+        return minMaxAVX2;
+    return minMaxSSE2;
+#else
+    return minMaxScalar;
+#endif
+}
+
+} // namespace detail
+
+/// min and max of every ENVELOPE_BASE_FACTOR samples of 'data',
+/// 'buckets' * ENVELOPE_BASE_FACTOR samples long
+inline void envelopeMinMax(const int16_t * data, std::size_t buckets, EnvelopeBucket * out)
+{
+    static const detail::MinMaxKernel kernel = detail::selectMinMaxKernel();
+    kernel(data, buckets, out);
+}
+
+/// builds the envelope of one channel from the blocks as they arrive
+class EnvelopeBuilder
+{
+public:
+
+    EnvelopeBuilder()
+        : samples_(0)
+    {
+        for(int l = 0; l < ENVELOPE_LEVELS; l++)
+            partialCount_[l] = 0;
+    }
+
+    /// allocates the levels of a channel of 'samples' samples at once,
+    /// so they never hold more than envelopeBytes() while it arrives
+    void reserve(uint64_t samples)
+    {
+        for(int l = 0; l < ENVELOPE_LEVELS; l++)
+            levels_[l].reserve(envelopeBuckets(l, samples));
+    }
+
+    void append(const int16_t * data, std::size_t n)
+    {
+        samples_ += n;
+
+        /// COMPLETE THE BUCKET LEFT OPEN BY THE PREVIOUS BLOCK
+        while(partialCount_[0] > 0 && n > 0)
+        {
+            mergeSample(*data++);
+            n--;
+        }
+
+        /// WHOLE BUCKETS STRAIGHT FROM THE BLOCK
+        std::size_t buckets = n / ENVELOPE_BASE_FACTOR;
+
+        if(buckets > 0)
+        {
+            std::size_t first = levels_[0].size();
+            levels_[0].resize(first + buckets);
+            envelopeMinMax(data, buckets, &levels_[0][first]);
+
+            for(std::size_t b = first; b < first + buckets; b++)
+                mergeUp(1, levels_[0][b]);
+
+            data += buckets * ENVELOPE_BASE_FACTOR;
+            n -= buckets * ENVELOPE_BASE_FACTOR;
+        }
+
+        while(n > 0)
+        {
+            mergeSample(*data++);
+            n--;
+        }
+    }
+
+    /// closes the partial buckets at the end of the channel
+    void finish()
+    {
+        for(int l = 0; l < ENVELOPE_LEVELS; l++)
+        {
+            if(partialCount_[l] == 0)
+                continue;
+
+            levels_[l].push_back(partial_[l]);
+            partialCount_[l] = 0;
+
+            if(l + 1 < ENVELOPE_LEVELS)
+                merge(l + 1, partial_[l]);
+        }
+    }
+
+    const std::vector<EnvelopeBucket> & level(int l) const
+    {
+        return levels_[l];
+    }
+
+    uint64_t samples() const
+    {
+        return samples_;
+    }
+
+private:
+
+    void mergeSample(int16_t v)
+    {
+        EnvelopeBucket b = { v, v };
+        merge(0, b);
+
+        if(partialCount_[0] == ENVELOPE_BASE_FACTOR)
+            complete(0);
+    }
+
+    void mergeUp(int l, const EnvelopeBucket & b)
+    {
+        if(l >= ENVELOPE_LEVELS)
+            return;
+
+        merge(l, b);
+
+        if(partialCount_[l] == ENVELOPE_BASE_FACTOR)
+            complete(l);
+    }
+
+    void merge(int l, const EnvelopeBucket & b)
+    {
+        if(partialCount_[l] == 0)
+        {
+            partial_[l] = b;
+        }
+        else
+        {
+            if(b.min < partial_[l].min) partial_[l].min = b.min;
+            if(b.max > partial_[l].max) partial_[l].max = b.max;
+        }
+
+        partialCount_[l]++;
+    }
+
+    void complete(int l)
+    {
+        EnvelopeBucket b = partial_[l];
+        levels_[l].push_back(b);
+        partialCount_[l] = 0;
+        mergeUp(l + 1, b);
+    }
+
+private:
+    std::vector<EnvelopeBucket> levels_[ENVELOPE_LEVELS];
+    EnvelopeBucket partial_[ENVELOPE_LEVELS];
+    uint32_t partialCount_[ENVELOPE_LEVELS];
+    uint64_t samples_;
+};
+
+/// envelope file, saved next to the capture:
+///
+///   [header][channel 0: level 0, level 1, ...][channel 1: ...]...
+///
+/// every level holds envelopeBuckets(level, samplesPerChannel) buckets
+
+const char ENVELOPE_MAGIC[8] = { 'R', 'O', 'S', 'Y', 'E', 'N', 'V', 0 };
+const uint32_t ENVELOPE_FORMAT_VERSION = 1;
+
+struct EnvelopeFileHeader
+{
+    char magic[8]; // ENVELOPE_MAGIC
+    uint32_t version; // ENVELOPE_FORMAT_VERSION
+    uint32_t numberOfChannels;
+    uint64_t samplesPerChannel;
+    double samplingPeriod; // [s] of the samples
+    uint32_t numberOfLevels;
+    uint32_t baseFactor;
+    int32_t channel[4]; // device channel (0 = A .. 3 = D) of every stored channel
+    int32_t channelRange[4]; // vertical range of every stored channel
+};
+
+inline void saveEnvelope(const std::string & path, const CaptureFileHeader & capture,
+                         std::vector<EnvelopeBuilder> & builders)
+{
+    EnvelopeFileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, ENVELOPE_MAGIC, sizeof(h.magic));
+    h.version = ENVELOPE_FORMAT_VERSION;
+    h.numberOfChannels = builders.size();
+    h.samplesPerChannel = builders.empty() ? 0 : builders[0].samples();
+    h.samplingPeriod = capture.effectiveSamplingPeriod;
+    h.numberOfLevels = ENVELOPE_LEVELS;
+    h.baseFactor = ENVELOPE_BASE_FACTOR;
+    std::memcpy(h.channel, capture.channel, sizeof(h.channel));
+    std::memcpy(h.channelRange, capture.channelRange, sizeof(h.channelRange));
+
+    std::fstream out(path.c_str(), std::fstream::out | std::fstream::binary);
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+
+    for(std::size_t c = 0; c < builders.size(); c++)
+    {
+        builders[c].finish();
+
+        for(int l = 0; l < ENVELOPE_LEVELS; l++)
+        {
+            const std::vector<EnvelopeBucket> & level = builders[c].level(l);
+            if(!level.empty())
+                out.write(reinterpret_cast<const char *>(&level[0]), level.size() * sizeof(EnvelopeBucket));
+        }
+    }
+
+    if(!out)
+        throw std::runtime_error("saveEnvelope: cannot write " + path);
+}
+
+/// reads back an envelope file; loads one level of one channel only
+class EnvelopeReader
+{
+public:
+
+    explicit EnvelopeReader(const std::string & path)
+        : path_(path), in_(path.c_str(), std::fstream::in | std::fstream::binary)
+    {
+        in_.read(reinterpret_cast<char *>(&header_), sizeof(header_));
+
+        if(!in_ || std::memcmp(header_.magic, ENVELOPE_MAGIC, sizeof(header_.magic)) != 0)
+            throw std::runtime_error("EnvelopeReader: not an envelope file: " + path);
+        if(header_.version != ENVELOPE_FORMAT_VERSION || header_.numberOfLevels != (uint32_t)ENVELOPE_LEVELS
+           || header_.baseFactor != ENVELOPE_BASE_FACTOR)
+            throw std::runtime_error("EnvelopeReader: unsupported envelope file: " + path);
+    }
+
+    const EnvelopeFileHeader & header() const
+    {
+        return header_;
+    }
+
+    std::vector<EnvelopeBucket> level(int channel, int level)
+    {
+        uint64_t offset = sizeof(header_);
+
+        for(int c = 0; c <= channel; c++)
+            for(int l = 0; l < ENVELOPE_LEVELS; l++)
+            {
+                if(c == channel && l == level)
+                    break;
+                offset += envelopeBuckets(l, header_.samplesPerChannel) * sizeof(EnvelopeBucket);
+            }
+
+        std::vector<EnvelopeBucket> buckets(envelopeBuckets(level, header_.samplesPerChannel));
+
+        in_.seekg(offset);
+        if(!buckets.empty())
+            in_.read(reinterpret_cast<char *>(&buckets[0]), buckets.size() * sizeof(EnvelopeBucket));
+
+        if(!in_)
+            throw std::runtime_error("EnvelopeReader: truncated envelope file: " + path_);
+
+        return buckets;
+    }
+
+private:
+    std::string path_;
+    std::fstream in_;
+    EnvelopeFileHeader header_;
+};
+
+#endif // WAVEFORM_ENVELOPE_HPP